@@ -8,6 +8,8 @@ int main(int argc, char *argv[])
         Rcon::RconApp().run(argc, argv);
     } catch (Rcon::AppException e) {
         return 1;
+    } catch (Rcon::CommandException e) {
+        return 2;
     } catch (Rcon::Exception e) {
         std::cerr << e.what() << std::endl;
         return 1;
@@ -1,9 +1,18 @@
 #include "rcon.hh"
 #include "rconmsg.hh"
 #include "rconexception.hh"
+#include "rconfanout.hh"
+#include "rconpipeline.hh"
+#include "rcondaemon.hh"
+#include "rconlisten.hh"
+#include "rconfilter.hh"
+#include "rconwebhook.hh"
+#include "rconcapture.hh"
 #include <sys/types.h>
+#include <signal.h>
 #include <cstdlib>
 #include <unistd.h>
+#include <getopt.h>
 #include <string>
 #include <cstring>
 #include <sys/socket.h>
@@ -11,10 +20,7 @@
 #include <fstream>
 #include <iostream>
 #include <sstream>
-/* According to POSIX.1-2001 */
-#include <sys/select.h>
-/* According to earlier standards */
-#include <sys/time.h>
+#include <chrono>
 
 
 namespace Rcon {
@@ -23,16 +29,91 @@ namespace Rcon {
 
     void RconApp::printHelp(const std::string & app) const {
         std::cout << std::endl;
-        std::cout << "Usage: " << app << " [-iqh] <ip address> <port> <command>" << std::endl;
+        std::cout << "Usage: " << app << " [-iqsh] [-k <config file>] [-w <window>] [-o <format>] [-r <ms>] [-P <policy>] [-D <mode>] <ip address> <port> <command> [<command> ...]" << std::endl;
+        std::cout << "       " << app << " [-qsh] [-k <config file>] [-w <window>] [-T <ms>] [-P <policy>] -b <batch file> <ip address> <port>" << std::endl;
+        std::cout << "       " << app << " [-qh] [-k <config file>] [-t <ms>] [-m [<host>:]<port>] [-W <workers>] [-A <ms>] [-C <capture dir>] -d <socket>"
+                  << " (-f <target list> | -g <servers> | <ip address> <port>)" << std::endl;
+        std::cout << "       " << app << " [-qh] [-o <format>] -c <socket> <ip address> <port> <command> [<command> ...]" << std::endl;
+        std::cout << "       " << app << " [-qh] [-k <config file>] [-t <ms>] [-o <format>] (-f <target list> | -g <servers>) <command>" << std::endl;
+        std::cout << "       " << app << " [-qsh] [-k <config file>] [-Q <bytes>] [-P <policy>] [-R <bytes>] [-S <spill file>] [-F <filter file>] [-C <capture dir>] -l <ip address> <port>" << std::endl;
+        std::cout << "       " << app << " [-qsh] [-o <format>] [-P <policy>] replay <capture dir> [<from> [<to>]]" << std::endl;
+        std::cout << "       " << app << " [-qsh] [-o <format>] [-P <policy>] grep <capture dir> <pattern> [<from> [<to>]]" << std::endl;
         std::cout << "   -q     Quiet mode (no extra client side output.)" << std::endl;
         std::cout << "   -i     Interactive mode." << std::endl;
+        std::cout << "   -s     Print session statistics and latency histograms to stderr on exit (also --stats)." << std::endl;
+        std::cout << "   -b     Batch mode, run every line of the file ('-' for stdin) as a command over one login." << std::endl;
+        std::cout << "          Exits with status 2 if any command failed." << std::endl;
+        std::cout << "   -T     Per-command deadline in milliseconds, unanswered commands are resent until it passes (default " << DEFAULT_TIMEOUT_MS << ")." << std::endl;
+        std::cout << "   -w     Number of commands kept outstanding at the same time (1-" << MAX_PIPELINE_WINDOW << ", default 1)." << std::endl;
+        std::cout << "   -o     Output format of the players, bans, admins and missions tables: text (default), json or csv." << std::endl;
+        std::cout << "   -r     Watch mode, rerun the commands every <ms> milliseconds (at most " << KEEPALIVE_INTERVAL_MS << ") until interrupted," << std::endl;
+        std::cout << "          printing only the table rows which were added, removed or changed." << std::endl;
+        std::cout << "   -f     Fan-out mode, run the command on every ip:port:password line of the file." << std::endl;
+        std::cout << "   -g     Fan-out mode on the servers of the config file, a comma separated list of server and group names" << std::endl;
+        std::cout << "          or '" CONFIG_ALL_SERVERS "'; in daemon mode the sessions follow the changes of the config file." << std::endl;
+        std::cout << "   -k     Config file with the passwords, servers, groups, timeouts and rates (default " CONFIG_FILE_NAME ")." << std::endl;
+        std::cout << "   -t     Login deadline in milliseconds, also per-server timeout for fan-out and daemon mode (default " << DEFAULT_TIMEOUT_MS << ")," << std::endl;
+        std::cout << "          unless the config file sets one." << std::endl;
+        std::cout << "   -d     Daemon mode, keep a session to each server alive and serve clients on the Unix socket." << std::endl;
+        std::cout << "   -m     Serve Prometheus metrics of the daemon sessions over HTTP (host defaults to 127.0.0.1)." << std::endl;
+        std::cout << "   -W     Worker threads to shard the daemon sessions across (0-" << DAEMON_MAX_WORKERS << ", default 0 for a single thread)." << std::endl;
+        std::cout << "   -A     Serve the players, bans, admins and missions outputs of the daemon sessions from a cache" << std::endl;
+        std::cout << "          for <ms> milliseconds, 0 disables it (default " << DAEMON_CACHE_TTL_MS << ")." << std::endl;
+        std::cout << "   -c     Client mode, run the commands through the daemon listening on the Unix socket." << std::endl;
+        std::cout << "   -l     Listen mode, acknowledge and print server messages until interrupted." << std::endl;
+        std::cout << "   -Q     Bytes of output kept queued for a slow stdout, which is written on a thread of its own (default " << LISTEN_QUEUE_LIMIT << ")." << std::endl;
+        std::cout << "   -P     What to do once the output queue is full: block (the default), drop the oldest lines (drop, the default" << std::endl;
+        std::cout << "          in listen mode) or spill the new lines to the -S file (spill, the default with -S). Exits with status 1" << std::endl;
+        std::cout << "          if the output of a command was dropped." << std::endl;
+        std::cout << "   -R     Socket receive buffer in bytes, 0 for the system default (default " << CHANNEL_RECV_BUFFER << ")." << std::endl;
+        std::cout << "   -S     Append the messages which do not fit into the queue to the file instead of dropping them." << std::endl;
+        std::cout << "   -F     Route the server messages by the '<output> <pattern>' lines of the file, the output being '-'" << std::endl;
+        std::cout << "          for stdout, an http:// webhook or a file; messages matching no pattern are dropped." << std::endl;
+        std::cout << "   -C     Capture the server messages received in listen and daemon mode to the directory." << std::endl;
+        std::cout << "   -D     Trace the packets sent and received, CRC failures and timeouts of every mode to stderr:" << std::endl;
+        std::cout << "          events for a line each, hex to add hex dumps of the packets." << std::endl;
+        std::cout << "   replay Write the captured server messages received from <from> to <to>, as seconds since the epoch" << std::endl;
+        std::cout << "          or UTC dates YYYY-MM-DD[THH:MM[:SS]], in the -o format (the output blocks by default)." << std::endl;
+        std::cout << "   grep   Like replay, but only the messages containing the pattern, ignoring case." << std::endl;
         std::cout << "   -h     Help." << std::endl << std::endl;
     }
 
     void RconApp::log(const std::stringstream & msg) {
         if (!mOptions["quiet"].boolVal)
         {
-            std::cout << msg.str();
+            mOutput->write(msg.str());
+        }
+    }
+
+
+    void RconApp::log(const std::string_view & line) {
+        if (!mOptions["quiet"].boolVal)
+        {
+            mOutput->append(line);
+        }
+    }
+
+
+    void RconApp::log(const Reassembler & response) {
+        if (!mOptions["quiet"].boolVal)
+        {
+            std::string_view parts[256];
+            size_t nofParts = std::min<size_t>(response.getNofParts(), 256);
+            for (size_t i = 0; i < nofParts; ++i) {
+                parts[i] = response.getPart(i);
+            }
+            mOutput->append(parts, nofParts);
+        }
+    }
+
+
+    void RconApp::checkOutput() {
+        mOutput->drain();
+        if (mOutput->getNofDropped() > 0) {
+            std::stringstream msg;
+            msg << "warning: " << mOutput->getNofDropped() << " lines of output were dropped, see -P" << std::endl;
+            error(msg);
+            throw AppException("output dropped");
         }
     }
 
@@ -44,9 +125,22 @@ namespace Rcon {
 
     void RconApp::getOpts(int argc, char *argv[]) {
 
+        mOptions["timeout"].intVal = DEFAULT_TIMEOUT_MS;
+        mOptions["window"].intVal = 1;
+        mOptions["cmdtimeout"].intVal = DEFAULT_TIMEOUT_MS;
+        mOptions["queue"].intVal = LISTEN_QUEUE_LIMIT;
+        mOptions["rcvbuf"].intVal = CHANNEL_RECV_BUFFER;
+        mOptions["cachettl"].intVal = DAEMON_CACHE_TTL_MS;
+
+        static const struct option longOptions[] = {
+            { "stats", no_argument, nullptr, 's' },
+            { "help",  no_argument, nullptr, 'h' },
+            { nullptr, 0,           nullptr, 0 }
+        };
+
         for(;;)
         {
-            switch(getopt(argc, argv, "hiq"))
+            switch(getopt_long(argc, argv, "hilqsb:c:d:f:g:k:m:o:r:t:w:A:C:D:F:P:Q:R:S:T:W:", longOptions, nullptr))
             {
                 case 'q':
                     mOptions["quiet"].boolVal = true;
@@ -56,6 +150,150 @@ namespace Rcon {
                     mOptions["interactive"].boolVal = true;
                     continue;
 
+                case 's':
+                    mOptions["stats"].boolVal = true;
+                    continue;
+
+                case 'l':
+                    mOptions["listen"].boolVal = true;
+                    continue;
+
+                case 'Q':
+                    mOptions["queue"].intVal = atoi(optarg);
+                    if (mOptions["queue"].intVal <= 0) {
+                        printHelp(argv[0]);
+                        throw AppException("wrong usage");
+                    }
+                    continue;
+
+                case 'S':
+                    mOptions["spill"].strVal = optarg;
+                    continue;
+
+                case 'F':
+                    mOptions["filter"].strVal = optarg;
+                    continue;
+
+                case 'C':
+                    mOptions["capture"].strVal = optarg;
+                    continue;
+
+                case 'P': {
+                    OutputWriter::Policy policy;
+                    if (!OutputWriter::parsePolicy(optarg, policy)) {
+                        printHelp(argv[0]);
+                        throw AppException("wrong usage");
+                    }
+                    mOptions["policy"].strVal = optarg;
+                    continue;
+                }
+
+                case 'R':
+                    mOptions["rcvbuf"].intVal = atoi(optarg);
+                    if (mOptions["rcvbuf"].intVal < 0) {
+                        printHelp(argv[0]);
+                        throw AppException("wrong usage");
+                    }
+                    continue;
+
+                case 'b':
+                    mOptions["batch"].strVal = optarg;
+                    continue;
+
+                case 'T':
+                    mOptions["cmdtimeout"].intVal = atoi(optarg);
+                    if (mOptions["cmdtimeout"].intVal <= 0) {
+                        printHelp(argv[0]);
+                        throw AppException("wrong usage");
+                    }
+                    continue;
+
+                case 'd':
+                    mOptions["daemon"].strVal = optarg;
+                    continue;
+
+                case 'c':
+                    mOptions["client"].strVal = optarg;
+                    continue;
+
+                case 'm':
+                    mOptions["metrics"].strVal = optarg;
+                    continue;
+
+                case 'A':
+                    mOptions["cachettl"].intVal = atoi(optarg);
+                    if (mOptions["cachettl"].intVal < 0) {
+                        printHelp(argv[0]);
+                        throw AppException("wrong usage");
+                    }
+                    continue;
+
+                case 'D':
+                    if (strcmp(optarg, "events") == 0) {
+                        Trace::setMode(Trace::TRACE_EVENTS);
+                    } else if (strcmp(optarg, "hex") == 0) {
+                        Trace::setMode(Trace::TRACE_HEXDUMP);
+                    } else {
+                        printHelp(argv[0]);
+                        throw AppException("wrong usage");
+                    }
+                    continue;
+
+                case 'W':
+                    mOptions["workers"].intVal = atoi(optarg);
+                    if (mOptions["workers"].intVal < 0 || mOptions["workers"].intVal > DAEMON_MAX_WORKERS) {
+                        printHelp(argv[0]);
+                        throw AppException("wrong usage");
+                    }
+                    continue;
+
+                case 'f':
+                    mOptions["fanout"].strVal = optarg;
+                    continue;
+
+                case 'g':
+                    mOptions["group"].strVal = optarg;
+                    continue;
+
+                case 'k':
+                    mOptions["config"].strVal = optarg;
+                    continue;
+
+                case 'o':
+                    {
+                        TableWriter::Format format;
+                        if (!TableWriter::parseFormat(optarg, format)) {
+                            printHelp(argv[0]);
+                            throw AppException("wrong usage");
+                        }
+                        mOptions["format"].strVal = optarg;
+                    }
+                    continue;
+
+                case 'r':
+                    mOptions["watch"].intVal = atoi(optarg);
+                    if (mOptions["watch"].intVal <= 0 || mOptions["watch"].intVal > KEEPALIVE_INTERVAL_MS) {
+                        printHelp(argv[0]);
+                        throw AppException("wrong usage");
+                    }
+                    continue;
+
+                case 'w':
+                    mOptions["window"].intVal = atoi(optarg);
+                    if (mOptions["window"].intVal < 1 || mOptions["window"].intVal > MAX_PIPELINE_WINDOW) {
+                        printHelp(argv[0]);
+                        throw AppException("wrong usage");
+                    }
+                    continue;
+
+                case 't':
+                    mOptions["timeout"].intVal = atoi(optarg);
+                    if (mOptions["timeout"].intVal <= 0) {
+                        printHelp(argv[0]);
+                        throw AppException("wrong usage");
+                    }
+                    continue;
+
                 case '?':
                 case 'h':
                 default :
@@ -68,160 +306,786 @@ namespace Rcon {
             }
             break;
         }
+
+        /* Only the server message stream must not fall behind, command outputs are never lost by default */
+        if (mOptions["policy"].strVal.empty()) {
+            mOptions["policy"].strVal = !mOptions["spill"].strVal.empty() ? "spill" : mOptions["listen"].boolVal ? "drop" : "block";
+        } else if (mOptions["policy"].strVal == "spill" && mOptions["spill"].strVal.empty()) {
+            printHelp(argv[0]);
+            throw AppException("wrong usage");
+        }
     }
 
 
-    void RconApp::readConfig(const std::string & cfgFile) {
+    std::string RconApp::getConfigFile() {
+        return mOptions["config"].strVal.empty() ? CONFIG_FILE_NAME : mOptions["config"].strVal;
+    }
+
 
-        std::ifstream file(cfgFile);
-        file >> mPassword;
-        file.close();
+    void RconApp::readConfig() {
+        /* Only a config file asked for must exist */
+        mConfig.load(getConfigFile(), !mOptions["config"].strVal.empty());
     }
 
 
     const std::string & RconApp::getPassword() const {
-        return mPassword;
+        return mConfig.getPassword();
     }
 
 
-    void RconApp::openConnection(const std::string & ip, const std::string & port) {
+    std::vector<Target> RconApp::getTargets() {
+        if (!mOptions["group"].strVal.empty()) {
+            return mConfig.select(mOptions["group"].strVal);
+        }
+        return readTargets(mOptions["fanout"].strVal, getPassword());
+    }
+
+
+    RconApp::~RconApp() {
+        while (!mInbox.empty()) {
+            mPool.release(mInbox.front());
+            mInbox.pop_front();
+        }
+    }
 
-        struct addrinfo hints;
-        struct addrinfo *result, *rp;
-        int s, j;
 
-        memset(&hints, 0, sizeof(struct addrinfo));
-        hints.ai_family = AF_UNSPEC;    /* Allow IPv4 or IPv6 */
-        hints.ai_socktype = SOCK_DGRAM;
-        hints.ai_flags = 0;
-        hints.ai_protocol = 0;
+    void RconApp::handleView(Channel & channel, const MessageView & view) {
 
-        s = getaddrinfo(ip.c_str(), port.c_str(), &hints, &result);
-        if (s != 0) {
-            std::stringstream error;
-            error << "getaddrinfo: " << gai_strerror(s) << std::endl;
-            throw SocketException(error.str());
+        /* While logging in the listener only takes the server messages */
+        if (mListener != nullptr && (mListening || view.type == Message::MSG_SRV_MSG)) {
+            mListener->handleView(channel, view);
+            return;
         }
 
-        for (rp = result; rp != nullptr; rp = rp->ai_next) {
-            mSocketFd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-            if (mSocketFd == -1)
-                continue;
+        if (view.type == Message::MSG_SRV_MSG) {
+            ServerAck ack(view.seqNum);
+            channel.queue(ack);
+            ++mMetrics.serverMessages;
+            if (mServerWindow.check(view.seqNum) != SequenceWindow::SEQ_DUPLICATE) {
+                log(view.payload);
+            } else {
+                ++mMetrics.duplicates;
+            }
+            return;
+        }
+
+        if (mPipeline != nullptr && mPipeline->handleView(view)) {
+            return;
+        }
+
+        if (view.type == Message::MSG_CMD_PART_RESP) {
+            /* Parts go straight from the receive buffer into their slot; stale parts are dropped */
+            if (view.seqNum == mReassembler.getSeqNum()) {
+                if (mReassembler.addPart(view) == Reassembler::PART_MISMATCHED) {
+                    ++mMetrics.staleParts;
+                } else if (!mCommandAnswered) {
+                    commandAnswered();
+                }
+            }
+            return;
+        }
+        mInbox.push_back(mPool.create(view));
+    }
+
+
+    void RconApp::handleMessage(Channel & channel, Message *msg) {
+        mInbox.push_back(msg);
+    }
 
-            if (connect(mSocketFd, rp->ai_addr, rp->ai_addrlen) != -1)
-                break;
 
-            close(mSocketFd);
+    void RconApp::handleError(Channel & channel, const Exception & e) {
+        if (mListening) {
+            mListener->handleError(channel, e);
+            return;
         }
+        mChannelError = e.what();
+    }
 
-        if (rp == nullptr) {
-            throw SocketException("Could not connect");
+
+    void RconApp::handleBatchEnd(Channel & channel) {
+        if (mListener != nullptr) {
+            mListener->handleBatchEnd(channel);
         }
+    }
 
-        freeaddrinfo(result);
+
+    void RconApp::openConnection(const std::string & ip, const std::string & port) {
+
+        mChannel.reset(new Channel(*mReactor, *this));
+        mChannel->setMetrics(&mMetrics);
+        mChannel->setSocketBuffers(mOptions["rcvbuf"].intVal, CHANNEL_SEND_BUFFER);
+        mChannel->setBatchSize(CHANNEL_BATCH_SIZE);
+        mChannel->open(ip, port);
     }
 
 
     void RconApp::closeConnection() {
-        close(mSocketFd);
+        mChannel.reset();
     }
 
 
-    void RconApp::sendPacket(Message *msg) {
-        
-        uint8_t buf[BUF_SIZE];
-        size_t len = msg->encode(buf);
-        if (write(mSocketFd, buf, len) != len) {
-            throw ProtocolException("partial/failed write");
+    void RconApp::login(const std::string & ip, const std::string & port, const std::function<void()> & opened) {
+
+        openConnection(ip, port);
+        mServerWindow.reset();
+        if (opened) {
+            opened();
+        }
+
+        /**** Password and timeout of the server in the config, the defaults for others ****/
+        Target target;
+        target.host = ip;
+        target.port = port;
+        const Target *server = mConfig.find(target.key());
+        int timeoutMs = (server != nullptr && server->timeoutMs > 0) ? server->timeoutMs : mOptions["timeout"].intVal;
+        mServer = (server != nullptr) ? *server : target;
+
+        /**** Login, resent with backoff until the login deadline ****/
+        Login login(server != nullptr ? server->password : getPassword());
+        RttEstimator & rtt = mChannel->getRtt();
+        Reactor::Clock::time_point sent = Reactor::Clock::now();
+        Reactor::Clock::time_point deadline = sent + std::chrono::milliseconds(timeoutMs);
+        int attempt = 0;
+        sendPacket(&login);
+
+        /**** Handle responses ****/
+        Message *rcvdMsg;
+        while ((rcvdMsg = receivePacket(rtt.getTimeout(attempt, deadline))) == nullptr) {
+            if (RCON_TRACING(timeout)) {
+                Trace::timeout(mChannel->getTraceId(), -1, attempt);
+            }
+            if (Reactor::Clock::now() >= deadline) {
+                throw ProtocolException("timeout");
+            }
+            ++attempt;
+            sendPacket(&login);
+        }
+        mMetrics.loginRtt.recordSince(sent);
+        if (attempt == 0) {
+            rtt.sampleSince(sent);
+        }
+        if (rcvdMsg->getType() != Message::MSG_LOGIN_RESP) {
+            mPool.release(rcvdMsg);
+            throw ProtocolException("Unexpected message received!");
+        }
+
+        LoginResponse *loginResp = static_cast<LoginResponse*>(rcvdMsg);
+        if (loginResp->getResult() == 0) {
+            mPool.release(loginResp);
+            throw ProtocolException("Wrong RCON password!");
+        }
+
+        mPool.release(loginResp);
+    }
+
+
+    void RconApp::runCommands(const std::vector<std::string> & cmds) {
+        size_t next = 0;
+        runCommands([&cmds, &next](std::string & cmdStr) {
+            if (next == cmds.size()) {
+                return false;
+            }
+            cmdStr = cmds[next++];
+            return true;
+        });
+    }
+
+
+    void RconApp::runCommands(std::istream & in) {
+        runCommands([&in](std::string & cmdStr) {
+            while (std::getline(in, cmdStr)) {
+                if (!cmdStr.empty() && cmdStr[cmdStr.size()-1] == '\r') {
+                    cmdStr.erase(cmdStr.size()-1);
+                }
+                if (!cmdStr.empty()) {
+                    return true;
+                }
+            }
+            return false;
+        });
+    }
+
+
+    void RconApp::runCommands(const std::function<bool(std::string &)> & nextCommand) {
+
+        Pipeline pipeline(*mReactor, *mChannel, mOptions["window"].intVal, [this](const Pipeline::Result & result) {
+            if (result.ok) {
+                logResult(result.command, result.output);
+            } else {
+                std::stringstream text;
+                text << result.error << " (" << result.command << ")" << std::endl;
+                error(text);
+            }
+        });
+        pipeline.setDeadline(mOptions["cmdtimeout"].intVal);
+        pipeline.setRate(mServer.rate, mServer.burst);
+
+        mPipeline = &pipeline;
+        try {
+            bool more = true;
+            std::string cmdStr;
+
+            /* Commands are only read while the window has room, so a long
+               batch is streamed instead of being read in up front. */
+            while (more || !pipeline.isIdle()) {
+                while (more && pipeline.getNofQueued() == 0) {
+                    more = nextCommand(cmdStr);
+                    if (more) {
+                        pipeline.submit(cmdStr);
+                    }
+                }
+                if (!pipeline.isIdle()) {
+                    waitFor([&pipeline, &more]() { return more ? pipeline.getNofQueued() == 0 : pipeline.isIdle(); },
+                            RECEIVE_TIMEOUT_MS);
+                }
+            }
+        } catch (...) {
+            mPipeline = nullptr;
+            throw;
+        }
+        mPipeline = nullptr;
+
+        if (pipeline.getNofFailed() > 0) {
+            std::stringstream text;
+            text << pipeline.getNofFailed() << " command(s) failed";
+            throw CommandException(text.str());
         }
     }
 
 
-    Message *RconApp::receivePacket() {
+    void RconApp::runWatch(const std::vector<std::string> & cmds) {
 
-        fd_set rfds;
-        struct timeval tv;
-        int retval;
-        int nread = 0;
-        uint8_t buf[BUF_SIZE];
+        Reactor::catchStopSignals();
+        mWatching = true;
+
+        while (!Reactor::isStopSignalled()) {
+            try {
+                runCommands(cmds);
+            } catch (CommandException &) {
+                /* Logged already, the next round may succeed */
+            }
+            waitFor([]() { return Reactor::isStopSignalled(); }, mOptions["watch"].intVal);
+        }
+        mWatching = false;
+    }
 
-        FD_ZERO(&rfds);
-        FD_SET(mSocketFd, &rfds);
 
-        // Wait for message for 0,5 seconds
-        tv.tv_sec = 0;
-        tv.tv_usec = 500000;
+    void RconApp::logResult(const std::string & cmdStr, const std::string & output) {
 
-        retval = select(FD_SETSIZE, &rfds, nullptr, nullptr, &tv);
-        if (retval == -1) {
-            perror("select()");
-            throw ProtocolException("select() error");
+        Table::Kind kind = Table::kindOf(cmdStr);
+        if (mWriter->getFormat() == TableWriter::FORMAT_TEXT || kind == Table::TABLE_NONE) {
+            log(std::string_view(output));
+            return;
+        }
 
-        } else if (retval) {
-            nread = read(mSocketFd, buf, BUF_SIZE);
-            if (nread == -1) 
-            {
-                perror("read");
-                close(mSocketFd);
-                throw ProtocolException("socket read error");
+        if (!mWatching) {
+            /* The records are written straight from views into the response */
+            Table table(kind);
+            if (!table.parse(output)) {
+                log(std::string_view(output));
+            } else if (!mOptions["quiet"].boolVal) {
+                mWriter->write(table, std::string_view());
+                logRecords();
             }
-            return Message::decode(buf, nread);
+            return;
+        }
+
+        /* The snapshot keeps its own copy of the text, which its table points into */
+        std::unique_ptr<Snapshot> next(new Snapshot(kind));
+        next->text = output;
+        if (!next->table.parse(next->text)) {
+            log(std::string_view(output));
+            return;
+        }
+        next->table.sort();
+
+        std::unique_ptr<Snapshot> & previous = mSnapshots[cmdStr];
+        if (!previous) {
+            previous.reset(new Snapshot(kind));
         }
-        else {
-            throw ProtocolException("timeout");
+        if (!mOptions["quiet"].boolVal) {
+            mWriter->writeDiff(previous->table, next->table, std::string_view());
+            logRecords();
         }
+        previous.swap(next);
     }
 
 
-    void RconApp::run(int argc, char *argv[]) {
+    void RconApp::logRecords() {
+        mOutput->write(mRecords.str());
+        mRecords.str(std::string());
+    }
 
 
-        getOpts(argc, argv);
-        bool interactive = mOptions["interactive"].boolVal;
+    void RconApp::runFanOut(int argc, char *argv[]) {
 
-        if (!interactive && argc < 3) {
+        if (optind >= argc) {
             printHelp(argv[0]);
-            throw AppException("wrong usage"); 
+            throw AppException("wrong usage");
         }
 
-        const std::string ip(argv[optind]);
-        const std::string port(argv[optind+1]);
+        /**** The targets of a list without a password take the default one ****/
+        std::vector<Target> targets = getTargets();
+        const std::string cmdStr(argv[optind]);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        FanOut fanOut(targets, mOptions["timeout"].intVal);
+        fanOut.setFormat(mWriter->getFormat());
+        std::stringstream out;
+        size_t failed = fanOut.run(cmdStr, mOptions["quiet"].boolVal ? out : std::cout, std::cerr);
+        std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+
+        std::stringstream summary;
+        summary << (targets.size() - failed) << "/" << targets.size() << " servers succeeded in "
+                << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << " ms" << std::endl;
+        if (!mOptions["quiet"].boolVal) {
+            error(summary);
+        }
 
-        openConnection(ip, port);
+        if (failed > 0) {
+            throw AppException("fan-out failed");
+        }
+    }
 
-        /**** Read password from cfg ****/
-        readConfig(CONFIG_FILE_NAME);
 
-        /**** Login ****/
-        Login login(getPassword());
-        sendPacket(&login);
+    void RconApp::runDaemon(int argc, char *argv[]) {
+
+        std::vector<Target> targets;
+        if (!mOptions["fanout"].strVal.empty() || !mOptions["group"].strVal.empty()) {
+            targets = getTargets();
+        } else if (argc - optind == 2) {
+            Target target;
+            target.host = argv[optind];
+            target.port = argv[optind+1];
+            const Target *server = mConfig.find(target.key());
+            if (server != nullptr) {
+                target = *server;
+            } else {
+                target.password = getPassword();
+            }
+            targets.push_back(target);
+        } else {
+            printHelp(argv[0]);
+            throw AppException("wrong usage");
+        }
+
+        std::unique_ptr<CaptureLog> capture;
+        if (!mOptions["capture"].strVal.empty()) {
+            capture.reset(new CaptureLog(mOptions["capture"].strVal));
+        }
+
+        Daemon daemon(targets, mOptions["daemon"].strVal, mOptions["timeout"].intVal,
+                      mOptions["quiet"].boolVal ? nullptr : &std::cout, mOptions["metrics"].strVal,
+                      mOptions["workers"].intVal);
+        daemon.setCapture(capture.get());
+        daemon.setCacheTtl(mOptions["cachettl"].intVal);
+
+        /* The sessions selected from the config follow its changes, the others stay as they are */
+        std::unique_ptr<ConfigWatcher> watcher;
+        if (!mOptions["group"].strVal.empty()) {
+            const std::string configFile = getConfigFile();
+            watcher.reset(new ConfigWatcher(daemon.getReactor(), configFile, [this, &daemon, configFile]() {
+                try {
+                    mConfig.load(configFile, true);
+                    daemon.reload(mConfig.select(mOptions["group"].strVal));
+                } catch (Exception & e) {
+                    std::stringstream text;
+                    text << "config not reloaded: " << e.what() << std::endl;
+                    error(text);
+                }
+            }));
+        }
+        daemon.run();
+    }
+
+
+    void RconApp::runClient(int argc, char *argv[]) {
+
+        if (argc - optind < 3) {
+            printHelp(argv[0]);
+            throw AppException("wrong usage");
+        }
+
+        Target target;
+        target.host = argv[optind];
+        target.port = argv[optind+1];
+
+        DaemonProxy proxy;
+        proxy.connect(mOptions["client"].strVal);
+
+        /* All requests are sent up front, the daemon answers them in order */
+        for (int i = optind + 2; i < argc; ++i) {
+            proxy.send(target.key(), argv[i]);
+        }
+
+        size_t failed = 0;
+        for (int i = optind + 2; i < argc; ++i) {
+            std::string text;
+            if (proxy.receive(text)) {
+                logResult(argv[i], text);
+            } else {
+                std::stringstream errorText;
+                errorText << text << " (" << argv[i] << ")" << std::endl;
+                error(errorText);
+                ++failed;
+            }
+        }
+
+        if (failed > 0) {
+            std::stringstream text;
+            text << failed << " command(s) failed";
+            throw CommandException(text.str());
+        }
+    }
+
+
+    void RconApp::runListen(int argc, char *argv[]) {
+
+        if (argc - optind != 2) {
+            printHelp(argv[0]);
+            throw AppException("wrong usage");
+        }
+
+        /* A vanished reader shows up as EPIPE on the output queue */
+        signal(SIGPIPE, SIG_IGN);
+        Reactor::catchStopSignals();
+
+        /* Bad rules fail before the login */
+        std::unique_ptr<MessageFilter> filter;
+        if (!mOptions["filter"].strVal.empty()) {
+            filter.reset(new MessageFilter(*mReactor, nullptr, mOptions["queue"].intVal));
+            filter->load(mOptions["filter"].strVal);
+        }
+
+        std::unique_ptr<CaptureLog> capture;
+        if (!mOptions["capture"].strVal.empty()) {
+            capture.reset(new CaptureLog(mOptions["capture"].strVal));
+        }
+
+        /* Installed before the login is sent, the admin login notice and whatever
+           follows it go through the filter and the capture like the rest */
+        OutputWriter *stdoutQueue = mOptions["quiet"].boolVal ? nullptr : mOutput.get();
+        std::unique_ptr<StreamListener> listener;
+        std::string channelError;
+        try {
+            login(argv[optind], argv[optind+1], [&]() {
+                mChannel->setBatchSize(LISTEN_BATCH_SIZE);
+                if (capture) {
+                    Target target;
+                    target.host = argv[optind];
+                    target.port = argv[optind+1];
+                    mChannel->setCapture(capture.get(), capture->addServer(target.key()));
+                }
+                listener.reset(new StreamListener(*mReactor, *mChannel, stdoutQueue, mServerWindow));
+                if (filter) {
+                    filter->setOutput(stdoutQueue);
+                    listener->setFilter(filter.get());
+                }
+                mListener = listener.get();
+            });
+            mListening = true;
+
+            while (!Reactor::isStopSignalled() && !mOutput->isClosed() && (channelError = listener->takeError()).empty()) {
+                mReactor->runOnce();
+            }
+            mOutput->drain();
+            if (filter) {
+                /* Give the last webhook posts a chance */
+                filter->drain();
+                waitFor([&filter]() { return !filter->isPosting(); }, WEBHOOK_TIMEOUT_MS);
+            }
+        } catch (...) {
+            mListener = nullptr;
+            mListening = false;
+            throw;
+        }
+        mListener = nullptr;
+        mListening = false;
+
+        if (mOptions["stats"].boolVal || mOutput->getNofDropped() > 0 || mChannel->getNofKernelDrops() > 0) {
+            std::stringstream stats;
+            listener->printStats(stats);
+            mChannel->printStats(stats);
+            mReactor->printStats(stats);
+            if (capture) {
+                capture->printStats(stats);
+            }
+            if (mOptions["stats"].boolVal) {
+                mMetrics.printSummary(stats);
+            }
+            error(stats);
+        }
+        closeConnection();
+
+        if (!channelError.empty()) {
+            throw Exception(channelError);
+        }
+    }
+
+
+    void RconApp::runReplay(int argc, char *argv[]) {
+
+        bool grep = strcmp(argv[optind], "grep") == 0;
+        int first = optind + (grep ? 3 : 2);
+        if (argc < first || argc - first > 2) {
+            printHelp(argv[0]);
+            throw AppException("wrong usage");
+        }
+
+        uint64_t from = 0;
+        uint64_t to = UINT64_MAX;
+        if ((argc > first && !CaptureReader::parseTime(argv[first], from)) ||
+            (argc > first + 1 && !CaptureReader::parseTime(argv[first+1], to))) {
+            printHelp(argv[0]);
+            throw AppException("wrong usage");
+        }
+
+        PatternMatcher matcher;
+        if (grep) {
+            matcher.add(argv[optind+2], 0);
+            matcher.compile();
+        }
+
+        /* A vanished reader shows up as EPIPE on the output */
+        signal(SIGPIPE, SIG_IGN);
+
+        CaptureReader reader(argv[optind+1]);
+        std::vector<std::string> servers;
+        size_t nofMatched = 0;
+        size_t nofInvalid = 0;
+        reader.scan(from, to, [&](const CaptureReader::Record & record) {
+            if (mOutput->isClosed()) {
+                return;
+            }
+            /* The datagrams were checked when captured, a damaged segment still fails the CRC */
+            MessageView view;
+            try {
+                view = Message::decodeView(record.datagram, record.length);
+            } catch (Exception &) {
+                ++nofInvalid;
+                return;
+            }
+            if (view.type != Message::MSG_SRV_MSG || (grep && matcher.match(view.payload) == 0)) {
+                return;
+            }
+            ++nofMatched;
+            if (mOptions["quiet"].boolVal) {
+                return;
+            }
+
+            if (record.server >= servers.size()) {
+                servers.resize(record.server + 1);
+            }
+            if (servers[record.server].empty()) {
+                servers[record.server] = reader.getServerName(record.server);
+            }
+            mWriter->writeMessage(CaptureReader::formatTime(record.time), servers[record.server], view.seqNum,
+                                  view.payload);
+            if (mRecords.tellp() >= WRITER_BATCH_SIZE) {
+                logRecords();
+            }
+        });
+        logRecords();
+        mOutput->drain();
+
+        if (mOptions["stats"].boolVal || nofInvalid > 0) {
+            std::stringstream stats;
+            stats << nofMatched << " messages" << (grep ? " matched" : "") << ", " << nofInvalid << " invalid" << std::endl;
+            reader.printStats(stats);
+            error(stats);
+        }
+    }
+
+
+    void RconApp::sendPacket(Message *msg) {
+        mChannel->send(*msg);
+    }
+
+
+    bool RconApp::waitFor(const std::function<bool()> & ready, int timeoutMs) {
+
+        if (!ready() && mChannelError.empty()) {
+            bool expired = false;
+            Reactor::TimerId timer = mReactor->addTimer(timeoutMs, [&expired]() { expired = true; });
+
+            while (!ready() && mChannelError.empty() && !expired) {
+                mReactor->runOnce();
+            }
+            mReactor->cancelTimer(timer);
+        }
+
+        if (!mChannelError.empty()) {
+            std::string error;
+            error.swap(mChannelError);
+            throw Exception(error);
+        }
+        return ready();
+    }
+
+
+    Message *RconApp::receivePacket(int timeoutMs) {
+
+        if (!waitFor([this]() { return !mInbox.empty(); }, timeoutMs)) {
+            ++mMetrics.timeouts;
+            return nullptr;
+        }
+
+        Message *msg = mInbox.front();
+        mInbox.pop_front();
+        return msg;
+    }
+
+
+    void RconApp::commandAnswered() {
+        mCommandAnswered = true;
+        mMetrics.commandRtt.recordSince(mCommandSent);
+        /* After a resend the round trip is ambiguous */
+        if (mCommandAttempt == 0) {
+            mChannel->getRtt().sampleSince(mCommandSent);
+        }
+    }
+
+
+    uint8_t RconApp::sendCommand(const std::string & cmdStr) {
+        Command cmd(cmdStr, mChannel->getCommandSequence().next());
+        sendPacket(&cmd);
+        return cmd.getSeqNum();
+    }
+
+
+    void RconApp::executeCommand(const std::string & cmdStr) {
+
+        mCommandSent = Reactor::Clock::now();
+        mCommandAnswered = false;
+        mCommandAttempt = 0;
+        Reactor::Clock::time_point deadline = mCommandSent + std::chrono::milliseconds(mOptions["cmdtimeout"].intVal);
+        uint8_t seqNum = sendCommand(cmdStr);
+        mReassembler.start(seqNum);
 
         /**** Handle responses ****/
-        Message *rcvdMsg = receivePacket();
-        if (rcvdMsg->getType() != Message::MSG_LOGIN_RESP) {
-            throw ProtocolException("Unexpected message received!");
+        for (;;) {
+            bool ready = waitFor([this]() { return !mInbox.empty() || mReassembler.isComplete(); },
+                                 mChannel->getRtt().getTimeout(mCommandAttempt, deadline));
+
+            if (mReassembler.isComplete()) {
+                mMetrics.multipartCompletion.recordSince(mCommandSent);
+                log(mReassembler);
+                return;
+            }
+
+            if (!ready) {
+                ++mMetrics.timeouts;
+                if (RCON_TRACING(timeout)) {
+                    Trace::timeout(mChannel->getTraceId(), seqNum, mCommandAttempt);
+                }
+                if (Reactor::Clock::now() >= deadline) {
+                    if (!mReassembler.isStarted()) {
+                        throw ProtocolException("timeout");
+                    }
+                    throw ProtocolException("incomplete response, " + mReassembler.describeMissing());
+                }
+                /* Same seqnum, so the parts of earlier attempts still count */
+                ++mCommandAttempt;
+                Command cmd(cmdStr, seqNum);
+                sendPacket(&cmd);
+                continue;
+            }
+
+            Message *rcvdMsg = mInbox.front();
+            mInbox.pop_front();
+
+            if (rcvdMsg->getType() == Message::MSG_CMD_RESP) {
+                CommandResponse *cmdResp = static_cast<CommandResponse*>(rcvdMsg);
+                if (cmdResp->getSeqNum() == mReassembler.getSeqNum()) {
+                    if (!mCommandAnswered) {
+                        commandAnswered();
+                    }
+                    std::stringstream rconText;
+                    rconText << cmdResp->getMessage() << std::endl;
+                    log(rconText);
+                    mPool.release(cmdResp);
+                    return;
+                }
+            }
+            mPool.release(rcvdMsg);
         }
+    }
 
-        LoginResponse *loginResp = static_cast<LoginResponse*>(rcvdMsg);
-        if (loginResp->getResult() == 0) {
-            throw ProtocolException("Wrong RCON password!");
+
+    void RconApp::run(int argc, char *argv[]) {
+
+
+        getOpts(argc, argv);
+
+        OutputWriter::Policy policy = OutputWriter::POLICY_BLOCK;
+        OutputWriter::parsePolicy(mOptions["policy"].strVal, policy);
+        mOutput.reset(new OutputWriter(STDOUT_FILENO, mOptions["queue"].intVal, policy, mOptions["spill"].strVal));
+
+        TableWriter::Format format = TableWriter::FORMAT_TEXT;
+        TableWriter::parseFormat(mOptions["format"].strVal, format);
+        mWriter.reset(new TableWriter(format, mRecords));
+
+        if (optind < argc && (strcmp(argv[optind], "replay") == 0 || strcmp(argv[optind], "grep") == 0)) {
+            runReplay(argc, argv);
+            checkOutput();
+            return;
+        }
+
+        /**** Parsed once, however many servers it has ****/
+        readConfig();
+
+        if (!mOptions["daemon"].strVal.empty()) {
+            runDaemon(argc, argv);
+            checkOutput();
+            return;
+        }
+
+        if (!mOptions["client"].strVal.empty()) {
+            runClient(argc, argv);
+            checkOutput();
+            return;
+        }
+
+        if (!mOptions["fanout"].strVal.empty() || !mOptions["group"].strVal.empty()) {
+            runFanOut(argc, argv);
+            checkOutput();
+            return;
+        }
+
+        if (mOptions["listen"].boolVal) {
+            runListen(argc, argv);
+            return;
+        }
+
+        bool interactive = mOptions["interactive"].boolVal;
+        const std::string batchFile = mOptions["batch"].strVal;
+
+        if (!interactive && argc - optind < (batchFile.empty() ? 3 : 2)) {
+            printHelp(argv[0]);
+            throw AppException("wrong usage"); 
         }
 
-        delete loginResp;
-        loginResp = nullptr;
+        const std::string ip(argv[optind]);
+        const std::string port(argv[optind+1]);
+
+        login(ip, port);
 
         if (interactive) {
-            std::cout << "Type 'exit' or 'quit' to exit interactive mode." << std::endl;
+            mOutput->append("Type 'exit' or 'quit' to exit interactive mode.");
         }
 
-        do {
+        while (interactive) {
             std::string cmdStr;
-            if (interactive) {
-                std::cout << "> ";
-                std::cin >> cmdStr;
+            /* The prompt follows the output of the last command */
+            mOutput->write("> ");
+            mOutput->drain();
+            if (!std::getline(std::cin, cmdStr)) {
+                mOutput->append("");
+                break;
+            }
 
-            } else {
-                cmdStr = argv[optind+2];
+            if (cmdStr.empty()) {
+                continue;
             }
 
             if (cmdStr == "quit" || cmdStr == "exit") {
@@ -229,59 +1093,47 @@ namespace Rcon {
             }
 
             /**** Execute remote command ****/
-            Command cmd(cmdStr);
-            sendPacket(&cmd);
-
-            /**** Handle responses ****/
-            Message::MsgType msgType = Message::MSG_NONE;
-
-            do {
-                ServerAck ack;
-                rcvdMsg = receivePacket();
-                msgType = rcvdMsg->getType();
-                CommandResponse *cmdResp = nullptr;
-                CommandPartialResponse *cmdPartResp = nullptr;
-                ServerMessage *srvMsg = nullptr;
-                std::stringstream rconText;
-                rconText.str(std::string());
-                uint8_t seqNum = 0;
-
-                switch(msgType) {
-
-                    case Message::MSG_CMD_RESP:
-                        cmdResp = static_cast<CommandResponse*>(rcvdMsg);
-                        rconText << cmdResp->getMessage() << std::endl;
-                        log(rconText);
-                        delete cmdResp;
-                        cmdResp = nullptr;
-                        break;
-
-                    case Message::MSG_CMD_PART_RESP:
-                        cmdPartResp = static_cast<CommandPartialResponse*>(rcvdMsg);
-                        rconText << cmdPartResp->getMessage() << std::endl;
-                        log(rconText);
-                        delete cmdPartResp;
-                        cmdPartResp = nullptr;
-                        break;
-
-                    case Message::MSG_SRV_MSG:
-                        srvMsg = static_cast<ServerMessage*>(rcvdMsg);
-                        seqNum = srvMsg->getSeqNum();
-                        rconText << srvMsg->getMessage() << std::endl;
-                        log(rconText);
-                        delete srvMsg;
-                        srvMsg = nullptr;
-
-                        ack.setSeqNum(seqNum);
-                        sendPacket(&ack);
-                        break;
+            executeCommand(cmdStr);
+        }
+
+        if (!batchFile.empty()) {
+            /**** Execute the batch over this session ****/
+            if (batchFile == "-") {
+                runCommands(std::cin);
+            } else {
+                std::ifstream batch(batchFile);
+                if (!batch) {
+                    throw AppException("could not open batch file " + batchFile);
                 }
+                runCommands(batch);
+            }
 
-            } while (msgType == Message::MSG_CMD_PART_RESP ||
-                     msgType == Message::MSG_SRV_MSG);
-        } while (interactive);
+        } else if (!interactive) {
+            /**** Execute remote commands pipelined, once or every -r milliseconds ****/
+            std::vector<std::string> cmds(argv + optind + 2, argv + argc);
+            if (mOptions["watch"].intVal > 0) {
+                runWatch(cmds);
+            } else {
+                runCommands(cmds);
+            }
+        }
+
+        if (mOptions["stats"].boolVal) {
+            /* After the output it is about */
+            mOutput->drain();
+            std::stringstream stats;
+            mPool.printStats(stats);
+            mOutput->printStats(stats);
+            mServerWindow.printStats(stats);
+            mMetrics.printSummary(stats);
+            mChannel->getRtt().printStats(stats);
+            mChannel->printStats(stats);
+            mReactor->printStats(stats);
+            error(stats);
+        }
 
         closeConnection();
+        checkOutput();
     }
 }
 
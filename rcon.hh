@@ -1,11 +1,28 @@
 #ifndef __RCON_HH__
 #define __RCON_HH__
 
+#include "rconreactor.hh"
+#include "rconpool.hh"
+#include "rconreasm.hh"
+#include "rconseq.hh"
+#include "rconmetrics.hh"
+#include "rcontable.hh"
+#include "rconwriter.hh"
+#include "rconconfig.hh"
 #include <sstream>
+#include <string_view>
 #include <map>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
 
 #define BUF_SIZE 2048
 #define CONFIG_FILE_NAME "./rcon.cfg"
+#define DEFAULT_TIMEOUT_MS 5000
+#define RECEIVE_TIMEOUT_MS 500
+/** BattlEye drops sessions without a command for 45 seconds */
+#define KEEPALIVE_INTERVAL_MS 30000
 
 
 namespace Rcon {
@@ -14,9 +31,14 @@ namespace Rcon {
         class Message;
     }
 
-    union OptVal {
-        OptVal() {}
-        ~OptVal() {}
+    class Pipeline;
+    class StreamListener;
+
+    struct OptVal {
+        OptVal() :
+            boolVal(false),
+            intVal(0)
+        {}
 
         bool boolVal;
         int intVal;
@@ -29,49 +51,185 @@ namespace Rcon {
      * @remark
      *    This application class does the following:
      *     - Parsing command line parameters.
-     *     - Managing the socket and the connection.
+     *     - Managing the socket and the connection on a reactor.
      *     - Logging in to the BattlEye RCon server.
-     *     - Sending RCon command to the server.
+     *     - Sending RCon commands to the server, pipelined.
+     *     - Running a RCon command on many servers concurrently (fan-out mode).
+     *     - Keeping sessions alive for local clients (daemon and client mode).
+     *     - Following the server message stream (listen mode).
+     *     - Writing table outputs as JSON or CSV records, or only their changes (watch mode).
      *     - Allows overriding run() and getOpts methods for customizing/extending behavior.
      */
-    class RconApp
+    class RconApp : public MessageHandler
     {
         public:
             RconApp() :
-                mSocketFd(0),
-                mOptions(std::map<std::string, OptVal>()),
-                mPassword(std::string())
+                mReactor(Reactor::create()),
+                mPool(BUF_SIZE),
+                mReassembler(BUF_SIZE),
+                mCommandAnswered(true),
+                mCommandAttempt(0),
+                mPipeline(nullptr),
+                mListener(nullptr),
+                mListening(false),
+                mWatching(false),
+                mOptions(std::map<std::string, OptVal>())
             {
             }
 
-            virtual ~RconApp(){
-            }
+            virtual ~RconApp();
 
             virtual void run(int argc, char *argv[]);
 
+            /** Logs and acknowledges server messages straight from the view, without allocating;
+                resent copies are acknowledged only.
+                Parts of the current command response go to the reassembler; every other
+                message is created from the message pool and queued for receivePacket(). */
+            virtual void handleView(Channel & channel, const Protocol::MessageView & view);
+
+            /** Queues a message for receivePacket(). */
+            virtual void handleMessage(Channel & channel, Protocol::Message *msg);
+
+            /** Remembers the channel error, so receivePacket() can throw it. */
+            virtual void handleError(Channel & channel, const Exception & e);
+
+            /** Passes the end of a batch on to the stream listener, if listening. */
+            virtual void handleBatchEnd(Channel & channel);
+
         protected:
 
             void log(const std::stringstream & msg);
 
+            /** Logs a text line, which is terminated with a newline. */
+            void log(const std::string_view & line);
+
+            /** Logs a complete multipart response, which is terminated with a newline. */
+            void log(const Protocol::Reassembler & response);
+
             void error(const std::stringstream & msg);
 
+            /** Warns and throws AppException if any output was dropped, which loses command results. */
+            void checkOutput();
+
             virtual void getOpts(int argc, char *argv[]);
 
-            void readConfig(const std::string & cfgFile);
+            /** Parses the config file given by -k, or CONFIG_FILE_NAME if it exists. */
+            void readConfig();
 
+            /** Returns the file of readConfig() */
+            std::string getConfigFile();
+
+            /** Returns the default password of the config file */
             const std::string & getPassword() const;
 
+            /** Returns the targets of the -f target list, or of the -g selection of the config file */
+            std::vector<Target> getTargets();
+
             void openConnection(const std::string & ip, const std::string & port);
 
             void closeConnection();
 
-            void sendPacket(Protocol::Message *msg);
+            /** Opens the connection and logs in with the password of the server in the
+                config file, or the default password if the server is not configured.
+                opened is called once the channel is open, before the login is sent. */
+            void login(const std::string & ip, const std::string & port,
+                       const std::function<void()> & opened = std::function<void()>());
 
-            Protocol::Message *receivePacket();
+            /** Executes the commands pipelined, with the window given by -w, and logs
+                their results in order. Throws CommandException if any command failed. */
+            virtual void runCommands(const std::function<bool(std::string &)> & nextCommand);
+
+            /** Executes the commands of the vector pipelined. */
+            void runCommands(const std::vector<std::string> & cmds);
+
+            /** Executes every non-empty line of the stream as a command pipelined. */
+            void runCommands(std::istream & in);
+
+            /** Executes the commands pipelined every -r milliseconds until stopped by a signal. */
+            virtual void runWatch(const std::vector<std::string> & cmds);
+
+            /** Logs the output of a command, as records in the -o format if the command
+                outputs a table; in watch mode only the records which changed since
+                the last output of the same command. */
+            void logResult(const std::string & cmdStr, const std::string & output);
+
+            /** Passes the records written by mWriter on to the output. */
+            void logRecords();
+
+            /** Runs the command given on the command line on all servers of the target list. */
+            virtual void runFanOut(int argc, char *argv[]);
+
+            /** Keeps sessions to the servers alive and serves clients on the Unix socket given by -d. */
+            virtual void runDaemon(int argc, char *argv[]);
+
+            /** Runs the commands given on the command line through the daemon listening on -c. */
+            virtual void runClient(int argc, char *argv[]);
+
+            /** Logs in and writes the server message stream to stdout until stopped by a signal. */
+            virtual void runListen(int argc, char *argv[]);
+
+            /** Writes the server messages of the capture directory in the time range
+                given on the command line, with grep only the ones matching the pattern. */
+            virtual void runReplay(int argc, char *argv[]);
+
+            void sendPacket(Protocol::Message *msg);
 
-            int mSocketFd;
+            /** Runs the reactor until a message is queued or timeoutMs has passed.
+                The returned message must be given back to mPool, null on timeout. */
+            Protocol::Message *receivePacket(int timeoutMs);
+
+            /** Runs the reactor until ready() returns true or timeoutMs has passed.
+                Returns the last result of ready(). */
+            bool waitFor(const std::function<bool()> & ready, int timeoutMs);
+
+            /** Sends a new command packet and returns its sequence number. */
+            uint8_t sendCommand(const std::string & cmdStr);
+
+            /** Records the round trip of the command of mReassembler. */
+            void commandAnswered();
+
+            /** Sends a command and logs its response once complete. An unanswered
+                command is resent with the same sequence number and backoff until
+                the command deadline has passed. */
+            virtual void executeCommand(const std::string & cmdStr);
+
+            std::unique_ptr<Reactor> mReactor;
+            std::unique_ptr<Channel> mChannel;
+            Protocol::MessagePool mPool;
+            Protocol::Reassembler mReassembler;
+            Protocol::SequenceWindow mServerWindow;
+            Metrics mMetrics;
+            /** When the command of mReassembler was first sent */
+            Reactor::Clock::time_point mCommandSent;
+            /** True unless the command of mReassembler waits for its first packet */
+            bool mCommandAnswered;
+            int mCommandAttempt;
+            Pipeline *mPipeline;
+            StreamListener *mListener;
+            /** True once the login of listen mode is done and mListener takes every message */
+            bool mListening;
+            std::deque<Protocol::Message*> mInbox;
+            std::string mChannelError;
+            /** The previous output of a command in watch mode, the table is made of views into the text */
+            struct Snapshot {
+                explicit Snapshot(Protocol::Table::Kind kind) :
+                    table(kind)
+                {}
+
+                std::string text;
+                Protocol::Table table;
+            };
+            /** Writes the standard output on its own thread */
+            std::unique_ptr<OutputWriter> mOutput;
+            /** The records of mWriter, which are passed on to mOutput */
+            std::stringstream mRecords;
+            std::unique_ptr<TableWriter> mWriter;
+            bool mWatching;
+            std::map<std::string, std::unique_ptr<Snapshot> > mSnapshots;
             std::map<std::string, OptVal> mOptions;
-            std::string mPassword;
+            Config mConfig;
+            /** The server logged in to, as configured */
+            Target mServer;
 
         private:
             void printHelp(const std::string & app) const;
@@ -0,0 +1,750 @@
+#include "rcon.hh"
+#include "rconmsg.hh"
+#include "rconcrc.hh"
+#include "rconexception.hh"
+#include "rconreactor.hh"
+#include "rconpipeline.hh"
+#include "rconreasm.hh"
+#include "rconseq.hh"
+#include "rconconfig.hh"
+#include "rconcapture.hh"
+#include "rcontable.hh"
+#include "rconfake.hh"
+#include <sys/types.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <fstream>
+
+/** Benchmarks of the protocol layer
+ *
+ * @remark
+ *    Usage: rconbench [-j] [-t <ms>] [-n <commands>] [-L <ms>] [-p <loss>] [-r <rate>]
+ *    Runs microbenchmarks of the CRC32 backends, the decoder, every encoder and
+ *    extractStr(), then end-to-end scenarios against an in-process FakeServer
+ *    on loopback UDP: pipelined commands, multipart responses and a server
+ *    message stream. -j prints the results as JSON for regression tracking.
+ *    The CRC32 backends, the reassembler, the sequence window, the config
+ *    parser, the table parser and diffs and a capture round trip are checked first, and every loopback command must complete with the output of its
+ *    own command despite the -p loss, so the exit status is 1 on a mismatch.
+ */
+
+using namespace Rcon;
+using namespace Rcon::Protocol;
+
+typedef std::chrono::steady_clock Clock;
+
+
+/** A named benchmark result with its metrics, in insertion order */
+struct Result {
+    std::string group;
+    std::string name;
+    std::vector<std::pair<std::string, double> > metrics;
+
+    void add(const std::string & key, double value) {
+        metrics.push_back(std::make_pair(key, value));
+    }
+};
+
+static std::vector<Result> gResults;
+
+/** The number of failed checks */
+static size_t gNofFailures = 0;
+
+/** Counts a failed check and reports it on stderr */
+static bool check(bool ok, const std::string & what) {
+    if (!ok) {
+        std::cerr << "check failed: " << what << std::endl;
+        ++gNofFailures;
+    }
+    return ok;
+}
+
+static std::string jsonString(const std::string & text) {
+    std::string quoted = "\"";
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] == '"' || text[i] == '\\') {
+            quoted += '\\';
+        }
+        quoted += text[i];
+    }
+    return quoted + "\"";
+}
+
+static void printJson(std::ostream & out, const FakeServer::Settings & settings, int millis) {
+    out << "{" << std::endl;
+    out << "  \"settings\": {\"case_ms\": " << millis << ", \"latency_ms\": " << settings.latencyMs
+        << ", \"loss\": " << settings.loss << ", \"message_rate\": " << settings.messageRate << "}," << std::endl;
+    out << "  \"results\": [" << std::endl;
+    for (size_t i = 0; i < gResults.size(); ++i) {
+        const Result & result = gResults[i];
+        out << "    {\"group\": " << jsonString(result.group) << ", \"name\": " << jsonString(result.name);
+        for (size_t j = 0; j < result.metrics.size(); ++j) {
+            out << ", " << jsonString(result.metrics[j].first) << ": " << std::setprecision(6) << result.metrics[j].second;
+        }
+        out << "}" << (i + 1 < gResults.size() ? "," : "") << std::endl;
+    }
+    out << "  ]" << std::endl << "}" << std::endl;
+}
+
+static void printTable(std::ostream & out) {
+    std::string group;
+    for (size_t i = 0; i < gResults.size(); ++i) {
+        const Result & result = gResults[i];
+        if (result.group != group) {
+            group = result.group;
+            out << std::endl << group << std::endl;
+        }
+        out << "  " << std::left << std::setw(36) << result.name << std::right;
+        for (size_t j = 0; j < result.metrics.size(); ++j) {
+            out << "  " << result.metrics[j].first << "=" << std::fixed << std::setprecision(1) << result.metrics[j].second;
+        }
+        out << std::endl;
+    }
+}
+
+/** Returns the value at quantile q of the sorted samples */
+static double quantile(const std::vector<double> & sorted, double q) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    size_t i = (size_t)(q * (sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
+
+static void addLatencies(Result & result, std::vector<double> samples) {
+    std::sort(samples.begin(), samples.end());
+    result.add("p50_us", quantile(samples, 0.50));
+    result.add("p90_us", quantile(samples, 0.90));
+    result.add("p99_us", quantile(samples, 0.99));
+    result.add("max_us", samples.empty() ? 0.0 : samples.back());
+}
+
+
+/* Microbenchmarks */
+
+/** Runs op for millis milliseconds and records ns/op and MB/s of bytesPerOp */
+static void microbench(const std::string & group, const std::string & name, size_t bytesPerOp, int millis,
+                       const std::function<void()> & op) {
+    Clock::time_point start = Clock::now();
+    Clock::time_point end = start + std::chrono::milliseconds(millis);
+    Clock::time_point now = start;
+    uint64_t ops = 0;
+
+    while (now < end) {
+        for (int i = 0; i < 256; ++i) {
+            op();
+        }
+        ops += 256;
+        now = Clock::now();
+    }
+    double seconds = std::chrono::duration<double>(now - start).count();
+
+    Result result;
+    result.group = group;
+    result.name = name;
+    result.add("ns_per_op", seconds * 1e9 / ops);
+    if (bytesPerOp > 0) {
+        result.add("mb_per_s", ops * (double)bytesPerOp / seconds / 1e6);
+    }
+    gResults.push_back(result);
+}
+
+static bool verifyCrcBackends(const std::vector<uint8_t> & data) {
+    bool ok = true;
+    for (int b = Crc32::CRC_SLICE8 + 1; b < Crc32::CRC_NOF_BACKENDS; ++b) {
+        Crc32::Backend backend = (Crc32::Backend)b;
+        if (!Crc32::isAvailable(backend)) {
+            continue;
+        }
+        for (size_t length = 0; length <= 4096; ++length) {
+            /* Odd offsets catch alignment assumptions */
+            const uint8_t *p = &data[length % 7];
+            Crc32::select(Crc32::CRC_SLICE8);
+            uint32_t expected = Crc32::calculate(p, length);
+            Crc32::select(backend);
+            uint32_t actual = Crc32::calculate(p, length);
+            if (actual != expected) {
+                std::cerr << Crc32::getName(backend) << ": crc32 of " << length << " bytes is " << std::hex << actual
+                          << ", expected " << expected << std::dec << std::endl;
+                ok = false;
+                break;
+            }
+        }
+    }
+    Crc32::select(Crc32::CRC_AUTO);
+    return ok;
+}
+
+static MessageView partView(uint8_t seqNum, uint8_t nofParts, uint8_t partIdx, const char *payload) {
+    MessageView view;
+    view.type = Message::MSG_CMD_PART_RESP;
+    view.seqNum = seqNum;
+    view.nofParts = nofParts;
+    view.partIdx = partIdx;
+    view.payload = payload;
+    return view;
+}
+
+/** Checks multipart reassembly out of order, with duplicates and with mismatched parts */
+static void verifyReassembler() {
+    Reassembler reassembler(16);
+    reassembler.start(7);
+    check(reassembler.addPart(partView(7, 3, 2, "c")) == Reassembler::PART_ADDED, "reassembler: last part first");
+    check(reassembler.addPart(partView(7, 3, 2, "c")) == Reassembler::PART_DUPLICATE, "reassembler: duplicate part");
+    check(reassembler.addPart(partView(7, 5, 1, "x")) == Reassembler::PART_MISMATCHED, "reassembler: part of a 5 part response");
+    check(reassembler.addPart(partView(7, 3, 3, "x")) == Reassembler::PART_MISMATCHED, "reassembler: part index out of range");
+    check(reassembler.describeMissing() == "2 of 3 parts missing (0, 1)", "reassembler: missing parts");
+    check(reassembler.addPart(partView(7, 3, 0, "a")) == Reassembler::PART_ADDED, "reassembler: first part");
+    check(reassembler.addPart(partView(7, 3, 1, "b")) == Reassembler::PART_COMPLETE, "reassembler: completing part");
+    check(reassembler.str() == "abc", "reassembler: parts in index order");
+
+    /* The buffer is reused by the next command */
+    reassembler.start(8);
+    check(!reassembler.isStarted(), "reassembler: restarted");
+    check(reassembler.addPart(partView(8, 1, 0, "single")) == Reassembler::PART_COMPLETE, "reassembler: single part");
+    check(reassembler.str() == "single", "reassembler: output of the next command");
+}
+
+/** Checks the verdicts of the server message window, across the wrap of the sequence number */
+static void verifySequenceWindow() {
+    SequenceWindow window;
+    check(window.check(250) == SequenceWindow::SEQ_NEW, "window: first message");
+    check(window.check(250) == SequenceWindow::SEQ_DUPLICATE, "window: copy of the first message");
+    check(window.check(251) == SequenceWindow::SEQ_NEW, "window: next message");
+    check(window.check(2) == SequenceWindow::SEQ_NEW, "window: message ahead across the wrap");
+    check(window.check(255) == SequenceWindow::SEQ_LATE, "window: message filling a gap");
+    check(window.check(255) == SequenceWindow::SEQ_DUPLICATE, "window: copy of a late message");
+    check(window.check(200) == SequenceWindow::SEQ_DUPLICATE, "window: message long behind");
+    check(window.getStats().gaps == 6 && window.getStats().resends == 1, "window: gaps and resends");
+    window.reset();
+    check(window.check(250) == SequenceWindow::SEQ_NEW, "window: first message after a reset");
+}
+
+/** Checks the parsing of a players table and the diff of two snapshots */
+static void verifyTable() {
+    const std::string before =
+        "Players on server:\n"
+        "[#] [IP Address]:[Port] [Ping] [GUID] [Name]\n"
+        "--------------------------------------------------\n"
+        "0   1.2.3.4:2304     47   0123456789abcdef0123456789abcdef(OK) First Player (Lobby)\n"
+        "1   5.6.7.8:2304     60   fedcba9876543210fedcba9876543210(?) Second\n"
+        "(2 players in total)\n";
+    const std::string after =
+        "Players on server:\n"
+        "[#] [IP Address]:[Port] [Ping] [GUID] [Name]\n"
+        "--------------------------------------------------\n"
+        "0   1.2.3.4:2304     52   0123456789abcdef0123456789abcdef(OK) First Player\n"
+        "2   9.9.9.9:2304     30   00000000000000000000000000000000(OK) Third\n"
+        "(2 players in total)\n";
+
+    check(Table::kindOf("players") == Table::TABLE_PLAYERS && Table::kindOf("say -1 hi") == Table::TABLE_NONE,
+          "table: kind of a command");
+    Table first(Table::TABLE_PLAYERS);
+    Table second(Table::TABLE_PLAYERS);
+    check(first.parse(before) && second.parse(after), "table: players parsed");
+    check(!Table(Table::TABLE_PLAYERS).parse("Unknown command"), "table: error message rejected");
+    check(first.getRows().size() == 2, "table: rows");
+    if (first.getRows().size() == 2) {
+        const Table::Row & row = first.getRows()[0];
+        check(row.fields[1] == "1.2.3.4" && row.fields[2] == "2304" && row.fields[3] == "47" &&
+              row.fields[4] == "0123456789abcdef0123456789abcdef" && row.fields[5] == "true" &&
+              row.fields[6] == "First Player" && row.fields[7] == "true", "table: fields of a row");
+        check(first.getRows()[1].fields[5] == "false", "table: unverified GUID");
+    }
+
+    /* Player 0 changed, 1 left and 2 joined */
+    first.sort();
+    second.sort();
+    std::ostringstream out;
+    TableWriter writer(TableWriter::FORMAT_CSV, out);
+    check(writer.writeDiff(first, second, "") == 3, "table: records of the diff");
+    check(writer.writeDiff(second, second, "") == 0, "table: diff of a snapshot with itself");
+}
+
+/** Removes a scratch directory and the files in it */
+static void removeDirectory(const std::string & directory) {
+    DIR *dir = opendir(directory.c_str());
+    if (dir != nullptr) {
+        while (struct dirent *entry = readdir(dir)) {
+            if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+                unlink((directory + "/" + entry->d_name).c_str());
+            }
+        }
+        closedir(dir);
+    }
+    rmdir(directory.c_str());
+}
+
+/** Checks the sections, defaults, groups and the legacy single password format of the config file */
+static void verifyConfig(const std::string & directory) {
+    std::string fileName = directory + "/rcon.cfg";
+    {
+        std::ofstream file(fileName);
+        file << "# defaults\npassword = secret with spaces\ntimeout = 1500\nrate = 20\n\n"
+             << "[server alpha]\nhost = 127.0.0.1\nport = 2302\ngroups = eu all-maps\n\n"
+             << "[server beta]\nhost = ::1\nport = 2303\npassword = other\ntimeout = 300\ngroups = eu\n";
+    }
+    Config config;
+    config.load(fileName, true);
+    check(config.getPassword() == "secret with spaces", "config: default password");
+    check(config.getNofServers() == 2, "config: servers");
+    std::vector<Target> eu = config.select("eu");
+    check(eu.size() == 2 && eu[0].port == "2302" && eu[1].port == "2303", "config: group in file order");
+    check(config.select("beta,eu,alpha").size() == 2, "config: servers selected once");
+    check(config.select(CONFIG_ALL_SERVERS).size() == 2, "config: all servers");
+    const Target *alpha = config.find("127.0.0.1:2302");
+    check(alpha != nullptr && alpha->password == "secret with spaces" && alpha->timeoutMs == 1500 && alpha->rate == 20,
+          "config: defaults of a server");
+    const Target *beta = config.find("[::1]:2303");
+    check(beta != nullptr && beta->password == "other" && beta->timeoutMs == 300, "config: settings of a server");
+
+    bool rejected = false;
+    try {
+        config.select("gamma");
+    } catch (Exception & e) {
+        rejected = true;
+    }
+    check(rejected, "config: unknown server rejected");
+
+    {
+        std::ofstream file(fileName);
+        file << "[server broken]\nhost = 127.0.0.1\n";
+    }
+    rejected = false;
+    try {
+        config.load(fileName, true);
+    } catch (Exception & e) {
+        rejected = true;
+    }
+    check(rejected && config.getNofServers() == 2, "config: broken file rejected, the loaded one kept");
+
+    {
+        std::ofstream file(fileName);
+        file << "\nold=style password\n";
+    }
+    config.load(fileName, true);
+    check(config.getPassword() == "old=style password" && config.getNofServers() == 0, "config: legacy password file");
+    unlink(fileName.c_str());
+}
+
+/** Checks that captured datagrams are read back in order, across segments */
+static void verifyCapture(const std::string & directory) {
+    std::string captureDir = directory + "/capture";
+    const size_t count = 200;
+    std::vector<std::vector<uint8_t> > datagrams;
+    {
+        /* Small segments, so the records span several of them */
+        CaptureLog capture(captureDir, 8192);
+        uint32_t servers[] = { capture.addServer("127.0.0.1:2302"), capture.addServer("127.0.0.1:2303") };
+        for (size_t i = 0; i < count; ++i) {
+            ServerMessage msg(i % 256, "Player #" + std::to_string(i) + " (Global): hello");
+            datagrams.push_back(std::vector<uint8_t>(msg.getEncodedSize()));
+            msg.encode(&datagrams.back()[0], datagrams.back().size());
+            capture.append(servers[i % 2], &datagrams.back()[0], datagrams.back().size());
+        }
+    }
+
+    CaptureReader reader(captureDir);
+    size_t read = 0;
+    size_t mismatched = 0;
+    uint64_t last = 0;
+    reader.scan(0, UINT64_MAX, [&](const CaptureReader::Record & record) {
+        if (read >= count || record.time < last ||
+            reader.getServerName(record.server) != (read % 2 ? "127.0.0.1:2303" : "127.0.0.1:2302") ||
+            record.length != datagrams[read].size() || memcmp(record.datagram, &datagrams[read][0], record.length) != 0) {
+            ++mismatched;
+        }
+        last = record.time;
+        ++read;
+    });
+    check(read == count, "capture: " + std::to_string(read) + " of " + std::to_string(count) + " records read back");
+    check(mismatched == 0, "capture: " + std::to_string(mismatched) + " records differ from the ones captured");
+    removeDirectory(captureDir);
+}
+
+static void benchCrc(const std::vector<uint8_t> & data, int millis) {
+    const size_t lengths[] = { 16, 64, 512, 2048, 65536 };
+    volatile uint32_t sink = 0;
+
+    for (int b = Crc32::CRC_SLICE8; b < Crc32::CRC_NOF_BACKENDS; ++b) {
+        Crc32::Backend backend = (Crc32::Backend)b;
+        if (!Crc32::isAvailable(backend)) {
+            continue;
+        }
+        Crc32::select(backend);
+        for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i) {
+            size_t length = lengths[i];
+            microbench("crc32", std::string(Crc32::getName(backend)) + "/" + std::to_string(length), length, millis,
+                       [&data, length, &sink]() { sink = sink + Crc32::calculate(&data[0], length); });
+        }
+    }
+    Crc32::select(Crc32::CRC_AUTO);
+}
+
+static void benchCodec(int millis) {
+    const std::string line = "Player #12 Somebody (Global): " + std::string(70, 'x');
+    const std::string part(1000, 'p');
+    uint8_t buffer[BUF_SIZE];
+    volatile size_t sink = 0;
+
+    /* Decoding of the inbound packets */
+    struct Packet {
+        const char *name;
+        std::vector<uint8_t> bytes;
+    };
+    std::vector<Packet> packets;
+    const Message *inbound[] = {
+        new LoginResponse(1),
+        new ServerMessage(7, line),
+        new CommandResponse(3, line),
+        new CommandPartialResponse(3, 4, 1, part)
+    };
+    const char *inboundNames[] = { "login response", "server message", "command response", "command part" };
+    for (size_t i = 0; i < sizeof(inbound) / sizeof(inbound[0]); ++i) {
+        Packet packet;
+        packet.name = inboundNames[i];
+        packet.bytes.resize(inbound[i]->getEncodedSize());
+        inbound[i]->encode(&packet.bytes[0], packet.bytes.size());
+        packets.push_back(packet);
+        delete inbound[i];
+    }
+
+    for (size_t i = 0; i < packets.size(); ++i) {
+        const std::vector<uint8_t> & bytes = packets[i].bytes;
+        microbench("decode", std::string("decodeView/") + packets[i].name, bytes.size(), millis, [&bytes, &sink]() {
+            sink = sink + Message::decodeView(&bytes[0], bytes.size()).payload.size();
+        });
+    }
+    for (size_t i = 0; i < packets.size(); ++i) {
+        const std::vector<uint8_t> & bytes = packets[i].bytes;
+        microbench("decode", std::string("decode/") + packets[i].name, bytes.size(), millis, [&bytes, &sink]() {
+            Message *msg = Message::decode(&bytes[0], bytes.size());
+            sink = sink + msg->getType();
+            delete msg;
+        });
+    }
+
+    /* Encoding of every message type */
+    const Message *outbound[] = {
+        new Login("secret password"),
+        new LoginResponse(1),
+        new Command("players", 1),
+        new CommandResponse(1, line),
+        new CommandPartialResponse(1, 4, 1, part),
+        new ServerMessage(1, line),
+        new ServerAck(1)
+    };
+    const char *outboundNames[] = { "login", "login response", "command", "command response",
+                                    "command part", "server message", "server ACK" };
+    for (size_t i = 0; i < sizeof(outbound) / sizeof(outbound[0]); ++i) {
+        const Message *msg = outbound[i];
+        microbench("encode", std::string("encode/") + outboundNames[i], msg->getEncodedSize(), millis,
+                   [msg, &buffer, &sink]() { sink = sink + msg->encode(buffer, sizeof(buffer)); });
+    }
+    for (size_t i = 0; i < sizeof(outbound) / sizeof(outbound[0]); ++i) {
+        const Message *msg = outbound[i];
+        microbench("encode", std::string("encode gather/") + outboundNames[i], msg->getEncodedSize(), millis,
+                   [msg, &buffer, &sink]() {
+            size_t headerLength;
+            std::string_view payload;
+            sink = sink + msg->encode(buffer, headerLength, payload);
+        });
+        delete msg;
+    }
+
+    /* Payload extraction */
+    const uint8_t *text = reinterpret_cast<const uint8_t*>(part.data());
+    const size_t lengths[] = { 100, 1000 };
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i) {
+        size_t length = lengths[i];
+        microbench("extract", "extractStr/" + std::to_string(length), length, millis, [text, length, &sink]() {
+            sink = sink + Message::extractStr(text, length).size();
+        });
+        microbench("extract", "extractView/" + std::to_string(length), length, millis, [text, length, &sink]() {
+            sink = sink + Message::extractView(text, length).size();
+        });
+    }
+}
+
+
+/* Loopback scenarios */
+
+/** BenchClient class
+  @remarks
+    A minimal session to a FakeServer: logs in, passes command responses
+    to the pipeline and acknowledges server messages in batches.
+*/
+class BenchClient : public MessageHandler {
+    public:
+        explicit BenchClient(const std::string & port) :
+            mReactor(Reactor::create()),
+            mChannel(*mReactor, *this),
+            mPipeline(nullptr),
+            mLoggedIn(false),
+            mNofMessages(0)
+        {
+            mChannel.open("127.0.0.1", port);
+            mChannel.setBatchSize(64);
+        }
+
+        /** Logs in, resending the login until timeoutMs has passed */
+        bool login(const std::string & password, int timeoutMs) {
+            Login login(password);
+            Clock::time_point end = Clock::now() + std::chrono::milliseconds(timeoutMs);
+            while (!mLoggedIn && Clock::now() < end) {
+                mChannel.send(login);
+                runUntil([this]() { return mLoggedIn; }, 100);
+            }
+            return mLoggedIn;
+        }
+
+        /** Runs the reactor until done() or timeoutMs has passed */
+        bool runUntil(const std::function<bool()> & done, int timeoutMs) {
+            Clock::time_point end = Clock::now() + std::chrono::milliseconds(timeoutMs);
+            while (!done() && Clock::now() < end) {
+                mReactor->runOnce(10);
+            }
+            return done();
+        }
+
+        virtual void handleView(Channel & channel, const MessageView & view) {
+            if (view.type == Message::MSG_SRV_MSG) {
+                ServerAck ack(view.seqNum);
+                channel.queue(ack);
+                ++mNofMessages;
+            } else if (view.type == Message::MSG_LOGIN_RESP) {
+                mLoggedIn = (view.result != 0);
+            } else if (mPipeline != nullptr) {
+                mPipeline->handleView(view);
+            }
+        }
+
+        virtual void handleError(Channel & channel, const Exception & e) {
+            std::cerr << "bench client: " << e.what() << std::endl;
+        }
+
+        std::unique_ptr<Reactor> mReactor;
+        Channel mChannel;
+        Pipeline *mPipeline;
+        bool mLoggedIn;
+        uint64_t mNofMessages;
+};
+
+static void benchCommands(const FakeServer::Settings & settings, const std::string & name, const std::string & cmd,
+                          size_t window, size_t count) {
+    FakeServer server(settings);
+    server.start();
+    BenchClient client(server.getPort());
+
+    Result result;
+    result.group = "loopback";
+    result.name = name;
+
+    if (!client.login(settings.password, 5000)) {
+        result.add("login_failed", 1);
+        gResults.push_back(result);
+        check(false, result.name + ": login failed");
+        return;
+    }
+
+    std::vector<Clock::time_point> submitted;
+    std::vector<double> latencies;
+    size_t completed = 0;
+    size_t mismatched = 0;
+
+    /* Every command is unique, so a response matched to the wrong one after a seqnum wrap shows */
+    Pipeline pipeline(*client.mReactor, client.mChannel, window, [&](const Pipeline::Result & r) {
+        latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - submitted[r.tag]).count());
+        ++completed;
+        std::string expected = (cmd.compare(0, 6, "parts ") == 0) ?
+            FakeServer::expectedParts(atoi(cmd.c_str() + 6), settings.partSize) :
+            "echo " + cmd + " " + std::to_string(r.tag);
+        if (r.ok && (r.command != cmd + " " + std::to_string(r.tag) || r.output != expected)) {
+            ++mismatched;
+        }
+    });
+    /* Lost packets are resent until they get through */
+    pipeline.setDeadline(60000);
+    client.mPipeline = &pipeline;
+
+    Clock::time_point start = Clock::now();
+    size_t next = 0;
+    client.runUntil([&]() {
+        /* Keep the window full, so every command is sent as soon as it is submitted */
+        while (next < count && next - completed < window) {
+            submitted.push_back(Clock::now());
+            pipeline.submit(cmd + " " + std::to_string(next), next);
+            ++next;
+        }
+        return completed == count;
+    }, 60000);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    client.mPipeline = nullptr;
+
+    FakeServer::Stats stats = server.getStats();
+    result.add("window", window);
+    result.add("commands", completed);
+    result.add("failed", pipeline.getNofFailed());
+    result.add("commands_per_s", completed / seconds);
+    result.add("sent", stats.commands);
+    result.add("mismatched", mismatched);
+    addLatencies(result, latencies);
+    gResults.push_back(result);
+
+    check(completed == count, name + ": " + std::to_string(completed) + " of " + std::to_string(count) + " commands completed");
+    check(pipeline.getNofFailed() == 0, name + ": " + std::to_string(pipeline.getNofFailed()) + " commands failed");
+    check(mismatched == 0, name + ": " + std::to_string(mismatched) + " responses do not match their command");
+}
+
+static void benchStream(const FakeServer::Settings & settings, int millis) {
+    FakeServer::Settings streaming = settings;
+    if (streaming.messageRate <= 0) {
+        streaming.messageRate = 20000;
+    }
+    FakeServer server(streaming);
+    server.start();
+    BenchClient client(server.getPort());
+
+    Result result;
+    result.group = "loopback";
+    result.name = "server message stream";
+
+    if (!client.login(streaming.password, 5000)) {
+        result.add("login_failed", 1);
+        gResults.push_back(result);
+        check(false, result.name + ": login failed");
+        return;
+    }
+
+    Clock::time_point start = Clock::now();
+    client.runUntil([]() { return false; }, millis);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    server.stop();
+
+    FakeServer::Stats stats = server.getStats();
+    result.add("rate", streaming.messageRate);
+    result.add("pushed", stats.messages);
+    result.add("received", client.mNofMessages);
+    result.add("acked", stats.ackLatencyUs.size());
+    result.add("messages_per_s", client.mNofMessages / seconds);
+    result.add("lost", stats.lost);
+    addLatencies(result, stats.ackLatencyUs);
+    gResults.push_back(result);
+
+    check(client.mNofMessages > 0, "server message stream: no message received");
+    check(client.mNofMessages <= stats.messages, "server message stream: more messages received than pushed");
+}
+
+
+static void usage(const char *app) {
+    std::cerr << "Usage: " << app << " [-j] [-t <ms>] [-n <commands>] [-L <ms>] [-p <loss>] [-r <rate>]" << std::endl;
+    std::cerr << "   -j     Print the results as JSON." << std::endl;
+    std::cerr << "   -t     Milliseconds per microbenchmark and of the stream (default 200)." << std::endl;
+    std::cerr << "   -n     Commands per loopback scenario (default 2000)." << std::endl;
+    std::cerr << "   -L     One-way latency of the fake server in milliseconds (default 0)." << std::endl;
+    std::cerr << "   -p     Packet loss probability of the fake server (default 0)." << std::endl;
+    std::cerr << "   -r     Server messages per second of the stream (default 20000)." << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    bool json = false;
+    int millis = 200;
+    size_t count = 2000;
+    FakeServer::Settings settings;
+
+    for (;;) {
+        int opt = getopt(argc, argv, "jht:n:L:p:r:");
+        if (opt == -1) {
+            break;
+        }
+        switch (opt) {
+            case 'j':
+                json = true;
+                break;
+            case 't':
+                millis = atoi(optarg);
+                break;
+            case 'n':
+                count = atoi(optarg);
+                break;
+            case 'L':
+                settings.latencyMs = atoi(optarg);
+                break;
+            case 'p':
+                settings.loss = atof(optarg);
+                break;
+            case 'r':
+                settings.messageRate = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (millis <= 0 || count == 0 || settings.latencyMs < 0 || settings.loss < 0.0 || settings.loss >= 1.0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<uint8_t> data(1 << 16);
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < data.size(); ++i) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = seed >> 16;
+    }
+    if (!verifyCrcBackends(data)) {
+        return 1;
+    }
+    verifyReassembler();
+    verifySequenceWindow();
+    verifyTable();
+    char scratch[] = "/tmp/rconbench.XXXXXX";
+    if (mkdtemp(scratch) == nullptr) {
+        std::cerr << "rconbench: cannot create a scratch directory" << std::endl;
+        return 1;
+    }
+    try {
+        verifyConfig(scratch);
+        verifyCapture(scratch);
+    } catch (Exception & e) {
+        check(false, e.what());
+    }
+    removeDirectory(scratch);
+
+    try {
+        benchCrc(data, millis);
+        benchCodec(millis);
+        benchCommands(settings, "commands window 1", "status", 1, count);
+        benchCommands(settings, "commands window 16", "status", 16, count);
+        benchCommands(settings, "multipart 4 parts window 16", "parts 4", 16, count);
+        FakeServer::Settings reversed = settings;
+        reversed.reverseParts = true;
+        benchCommands(reversed, "multipart 4 parts reversed window 16", "parts 4", 16, count);
+        benchStream(settings, millis);
+    } catch (Exception & e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    if (json) {
+        printJson(std::cout, settings, millis);
+    } else {
+        std::cout << "crc32 auto selects " << Crc32::getName(Crc32::getBackend()) << std::endl;
+        printTable(std::cout);
+    }
+    if (gNofFailures > 0) {
+        std::cerr << gNofFailures << " checks failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,348 @@
+#include "rconcapture.hh"
+#include "rconexception.hh"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <ctime>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+
+namespace Rcon {
+
+    /** The header rounded up to whole pages, where the first record starts */
+    static const size_t HEADER_SIZE = (sizeof(CaptureSegmentHeader) + 4095) & ~static_cast<size_t>(4095);
+
+    /** Returns the segment numbers found in the directory, sorted */
+    static std::vector<uint32_t> listSegments(const std::string & directory) {
+        std::vector<uint32_t> segments;
+        DIR *dir = opendir(directory.c_str());
+        if (dir == nullptr) {
+            throw Exception("capture: " + directory + ": " + strerror(errno));
+        }
+        const std::string suffix(CAPTURE_SEGMENT_SUFFIX);
+        for (struct dirent *entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+            std::string name(entry->d_name);
+            if (name.size() <= suffix.size() ||
+                name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0 ||
+                name.find_first_not_of("0123456789") != name.size() - suffix.size()) {
+                continue;
+            }
+            segments.push_back(std::stoul(name.substr(0, name.size() - suffix.size())));
+        }
+        closedir(dir);
+        std::sort(segments.begin(), segments.end());
+        return segments;
+    }
+
+    /** Returns the path of a segment */
+    static std::string segmentPath(const std::string & directory, uint32_t segment) {
+        char name[32];
+        snprintf(name, sizeof(name), "%08u" CAPTURE_SEGMENT_SUFFIX, segment);
+        return directory + "/" + name;
+    }
+
+    /** Reads the server names of the servers file */
+    static void readServers(const std::string & directory, std::map<uint32_t, std::string> & servers) {
+        std::ifstream in(directory + "/" CAPTURE_SERVERS_FILE);
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            uint32_t id;
+            std::string name;
+            if (fields >> id >> name) {
+                servers[id] = name;
+            }
+        }
+    }
+
+
+    /* CaptureLog class */
+
+    CaptureLog::CaptureLog(const std::string & directory, size_t segmentSize) :
+        mDirectory(directory),
+        mSegmentSize(std::max(segmentSize, HEADER_SIZE * 2)),
+        mFd(-1),
+        mBase(nullptr),
+        mHeader(nullptr),
+        mNextSegment(0),
+        mNextIndexOffset(0),
+        mLastTime(0),
+        mNofRecords(0),
+        mNofBytes(0),
+        mNofSegments(0)
+    {
+        if (mkdir(mDirectory.c_str(), 0755) == -1 && errno != EEXIST) {
+            throw Exception("capture: " + mDirectory + ": " + strerror(errno));
+        }
+        std::vector<uint32_t> segments = listSegments(mDirectory);
+        mNextSegment = segments.empty() ? 0 : segments.back() + 1;
+
+        std::map<uint32_t, std::string> servers;
+        readServers(mDirectory, servers);
+        for (std::map<uint32_t, std::string>::const_iterator it = servers.begin(); it != servers.end(); ++it) {
+            mServers[it->second] = it->first;
+        }
+        openSegment();
+    }
+
+    CaptureLog::~CaptureLog() {
+        closeSegment();
+    }
+
+    uint32_t CaptureLog::addServer(const std::string & name) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        std::map<std::string, uint32_t>::const_iterator it = mServers.find(name);
+        if (it != mServers.end()) {
+            return it->second;
+        }
+        uint32_t id = mServers.size();
+        mServers[name] = id;
+
+        std::ofstream out(mDirectory + "/" CAPTURE_SERVERS_FILE, std::ios::out | std::ios::app);
+        out << id << " " << name << std::endl;
+        if (!out) {
+            throw Exception("capture: could not write " CAPTURE_SERVERS_FILE " of " + mDirectory);
+        }
+        return id;
+    }
+
+    void CaptureLog::append(uint32_t server, const uint8_t *datagram, size_t length) {
+        uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::system_clock::now().time_since_epoch()).count();
+        size_t size = (sizeof(CaptureRecordHeader) + length + 7) & ~static_cast<size_t>(7);
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mHeader->used + size > mSegmentSize) {
+            if (mHeader->used == HEADER_SIZE) {
+                /* Larger than a segment */
+                return;
+            }
+            closeSegment();
+            openSegment();
+        }
+
+        mLastTime = std::max(now, mLastTime);
+        uint64_t offset = mHeader->used;
+        CaptureRecordHeader *record = reinterpret_cast<CaptureRecordHeader *>(mBase + offset);
+        record->time = mLastTime;
+        record->server = server;
+        record->length = length;
+        memcpy(record + 1, datagram, length);
+
+        if (offset >= mNextIndexOffset && mHeader->nofIndexEntries < CAPTURE_INDEX_ENTRIES) {
+            CaptureIndexEntry & entry = mHeader->index[mHeader->nofIndexEntries++];
+            entry.time = mLastTime;
+            entry.offset = offset;
+            mNextIndexOffset = offset + (mSegmentSize - HEADER_SIZE) / CAPTURE_INDEX_ENTRIES;
+        }
+        if (mHeader->nofRecords == 0) {
+            mHeader->firstTime = mLastTime;
+        }
+        mHeader->lastTime = mLastTime;
+        ++mHeader->nofRecords;
+        /* Readers trust everything before used */
+        __atomic_store_n(&mHeader->used, offset + size, __ATOMIC_RELEASE);
+
+        ++mNofRecords;
+        mNofBytes += length;
+    }
+
+    void CaptureLog::printStats(std::ostream & out) const {
+        std::lock_guard<std::mutex> lock(mMutex);
+        out << "capture: " << mNofRecords << " datagrams (" << mNofBytes << " bytes) in " << mNofSegments
+            << " segments of " << mDirectory << std::endl;
+    }
+
+    void CaptureLog::openSegment() {
+        std::string path = segmentPath(mDirectory, mNextSegment);
+        mFd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (mFd == -1) {
+            throw Exception("capture: " + path + ": " + strerror(errno));
+        }
+        if (ftruncate(mFd, mSegmentSize) == -1) {
+            int error = errno;
+            close(mFd);
+            mFd = -1;
+            throw Exception("capture: " + path + ": " + strerror(error));
+        }
+        void *base = mmap(nullptr, mSegmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+        if (base == MAP_FAILED) {
+            int error = errno;
+            close(mFd);
+            mFd = -1;
+            throw Exception("capture: mmap: " + std::string(strerror(error)));
+        }
+        ++mNextSegment;
+        ++mNofSegments;
+
+        /* The file is zeroed, only the fixed fields need to be set */
+        mBase = static_cast<uint8_t *>(base);
+        mHeader = reinterpret_cast<CaptureSegmentHeader *>(mBase);
+        memcpy(mHeader->magic, CAPTURE_MAGIC, sizeof(mHeader->magic));
+        mHeader->version = CAPTURE_VERSION;
+        mHeader->headerSize = HEADER_SIZE;
+        mHeader->used = HEADER_SIZE;
+        mNextIndexOffset = HEADER_SIZE;
+    }
+
+    void CaptureLog::closeSegment() {
+        if (mBase == nullptr) {
+            return;
+        }
+        uint64_t used = mHeader->used;
+        munmap(mBase, mSegmentSize);
+        mBase = nullptr;
+        mHeader = nullptr;
+        /* Only the last segment of a capture which crashed keeps its sparse tail */
+        if (ftruncate(mFd, used) == -1) {
+            /* Still valid up to used */
+        }
+        close(mFd);
+        mFd = -1;
+    }
+
+
+    /* CaptureReader class */
+
+    CaptureReader::CaptureReader(const std::string & directory) :
+        mDirectory(directory),
+        mNofScanned(0),
+        mNofSkipped(0),
+        mNofRead(0)
+    {
+        std::vector<uint32_t> segments = listSegments(mDirectory);
+        for (size_t i = 0; i < segments.size(); ++i) {
+            mSegments.push_back(segmentPath(mDirectory, segments[i]));
+        }
+        readServers(mDirectory, mServers);
+    }
+
+    size_t CaptureReader::scan(uint64_t from, uint64_t to, const Callback & callback) {
+        size_t nofRecords = 0;
+        for (size_t i = 0; i < mSegments.size(); ++i) {
+            nofRecords += scanSegment(mSegments[i], from, to, callback);
+        }
+        return nofRecords;
+    }
+
+    size_t CaptureReader::scanSegment(const std::string & path, uint64_t from, uint64_t to, const Callback & callback) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            throw Exception("capture: " + path + ": " + strerror(errno));
+        }
+        struct stat st;
+        if (fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size) < sizeof(CaptureSegmentHeader)) {
+            close(fd);
+            ++mNofSkipped;
+            return 0;
+        }
+        size_t size = st.st_size;
+        void *base = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) {
+            throw Exception("capture: mmap " + path + ": " + strerror(errno));
+        }
+
+        const uint8_t *data = static_cast<const uint8_t *>(base);
+        const CaptureSegmentHeader *header = reinterpret_cast<const CaptureSegmentHeader *>(data);
+        uint64_t used = __atomic_load_n(&header->used, __ATOMIC_ACQUIRE);
+        if (memcmp(header->magic, CAPTURE_MAGIC, sizeof(header->magic)) != 0 || header->version != CAPTURE_VERSION ||
+            used > size || header->nofRecords == 0 || header->lastTime < from || header->firstTime > to) {
+            munmap(base, size);
+            ++mNofSkipped;
+            return 0;
+        }
+        ++mNofScanned;
+
+        /* Start at the last index entry before from, the times are ordered */
+        uint64_t offset = header->headerSize;
+        const CaptureIndexEntry *begin = header->index;
+        const CaptureIndexEntry *end = header->index + std::min<uint32_t>(header->nofIndexEntries, CAPTURE_INDEX_ENTRIES);
+        const CaptureIndexEntry *entry = std::lower_bound(begin, end, from,
+            [](const CaptureIndexEntry & e, uint64_t time) { return e.time < time; });
+        if (entry != begin) {
+            offset = (entry - 1)->offset;
+        }
+        madvise(const_cast<uint8_t *>(data) + (offset & ~static_cast<uint64_t>(4095)),
+                size - (offset & ~static_cast<uint64_t>(4095)), MADV_SEQUENTIAL);
+
+        size_t nofRecords = 0;
+        while (offset + sizeof(CaptureRecordHeader) <= used) {
+            const CaptureRecordHeader *record = reinterpret_cast<const CaptureRecordHeader *>(data + offset);
+            if (offset + sizeof(CaptureRecordHeader) + record->length > used || record->time > to) {
+                break;
+            }
+            ++mNofRead;
+            if (record->time >= from) {
+                Record view;
+                view.time = record->time;
+                view.server = record->server;
+                view.datagram = reinterpret_cast<const uint8_t *>(record + 1);
+                view.length = record->length;
+                ++nofRecords;
+                try {
+                    callback(view);
+                } catch (...) {
+                    munmap(base, size);
+                    throw;
+                }
+            }
+            offset += (sizeof(CaptureRecordHeader) + record->length + 7) & ~static_cast<uint64_t>(7);
+        }
+        munmap(base, size);
+        return nofRecords;
+    }
+
+    std::string CaptureReader::getServerName(uint32_t server) const {
+        std::map<uint32_t, std::string>::const_iterator it = mServers.find(server);
+        return (it != mServers.end()) ? it->second : "#" + std::to_string(server);
+    }
+
+    void CaptureReader::printStats(std::ostream & out) const {
+        out << "capture: " << mSegments.size() << " segments, " << mNofScanned << " scanned, " << mNofSkipped
+            << " skipped by their header, " << mNofRead << " records read" << std::endl;
+    }
+
+    bool CaptureReader::parseTime(const std::string & text, uint64_t & time) {
+        if (!text.empty() && text.find_first_not_of("0123456789.") == std::string::npos) {
+            char *end;
+            double seconds = strtod(text.c_str(), &end);
+            if (*end != '\0') {
+                return false;
+            }
+            time = static_cast<uint64_t>(seconds * 1000000.0);
+            return true;
+        }
+
+        static const char *formats[] = { "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M", "%Y-%m-%d" };
+        for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+            struct tm tm;
+            memset(&tm, 0, sizeof(tm));
+            const char *end = strptime(text.c_str(), formats[i], &tm);
+            if (end != nullptr && (*end == '\0' || (*end == 'Z' && end[1] == '\0'))) {
+                time = static_cast<uint64_t>(timegm(&tm)) * 1000000;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string CaptureReader::formatTime(uint64_t time) {
+        time_t seconds = time / 1000000;
+        struct tm tm;
+        gmtime_r(&seconds, &tm);
+        char text[40];
+        size_t n = strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%S", &tm);
+        snprintf(text + n, sizeof(text) - n, ".%03uZ", static_cast<unsigned>((time / 1000) % 1000));
+        return text;
+    }
+}
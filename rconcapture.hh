@@ -0,0 +1,179 @@
+#ifndef __RCONCAPTURE_HH__
+#define __RCONCAPTURE_HH__
+
+#include <sys/types.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <functional>
+#include <ostream>
+
+/** The size of a capture segment file, the tail of the last one is sparse until written */
+#define CAPTURE_SEGMENT_SIZE (64 * 1024 * 1024)
+/** The time index entries of a segment, spread evenly over its records */
+#define CAPTURE_INDEX_ENTRIES 1024
+/** The file of a capture directory naming the server ids */
+#define CAPTURE_SERVERS_FILE "servers"
+#define CAPTURE_SEGMENT_SUFFIX ".rcap"
+#define CAPTURE_MAGIC "RCONCAP1"
+#define CAPTURE_VERSION 1
+
+namespace Rcon {
+
+    /** The time index entry of a segment */
+    struct CaptureIndexEntry {
+        /** The time of the record in microseconds since the epoch */
+        uint64_t time;
+        /** The offset of the record in the segment */
+        uint64_t offset;
+    };
+
+    /** The header at the start of every segment, followed by the records */
+    struct CaptureSegmentHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t headerSize;
+        /** The end of the last complete record, stored after the record is */
+        uint64_t used;
+        uint64_t nofRecords;
+        uint64_t firstTime;
+        uint64_t lastTime;
+        uint32_t nofIndexEntries;
+        uint32_t reserved;
+        CaptureIndexEntry index[CAPTURE_INDEX_ENTRIES];
+    };
+
+    /** The header of every record, followed by the datagram and padded to 8 bytes */
+    struct CaptureRecordHeader {
+        uint64_t time;
+        uint32_t server;
+        uint32_t length;
+    };
+
+
+    /** CaptureLog class
+      @remarks
+        Appends the server message datagrams received to a directory of
+        segment files, each a header with a time index followed by the
+        records, every record the receive time, the id of the server and
+        the raw datagram as it came off the socket. The current segment is
+        preallocated and mapped, so appending a record is a copy into the
+        mapping; the header is updated after the record, so a segment is
+        always valid up to its used offset, even after a crash. A full
+        segment is truncated to its used size and the next one is started.
+        The times of a capture never go backwards, a clock stepped back
+        repeats the last time, so the index can be searched. Appending is
+        thread safe.
+      @param
+        directory The capture directory, created if missing. Every capture
+        starts a new segment after the ones already there.
+      @param
+        segmentSize The size of the segment files.
+    */
+    class CaptureLog {
+        public:
+            explicit CaptureLog(const std::string & directory, size_t segmentSize = CAPTURE_SEGMENT_SIZE);
+
+            /** Closes the current segment. */
+            virtual ~CaptureLog();
+
+            CaptureLog(const CaptureLog &) = delete;
+            CaptureLog & operator=(const CaptureLog &) = delete;
+
+            /** Returns the id of a server, e.g. "host:port", adding it to the servers file if new */
+            uint32_t addServer(const std::string & name);
+
+            /** Appends a datagram received from the server. */
+            void append(uint32_t server, const uint8_t *datagram, size_t length);
+
+            /** Prints the capture statistics to the stream. */
+            void printStats(std::ostream & out) const;
+
+        protected:
+            /** Creates and maps the next segment. */
+            void openSegment();
+
+            /** Unmaps and truncates the current segment. */
+            void closeSegment();
+
+            std::string mDirectory;
+            size_t mSegmentSize;
+            mutable std::mutex mMutex;
+            std::map<std::string, uint32_t> mServers;
+            int mFd;
+            uint8_t *mBase;
+            CaptureSegmentHeader *mHeader;
+            uint32_t mNextSegment;
+            /** The record offset from which on the next index entry is made */
+            uint64_t mNextIndexOffset;
+            uint64_t mLastTime;
+            size_t mNofRecords;
+            size_t mNofBytes;
+            size_t mNofSegments;
+    };
+
+
+    /** CaptureReader class
+      @remarks
+        Reads the records of a capture directory by time range. Segments
+        whose first and last times are outside of the range are skipped by
+        their header alone; within a segment the time index is searched
+        for the first record of the range, so only the mapped pages of the
+        records in range are read from disk.
+      @param
+        directory The capture directory.
+    */
+    class CaptureReader {
+        public:
+            /** A record, the datagram is only valid during the callback */
+            struct Record {
+                uint64_t time;
+                uint32_t server;
+                const uint8_t *datagram;
+                size_t length;
+            };
+
+            typedef std::function<void(const Record & record)> Callback;
+
+            explicit CaptureReader(const std::string & directory);
+
+            virtual ~CaptureReader() {}
+
+            /** Calls back for every record with from <= time <= to, oldest first
+              @return
+                The number of records in range.
+            */
+            size_t scan(uint64_t from, uint64_t to, const Callback & callback);
+
+            /** Returns the name of a server id, "#<id>" if unknown */
+            std::string getServerName(uint32_t server) const;
+
+            /** Prints the scan statistics to the stream. */
+            void printStats(std::ostream & out) const;
+
+            /** Parses a time, seconds since the epoch or a UTC date
+                "YYYY-MM-DD[THH:MM[:SS]]", into microseconds since the epoch
+              @return
+                false if the time is invalid.
+            */
+            static bool parseTime(const std::string & text, uint64_t & time);
+
+            /** Formats microseconds since the epoch as "YYYY-MM-DDTHH:MM:SS.mmmZ" */
+            static std::string formatTime(uint64_t time);
+
+        protected:
+            /** Scans the records in range of a single segment. */
+            size_t scanSegment(const std::string & path, uint64_t from, uint64_t to, const Callback & callback);
+
+            std::string mDirectory;
+            std::vector<std::string> mSegments;
+            std::map<uint32_t, std::string> mServers;
+            size_t mNofScanned;
+            size_t mNofSkipped;
+            size_t mNofRead;
+    };
+}
+
+#endif // __RCONCAPTURE_HH__
@@ -0,0 +1,369 @@
+#include "rconconfig.hh"
+#include "rconexception.hh"
+#include <sys/types.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+
+namespace Rcon {
+
+    std::string Target::key() const {
+        if (host.find(':') != std::string::npos) {
+            return "[" + host + "]:" + port;
+        }
+        return host + ":" + port;
+    }
+
+
+    std::string Target::tag() const {
+        return "[" + key() + "]";
+    }
+
+
+    std::vector<Target> readTargets(const std::string & fileName, const std::string & defaultPassword) {
+
+        std::ifstream file(fileName);
+        if (!file) {
+            throw AppException("could not open target list " + fileName);
+        }
+
+        std::vector<Target> targets;
+        std::string line;
+        size_t lineNo = 0;
+
+        while (std::getline(file, line)) {
+            ++lineNo;
+            if (!line.empty() && line[line.size()-1] == '\r') {
+                line.erase(line.size()-1);
+            }
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+
+            Target target;
+            size_t pos = 0;
+
+            if (line[0] == '[') {
+                size_t end = line.find(']');
+                if (end == std::string::npos) {
+                    std::stringstream error;
+                    error << fileName << ":" << lineNo << ": unterminated IPv6 address";
+                    throw AppException(error.str());
+                }
+                target.host = line.substr(1, end - 1);
+                pos = end + 1;
+            } else {
+                pos = line.find(':');
+                target.host = line.substr(0, pos);
+            }
+
+            if (pos == std::string::npos || pos >= line.size() || line[pos] != ':') {
+                std::stringstream error;
+                error << fileName << ":" << lineNo << ": expected ip:port:password";
+                throw AppException(error.str());
+            }
+
+            size_t portEnd = line.find(':', pos + 1);
+            target.port = line.substr(pos + 1, portEnd == std::string::npos ? std::string::npos : portEnd - pos - 1);
+            target.password = (portEnd == std::string::npos) ? defaultPassword : line.substr(portEnd + 1);
+
+            if (target.host.empty() || target.port.empty()) {
+                std::stringstream error;
+                error << fileName << ":" << lineNo << ": expected ip:port:password";
+                throw AppException(error.str());
+            }
+            targets.push_back(target);
+        }
+        return targets;
+    }
+
+
+    /** Returns the text without leading and trailing blanks */
+    static std::string trim(const std::string & text) {
+        size_t start = text.find_first_not_of(" \t\r");
+        if (start == std::string::npos) {
+            return std::string();
+        }
+        return text.substr(start, text.find_last_not_of(" \t\r") + 1 - start);
+    }
+
+
+    /* Config class */
+
+    Config::Config() :
+        mTimeoutMs(0),
+        mRate(0),
+        mBurst(0)
+    {
+    }
+
+    void Config::load(const std::string & fileName, bool required) {
+        std::ifstream file(fileName);
+        if (!file) {
+            if (required) {
+                throw Exception("could not open config file " + fileName);
+            }
+            *this = Config();
+            return;
+        }
+
+        std::vector<std::string> lines;
+        bool keyed = false;
+        std::string line;
+        while (std::getline(file, line)) {
+            line = trim(line);
+            /* Old files may hold a password with a '=' in it */
+            std::string key = trim(line.substr(0, line.find('=')));
+            if (!line.empty() && line[0] != '#' && (line[0] == '[' ||
+                (line.find('=') != std::string::npos &&
+                 (key == "password" || key == "timeout" || key == "rate" || key == "burst")))) {
+                keyed = true;
+            }
+            lines.push_back(line);
+        }
+
+        /* Parsed aside, so a broken file keeps the config loaded before */
+        Config config;
+        if (!keyed) {
+            for (size_t i = 0; i < lines.size() && config.mPassword.empty(); ++i) {
+                config.mPassword = lines[i];
+            }
+            *this = std::move(config);
+            return;
+        }
+
+        bool inServer = false;
+        for (size_t i = 0; i < lines.size(); ++i) {
+            const std::string & text = lines[i];
+            if (text.empty() || text[0] == '#') {
+                continue;
+            }
+            std::string where = fileName + ":" + std::to_string(i + 1);
+
+            if (text[0] == '[') {
+                if (text[text.size()-1] != ']' || text.compare(1, 7, "server ") != 0) {
+                    throw Exception(where + ": expected [server <name>]");
+                }
+                std::string name = trim(text.substr(8, text.size() - 9));
+                if (name.empty() || name == CONFIG_ALL_SERVERS || name.find_first_of(" \t,") != std::string::npos) {
+                    throw Exception(where + ": invalid server name '" + name + "'");
+                }
+                if (!config.mByName.emplace(name, config.mServers.size()).second) {
+                    throw Exception(where + ": server " + name + " defined twice");
+                }
+                config.mServers.push_back(Target());
+                inServer = true;
+                continue;
+            }
+
+            size_t sep = text.find('=');
+            if (sep == std::string::npos) {
+                throw Exception(where + ": expected <key> = <value>");
+            }
+            config.set(inServer ? &config.mServers.back() : nullptr, trim(text.substr(0, sep)),
+                       trim(text.substr(sep + 1)), where);
+        }
+
+        for (std::unordered_map<std::string, uint32_t>::const_iterator it = config.mByName.begin();
+             it != config.mByName.end(); ++it) {
+            Target & server = config.mServers[it->second];
+            if (server.host.empty() || server.port.empty()) {
+                throw Exception(fileName + ": server " + it->first + " needs a host and a port");
+            }
+            if (server.password.empty()) {
+                server.password = config.mPassword;
+            }
+            if (server.timeoutMs == 0) {
+                server.timeoutMs = config.mTimeoutMs;
+            }
+            if (server.rate == 0) {
+                server.rate = config.mRate;
+            }
+            if (server.burst == 0) {
+                server.burst = config.mBurst;
+            }
+            if (!config.mByKey.emplace(server.key(), it->second).second) {
+                throw Exception(fileName + ": server " + server.key() + " defined twice");
+            }
+        }
+        *this = std::move(config);
+    }
+
+    void Config::set(Target *server, const std::string & key, const std::string & value, const std::string & where) {
+        if (key == "password") {
+            (server != nullptr ? server->password : mPassword) = value;
+            return;
+        }
+
+        if (key == "timeout") {
+            int timeoutMs = atoi(value.c_str());
+            if (timeoutMs <= 0) {
+                throw Exception(where + ": invalid timeout " + value);
+            }
+            (server != nullptr ? server->timeoutMs : mTimeoutMs) = timeoutMs;
+            return;
+        }
+
+        if (key == "rate") {
+            double rate = atof(value.c_str());
+            if (rate <= 0) {
+                throw Exception(where + ": invalid rate " + value);
+            }
+            (server != nullptr ? server->rate : mRate) = rate;
+            return;
+        }
+
+        if (key == "burst") {
+            int burst = atoi(value.c_str());
+            if (burst <= 0) {
+                throw Exception(where + ": invalid burst " + value);
+            }
+            (server != nullptr ? server->burst : mBurst) = burst;
+            return;
+        }
+
+        if (server == nullptr) {
+            throw Exception(where + ": unknown default " + key);
+        }
+
+        if (key == "host") {
+            /* IPv6 addresses may be written in brackets as in the target lists */
+            server->host = (value.size() > 2 && value[0] == '[' && value[value.size()-1] == ']') ?
+                           value.substr(1, value.size() - 2) : value;
+        } else if (key == "port") {
+            server->port = value;
+        } else if (key == "groups") {
+            uint32_t index = server - &mServers[0];
+            std::istringstream names(value);
+            std::string group;
+            while (std::getline(names, group, ' ')) {
+                std::istringstream parts(group);
+                std::string name;
+                while (std::getline(parts, name, ',')) {
+                    name = trim(name);
+                    if (name.empty()) {
+                        continue;
+                    }
+                    if (name == CONFIG_ALL_SERVERS) {
+                        throw Exception(where + ": invalid group name " + name);
+                    }
+                    std::vector<uint32_t> & members = mGroups[name];
+                    if (members.empty() || members.back() != index) {
+                        members.push_back(index);
+                    }
+                }
+            }
+        } else {
+            throw Exception(where + ": unknown key " + key);
+        }
+    }
+
+    const std::string & Config::getPassword() const {
+        return mPassword;
+    }
+
+    size_t Config::getNofServers() const {
+        return mServers.size();
+    }
+
+    std::vector<Target> Config::select(const std::string & names) const {
+        std::vector<bool> selected(mServers.size(), false);
+        std::vector<Target> targets;
+
+        std::istringstream list(names);
+        std::string name;
+        while (std::getline(list, name, ',')) {
+            name = trim(name);
+            std::vector<uint32_t> indices;
+            std::unordered_map<std::string, uint32_t>::const_iterator server = mByName.find(name);
+            std::map<std::string, std::vector<uint32_t> >::const_iterator group = mGroups.find(name);
+            if (name == CONFIG_ALL_SERVERS) {
+                for (uint32_t i = 0; i < mServers.size(); ++i) {
+                    indices.push_back(i);
+                }
+            } else if (server != mByName.end()) {
+                indices.push_back(server->second);
+            } else if (group != mGroups.end()) {
+                indices = group->second;
+            } else {
+                throw Exception("no server or group " + name + " in the config file");
+            }
+
+            for (size_t i = 0; i < indices.size(); ++i) {
+                if (!selected[indices[i]]) {
+                    selected[indices[i]] = true;
+                    targets.push_back(mServers[indices[i]]);
+                }
+            }
+        }
+        return targets;
+    }
+
+    const Target *Config::find(const std::string & key) const {
+        std::unordered_map<std::string, uint32_t>::const_iterator it = mByKey.find(key);
+        return (it != mByKey.end()) ? &mServers[it->second] : nullptr;
+    }
+
+
+    /* ConfigWatcher class */
+
+    ConfigWatcher::ConfigWatcher(Reactor & reactor, const std::string & fileName, const std::function<void()> & callback) :
+        mReactor(reactor),
+        mCallback(callback),
+        mFd(-1)
+    {
+        size_t slash = fileName.rfind('/');
+        std::string directory = (slash == std::string::npos) ? "." : (slash == 0) ? "/" : fileName.substr(0, slash);
+        mName = (slash == std::string::npos) ? fileName : fileName.substr(slash + 1);
+
+        mFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (mFd == -1) {
+            throw Exception(std::string("inotify: ") + strerror(errno));
+        }
+        if (inotify_add_watch(mFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+            int error = errno;
+            close(mFd);
+            mFd = -1;
+            throw Exception("inotify " + directory + ": " + strerror(error));
+        }
+        mReactor.addSocket(mFd, this);
+    }
+
+    ConfigWatcher::~ConfigWatcher() {
+        if (mFd != -1) {
+            mReactor.removeSocket(mFd);
+            close(mFd);
+        }
+    }
+
+    void ConfigWatcher::onReadable() {
+        alignas(struct inotify_event) char buffer[4096];
+        bool changed = false;
+
+        for (;;) {
+            ssize_t length = read(mFd, buffer, sizeof(buffer));
+            if (length == -1 && errno == EINTR) {
+                continue;
+            }
+            if (length <= 0) {
+                break;
+            }
+            for (ssize_t offset = 0; offset < length; ) {
+                const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(buffer + offset);
+                if (event->len > 0 && mName == event->name) {
+                    changed = true;
+                }
+                offset += sizeof(struct inotify_event) + event->len;
+            }
+        }
+
+        if (changed) {
+            mCallback();
+        }
+    }
+}
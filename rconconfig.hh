@@ -0,0 +1,163 @@
+#ifndef __RCONCONFIG_HH__
+#define __RCONCONFIG_HH__
+
+#include "rconreactor.hh"
+#include <sys/types.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <functional>
+
+/** The selection of every server of the config file */
+#define CONFIG_ALL_SERVERS "all"
+
+namespace Rcon {
+
+    /** Target
+      @remarks
+        A single BattlEye RCon server read from a target list file or
+        the config file. The target list file has one target per line in
+        the form ip:port:password. IPv6 addresses are written in brackets,
+        e.g. [::1]:2302:secret. Empty lines and lines starting with '#'
+        are ignored.
+    */
+    struct Target {
+        Target() :
+            timeoutMs(0),
+            rate(0),
+            burst(0)
+        {}
+
+        std::string host;
+        std::string port;
+        std::string password;
+        /** The per-server deadline in milliseconds, 0 for the one of the command line */
+        int timeoutMs;
+        /** The commands per second the server is sent at most, 0 for no limit */
+        double rate;
+        /** The commands sent at once while under the rate, 0 for a single one */
+        size_t burst;
+
+        /** Returns the host:port key identifying this target, IPv6 hosts in brackets */
+        std::string key() const;
+
+        /** Returns the tag used for prefixing the output of this target */
+        std::string tag() const;
+    };
+
+
+    /** Reads a target list file
+      @param
+        fileName The path of the target list file.
+      @param
+        defaultPassword The password to use for targets without one.
+      @return
+        The targets in the order they appear in the file.
+    */
+    std::vector<Target> readTargets(const std::string & fileName, const std::string & defaultPassword);
+
+
+    /** Config class
+      @remarks
+        The servers, groups, passwords and timeouts of the config file,
+        parsed once into a table of targets indexed by name, group and
+        host:port key. The file is made of "key = value" lines, the ones
+        before the first section being the defaults, and a section for
+        every server:
+            password = <default password>
+            timeout = <default deadline in milliseconds>
+            rate = <default commands per second>
+            burst = <default commands sent at once>
+
+            [server <name>]
+            host = <ip address or host name>
+            port = <port>
+            password = <password>
+            timeout = <deadline in milliseconds>
+            rate = <commands per second>
+            burst = <commands sent at once>
+            groups = <group> [<group> ...]
+        Values are taken up to the end of the line, so passwords may
+        contain spaces. Empty lines and lines starting with '#' are
+        ignored. A file without any "key = value" line holds the default
+        password alone on its first line, as rcon.cfg always did.
+    */
+    class Config {
+        public:
+            explicit Config();
+
+            virtual ~Config() {}
+
+            /** Parses the config file, replacing what was loaded before
+              @param
+                fileName The path of the config file.
+              @param
+                required If false a missing file is an empty config.
+            */
+            void load(const std::string & fileName, bool required);
+
+            /** Returns the default password */
+            const std::string & getPassword() const;
+
+            /** Returns the number of servers */
+            size_t getNofServers() const;
+
+            /** Returns the servers of a comma separated list of server and
+                group names, each server once, CONFIG_ALL_SERVERS for all. */
+            std::vector<Target> select(const std::string & names) const;
+
+            /** Returns the server with the host:port key, null if not in the config */
+            const Target *find(const std::string & key) const;
+
+        protected:
+            /** Applies a "key = value" line of a server section, or of the defaults if server is null. */
+            void set(Target *server, const std::string & key, const std::string & value, const std::string & where);
+
+            std::string mPassword;
+            int mTimeoutMs;
+            double mRate;
+            size_t mBurst;
+            std::vector<Target> mServers;
+            std::unordered_map<std::string, uint32_t> mByName;
+            std::unordered_map<std::string, uint32_t> mByKey;
+            /** The servers of every group, in the order of the file */
+            std::map<std::string, std::vector<uint32_t> > mGroups;
+    };
+
+
+    /** ConfigWatcher class
+      @remarks
+        Watches a file with inotify and calls back once the file was
+        rewritten or replaced, as editors and deployment tools do by
+        renaming a new file over it; the directory of the file is watched,
+        so the watch survives the replacement. The events read at the same
+        time are coalesced into a single callback.
+      @param
+        reactor The reactor the inotify descriptor is served by.
+      @param
+        fileName The file to watch.
+      @param
+        callback The callback, on the thread of the reactor.
+    */
+    class ConfigWatcher : public SocketHandler {
+        public:
+            explicit ConfigWatcher(Reactor & reactor, const std::string & fileName, const std::function<void()> & callback);
+
+            virtual ~ConfigWatcher();
+
+            ConfigWatcher(const ConfigWatcher &) = delete;
+            ConfigWatcher & operator=(const ConfigWatcher &) = delete;
+
+            virtual void onReadable();
+
+        protected:
+            Reactor & mReactor;
+            std::string mName;
+            std::function<void()> mCallback;
+            int mFd;
+    };
+}
+
+#endif // __RCONCONFIG_HH__
@@ -0,0 +1,334 @@
+#include "rconcrc.hh"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#ifdef RCON_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+
+namespace Rcon {
+
+    namespace Protocol {
+
+        /* Slice-by-8 backend */
+
+        /** The 8 lookup tables of the reflected polynomial 0xedb88320, built at compile time */
+        struct Slice8Tables {
+            constexpr Slice8Tables() :
+                table()
+            {
+                for (uint32_t n = 0; n < 256; ++n) {
+                    uint32_t c = n;
+                    for (int k = 0; k < 8; ++k) {
+                        c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+                    }
+                    table[0][n] = c;
+                }
+                for (uint32_t n = 0; n < 256; ++n) {
+                    for (int k = 1; k < 8; ++k) {
+                        table[k][n] = (table[k-1][n] >> 8) ^ table[0][table[k-1][n] & 0xff];
+                    }
+                }
+            }
+
+            uint32_t table[8][256];
+        };
+
+        static constexpr Slice8Tables gSlice8;
+
+        static inline uint32_t load32(const uint8_t *p) {
+            return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+        }
+
+        /** Works on the inverted crc register, like the other backend kernels */
+        static uint32_t slice8Kernel(uint32_t c, const uint8_t *data, size_t length) {
+            const uint32_t (*t)[256] = gSlice8.table;
+
+            while (length >= 8) {
+                uint32_t one = c ^ load32(data);
+                uint32_t two = load32(data + 4);
+                c = t[7][one & 0xff] ^ t[6][(one >> 8) & 0xff] ^ t[5][(one >> 16) & 0xff] ^ t[4][one >> 24] ^
+                    t[3][two & 0xff] ^ t[2][(two >> 8) & 0xff] ^ t[1][(two >> 16) & 0xff] ^ t[0][two >> 24];
+                data += 8;
+                length -= 8;
+            }
+            while (length-- > 0) {
+                c = t[0][(c ^ *data++) & 0xff] ^ (c >> 8);
+            }
+            return c;
+        }
+
+        static uint32_t slice8Update(uint32_t crc, const uint8_t *data, size_t length) {
+            return ~slice8Kernel(~crc, data, length);
+        }
+
+
+#if defined(__x86_64__)
+
+        /* PCLMULQDQ backend, folding as in Intel's "Fast CRC Computation for
+           Generic Polynomials Using PCLMULQDQ Instruction" */
+
+        alignas(16) static const uint64_t gK1K2[] = { 0x0154442bd4, 0x01c6e41596 };
+        alignas(16) static const uint64_t gK3K4[] = { 0x01751997d0, 0x00ccaa009e };
+        alignas(16) static const uint64_t gK5K0[] = { 0x0163cd6124, 0x0000000000 };
+        alignas(16) static const uint64_t gPoly[] = { 0x01db710641, 0x01f7011641 };
+
+        /** Folds a multiple of 16 bytes, at least 64, into the inverted crc register */
+        __attribute__((target("pclmul,sse4.1")))
+        static uint32_t pclmulKernel(uint32_t c, const uint8_t *data, size_t length) {
+            __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+            x1 = _mm_loadu_si128((const __m128i *)(data + 0x00));
+            x2 = _mm_loadu_si128((const __m128i *)(data + 0x10));
+            x3 = _mm_loadu_si128((const __m128i *)(data + 0x20));
+            x4 = _mm_loadu_si128((const __m128i *)(data + 0x30));
+            x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(c));
+            x0 = _mm_load_si128((const __m128i *)gK1K2);
+            data += 64;
+            length -= 64;
+
+            /* Fold 4 x 128 bits in parallel */
+            while (length >= 64) {
+                x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+                x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+                x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+                x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+                x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+                x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+                x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+                x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+                y5 = _mm_loadu_si128((const __m128i *)(data + 0x00));
+                y6 = _mm_loadu_si128((const __m128i *)(data + 0x10));
+                y7 = _mm_loadu_si128((const __m128i *)(data + 0x20));
+                y8 = _mm_loadu_si128((const __m128i *)(data + 0x30));
+
+                x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+                x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+                x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+                x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+                data += 64;
+                length -= 64;
+            }
+
+            /* Fold into 128 bits */
+            x0 = _mm_load_si128((const __m128i *)gK3K4);
+
+            x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+            x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+            x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+            x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+            x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+            x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+            /* Fold the remaining 128 bit blocks */
+            while (length >= 16) {
+                x2 = _mm_loadu_si128((const __m128i *)data);
+
+                x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+                x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+                x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+                data += 16;
+                length -= 16;
+            }
+
+            /* Fold 128 bits to 64 bits */
+            x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+            x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+            x1 = _mm_srli_si128(x1, 8);
+            x1 = _mm_xor_si128(x1, x2);
+
+            x0 = _mm_loadl_epi64((const __m128i *)gK5K0);
+
+            x2 = _mm_srli_si128(x1, 4);
+            x1 = _mm_and_si128(x1, x3);
+            x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+            x1 = _mm_xor_si128(x1, x2);
+
+            /* Barrett reduction to 32 bits */
+            x0 = _mm_load_si128((const __m128i *)gPoly);
+
+            x2 = _mm_and_si128(x1, x3);
+            x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+            x2 = _mm_and_si128(x2, x3);
+            x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+            x1 = _mm_xor_si128(x1, x2);
+
+            return _mm_extract_epi32(x1, 1);
+        }
+
+        static uint32_t pclmulUpdate(uint32_t crc, const uint8_t *data, size_t length) {
+            uint32_t c = ~crc;
+            if (length >= 64) {
+                size_t folded = length & ~(size_t)15;
+                c = pclmulKernel(c, data, folded);
+                data += folded;
+                length -= folded;
+            }
+            return ~slice8Kernel(c, data, length);
+        }
+
+        static bool hasPclmul() {
+            return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+        }
+
+#elif defined(__aarch64__)
+
+        /* ARMv8 CRC32 instruction backend */
+
+        __attribute__((target("+crc")))
+        static uint32_t armv8Update(uint32_t crc, const uint8_t *data, size_t length) {
+            uint32_t c = ~crc;
+            while (length >= 8) {
+                uint64_t word = (uint64_t)load32(data) | ((uint64_t)load32(data + 4) << 32);
+                c = __crc32d(c, word);
+                data += 8;
+                length -= 8;
+            }
+            while (length-- > 0) {
+                c = __crc32b(c, *data++);
+            }
+            return ~c;
+        }
+
+        static bool hasArmv8Crc() {
+            return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+        }
+
+#endif
+
+
+#ifdef RCON_WITH_ZLIB
+
+        /* zlib backend */
+
+        static uint32_t zlibUpdate(uint32_t crc, const uint8_t *data, size_t length) {
+            while (length > 0) {
+                uInt chunk = (length > 0x40000000) ? 0x40000000 : (uInt)length;
+                crc = crc32(crc, data, chunk);
+                data += chunk;
+                length -= chunk;
+            }
+            return crc;
+        }
+
+#endif
+
+
+        /* Crc32 class */
+
+        /* Every thread selects the same backend, relaxed ordering is all it takes */
+        std::atomic<Crc32::UpdateFunc> Crc32::sUpdate(&Crc32::autoUpdate);
+        std::atomic<Crc32::Backend> Crc32::sBackend(Crc32::CRC_AUTO);
+
+        uint32_t Crc32::calculate(const uint8_t *data, size_t length) {
+            return sUpdate.load(std::memory_order_relaxed)(0, data, length);
+        }
+
+        uint32_t Crc32::update(uint32_t crc, const uint8_t *data, size_t length) {
+            return sUpdate.load(std::memory_order_relaxed)(crc, data, length);
+        }
+
+        uint32_t Crc32::autoUpdate(uint32_t crc, const uint8_t *data, size_t length) {
+            select(CRC_AUTO);
+            return sUpdate.load(std::memory_order_relaxed)(crc, data, length);
+        }
+
+        bool Crc32::isAvailable(Backend backend) {
+            switch (backend) {
+                case CRC_AUTO:
+                case CRC_SLICE8:
+                    return true;
+#if defined(__x86_64__)
+                case CRC_PCLMUL:
+                    return hasPclmul();
+#elif defined(__aarch64__)
+                case CRC_ARMV8:
+                    return hasArmv8Crc();
+#endif
+#ifdef RCON_WITH_ZLIB
+                case CRC_ZLIB:
+                    return true;
+#endif
+                default:
+                    return false;
+            }
+        }
+
+        bool Crc32::select(Backend backend) {
+            if (backend == CRC_AUTO) {
+                if (isAvailable(CRC_PCLMUL)) {
+                    backend = CRC_PCLMUL;
+                } else if (isAvailable(CRC_ARMV8)) {
+                    backend = CRC_ARMV8;
+                } else {
+                    backend = CRC_SLICE8;
+                }
+            }
+            if (!isAvailable(backend)) {
+                return false;
+            }
+
+            switch (backend) {
+#if defined(__x86_64__)
+                case CRC_PCLMUL:
+                    sUpdate.store(&pclmulUpdate, std::memory_order_relaxed);
+                    break;
+#elif defined(__aarch64__)
+                case CRC_ARMV8:
+                    sUpdate.store(&armv8Update, std::memory_order_relaxed);
+                    break;
+#endif
+#ifdef RCON_WITH_ZLIB
+                case CRC_ZLIB:
+                    sUpdate.store(&zlibUpdate, std::memory_order_relaxed);
+                    break;
+#endif
+                default:
+                    sUpdate.store(&slice8Update, std::memory_order_relaxed);
+                    break;
+            }
+            sBackend.store(backend, std::memory_order_relaxed);
+            return true;
+        }
+
+        Crc32::Backend Crc32::getBackend() {
+            if (sBackend.load(std::memory_order_relaxed) == CRC_AUTO) {
+                select(CRC_AUTO);
+            }
+            return sBackend.load(std::memory_order_relaxed);
+        }
+
+        const char *Crc32::getName(Backend backend) {
+            switch (backend) {
+                case CRC_AUTO:
+                    return "auto";
+                case CRC_SLICE8:
+                    return "slice-by-8";
+                case CRC_PCLMUL:
+                    return "pclmulqdq";
+                case CRC_ARMV8:
+                    return "armv8-crc";
+                case CRC_ZLIB:
+                    return "zlib";
+                default:
+                    return "unknown";
+            }
+        }
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef __RCONCRC_HH__
+#define __RCONCRC_HH__
+
+#include <sys/types.h>
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+namespace Rcon {
+
+    namespace Protocol {
+
+        /** CRC32 class
+          @remarks
+            The CRC32 (IEEE 802.3, as computed by zlib's crc32()) of the
+            BattlEye packets, with pluggable backends. By default the fastest
+            backend available on the CPU is picked at the first use: carry-less
+            multiplication folding (PCLMULQDQ) on x86-64, the CRC32 instructions
+            on ARMv8, and slice-by-8 tables everywhere else. The zlib backend
+            is only built with RCON_WITH_ZLIB. All backends give bit-identical
+            results. The selection is atomic, so sessions on several threads
+            may race for the first use.
+        */
+        class Crc32 {
+            public:
+                enum Backend {
+                    CRC_AUTO,
+                    CRC_SLICE8,
+                    CRC_PCLMUL,
+                    CRC_ARMV8,
+                    CRC_ZLIB,
+                    CRC_NOF_BACKENDS
+                };
+
+                /** Returns the CRC32 of the data. */
+                static uint32_t calculate(const uint8_t *data, size_t length);
+
+                /** Continues a CRC32 over more data, like zlib's crc32()
+                  @param
+                    crc The CRC32 of the data before, 0 to start.
+                  @param
+                    data The data to add.
+                  @param
+                    length The length of the data in bytes.
+                  @return
+                    The CRC32 of all data so far.
+                */
+                static uint32_t update(uint32_t crc, const uint8_t *data, size_t length);
+
+                /** Selects the backend used by calculate() and update()
+                  @param
+                    backend The backend, CRC_AUTO for the fastest one available.
+                  @return
+                    false if the backend is not available on this CPU or build.
+                */
+                static bool select(Backend backend);
+
+                /** Returns true if the backend is available on this CPU and build */
+                static bool isAvailable(Backend backend);
+
+                /** Returns the selected backend, never CRC_AUTO */
+                static Backend getBackend();
+
+                /** Returns the name of a backend */
+                static const char *getName(Backend backend);
+
+            private:
+                typedef uint32_t (*UpdateFunc)(uint32_t crc, const uint8_t *data, size_t length);
+
+                /** Selects the fastest backend on the first call and continues with it */
+                static uint32_t autoUpdate(uint32_t crc, const uint8_t *data, size_t length);
+
+                static std::atomic<UpdateFunc> sUpdate;
+                static std::atomic<Backend> sBackend;
+        };
+    }
+}
+
+#endif // __RCONCRC_HH__
@@ -0,0 +1,1022 @@
+#include "rcondaemon.hh"
+#include "rconmsg.hh"
+#include "rconexception.hh"
+#include "rconcapture.hh"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <sstream>
+#include <algorithm>
+#include <cctype>
+
+
+namespace Rcon {
+
+    using namespace Protocol;
+
+    /* DaemonSession class */
+
+    DaemonSession::DaemonSession(Daemon & daemon, Reactor & reactor, Resolver & resolver, const Target & target) :
+        mDaemon(daemon),
+        mReactor(reactor),
+        mResolver(resolver),
+        mTarget(target),
+        mChannel(reactor, *this),
+        mState(SESSION_DOWN),
+        mCacheGeneration(0),
+        mLoginAttempt(0),
+        mReconnectAttempt(0),
+        mWasUp(false),
+        mStopped(false),
+        mProbing(false),
+        mNextTag(1),
+        mRandom(std::random_device()()),
+        mResolveRequest(0),
+        mLoginTimer(0),
+        mKeepaliveTimer(0),
+        mRestartTimer(0),
+        mQueuedTimer(0)
+    {
+        mChannel.setMetrics(&mMetrics);
+        mChannel.setBatchSize(CHANNEL_BATCH_SIZE);
+    }
+
+    DaemonSession::~DaemonSession() {
+        cancelTimers();
+        mReactor.cancelTimer(mQueuedTimer);
+    }
+
+    void DaemonSession::setCapture(CaptureLog *capture) {
+        mChannel.setCapture(capture, (capture != nullptr) ? capture->addServer(mTarget.key()) : 0);
+    }
+
+    void DaemonSession::cancelTimers() {
+        mReactor.cancelTimer(mLoginTimer);
+        mReactor.cancelTimer(mKeepaliveTimer);
+        mReactor.cancelTimer(mRestartTimer);
+        mLoginTimer = mKeepaliveTimer = mRestartTimer = 0;
+        mResolver.cancel(mResolveRequest);
+        mResolveRequest = 0;
+    }
+
+    void DaemonSession::start() {
+        mState = SESSION_LOGIN;
+        mServerWindow.reset();
+        mLoginAttempt = 0;
+        mLoginDeadline = Reactor::Clock::now() + std::chrono::milliseconds(getTimeout());
+        if (mChannel.isOpen()) {
+            /* The warm socket of the lost session */
+            login();
+            return;
+        }
+        mResolveRequest = mResolver.resolve(mTarget.host, mTarget.port,
+                                            [this](const std::vector<Address> & addresses, const std::string & error) {
+            mResolveRequest = 0;
+            if (!error.empty()) {
+                scheduleRestart(SocketException(error).what());
+                return;
+            }
+            try {
+                mChannel.open(addresses);
+            } catch (Exception & e) {
+                scheduleRestart(e.what());
+                return;
+            }
+            login();
+        });
+    }
+
+    void DaemonSession::login() {
+        mLoginSent = Reactor::Clock::now();
+        try {
+            sendLogin();
+        } catch (Exception & e) {
+            scheduleRestart(e.what());
+        }
+    }
+
+    void DaemonSession::sendLogin() {
+        Login login(mTarget.password);
+        mChannel.send(login);
+        mLoginTimer = mReactor.addTimer(mChannel.getRtt().getTimeout(mLoginAttempt, mLoginDeadline), [this]() {
+            mLoginTimer = 0;
+            loginTimeout();
+        });
+    }
+
+    void DaemonSession::loginTimeout() {
+        ++mMetrics.timeouts;
+        if (RCON_TRACING(timeout)) {
+            Trace::timeout(mChannel.getTraceId(), -1, mLoginAttempt);
+        }
+        if (Reactor::Clock::now() >= mLoginDeadline) {
+            scheduleRestart("login timed out");
+            return;
+        }
+        ++mLoginAttempt;
+        try {
+            sendLogin();
+        } catch (Exception & e) {
+            scheduleRestart(e.what());
+        }
+    }
+
+    void DaemonSession::scheduleRestart(const std::string & reason) {
+        if (mState == SESSION_DOWN) {
+            return;
+        }
+        /* Never tear down the pipeline from within one of its own callbacks */
+        mState = SESSION_DOWN;
+        cancelTimers();
+        mRestartTimer = mReactor.addTimer(0, [this, reason]() {
+            mRestartTimer = 0;
+            restart(reason);
+        });
+    }
+
+    void DaemonSession::restart(const std::string & reason) {
+        cancelTimers();
+        mProbing = false;
+        /* The server may have restarted as well */
+        mCache.clear();
+        ++mCacheGeneration;
+
+        /* The commands not sent yet are replayed, the ones sent may have been executed */
+        std::deque<Pipeline::Submission> unsent;
+        if (mPipeline) {
+            unsent = mPipeline->takeQueued();
+            mPipeline.reset();
+        }
+        Reactor::Clock::time_point deadline = Reactor::Clock::now() + std::chrono::milliseconds(getTimeout());
+        for (size_t i = unsent.size(); i > 0; --i) {
+            std::unordered_map<uint64_t, Waiter>::iterator it = mWaiting.find(unsent[i - 1].tag);
+            if (it == mWaiting.end()) {
+                continue;
+            }
+            if (it->second.clientId != 0) {
+                Queued queued;
+                queued.waiter = it->second;
+                queued.cmd = unsent[i - 1].command;
+                queued.deadline = deadline;
+                mQueued.push_front(queued);
+            }
+            mWaiting.erase(it);
+        }
+        for (std::unordered_map<uint64_t, Waiter>::const_iterator it = mWaiting.begin(); it != mWaiting.end(); ++it) {
+            if (it->second.clientId != 0) {
+                mDaemon.reply(it->second.clientId, it->second.slot, false, "session lost: " + reason);
+            }
+        }
+        mWaiting.clear();
+        armQueued();
+
+        /* A socket which keeps failing may point to a server which moved */
+        ++mReconnectAttempt;
+        if (mReconnectAttempt % DAEMON_RERESOLVE_ATTEMPTS == 0) {
+            mChannel.close();
+        }
+
+        /* Jittered, so the sessions of a fleet lost at once do not reconnect in lockstep */
+        int delayMs = DAEMON_RECONNECT_MAX_MS;
+        if (mReconnectAttempt <= 16) {
+            delayMs = std::min(DAEMON_RECONNECT_MIN_MS << (mReconnectAttempt - 1), DAEMON_RECONNECT_MAX_MS);
+        }
+        delayMs = std::uniform_int_distribution<int>(delayMs / 2, delayMs)(mRandom);
+
+        std::stringstream text;
+        text << "session down: " << reason << ", reconnecting in " << delayMs << " ms";
+        mDaemon.log(mTarget, text.str());
+
+        mRestartTimer = mReactor.addTimer(delayMs, [this]() {
+            mRestartTimer = 0;
+            start();
+        });
+    }
+
+    void DaemonSession::shutdown(const std::string & reason) {
+        cancelTimers();
+        mReactor.cancelTimer(mQueuedTimer);
+        mQueuedTimer = 0;
+        mChannel.close();
+        mPipeline.reset();
+        mState = SESSION_DOWN;
+
+        for (std::unordered_map<uint64_t, Waiter>::const_iterator it = mWaiting.begin(); it != mWaiting.end(); ++it) {
+            if (it->second.clientId != 0) {
+                mDaemon.reply(it->second.clientId, it->second.slot, false, "session lost: " + reason);
+            }
+        }
+        mWaiting.clear();
+        while (!mQueued.empty()) {
+            Queued queued = mQueued.front();
+            mQueued.pop_front();
+            mDaemon.reply(queued.waiter.clientId, queued.waiter.slot, false, "session lost: " + reason);
+        }
+    }
+
+    void DaemonSession::stop() {
+        mStopped = true;
+        mDaemon.log(mTarget, "session removed from the config");
+        shutdown("server removed");
+    }
+
+    void DaemonSession::update(const Target & target) {
+        /* Only what the front end never reads, so the target is not shared */
+        mTarget.password = target.password;
+        mTarget.timeoutMs = target.timeoutMs;
+        mTarget.rate = target.rate;
+        mTarget.burst = target.burst;
+    }
+
+    int DaemonSession::getTimeout() const {
+        return (mTarget.timeoutMs > 0) ? mTarget.timeoutMs : mDaemon.getTimeout();
+    }
+
+    void DaemonSession::armQueued() {
+        if (mQueuedTimer != 0 || mQueued.empty()) {
+            return;
+        }
+        Reactor::Clock::duration left = mQueued.front().deadline - Reactor::Clock::now();
+        int delayMs = (int)std::chrono::duration_cast<std::chrono::milliseconds>(left).count();
+        mQueuedTimer = mReactor.addTimer(delayMs > 0 ? delayMs + 1 : 0, [this]() {
+            mQueuedTimer = 0;
+            expireQueued();
+        });
+    }
+
+    void DaemonSession::expireQueued() {
+        Reactor::Clock::time_point now = Reactor::Clock::now();
+        while (!mQueued.empty() && mQueued.front().deadline <= now) {
+            Queued queued = mQueued.front();
+            mQueued.pop_front();
+            mDaemon.reply(queued.waiter.clientId, queued.waiter.slot, false, "server not connected");
+        }
+        armQueued();
+    }
+
+    void DaemonSession::replayQueued() {
+        mReactor.cancelTimer(mQueuedTimer);
+        mQueuedTimer = 0;
+        while (!mQueued.empty() && mState == SESSION_READY) {
+            Queued queued = mQueued.front();
+            mQueued.pop_front();
+            ++mMetrics.replayed;
+            submit(queued.waiter.clientId, queued.waiter.slot, queued.cmd);
+        }
+    }
+
+    void DaemonSession::submit(uint64_t clientId, size_t slot, const std::string & cmd) {
+        if (mState != SESSION_READY) {
+            if (clientId == 0) {
+                return;
+            }
+            if (mStopped || mQueued.size() >= DAEMON_REPLAY_LIMIT) {
+                mDaemon.reply(clientId, slot, false, "server not connected");
+                return;
+            }
+            Queued queued;
+            queued.waiter.clientId = clientId;
+            queued.waiter.slot = slot;
+            queued.waiter.generation = 0;
+            queued.cmd = cmd;
+            queued.deadline = Reactor::Clock::now() + std::chrono::milliseconds(getTimeout());
+            mQueued.push_back(queued);
+            armQueued();
+            return;
+        }
+        if (clientId == 0) {
+            mProbing = true;
+        } else if (replyCached(clientId, slot, cmd)) {
+            return;
+        } else {
+            invalidate(cmd);
+        }
+
+        Waiter waiter;
+        waiter.clientId = clientId;
+        waiter.slot = slot;
+        waiter.generation = mCacheGeneration;
+        uint64_t tag = mNextTag++;
+        mWaiting[tag] = waiter;
+        mLastSend = Reactor::Clock::now();
+
+        try {
+            mPipeline->submit(cmd, tag, Pipeline::priorityOf(cmd));
+        } catch (Exception & e) {
+            scheduleRestart(e.what());
+        }
+    }
+
+    bool DaemonSession::isReady() const {
+        return mState == SESSION_READY;
+    }
+
+    const Target & DaemonSession::getTarget() const {
+        return mTarget;
+    }
+
+    const Metrics & DaemonSession::getMetrics() const {
+        return mMetrics;
+    }
+
+    void DaemonSession::armKeepalive() {
+        Reactor::Clock::duration idle = Reactor::Clock::now() - mLastSend;
+        int delay = KEEPALIVE_INTERVAL_MS - (int)std::chrono::duration_cast<std::chrono::milliseconds>(idle).count();
+        mKeepaliveTimer = mReactor.addTimer(delay > 0 ? delay : 0, [this]() {
+            mKeepaliveTimer = 0;
+            keepalive();
+        });
+    }
+
+    void DaemonSession::keepalive() {
+        if (mState != SESSION_READY) {
+            return;
+        }
+        Reactor::Clock::duration idle = Reactor::Clock::now() - mLastSend;
+        if (idle >= std::chrono::milliseconds(KEEPALIVE_INTERVAL_MS) && !mProbing) {
+            /* BattlEye answers the empty command with an empty response */
+            submit(0, 0, std::string());
+        }
+        if (mState == SESSION_READY) {
+            armKeepalive();
+        }
+    }
+
+    void DaemonSession::onResult(const Pipeline::Result & result) {
+        std::unordered_map<uint64_t, Waiter>::iterator it = mWaiting.find(result.tag);
+        if (it == mWaiting.end()) {
+            return;
+        }
+        Waiter waiter = it->second;
+        mWaiting.erase(it);
+
+        if (waiter.clientId == 0) {
+            mProbing = false;
+            if (!result.ok) {
+                scheduleRestart("keepalive not answered");
+            }
+            return;
+        }
+        mDaemon.reply(waiter.clientId, waiter.slot, result.ok, result.ok ? result.output : result.error);
+
+        if (result.ok && mDaemon.getCacheTtl() > 0 && waiter.generation == mCacheGeneration &&
+            Pipeline::isReadOnly(result.command)) {
+            CacheEntry & entry = mCache[result.command];
+            entry.output = result.output;
+            entry.expires = Reactor::Clock::now() + std::chrono::milliseconds(mDaemon.getCacheTtl());
+        }
+
+        /* A command unanswered until its deadline may be the first sign of a dead server */
+        if (!result.ok && !mProbing && mState == SESSION_READY) {
+            submit(0, 0, std::string());
+        }
+    }
+
+    bool DaemonSession::replyCached(uint64_t clientId, size_t slot, const std::string & cmd) {
+        if (mDaemon.getCacheTtl() <= 0 || !Pipeline::isReadOnly(cmd)) {
+            return false;
+        }
+        std::unordered_map<std::string, CacheEntry>::iterator it = mCache.find(cmd);
+        if (it == mCache.end()) {
+            return false;
+        }
+        if (it->second.expires <= Reactor::Clock::now()) {
+            mCache.erase(it);
+            return false;
+        }
+        ++mMetrics.cacheHits;
+        mDaemon.reply(clientId, slot, true, it->second.output);
+        return true;
+    }
+
+    void DaemonSession::invalidate(const std::string & cmd) {
+        if (Pipeline::isReadOnly(cmd)) {
+            return;
+        }
+        std::string name = cmd.substr(0, cmd.find(' '));
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+        if (name == "say") {
+            return;
+        }
+
+        ++mCacheGeneration;
+        if (name == "kick") {
+            mCache.erase("players");
+        } else if (name == "addban" || name == "removeban" || name == "loadbans") {
+            mCache.erase("bans");
+        } else if (name == "ban") {
+            /* Bans the player by number, which also kicks the player */
+            mCache.erase("players");
+            mCache.erase("bans");
+        } else {
+            /* Nothing is known about the others */
+            mCache.clear();
+        }
+    }
+
+    void DaemonSession::handleView(Channel & channel, const MessageView & view) {
+        try {
+            switch (view.type) {
+
+                case Message::MSG_SRV_MSG:
+                    {
+                        ServerAck ack(view.seqNum);
+                        channel.queue(ack);
+                    }
+                    ++mMetrics.serverMessages;
+                    if (mServerWindow.check(view.seqNum) != SequenceWindow::SEQ_DUPLICATE) {
+                        mDaemon.log(mTarget, view.payload);
+                    } else {
+                        ++mMetrics.duplicates;
+                    }
+                    break;
+
+                case Message::MSG_LOGIN_RESP:
+                    if (mState != SESSION_LOGIN) {
+                        break;
+                    }
+                    mReactor.cancelTimer(mLoginTimer);
+                    mLoginTimer = 0;
+                    mMetrics.loginRtt.recordSince(mLoginSent);
+                    if (mLoginAttempt == 0) {
+                        mChannel.getRtt().sampleSince(mLoginSent);
+                    }
+                    if (view.result == 0) {
+                        scheduleRestart("Wrong RCON password!");
+                        break;
+                    }
+                    mPipeline.reset(new Pipeline(mReactor, mChannel, DAEMON_WINDOW,
+                        [this](const Pipeline::Result & result) { onResult(result); }));
+                    mPipeline->setDeadline(getTimeout());
+                    mPipeline->setRate(mTarget.rate, mTarget.burst);
+                    mPipeline->setCoalescing(true);
+                    mState = SESSION_READY;
+                    mLastSend = Reactor::Clock::now();
+                    armKeepalive();
+                    if (mWasUp) {
+                        ++mMetrics.reconnects;
+                    }
+                    mWasUp = true;
+                    mReconnectAttempt = 0;
+                    if (mQueued.empty()) {
+                        mDaemon.log(mTarget, "session up");
+                    } else {
+                        std::stringstream text;
+                        text << "session up, replaying " << mQueued.size() << " commands";
+                        mDaemon.log(mTarget, text.str());
+                        replayQueued();
+                    }
+                    break;
+
+                default:
+                    if (mState == SESSION_READY) {
+                        mPipeline->handleView(view);
+                    }
+                    break;
+            }
+        } catch (Exception & e) {
+            scheduleRestart(e.what());
+        }
+    }
+
+    void DaemonSession::handleError(Channel &, const Exception & e) {
+        scheduleRestart(e.what());
+    }
+
+
+    /* DaemonClient class */
+
+    DaemonClient::DaemonClient(Daemon & daemon, int fd, uint64_t id) :
+        mDaemon(daemon),
+        mFd(fd),
+        mId(id),
+        mFirstSlot(0),
+        mEof(false),
+        mWatching(false)
+    {
+        mDaemon.getReactor().addSocket(mFd, this);
+    }
+
+    DaemonClient::~DaemonClient() {
+        mDaemon.getReactor().removeSocket(mFd);
+        close(mFd);
+    }
+
+    void DaemonClient::onReadable() {
+        char buf[BUF_SIZE];
+
+        while (!mEof) {
+            ssize_t nread = recv(mFd, buf, sizeof(buf), 0);
+            if (nread == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    mDaemon.closeClient(mId);
+                }
+                break;
+            }
+            if (nread == 0) {
+                /* The client is done sending, answer what is pending */
+                mDaemon.getReactor().watchReadable(mFd, false);
+                mEof = true;
+                break;
+            }
+            mIn.append(buf, nread);
+        }
+
+        size_t pos = 0;
+        size_t end;
+        while ((end = mIn.find('\n', pos)) != std::string::npos) {
+            std::string line = mIn.substr(pos, end - pos);
+            pos = end + 1;
+            if (!line.empty() && line[line.size()-1] == '\r') {
+                line.erase(line.size()-1);
+            }
+            size_t slot = mFirstSlot + mResponses.size();
+            mResponses.push_back(Response());
+            mDaemon.dispatch(mId, slot, line);
+        }
+        mIn.erase(0, pos);
+
+        if (mIn.size() > BUF_SIZE) {
+            mDaemon.closeClient(mId);
+            return;
+        }
+        flush();
+    }
+
+    void DaemonClient::onWritable() {
+        flush();
+    }
+
+    void DaemonClient::reply(size_t slot, bool ok, const std::string & text) {
+        if (slot < mFirstSlot || slot - mFirstSlot >= mResponses.size()) {
+            return;
+        }
+
+        Response & response = mResponses[slot - mFirstSlot];
+        std::stringstream data;
+        if (ok) {
+            data << "OK " << text.size() << "\n" << text;
+        } else {
+            std::string error(text);
+            for (size_t i = 0; i < error.size(); ++i) {
+                if (error[i] == '\n' || error[i] == '\r') {
+                    error[i] = ' ';
+                }
+            }
+            data << "ERR " << error << "\n";
+        }
+        response.data = data.str();
+        response.done = true;
+
+        while (!mResponses.empty() && mResponses.front().done) {
+            mOut += mResponses.front().data;
+            mResponses.pop_front();
+            ++mFirstSlot;
+        }
+        flush();
+    }
+
+    void DaemonClient::flush() {
+        while (!mOut.empty()) {
+            ssize_t nwritten = send(mFd, mOut.data(), mOut.size(), MSG_NOSIGNAL);
+            if (nwritten == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    if (!mWatching) {
+                        mDaemon.getReactor().watchWritable(mFd, true);
+                        mWatching = true;
+                    }
+                    return;
+                }
+                mDaemon.closeClient(mId);
+                return;
+            }
+            mOut.erase(0, nwritten);
+        }
+
+        if (mWatching) {
+            mDaemon.getReactor().watchWritable(mFd, false);
+            mWatching = false;
+        }
+
+        if (mEof && mResponses.empty()) {
+            mDaemon.closeClient(mId);
+        }
+    }
+
+
+    /* Daemon class */
+
+    Daemon::Daemon(const std::vector<Target> & targets, const std::string & socketPath,
+                   int timeoutMs, std::ostream *log, const std::string & metricsAddress,
+                   size_t nofWorkers) :
+        mReactor(Reactor::create()),
+        mSnapshotTimer(0),
+        mSocketPath(socketPath),
+        mMetricsAddress(metricsAddress),
+        mListenFd(-1),
+        mTimeoutMs(timeoutMs),
+        mCacheTtlMs(DAEMON_CACHE_TTL_MS),
+        mNextClientId(1),
+        mLog(log),
+        mCapture(nullptr)
+    {
+        if (nofWorkers > 0) {
+            mInbox.reset(new WorkQueue(*mReactor));
+        }
+        for (size_t i = 0; i < nofWorkers; ++i) {
+            mWorkers.push_back(std::unique_ptr<Worker>(new Worker()));
+            mResolvers.push_back(std::unique_ptr<Resolver>(new Resolver(mWorkers[i]->getReactor())));
+        }
+        if (mWorkers.empty()) {
+            mResolvers.push_back(std::unique_ptr<Resolver>(new Resolver(*mReactor)));
+        }
+
+        for (size_t i = 0; i < targets.size(); ++i) {
+            addSession(targets[i]);
+        }
+    }
+
+    void Daemon::addSession(const Target & target) {
+        size_t index = mSessions.size();
+        Worker *worker = mWorkers.empty() ? nullptr : mWorkers[index % mWorkers.size()].get();
+        DaemonSession *session = new DaemonSession(*this, worker ? worker->getReactor() : *mReactor,
+                                                   *mResolvers[index % mResolvers.size()], target);
+        session->setCapture(mCapture);
+        mSessions.push_back(std::unique_ptr<DaemonSession>(session));
+        mSessionWorkers.push_back(worker);
+        mSessionsByKey[target.key()] = index;
+        mSnapshots.resize(mSessions.size());
+    }
+
+    void Daemon::startSession(size_t index) {
+        DaemonSession *session = mSessions[index].get();
+        if (mSessionWorkers[index] != nullptr) {
+            mSessionWorkers[index]->post([session]() { session->start(); });
+        } else {
+            session->start();
+        }
+    }
+
+    void Daemon::reload(const std::vector<Target> & targets) {
+        std::map<std::string, const Target *> wanted;
+        for (size_t i = 0; i < targets.size(); ++i) {
+            wanted[targets[i].key()] = &targets[i];
+        }
+
+        size_t nofAdded = 0;
+        size_t nofRemoved = 0;
+        for (std::map<std::string, size_t>::iterator it = mSessionsByKey.begin(); it != mSessionsByKey.end(); ) {
+            size_t index = it->second;
+            Worker *worker = mSessionWorkers[index];
+            std::map<std::string, const Target *>::const_iterator target = wanted.find(it->first);
+
+            if (target != wanted.end()) {
+                DaemonSession *session = mSessions[index].get();
+                Target changed = *target->second;
+                if (worker != nullptr) {
+                    worker->post([session, changed]() { session->update(changed); });
+                } else {
+                    session->update(changed);
+                }
+                ++it;
+                continue;
+            }
+
+            /* Sessions live on the thread of their reactor, so they end there too; the tasks
+               posted to the session before are run first, its slot is never reused */
+            DaemonSession *session = mSessions[index].release();
+            if (worker != nullptr) {
+                worker->post([session]() {
+                    session->stop();
+                    delete session;
+                });
+            } else {
+                session->stop();
+                delete session;
+            }
+            mSessionsByKey.erase(it++);
+            ++nofRemoved;
+        }
+
+        for (size_t i = 0; i < targets.size(); ++i) {
+            if (mSessionsByKey.find(targets[i].key()) == mSessionsByKey.end()) {
+                addSession(targets[i]);
+                startSession(mSessions.size() - 1);
+                ++nofAdded;
+            }
+        }
+
+        if (mLog != nullptr) {
+            *mLog << "config reloaded: " << mSessionsByKey.size() << " servers, " << nofAdded << " added, "
+                  << nofRemoved << " removed" << std::endl;
+        }
+    }
+
+    Daemon::~Daemon() {
+        /* The sessions are torn down on this thread once their workers are gone */
+        for (size_t i = 0; i < mWorkers.size(); ++i) {
+            mWorkers[i]->stop();
+        }
+        mReactor->cancelTimer(mSnapshotTimer);
+        mMetricsEndpoint.reset();
+        mClients.clear();
+        mSessions.clear();
+        mResolvers.clear();
+        mWorkers.clear();
+        if (mListenFd != -1) {
+            mReactor->removeSocket(mListenFd);
+            close(mListenFd);
+            unlink(mSocketPath.c_str());
+        }
+    }
+
+    Reactor & Daemon::getReactor() {
+        return *mReactor;
+    }
+
+    int Daemon::getTimeout() const {
+        return mTimeoutMs;
+    }
+
+    void Daemon::setCapture(CaptureLog *capture) {
+        mCapture = capture;
+        for (size_t i = 0; i < mSessions.size(); ++i) {
+            mSessions[i]->setCapture(capture);
+        }
+    }
+
+    void Daemon::setCacheTtl(int ttlMs) {
+        mCacheTtlMs = ttlMs;
+    }
+
+    int Daemon::getCacheTtl() const {
+        return mCacheTtlMs;
+    }
+
+    void Daemon::run() {
+
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (mSocketPath.size() >= sizeof(addr.sun_path)) {
+            throw SocketException("socket path too long: " + mSocketPath);
+        }
+        strncpy(addr.sun_path, mSocketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+        /* Remove a stale socket of an earlier daemon */
+        struct stat st;
+        if (stat(mSocketPath.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+            unlink(mSocketPath.c_str());
+        }
+
+        mListenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (mListenFd == -1) {
+            throw SocketException(std::string("socket: ") + strerror(errno));
+        }
+        if (bind(mListenFd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(mListenFd, 64) == -1) {
+            std::string error = std::string("bind/listen ") + mSocketPath + ": " + strerror(errno);
+            close(mListenFd);
+            mListenFd = -1;
+            throw SocketException(error);
+        }
+        mReactor->addSocket(mListenFd, this);
+
+        if (!mMetricsAddress.empty()) {
+            mMetricsEndpoint.reset(new MetricsEndpoint(*mReactor, [this](std::ostream & out) { writeMetrics(out); }));
+            mMetricsEndpoint->open(mMetricsAddress);
+        }
+
+        Reactor::catchStopSignals();
+
+        for (size_t i = 0; i < mWorkers.size(); ++i) {
+            mWorkers[i]->start();
+        }
+        for (size_t i = 0; i < mSessions.size(); ++i) {
+            startSession(i);
+        }
+        if (!mWorkers.empty()) {
+            requestSnapshots();
+        }
+
+        while (!Reactor::isStopSignalled()) {
+            mReactor->runOnce();
+
+            for (size_t i = 0; i < mClosed.size(); ++i) {
+                mClients.erase(mClosed[i]);
+            }
+            mClosed.clear();
+        }
+    }
+
+    void Daemon::onReadable() {
+        for (;;) {
+            int fd = accept4(mListenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            uint64_t id = mNextClientId++;
+            mClients[id] = std::unique_ptr<DaemonClient>(new DaemonClient(*this, fd, id));
+        }
+    }
+
+    void Daemon::dispatch(uint64_t clientId, size_t slot, const std::string & line) {
+        size_t sep = line.find(' ');
+        if (sep == std::string::npos) {
+            reply(clientId, slot, false, "expected <host>:<port> <command>");
+            return;
+        }
+
+        std::map<std::string, size_t>::iterator it = mSessionsByKey.find(line.substr(0, sep));
+        if (it == mSessionsByKey.end()) {
+            reply(clientId, slot, false, "unknown server " + line.substr(0, sep));
+            return;
+        }
+
+        DaemonSession *session = mSessions[it->second].get();
+        Worker *worker = mSessionWorkers[it->second];
+        if (worker == nullptr) {
+            session->submit(clientId, slot, line.substr(sep + 1));
+            return;
+        }
+        std::string cmd = line.substr(sep + 1);
+        worker->post([session, clientId, slot, cmd]() { session->submit(clientId, slot, cmd); });
+    }
+
+    void Daemon::reply(uint64_t clientId, size_t slot, bool ok, const std::string & text) {
+        if (mInbox) {
+            mInbox->post([this, clientId, slot, ok, text]() { deliver(clientId, slot, ok, text); });
+        } else {
+            deliver(clientId, slot, ok, text);
+        }
+    }
+
+    void Daemon::deliver(uint64_t clientId, size_t slot, bool ok, const std::string & text) {
+        std::map<uint64_t, std::unique_ptr<DaemonClient> >::iterator it = mClients.find(clientId);
+        if (it != mClients.end()) {
+            it->second->reply(slot, ok, text);
+        }
+    }
+
+    void Daemon::closeClient(uint64_t clientId) {
+        for (size_t i = 0; i < mClosed.size(); ++i) {
+            if (mClosed[i] == clientId) {
+                return;
+            }
+        }
+        mClosed.push_back(clientId);
+    }
+
+    void Daemon::log(const Target & target, const std::string_view & text) {
+        if (mLog == nullptr) {
+            return;
+        }
+        if (mInbox) {
+            std::string tag = target.tag();
+            std::string line(text);
+            mInbox->post([this, tag, line]() { writeLog(tag, line); });
+        } else {
+            writeLog(target.tag(), text);
+        }
+    }
+
+    void Daemon::writeLog(const std::string & tag, const std::string_view & text) {
+        *mLog << tag << " ";
+        mLog->write(text.data(), text.size());
+        *mLog << std::endl;
+    }
+
+    void Daemon::requestSnapshots() {
+        for (size_t i = 0; i < mSessions.size(); ++i) {
+            DaemonSession *session = mSessions[i].get();
+            if (session == nullptr) {
+                continue;
+            }
+            mSessionWorkers[i]->post([this, session, i]() {
+                Snapshot snapshot;
+                snapshot.metrics = session->getMetrics();
+                snapshot.up = session->isReady();
+                mInbox->post([this, snapshot, i]() { mSnapshots[i] = snapshot; });
+            });
+        }
+        mSnapshotTimer = mReactor->addTimer(DAEMON_SNAPSHOT_MS, [this]() {
+            mSnapshotTimer = 0;
+            requestSnapshots();
+        });
+    }
+
+    void Daemon::writeMetrics(std::ostream & out) const {
+        /* The sessions of workers are only read through their last snapshot */
+        std::vector<Metrics::Series> series;
+        for (size_t i = 0; i < mSessions.size(); ++i) {
+            if (!mSessions[i]) {
+                continue;
+            }
+            Metrics::Series entry;
+            entry.labels = Metrics::label("server", mSessions[i]->getTarget().key());
+            if (mSessionWorkers[i] != nullptr) {
+                entry.metrics = &mSnapshots[i].metrics;
+                entry.up = mSnapshots[i].up;
+            } else {
+                entry.metrics = &mSessions[i]->getMetrics();
+                entry.up = mSessions[i]->isReady();
+            }
+            series.push_back(entry);
+        }
+        Metrics::writePrometheus(out, series);
+    }
+
+
+    /* DaemonProxy class */
+
+    DaemonProxy::~DaemonProxy() {
+        if (mFd != -1) {
+            close(mFd);
+        }
+    }
+
+    void DaemonProxy::connect(const std::string & socketPath) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (socketPath.size() >= sizeof(addr.sun_path)) {
+            throw SocketException("socket path too long: " + socketPath);
+        }
+        strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+        mFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (mFd == -1 || ::connect(mFd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+            throw SocketException("could not connect to daemon at " + socketPath + ": " + strerror(errno));
+        }
+    }
+
+    void DaemonProxy::send(const std::string & server, const std::string & cmd) {
+        if (cmd.find('\n') != std::string::npos) {
+            throw AppException("commands must not contain newlines");
+        }
+        std::string line = server + " " + cmd + "\n";
+        size_t pos = 0;
+        while (pos < line.size()) {
+            ssize_t nwritten = ::send(mFd, line.data() + pos, line.size() - pos, MSG_NOSIGNAL);
+            if (nwritten == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw SocketException(std::string("daemon write error: ") + strerror(errno));
+            }
+            pos += nwritten;
+        }
+    }
+
+    void DaemonProxy::fill(size_t length) {
+        char buf[BUF_SIZE];
+        while (mIn.size() < length) {
+            ssize_t nread = recv(mFd, buf, sizeof(buf), 0);
+            if (nread == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw SocketException(std::string("daemon read error: ") + strerror(errno));
+            }
+            if (nread == 0) {
+                throw SocketException("daemon closed the connection");
+            }
+            mIn.append(buf, nread);
+        }
+    }
+
+    bool DaemonProxy::receive(std::string & text) {
+        size_t end;
+        while ((end = mIn.find('\n')) == std::string::npos) {
+            fill(mIn.size() + 1);
+        }
+        std::string status = mIn.substr(0, end);
+        mIn.erase(0, end + 1);
+
+        if (status.compare(0, 3, "OK ") == 0) {
+            size_t length = strtoul(status.c_str() + 3, nullptr, 10);
+            fill(length);
+            text = mIn.substr(0, length);
+            mIn.erase(0, length);
+            return true;
+        }
+        if (status.compare(0, 4, "ERR ") == 0) {
+            text = status.substr(4);
+            return false;
+        }
+        throw ProtocolException("unexpected daemon response: " + status);
+    }
+}
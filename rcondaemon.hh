@@ -0,0 +1,448 @@
+#ifndef __RCONDAEMON_HH__
+#define __RCONDAEMON_HH__
+
+#include "rcon.hh"
+#include "rconreactor.hh"
+#include "rconfanout.hh"
+#include "rconpipeline.hh"
+#include "rconseq.hh"
+#include "rconmetrics.hh"
+#include "rconshard.hh"
+#include "rconresolve.hh"
+#include <sys/types.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <ostream>
+#include <random>
+
+/** The reconnect backoff of a lost session, doubled per failed attempt up to the maximum */
+#define DAEMON_RECONNECT_MIN_MS 200
+#define DAEMON_RECONNECT_MAX_MS 10000
+/** The failed reconnects on the warm socket after which the server is resolved again */
+#define DAEMON_RERESOLVE_ATTEMPTS 3
+/** The most commands queued for replay while a session is down */
+#define DAEMON_REPLAY_LIMIT 256
+/** How long the output of a read-only command is served from the cache by default */
+#define DAEMON_CACHE_TTL_MS 1000
+#define DAEMON_WINDOW 16
+/** The most worker threads the sessions may be sharded across */
+#define DAEMON_MAX_WORKERS 64
+/** How often sharded sessions hand a copy of their metrics to the front end */
+#define DAEMON_SNAPSHOT_MS 1000
+
+namespace Rcon {
+
+    class Daemon;
+
+    /** DaemonSession class
+      @remarks
+        A persistent, authenticated session to a single BattlEye RCon server.
+        The session resolves its server in the background and logs in on
+        start(), resending the login with backoff until the daemon timeout
+        has passed, acknowledges every server message,
+        logs resent copies only once,
+        sends an empty keepalive command whenever nothing was sent for
+        KEEPALIVE_INTERVAL_MS and executes the client commands pipelined,
+        by priority class and at the rate of the server if it has one,
+        identical read-only commands of several clients sharing a result.
+        The output of the read-only commands (players, bans, admins and
+        missions) is cached for the cache TTL of the daemon and served to
+        clients without a round trip; a command which may change it, e.g.
+        a ban or kick, drops what it may change, and outputs read before
+        such a command was sent are not cached.
+        A failed command is followed by a keepalive right away, so a server
+        gone silent is noticed within a deadline. A failed login, channel
+        error or unanswered keepalive restarts the session with jittered
+        exponential backoff from DAEMON_RECONNECT_MIN_MS to
+        DAEMON_RECONNECT_MAX_MS. A restart keeps the resolved socket open
+        and logs in again on it, so a server restart costs a login round
+        trip; the server is only resolved again after
+        DAEMON_RERESOLVE_ATTEMPTS failed reconnects. Commands submitted
+        while the session is down, and the ones the lost session had not
+        sent yet, are queued and replayed in order once it is up again,
+        or fail once their deadline passed; commands which were sent fail,
+        as the server may have executed them. The protocol counters and
+        latency histograms of the session survive restarts. The session
+        only ever runs on the thread of its reactor.
+      @param
+        daemon The daemon which owns the session.
+      @param
+        reactor The reactor of the worker serving the session.
+      @param
+        resolver The resolver of that reactor.
+      @param
+        target The server of the session.
+    */
+    class DaemonSession : public MessageHandler {
+        public:
+            explicit DaemonSession(Daemon & daemon, Reactor & reactor, Resolver & resolver, const Target & target);
+
+            virtual ~DaemonSession();
+
+            /** Resolves the server, then opens the channel and sends the login. */
+            void start();
+
+            /** Executes a client command, queued while the session is down, the result is passed to Daemon::reply(). */
+            void submit(uint64_t clientId, size_t slot, const std::string & cmd);
+
+            /** Returns true if the session is logged in */
+            bool isReady() const;
+
+            /** Returns the server of the session */
+            const Target & getTarget() const;
+
+            /** Returns the metrics of the session */
+            const Metrics & getMetrics() const;
+
+            /** Appends the server messages of the session to a capture, before start(). */
+            void setCapture(CaptureLog *capture);
+
+            /** Takes the password and timeout of a changed config, used from the next login on. */
+            void update(const Target & target);
+
+            /** Tears the session down for good, failing the commands still waiting. */
+            void stop();
+
+            virtual void handleView(Channel & channel, const Protocol::MessageView & view);
+
+            virtual void handleError(Channel & channel, const Exception & e);
+
+        protected:
+            enum State {
+                SESSION_DOWN,
+                SESSION_LOGIN,
+                SESSION_READY
+            };
+
+            /** A command waiting for its result, clientId 0 is a keepalive */
+            struct Waiter {
+                uint64_t clientId;
+                size_t slot;
+                /** The cache generation when the command was submitted */
+                uint64_t generation;
+            };
+
+            /** The cached output of a read-only command */
+            struct CacheEntry {
+                std::string output;
+                Reactor::Clock::time_point expires;
+            };
+
+            /** A command waiting for the session to be up again */
+            struct Queued {
+                Waiter waiter;
+                std::string cmd;
+                Reactor::Clock::time_point deadline;
+            };
+
+            /** Tears the session down, keeping the socket and the commands not sent
+                yet, and schedules the next start() after the backoff. */
+            void restart(const std::string & reason);
+
+            /** Closes the channel and fails the commands still waiting and queued. */
+            void shutdown(const std::string & reason);
+
+            /** Fails the queued commands whose deadline has passed and rearms. */
+            void expireQueued();
+
+            /** Arms the timer of the first queued command's deadline, if not armed. */
+            void armQueued();
+
+            /** Submits the queued commands once the session is up. */
+            void replayQueued();
+
+            /** Replies from the cache if the command is read-only and its output cached
+              @return
+                true if the client was answered.
+            */
+            bool replyCached(uint64_t clientId, size_t slot, const std::string & cmd);
+
+            /** Drops the cached outputs a command which is not read-only may change. */
+            void invalidate(const std::string & cmd);
+
+            /** Returns the login and per-command deadline of the server */
+            int getTimeout() const;
+
+            /** Starts the login on the open channel. */
+            void login();
+
+            /** Sends the login and arms its retransmit timer. */
+            void sendLogin();
+
+            /** Resends the login, or restarts once its deadline has passed. */
+            void loginTimeout();
+
+            /** Schedules restart() outside of the current callback. */
+            void scheduleRestart(const std::string & reason);
+
+            /** Arms the keepalive timer relative to the last command sent. */
+            void armKeepalive();
+
+            void keepalive();
+
+            void onResult(const Pipeline::Result & result);
+
+            /** Cancels the pending timers and the resolution of the server. */
+            void cancelTimers();
+
+            Daemon & mDaemon;
+            Reactor & mReactor;
+            Resolver & mResolver;
+            Target mTarget;
+            Channel mChannel;
+            State mState;
+            std::unique_ptr<Pipeline> mPipeline;
+            /** The commands submitted to the pipeline by their tag */
+            std::unordered_map<uint64_t, Waiter> mWaiting;
+            std::deque<Queued> mQueued;
+            /** The output of the read-only commands, by command */
+            std::unordered_map<std::string, CacheEntry> mCache;
+            /** Advanced on every invalidation, so outputs read before are not cached */
+            uint64_t mCacheGeneration;
+            Protocol::SequenceWindow mServerWindow;
+            Metrics mMetrics;
+            Reactor::Clock::time_point mLoginSent;
+            Reactor::Clock::time_point mLoginDeadline;
+            int mLoginAttempt;
+            /** The restarts since the session was last up */
+            int mReconnectAttempt;
+            bool mWasUp;
+            bool mStopped;
+            /** True while a keepalive is outstanding */
+            bool mProbing;
+            uint64_t mNextTag;
+            std::mt19937 mRandom;
+            Resolver::RequestId mResolveRequest;
+            Reactor::TimerId mLoginTimer;
+            Reactor::TimerId mKeepaliveTimer;
+            Reactor::TimerId mRestartTimer;
+            Reactor::TimerId mQueuedTimer;
+            Reactor::Clock::time_point mLastSend;
+    };
+
+
+    /** DaemonClient class
+      @remarks
+        A front end connection accepted on the daemon's Unix domain socket.
+        The client sends one request per line in the form
+            <host>:<port> <command>
+        and gets one response per request, in request order, either
+            OK <length>\n<length bytes of command output>
+        or
+            ERR <message>\n
+        Requests to different servers are executed concurrently.
+    */
+    class DaemonClient : public SocketHandler {
+        public:
+            explicit DaemonClient(Daemon & daemon, int fd, uint64_t id);
+
+            virtual ~DaemonClient();
+
+            /** Stores the response of a request and writes all leading complete responses */
+            void reply(size_t slot, bool ok, const std::string & text);
+
+            virtual void onReadable();
+
+            virtual void onWritable();
+
+        protected:
+            struct Response {
+                Response() :
+                    done(false)
+                {}
+
+                bool done;
+                std::string data;
+            };
+
+            /** Writes buffered output, watching writability if the socket is full */
+            void flush();
+
+            Daemon & mDaemon;
+            int mFd;
+            uint64_t mId;
+            std::string mIn;
+            std::string mOut;
+            std::deque<Response> mResponses;
+            size_t mFirstSlot;
+            bool mEof;
+            bool mWatching;
+    };
+
+
+    /** Daemon class
+      @remarks
+        Keeps one DaemonSession per target alive and multiplexes the requests
+        of all front end clients on a Unix domain socket onto them. Without
+        workers everything runs on a single reactor. With workers the
+        sessions are sharded round robin across that many Worker threads,
+        each with its own reactor and sockets, while the clients, the log
+        and the metrics endpoint stay on the front end reactor of run().
+        Requests are routed to a session's worker and results and log lines
+        back to the front end through lock-free queues, so no locks are
+        shared; the metrics endpoint then serves the copies the sessions
+        hand over every DAEMON_SNAPSHOT_MS. Server messages are written to
+        the log stream tagged with their server. With a metrics address the
+        metrics of all sessions are served to Prometheus on GET /metrics.
+        The servers may change while serving through reload(), sessions
+        to the servers which stay are kept. run() returns on SIGINT or
+        SIGTERM.
+      @param
+        targets The servers to keep sessions to.
+      @param
+        socketPath The path of the Unix domain socket to listen on.
+      @param
+        timeoutMs The login deadline and the per-command deadline in milliseconds.
+      @param
+        log The stream for server messages and session events, may be null.
+      @param
+        metricsAddress The [host:]port to serve metrics on, empty for none.
+      @param
+        nofWorkers The worker threads to shard the sessions across, 0 for none.
+    */
+    class Daemon : public SocketHandler {
+        public:
+            explicit Daemon(const std::vector<Target> & targets, const std::string & socketPath,
+                            int timeoutMs, std::ostream *log, const std::string & metricsAddress = std::string(),
+                            size_t nofWorkers = 0);
+
+            virtual ~Daemon();
+
+            /** Appends the server messages of all sessions to a capture, before run(). */
+            void setCapture(CaptureLog *capture);
+
+            /** Sets how long the sessions serve read-only outputs from their cache, 0 disables it, before run(). */
+            void setCacheTtl(int ttlMs);
+
+            /** Returns the cache TTL of the sessions in milliseconds */
+            int getCacheTtl() const;
+
+            /** Applies a changed list of servers while run() serves, on the front end thread:
+                sessions are started for new servers and stopped for the ones gone, the
+                others keep their sessions and take a changed password from the next login on. */
+            void reload(const std::vector<Target> & targets);
+
+            /** Listens on the socket and serves sessions and clients until stopped by a signal. */
+            void run();
+
+            /** Accepts pending front end connections. */
+            virtual void onReadable();
+
+            /** Returns the front end reactor serving the clients, and the sessions without workers */
+            Reactor & getReactor();
+
+            /** Returns the login and per-command deadline in milliseconds */
+            int getTimeout() const;
+
+            /** Parses a request line of a client and submits it to its session. */
+            void dispatch(uint64_t clientId, size_t slot, const std::string & line);
+
+            /** Passes the result of a request back to its client, if still connected.
+                May be called from any thread, the client is served on the front end. */
+            void reply(uint64_t clientId, size_t slot, bool ok, const std::string & text);
+
+            /** Closes a client after the current reactor iteration. */
+            void closeClient(uint64_t clientId);
+
+            /** Logs a server message or session event of a session, from any thread. */
+            void log(const Target & target, const std::string_view & text);
+
+            /** Writes the metrics of all sessions in the Prometheus text format. */
+            void writeMetrics(std::ostream & out) const;
+
+        protected:
+            /** The metrics of a sharded session as last handed over to the front end */
+            struct Snapshot {
+                Snapshot() :
+                    up(false)
+                {}
+
+                Metrics metrics;
+                bool up;
+            };
+
+            /** Passes a result to its client, on the front end thread. */
+            void deliver(uint64_t clientId, size_t slot, bool ok, const std::string & text);
+
+            /** Writes a log line, on the front end thread. */
+            void writeLog(const std::string & tag, const std::string_view & text);
+
+            /** Asks every sharded session for a copy of its metrics and rearms. */
+            void requestSnapshots();
+
+            /** Creates the session of a server, on the next worker round robin. */
+            void addSession(const Target & target);
+
+            /** Starts a session, on its worker if it has one. */
+            void startSession(size_t index);
+
+            std::unique_ptr<Reactor> mReactor;
+            /** Posts to the front end reactor, only set with workers */
+            std::unique_ptr<WorkQueue> mInbox;
+            std::vector<std::unique_ptr<Worker> > mWorkers;
+            /** The resolver of every worker, or of the front end reactor without workers */
+            std::vector<std::unique_ptr<Resolver> > mResolvers;
+            /** The sessions by index, null once stopped by a reload */
+            std::vector<std::unique_ptr<DaemonSession> > mSessions;
+            /** The worker of every session, null without workers */
+            std::vector<Worker*> mSessionWorkers;
+            std::vector<Snapshot> mSnapshots;
+            Reactor::TimerId mSnapshotTimer;
+            /** The index of the session of every server key */
+            std::map<std::string, size_t> mSessionsByKey;
+            std::map<uint64_t, std::unique_ptr<DaemonClient> > mClients;
+            std::vector<uint64_t> mClosed;
+            std::string mSocketPath;
+            std::string mMetricsAddress;
+            std::unique_ptr<MetricsEndpoint> mMetricsEndpoint;
+            int mListenFd;
+            int mTimeoutMs;
+            int mCacheTtlMs;
+            uint64_t mNextClientId;
+            std::ostream *mLog;
+            CaptureLog *mCapture;
+    };
+
+
+    /** DaemonProxy class
+      @remarks
+        The blocking front end side of the daemon protocol, used by
+        the -c client mode.
+    */
+    class DaemonProxy {
+        public:
+            DaemonProxy() :
+                mFd(-1)
+            {}
+
+            virtual ~DaemonProxy();
+
+            /** Connects to the daemon's Unix domain socket. */
+            void connect(const std::string & socketPath);
+
+            /** Sends a request without waiting for its response. */
+            void send(const std::string & server, const std::string & cmd);
+
+            /** Receives the response of the oldest request sent
+              @param
+                text The command output, or the error message.
+              @return
+                true if the command succeeded.
+            */
+            bool receive(std::string & text);
+
+        protected:
+            /** Reads until mIn holds at least length bytes */
+            void fill(size_t length);
+
+            int mFd;
+            std::string mIn;
+    };
+}
+
+#endif // __RCONDAEMON_HH__
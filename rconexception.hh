@@ -1,3 +1,6 @@
+#ifndef __RCONEXCEPTION_HH__
+#define __RCONEXCEPTION_HH__
+
 #include <exception>
 #include <string>
 
@@ -31,6 +34,20 @@ namespace Rcon {
     };
 
 
+    /** ChecksumException class
+      @remarks
+        Thrown for a received packet whose CRC32 does not match,
+        so corrupted packets can be counted apart from malformed ones.
+     * @param msg The message to throw with the exception.
+     */
+    class ChecksumException : virtual public ProtocolException {
+        public:
+            explicit ChecksumException(const std::string & msg) :
+                Exception(std::string("Protocol Error: " + msg)),
+                ProtocolException(msg) {}
+    };
+
+
     /** SocketException class
      * @param msg The message to throw with the exception.
      */
@@ -41,6 +58,19 @@ namespace Rcon {
     };
 
 
+    /** CommandException class
+      @remarks
+        Thrown when a RCon command failed on the server connection,
+        while the session itself is still usable.
+     * @param msg The message to throw with the exception.
+     */
+    class CommandException : virtual public Exception {
+        public:
+            explicit CommandException(const std::string & msg) :
+                Exception(std::string("Command Error: " + msg)) {}
+    };
+
+
     /** AppException class
      * @param msg The message to throw with the exception.
      */
@@ -50,3 +80,5 @@ namespace Rcon {
                 Exception(std::string("Application Error: " + msg)) {}
     };
 }
+
+#endif // __RCONEXCEPTION_HH__
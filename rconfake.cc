@@ -0,0 +1,268 @@
+#include "rconfake.hh"
+#include "rconmsg.hh"
+#include "rconcrc.hh"
+#include "rconexception.hh"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+
+namespace Rcon {
+
+    using namespace Protocol;
+
+    static std::string encodePacket(const Message & msg) {
+        std::string packet(msg.getEncodedSize(), '\0');
+        msg.encode(reinterpret_cast<uint8_t*>(&packet[0]), packet.size());
+        return packet;
+    }
+
+
+    /* FakeServer class */
+
+    FakeServer::FakeServer(const Settings & settings) :
+        mSettings(settings),
+        mFd(-1),
+        mRunning(false),
+        mHaveClient(false),
+        mClientLength(0),
+        mRandom(settings.seed),
+        mUniform(0.0, 1.0),
+        mNextOrder(0),
+        mNextSeqNum(0),
+        mNofPushed(0)
+    {
+        memset(&mClient, 0, sizeof(mClient));
+    }
+
+    FakeServer::~FakeServer() {
+        stop();
+    }
+
+    void FakeServer::start() {
+        mFd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (mFd == -1) {
+            throw SocketException(std::string("socket: ") + strerror(errno));
+        }
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        socklen_t addrLength = sizeof(addr);
+        if (bind(mFd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+            getsockname(mFd, (struct sockaddr *)&addr, &addrLength) == -1) {
+            std::string error = std::string("bind: ") + strerror(errno);
+            close(mFd);
+            mFd = -1;
+            throw SocketException(error);
+        }
+        mPort = std::to_string(ntohs(addr.sin_port));
+
+        mRunning = true;
+        mThread = std::thread(&FakeServer::serve, this);
+    }
+
+    void FakeServer::stop() {
+        if (mThread.joinable()) {
+            mRunning = false;
+            mThread.join();
+        }
+        if (mFd != -1) {
+            close(mFd);
+            mFd = -1;
+        }
+    }
+
+    std::string FakeServer::getPort() const {
+        return mPort;
+    }
+
+    FakeServer::Stats FakeServer::getStats() const {
+        std::lock_guard<std::mutex> lock(mStatsMutex);
+        return mStats;
+    }
+
+    std::string FakeServer::partPayload(size_t partIdx, size_t partSize) {
+        std::string part = std::to_string(partIdx) + ":";
+        part.resize(std::max(partSize, part.size()), 'p');
+        return part;
+    }
+
+    std::string FakeServer::expectedParts(size_t nofParts, size_t partSize) {
+        std::string output;
+        for (size_t i = 0; i < nofParts; ++i) {
+            output += partPayload(i, partSize);
+        }
+        return output;
+    }
+
+    bool FakeServer::lose() {
+        return mSettings.loss > 0.0 && mUniform(mRandom) < mSettings.loss;
+    }
+
+    void FakeServer::serve() {
+        uint8_t buffer[65536];
+
+        while (mRunning) {
+            /* Wake up for the next delayed packet, the next server message or to check mRunning */
+            int timeoutMs = 10;
+            if (!mDelayed.empty()) {
+                Clock::duration wait = mDelayed.top().due - Clock::now();
+                int due = (int)std::chrono::duration_cast<std::chrono::milliseconds>(wait).count();
+                timeoutMs = (due < 0) ? 0 : (due < timeoutMs ? due : timeoutMs);
+            }
+            if (mHaveClient && mSettings.messageRate > 0) {
+                timeoutMs = (timeoutMs > 1) ? 1 : timeoutMs;
+            }
+
+            struct pollfd pfd;
+            pfd.fd = mFd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            if (poll(&pfd, 1, timeoutMs) > 0) {
+                for (;;) {
+                    struct sockaddr_storage from;
+                    socklen_t fromLength = sizeof(from);
+                    ssize_t n = recvfrom(mFd, buffer, sizeof(buffer), MSG_DONTWAIT, (struct sockaddr *)&from, &fromLength);
+                    if (n == -1) {
+                        break;
+                    }
+                    {
+                        std::lock_guard<std::mutex> lock(mStatsMutex);
+                        ++mStats.received;
+                        if (lose()) {
+                            ++mStats.lost;
+                            continue;
+                        }
+                    }
+                    memcpy(&mClient, &from, fromLength);
+                    mClientLength = fromLength;
+                    handlePacket(buffer, n);
+                }
+            }
+
+            pushMessages();
+            sendDue();
+        }
+    }
+
+    void FakeServer::handlePacket(const uint8_t *buffer, size_t length) {
+
+        /* Clients send the outbound layouts, which the client side decoder rejects */
+        if (length < 8 || buffer[0] != 0x42 || buffer[1] != 0x45 || buffer[6] != 0xff) {
+            return;
+        }
+        uint32_t crc;
+        memcpy(&crc, buffer + 2, sizeof(crc));
+        if (crc != Crc32::calculate(buffer + 6, length - 6)) {
+            return;
+        }
+
+        std::string payload(reinterpret_cast<const char*>(buffer) + 9, (length > 9) ? length - 9 : 0);
+
+        if (buffer[7] == Message::PKT_LOGIN) {
+            std::string password(reinterpret_cast<const char*>(buffer) + 8, length - 8);
+            bool ok = (password == mSettings.password);
+            sendLater(encodePacket(LoginResponse(ok ? 1 : 0)));
+            if (ok) {
+                mHaveClient = true;
+                mLoginTime = Clock::now();
+                mNofPushed = 0;
+                mNextSeqNum = 0;
+                mUnacked.clear();
+            }
+            std::lock_guard<std::mutex> lock(mStatsMutex);
+            ++mStats.logins;
+            return;
+        }
+
+        if (length < 9) {
+            return;
+        }
+        uint8_t seqNum = buffer[8];
+
+        if (buffer[7] == Message::PKT_SERVER) {
+            std::map<uint8_t, Clock::time_point>::iterator it = mUnacked.find(seqNum);
+            std::lock_guard<std::mutex> lock(mStatsMutex);
+            ++mStats.acks;
+            if (it != mUnacked.end()) {
+                mStats.ackLatencyUs.push_back(std::chrono::duration<double, std::micro>(Clock::now() - it->second).count());
+                mUnacked.erase(it);
+            }
+            return;
+        }
+
+        if (buffer[7] != Message::PKT_CMD) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mStatsMutex);
+            ++mStats.commands;
+        }
+
+        if (payload.compare(0, 6, "parts ") == 0) {
+            int nofParts = atoi(payload.c_str() + 6);
+            nofParts = (nofParts < 1) ? 1 : (nofParts > 255 ? 255 : nofParts);
+            for (int n = 0; n < nofParts; ++n) {
+                int i = mSettings.reverseParts ? nofParts - 1 - n : n;
+                sendLater(encodePacket(CommandPartialResponse(seqNum, nofParts, i, partPayload(i, mSettings.partSize))));
+            }
+        } else if (payload.empty()) {
+            sendLater(encodePacket(CommandResponse(seqNum, "")));
+        } else {
+            sendLater(encodePacket(CommandResponse(seqNum, "echo " + payload)));
+        }
+    }
+
+    void FakeServer::pushMessages() {
+        if (!mHaveClient || mSettings.messageRate <= 0) {
+            return;
+        }
+
+        Clock::duration elapsed = Clock::now() - mLoginTime;
+        uint64_t due = (uint64_t)(std::chrono::duration<double>(elapsed).count() * mSettings.messageRate);
+        while (mNofPushed < due) {
+            uint8_t seqNum = mNextSeqNum++;
+            std::string text = "Player #" + std::to_string(mNofPushed % 100) + " (Global): message " + std::to_string(mNofPushed);
+            mUnacked[seqNum] = Clock::now() + std::chrono::milliseconds(mSettings.latencyMs);
+            sendLater(encodePacket(ServerMessage(seqNum, text)));
+            ++mNofPushed;
+
+            std::lock_guard<std::mutex> lock(mStatsMutex);
+            ++mStats.messages;
+        }
+    }
+
+    void FakeServer::sendLater(const std::string & packet) {
+        Delayed delayed;
+        delayed.due = Clock::now() + std::chrono::milliseconds(mSettings.latencyMs);
+        delayed.order = mNextOrder++;
+        delayed.packet = packet;
+        mDelayed.push(delayed);
+        sendDue();
+    }
+
+    void FakeServer::sendDue() {
+        Clock::time_point now = Clock::now();
+        while (!mDelayed.empty() && mDelayed.top().due <= now) {
+            const std::string & packet = mDelayed.top().packet;
+            std::lock_guard<std::mutex> lock(mStatsMutex);
+            if (lose()) {
+                ++mStats.lost;
+            } else {
+                sendto(mFd, packet.data(), packet.size(), 0, (struct sockaddr *)&mClient, mClientLength);
+                ++mStats.sent;
+            }
+            mDelayed.pop();
+        }
+    }
+}
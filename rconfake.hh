@@ -0,0 +1,162 @@
+#ifndef __RCONFAKE_HH__
+#define __RCONFAKE_HH__
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <queue>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <chrono>
+
+namespace Rcon {
+
+    /** FakeServer class
+      @remarks
+        An in-process BattlEye RCon server on a loopback UDP port, run on
+        its own thread, for benchmarks and experiments. It answers logins
+        and commands like a real server and pushes server messages at a
+        fixed rate once a client has logged in:
+         - the empty command (keepalive) gets an empty response,
+         - "parts <n>" gets a multipart response of n parts, see expectedParts(),
+         - every other command gets "echo <command>".
+        Every outgoing packet is delayed by the latency and every packet in
+        either direction is lost with the loss probability.
+      @param
+        settings The behaviour of the server.
+    */
+    class FakeServer {
+        public:
+            typedef std::chrono::steady_clock Clock;
+
+            /** Server behaviour */
+            struct Settings {
+                Settings() :
+                    password("bench"),
+                    latencyMs(0),
+                    loss(0.0),
+                    messageRate(0),
+                    partSize(1000),
+                    reverseParts(false),
+                    seed(1)
+                {}
+
+                /** The password accepted by the login */
+                std::string password;
+                /** The one-way delay of every packet sent by the server */
+                int latencyMs;
+                /** The probability in [0, 1] of losing a packet in either direction */
+                double loss;
+                /** The server messages per second pushed to the logged in client, 0 for none */
+                int messageRate;
+                /** The payload size of every part of a multipart response */
+                size_t partSize;
+                /** Sends the parts of a multipart response last part first */
+                bool reverseParts;
+                /** The seed of the loss generator */
+                unsigned seed;
+            };
+
+            /** Server statistics */
+            struct Stats {
+                Stats() :
+                    received(0),
+                    sent(0),
+                    lost(0),
+                    logins(0),
+                    commands(0),
+                    messages(0),
+                    acks(0)
+                {}
+
+                uint64_t received;
+                uint64_t sent;
+                uint64_t lost;
+                uint64_t logins;
+                uint64_t commands;
+                uint64_t messages;
+                uint64_t acks;
+                /** The microseconds from sending each acknowledged server message to its first ACK */
+                std::vector<double> ackLatencyUs;
+            };
+
+            explicit FakeServer(const Settings & settings);
+
+            virtual ~FakeServer();
+
+            /** Binds a free loopback port and starts serving on a new thread. */
+            void start();
+
+            /** Stops the server thread. */
+            void stop();
+
+            /** Returns the port the server is bound to */
+            std::string getPort() const;
+
+            /** Returns a copy of the statistics so far */
+            Stats getStats() const;
+
+            /** Returns the payload of part partIdx of a multipart response, which starts with its index */
+            static std::string partPayload(size_t partIdx, size_t partSize);
+
+            /** Returns the reassembled output of the response to "parts <nofParts>" */
+            static std::string expectedParts(size_t nofParts, size_t partSize);
+
+        protected:
+            /** A packet waiting for its latency to pass */
+            struct Delayed {
+                Clock::time_point due;
+                uint64_t order;
+                std::string packet;
+
+                bool operator>(const Delayed & other) const {
+                    return due > other.due || (due == other.due && order > other.order);
+                }
+            };
+
+            void serve();
+
+            void handlePacket(const uint8_t *buffer, size_t length);
+
+            /** Queues a packet for sending after the latency, unless it is lost */
+            void sendLater(const std::string & packet);
+
+            /** Sends the queued packets whose latency has passed */
+            void sendDue();
+
+            /** Pushes the server messages due since the last call */
+            void pushMessages();
+
+            /** Returns true if the next packet is to be lost */
+            bool lose();
+
+            Settings mSettings;
+            int mFd;
+            std::string mPort;
+            std::thread mThread;
+            std::atomic<bool> mRunning;
+
+            /* Only touched by the server thread */
+            bool mHaveClient;
+            struct sockaddr_storage mClient;
+            socklen_t mClientLength;
+            std::mt19937 mRandom;
+            std::uniform_real_distribution<double> mUniform;
+            std::priority_queue<Delayed, std::vector<Delayed>, std::greater<Delayed> > mDelayed;
+            uint64_t mNextOrder;
+            uint8_t mNextSeqNum;
+            Clock::time_point mLoginTime;
+            uint64_t mNofPushed;
+            std::map<uint8_t, Clock::time_point> mUnacked;
+
+            mutable std::mutex mStatsMutex;
+            Stats mStats;
+    };
+}
+
+#endif // __RCONFAKE_HH__
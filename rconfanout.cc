@@ -0,0 +1,248 @@
+#include "rconfanout.hh"
+#include "rcon.hh"
+#include "rconmsg.hh"
+#include "rconexception.hh"
+#include <sys/types.h>
+#include <sstream>
+
+
+namespace Rcon {
+
+    using namespace Protocol;
+
+    FanOut::FanOut(const std::vector<Target> & targets, int timeoutMs) :
+        mReactor(Reactor::create()),
+        mResolver(*mReactor),
+        mTimeoutMs(timeoutMs),
+        mPending(0),
+        mFailed(0),
+        mOut(nullptr),
+        mErr(nullptr),
+        mFormat(TableWriter::FORMAT_TEXT)
+    {
+        for (size_t i = 0; i < targets.size(); ++i) {
+            mPeers.push_back(std::unique_ptr<Peer>(new Peer(*this, targets[i])));
+        }
+    }
+
+
+    FanOut::~FanOut() {
+    }
+
+
+    void FanOut::Peer::handleView(Channel & channel, const MessageView & view) {
+        try {
+            owner.handleView(*this, view);
+        } catch (Exception & e) {
+            owner.finishPeer(*this, PEER_FAILED, e.what());
+        }
+    }
+
+
+    void FanOut::Peer::handleError(Channel & channel, const Exception & e) {
+        owner.finishPeer(*this, PEER_FAILED, e.what());
+    }
+
+
+    void FanOut::handleView(Peer & peer, const MessageView & view) {
+
+        switch (view.type) {
+
+            case Message::MSG_LOGIN_RESP:
+                if (peer.state != PEER_LOGIN) {
+                    break;
+                }
+                mReactor->cancelTimer(peer.retransmitTimer);
+                if (peer.attempt == 0) {
+                    peer.channel.getRtt().sampleSince(peer.sentAt);
+                }
+                if (view.result == 0) {
+                    finishPeer(peer, PEER_FAILED, "Wrong RCON password!");
+                    break;
+                }
+                peer.state = PEER_COMMAND;
+                sendCommand(peer);
+                break;
+
+            case Message::MSG_CMD_RESP:
+                if (peer.state == PEER_COMMAND && view.seqNum == peer.cmdSeqNum) {
+                    peer.output.append(view.payload);
+                    finishPeer(peer, PEER_DONE);
+                }
+                break;
+
+            case Message::MSG_CMD_PART_RESP:
+                if (peer.state == PEER_COMMAND && view.seqNum == peer.cmdSeqNum) {
+                    Reassembler::PartStatus status = peer.reassembler.addPart(view);
+                    if (status == Reassembler::PART_MISMATCHED) {
+                        break;
+                    }
+                    mReactor->cancelTimer(peer.retransmitTimer);
+                    if (status == Reassembler::PART_COMPLETE) {
+                        peer.output = peer.reassembler.str();
+                        finishPeer(peer, PEER_DONE);
+                    } else {
+                        armRetransmit(peer);
+                    }
+                }
+                break;
+
+            case Message::MSG_SRV_MSG:
+                {
+                    ServerAck ack(view.seqNum);
+                    peer.channel.send(ack);
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+
+
+    void FanOut::setFormat(TableWriter::Format format) {
+        mFormat = format;
+    }
+
+
+    void FanOut::sendLogin(Peer & peer, const std::vector<Address> & addresses) {
+        try {
+            peer.channel.open(addresses);
+            Login login(peer.target.password);
+            peer.attempt = 0;
+            peer.sentAt = Reactor::Clock::now();
+            peer.channel.send(login);
+            armRetransmit(peer);
+        } catch (Exception & e) {
+            finishPeer(peer, PEER_FAILED, e.what());
+        }
+    }
+
+
+    void FanOut::sendCommand(Peer & peer) {
+        Command command(mCmdStr, peer.channel.getCommandSequence().next());
+        peer.cmdSeqNum = command.getSeqNum();
+        peer.reassembler.start(peer.cmdSeqNum);
+        peer.attempt = 0;
+        peer.sentAt = Reactor::Clock::now();
+        peer.channel.send(command);
+        armRetransmit(peer);
+    }
+
+
+    void FanOut::armRetransmit(Peer & peer) {
+        peer.retransmitTimer = mReactor->addTimer(peer.channel.getRtt().getTimeout(peer.attempt), [this, &peer]() {
+            retransmit(peer);
+        });
+    }
+
+
+    void FanOut::retransmit(Peer & peer) {
+        /* The deadline timer ends the attempts */
+        ++peer.attempt;
+        try {
+            if (peer.state == PEER_LOGIN) {
+                Login login(peer.target.password);
+                peer.channel.send(login);
+            } else {
+                /* Same seqnum, so the parts of earlier attempts still count */
+                Command command(mCmdStr, peer.cmdSeqNum);
+                peer.channel.send(command);
+            }
+        } catch (Exception & e) {
+            finishPeer(peer, PEER_FAILED, e.what());
+            return;
+        }
+        armRetransmit(peer);
+    }
+
+
+    void FanOut::finishPeer(Peer & peer, PeerState state, const std::string & error) {
+
+        if (peer.state == PEER_DONE || peer.state == PEER_FAILED) {
+            return;
+        }
+        peer.state = state;
+        peer.error = error;
+        peer.channel.close();
+        mResolver.cancel(peer.resolveRequest);
+        mReactor->cancelTimer(peer.deadlineTimer);
+        mReactor->cancelTimer(peer.retransmitTimer);
+
+        if (state == PEER_FAILED) {
+            ++mFailed;
+        }
+        --mPending;
+        printPeer(peer);
+    }
+
+
+    void FanOut::printPeer(const Peer & peer) {
+
+        const std::string tag = peer.target.tag();
+
+        if (peer.state == PEER_FAILED) {
+            *mErr << tag << " " << peer.error << std::endl;
+            return;
+        }
+
+        Table::Kind kind = Table::kindOf(mCmdStr);
+        if (mFormat != TableWriter::FORMAT_TEXT && kind != Table::TABLE_NONE) {
+            Table table(kind);
+            if (table.parse(peer.output)) {
+                mWriter->write(table, peer.target.key());
+                return;
+            }
+        }
+
+        std::istringstream lines(peer.output);
+        std::string line;
+        bool any = false;
+        while (std::getline(lines, line)) {
+            *mOut << tag << " " << line << std::endl;
+            any = true;
+        }
+        if (!any) {
+            *mOut << tag << std::endl;
+        }
+    }
+
+
+    size_t FanOut::run(const std::string & cmd, std::ostream & out, std::ostream & err) {
+
+        mCmdStr = cmd;
+        mOut = &out;
+        mErr = &err;
+        mWriter.reset(new TableWriter(mFormat, out));
+        mFailed = 0;
+        mPending = mPeers.size();
+
+        /**** Resolve all targets, each login is sent as soon as its addresses are known ****/
+        for (size_t i = 0; i < mPeers.size(); ++i) {
+            Peer & peer = *mPeers[i];
+            int timeoutMs = (peer.target.timeoutMs > 0) ? peer.target.timeoutMs : mTimeoutMs;
+            peer.deadlineTimer = mReactor->addTimer(timeoutMs, [this, &peer]() {
+                if (peer.state == PEER_COMMAND && peer.reassembler.isStarted()) {
+                    finishPeer(peer, PEER_FAILED, "Protocol Error: incomplete response, " + peer.reassembler.describeMissing());
+                } else {
+                    finishPeer(peer, PEER_FAILED, "Protocol Error: timeout");
+                }
+            });
+            peer.resolveRequest = mResolver.resolve(peer.target.host, peer.target.port,
+                                                    [this, &peer](const std::vector<Address> & addresses, const std::string & error) {
+                if (error.empty()) {
+                    sendLogin(peer, addresses);
+                } else {
+                    finishPeer(peer, PEER_FAILED, SocketException(error).what());
+                }
+            });
+        }
+
+        /**** Serve all channels until every target is done ****/
+        while (mPending > 0) {
+            mReactor->runOnce();
+        }
+
+        return mFailed;
+    }
+}
@@ -0,0 +1,135 @@
+#ifndef __RCONFANOUT_HH__
+#define __RCONFANOUT_HH__
+
+#include <sys/types.h>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <memory>
+#include "rcon.hh"
+#include "rconreactor.hh"
+#include "rconreasm.hh"
+#include "rconresolve.hh"
+#include "rcontable.hh"
+#include "rconconfig.hh"
+
+namespace Rcon {
+
+    namespace Protocol {
+        class Message;
+    }
+
+    /** FanOut class
+      @remarks
+        Runs a single RCon command against many servers concurrently.
+        Every target gets its own channel; all channels are served by
+        a single reactor, so the host names of all targets are resolved in
+        parallel and their logins and commands are in flight at the same
+        time, the total wall time is set by the slowest server. Unanswered logins and commands are resent with
+        the retransmit timeout of the target's round trip estimate, doubled
+        on every attempt, until the per-server deadline has passed.
+      @param
+        targets The servers to run the command on.
+      @param
+        timeoutMs The per-server deadline for login and command in milliseconds.
+    */
+    class FanOut
+    {
+        public:
+            explicit FanOut(const std::vector<Target> & targets, int timeoutMs);
+
+            virtual ~FanOut();
+
+            /** Runs the command on all targets
+              @param
+                cmd The RCon command to run.
+              @param
+                out The stream in which tagged results are printed.
+              @param
+                err The stream in which tagged errors are printed.
+              @return
+                The number of targets which failed.
+            */
+            size_t run(const std::string & cmd, std::ostream & out, std::ostream & err);
+
+            /** Sets the format of table outputs, which are written as records
+                tagged with their server unless the format is text (the default). */
+            void setFormat(TableWriter::Format format);
+
+        protected:
+            /** The state of a single target during the fan-out */
+            enum PeerState {
+                PEER_LOGIN,
+                PEER_COMMAND,
+                PEER_DONE,
+                PEER_FAILED
+            };
+
+            struct Peer : public MessageHandler {
+                Peer(FanOut & fanOut, const Target & target) :
+                    owner(fanOut),
+                    target(target),
+                    channel(*fanOut.mReactor, *this),
+                    reassembler(BUF_SIZE),
+                    state(PEER_LOGIN),
+                    cmdSeqNum(0),
+                    resolveRequest(0),
+                    attempt(0),
+                    deadlineTimer(0),
+                    retransmitTimer(0)
+                {}
+
+                virtual void handleView(Channel & channel, const Protocol::MessageView & view);
+
+                virtual void handleError(Channel & channel, const Exception & e);
+
+                FanOut & owner;
+                Target target;
+                Channel channel;
+                Protocol::Reassembler reassembler;
+                PeerState state;
+                uint8_t cmdSeqNum;
+                Resolver::RequestId resolveRequest;
+                /** The number of times the login or command was resent */
+                int attempt;
+                /** When the login or command was first sent */
+                Reactor::Clock::time_point sentAt;
+                std::string output;
+                std::string error;
+                Reactor::TimerId deadlineTimer;
+                Reactor::TimerId retransmitTimer;
+            };
+
+            /** Opens the channel of the peer to its resolved addresses and sends the login. */
+            void sendLogin(Peer & peer, const std::vector<Address> & addresses);
+
+            /** Sends the command to the peer and starts collecting its response. */
+            void sendCommand(Peer & peer);
+
+            /** Arms the retransmit timer of the peer for its current attempt. */
+            void armRetransmit(Peer & peer);
+
+            /** Resends the login or the command, with the same sequence number, of a peer. */
+            void retransmit(Peer & peer);
+
+            void handleView(Peer & peer, const Protocol::MessageView & view);
+
+            void finishPeer(Peer & peer, PeerState state, const std::string & error = std::string());
+
+            void printPeer(const Peer & peer);
+
+            std::unique_ptr<Reactor> mReactor;
+            Resolver mResolver;
+            std::vector<std::unique_ptr<Peer> > mPeers;
+            int mTimeoutMs;
+            size_t mPending;
+            size_t mFailed;
+            std::string mCmdStr;
+            std::ostream *mOut;
+            std::ostream *mErr;
+            TableWriter::Format mFormat;
+            std::unique_ptr<TableWriter> mWriter;
+    };
+}
+
+#endif // __RCONFANOUT_HH__
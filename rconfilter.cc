@@ -0,0 +1,289 @@
+#include "rconfilter.hh"
+#include "rconwebhook.hh"
+#include "rconexception.hh"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <fstream>
+
+
+namespace Rcon {
+
+    /** Folds an ASCII letter to lower case */
+    static inline uint8_t foldCase(uint8_t byte) {
+        return (byte >= 'A' && byte <= 'Z') ? byte + ('a' - 'A') : byte;
+    }
+
+
+    /* PatternMatcher class */
+
+    PatternMatcher::PatternMatcher() :
+        mNofPatterns(0),
+        mCompiled(false)
+    {
+        addState();
+    }
+
+    uint32_t PatternMatcher::addState() {
+        if (mOutput.size() >= FILTER_MAX_STATES) {
+            throw AppException("too many filter patterns");
+        }
+        /* While building, 0 means no transition, nothing leads back to the root */
+        uint32_t offset = mNext.size();
+        mNext.resize(mNext.size() + 256, 0);
+        mOutput.push_back(0);
+        return offset;
+    }
+
+    void PatternMatcher::add(const std::string_view & pattern, size_t route) {
+        if (mCompiled || pattern.empty() || route >= FILTER_MAX_ROUTES) {
+            throw AppException("invalid filter pattern");
+        }
+
+        uint32_t state = 0;
+        for (size_t i = 0; i < pattern.size(); ++i) {
+            uint8_t byte = foldCase(pattern[i]);
+            uint32_t next = mNext[state + byte];
+            if (next == 0) {
+                next = addState();
+                mNext[state + byte] = next;
+            }
+            state = next;
+        }
+        mOutput[state >> 8] |= Mask(1) << route;
+        ++mNofPatterns;
+    }
+
+    void PatternMatcher::compile() {
+        if (mCompiled) {
+            return;
+        }
+
+        /* Breadth first, so the failure state of every state is complete before it */
+        std::vector<uint32_t> fail(mOutput.size(), 0);
+        std::deque<uint32_t> queue;
+        for (size_t byte = 0; byte < 256; ++byte) {
+            if (mNext[byte] != 0) {
+                queue.push_back(mNext[byte]);
+            }
+        }
+
+        while (!queue.empty()) {
+            uint32_t state = queue.front();
+            queue.pop_front();
+            uint32_t failure = fail[state >> 8];
+            mOutput[state >> 8] |= mOutput[failure >> 8];
+
+            for (size_t byte = 0; byte < 256; ++byte) {
+                uint32_t child = mNext[state + byte];
+                if (child != 0) {
+                    fail[child >> 8] = mNext[failure + byte];
+                    queue.push_back(child);
+                } else {
+                    mNext[state + byte] = mNext[failure + byte];
+                }
+            }
+        }
+
+        /* Upper case letters take the transitions of their lower case ones */
+        for (size_t state = 0; state < mNext.size(); state += 256) {
+            for (size_t byte = 'A'; byte <= 'Z'; ++byte) {
+                mNext[state + byte] = mNext[state + foldCase(byte)];
+            }
+        }
+        mCompiled = true;
+    }
+
+    PatternMatcher::Mask PatternMatcher::match(const std::string_view & text) const {
+        const uint32_t *next = mNext.data();
+        const Mask *output = mOutput.data();
+        uint32_t state = 0;
+        Mask mask = 0;
+        for (size_t i = 0; i < text.size(); ++i) {
+            state = next[state + static_cast<uint8_t>(text[i])];
+            mask |= output[state >> 8];
+        }
+        return mask;
+    }
+
+    size_t PatternMatcher::getNofPatterns() const {
+        return mNofPatterns;
+    }
+
+    size_t PatternMatcher::getNofStates() const {
+        return mOutput.size();
+    }
+
+
+    /* MessageFilter class */
+
+    MessageFilter::MessageFilter(Reactor & reactor, LineSink *out, size_t limit) :
+        mReactor(reactor),
+        mOut(out),
+        mLimit(limit),
+        mNofRouted(0),
+        mNofDropped(0)
+    {
+    }
+
+    MessageFilter::~MessageFilter() {
+        for (size_t i = 0; i < mRoutes.size(); ++i) {
+            mRoutes[i].owned.reset();
+            if (mRoutes[i].fd != -1) {
+                close(mRoutes[i].fd);
+            }
+        }
+    }
+
+    void MessageFilter::load(const std::string & fileName) {
+        std::ifstream in(fileName);
+        if (!in) {
+            throw AppException("could not open filter file " + fileName);
+        }
+
+        std::string line;
+        size_t lineNo = 0;
+        while (std::getline(in, line)) {
+            ++lineNo;
+            size_t start = line.find_first_not_of(" \t\r");
+            if (start == std::string::npos || line[start] == '#') {
+                continue;
+            }
+            size_t end = line.find_first_of(" \t", start);
+            size_t patternStart = (end == std::string::npos) ? end : line.find_first_not_of(" \t", end);
+            size_t patternEnd = line.find_last_not_of(" \t\r");
+            if (patternStart == std::string::npos || patternStart > patternEnd) {
+                throw AppException(fileName + ":" + std::to_string(lineNo) + ": missing pattern");
+            }
+            addRule(line.substr(start, end - start),
+                    std::string_view(line).substr(patternStart, patternEnd + 1 - patternStart));
+        }
+
+        if (mMatcher.getNofPatterns() == 0) {
+            throw AppException("no patterns in filter file " + fileName);
+        }
+        compile();
+    }
+
+    void MessageFilter::addRule(const std::string & output, const std::string_view & pattern) {
+        size_t routeIdx = 0;
+        while (routeIdx < mRoutes.size() && mRoutes[routeIdx].name != output) {
+            ++routeIdx;
+        }
+
+        if (routeIdx == mRoutes.size()) {
+            if (mRoutes.size() == FILTER_MAX_ROUTES) {
+                throw AppException("too many filter outputs");
+            }
+            Route route;
+            route.name = output;
+            route.sink = nullptr;
+            route.queue = nullptr;
+            route.fd = -1;
+            route.webhook = nullptr;
+            route.nofMatched = 0;
+            open(route);
+            mRoutes.push_back(std::move(route));
+        }
+        mMatcher.add(pattern, routeIdx);
+    }
+
+    void MessageFilter::setOutput(LineSink *out) {
+        mOut = out;
+        for (size_t i = 0; i < mRoutes.size(); ++i) {
+            if (mRoutes[i].name == "-") {
+                mRoutes[i].sink = mOut;
+            }
+        }
+    }
+
+    void MessageFilter::compile() {
+        mMatcher.compile();
+    }
+
+    void MessageFilter::open(Route & route) {
+        if (route.name == "-") {
+            route.sink = mOut;
+            return;
+        }
+
+        if (route.name.compare(0, 7, "http://") == 0 || route.name.compare(0, 8, "https://") == 0) {
+            route.webhook = new WebhookSink(mReactor, route.name, mLimit);
+            route.owned.reset(route.webhook);
+            route.sink = route.webhook;
+            return;
+        }
+
+        route.fd = ::open(route.name.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (route.fd == -1) {
+            throw AppException("could not open filter output " + route.name + ": " + strerror(errno));
+        }
+        route.queue = new OutputQueue(mReactor, route.fd, mLimit, "");
+        route.owned.reset(route.queue);
+        route.sink = route.queue;
+    }
+
+    bool MessageFilter::route(const std::string_view & message) {
+        PatternMatcher::Mask mask = mMatcher.match(message);
+        if (mask == 0) {
+            ++mNofDropped;
+            return false;
+        }
+
+        ++mNofRouted;
+        while (mask != 0) {
+            Route & route = mRoutes[__builtin_ctzll(mask)];
+            mask &= mask - 1;
+            ++route.nofMatched;
+            if (route.sink != nullptr) {
+                route.sink->append(message);
+            }
+        }
+        return true;
+    }
+
+    void MessageFilter::flush() {
+        for (size_t i = 0; i < mRoutes.size(); ++i) {
+            if (mRoutes[i].owned) {
+                mRoutes[i].owned->flush();
+            }
+        }
+    }
+
+    void MessageFilter::drain() {
+        for (size_t i = 0; i < mRoutes.size(); ++i) {
+            if (mRoutes[i].owned) {
+                mRoutes[i].owned->drain();
+            }
+        }
+    }
+
+    bool MessageFilter::isPosting() const {
+        for (size_t i = 0; i < mRoutes.size(); ++i) {
+            if (mRoutes[i].webhook != nullptr && mRoutes[i].webhook->isPosting()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void MessageFilter::printStats(std::ostream & out) const {
+        out << "Filter: " << mMatcher.getNofPatterns() << " patterns in " << mMatcher.getNofStates() << " states, "
+            << mNofRouted << " messages routed, " << mNofDropped << " dropped" << std::endl;
+        for (size_t i = 0; i < mRoutes.size(); ++i) {
+            const Route & route = mRoutes[i];
+            out << "  " << route.name << ": " << route.nofMatched << " matched";
+            if (route.webhook != nullptr) {
+                out << ", " << route.webhook->getNofPosted() << " posts, " << route.webhook->getNofFailed() << " failed, "
+                    << route.webhook->getNofDropped() << " dropped";
+            } else if (route.queue != nullptr) {
+                out << ", " << route.queue->getNofDropped() << " dropped";
+            }
+            out << std::endl;
+        }
+    }
+}
@@ -0,0 +1,157 @@
+#ifndef __RCONFILTER_HH__
+#define __RCONFILTER_HH__
+
+#include "rconreactor.hh"
+#include "rconlisten.hh"
+#include <sys/types.h>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <ostream>
+
+/** The most outputs a filter routes to, one bit of the match mask each */
+#define FILTER_MAX_ROUTES 64
+/** The most matcher states, every state takes a 1 KiB transition row */
+#define FILTER_MAX_STATES 16384
+
+namespace Rcon {
+
+    class WebhookSink;
+
+
+    /** PatternMatcher class
+      @remarks
+        Finds which of a set of patterns occur in a text in a single pass,
+        with an Aho-Corasick automaton compiled into a dense transition table:
+        every byte of the text is one table lookup, no matter how many
+        patterns there are, and nothing is allocated while matching. Patterns
+        are matched ignoring the case of ASCII letters, which is folded into
+        the table as well. Each pattern belongs to a route, and a match
+        returns the routes of all patterns found as a bit mask.
+    */
+    class PatternMatcher {
+        public:
+            typedef uint64_t Mask;
+
+            explicit PatternMatcher();
+
+            virtual ~PatternMatcher() {}
+
+            /** Adds a pattern, which must not be empty, before compile()
+              @param
+                pattern The text to look for.
+              @param
+                route The route of the pattern, less than FILTER_MAX_ROUTES.
+            */
+            void add(const std::string_view & pattern, size_t route);
+
+            /** Computes the failure transitions, after which the matcher is ready. */
+            void compile();
+
+            /** Returns the routes of the patterns which occur in the text, 0 if none */
+            Mask match(const std::string_view & text) const;
+
+            size_t getNofPatterns() const;
+
+            size_t getNofStates() const;
+
+        protected:
+            /** Appends a state without transitions, returns its row offset */
+            uint32_t addState();
+
+            /** The transitions by state row offset plus byte, row offsets are state * 256 */
+            std::vector<uint32_t> mNext;
+            /** The routes found on entering each state */
+            std::vector<Mask> mOutput;
+            size_t mNofPatterns;
+            bool mCompiled;
+    };
+
+
+    /** MessageFilter class
+      @remarks
+        Routes the server messages of the stream to outputs by their text,
+        before anything is formatted or queued. The rules are read from a
+        file with one "<output> <pattern>" line per pattern, e.g.
+            kicks.log           has been kicked by BattlEye
+            -                   RCon admin #
+            http://hooks:8080/  Script Restriction
+        where the output is "-" for the standard output, an http:// URL to
+        post the lines to, or a file to append them to. A message goes to
+        the outputs of all patterns it contains, once each, and a message
+        which contains none is dropped without being copied.
+      @param
+        reactor The reactor the outputs are written on.
+      @param
+        out The queue of the standard output, may be null to discard the "-" lines.
+      @param
+        limit The maximum number of bytes queued per output.
+    */
+    class MessageFilter {
+        public:
+            explicit MessageFilter(Reactor & reactor, LineSink *out, size_t limit);
+
+            virtual ~MessageFilter();
+
+            MessageFilter(const MessageFilter &) = delete;
+            MessageFilter & operator=(const MessageFilter &) = delete;
+
+            /** Reads the rules of a filter file and compiles them. */
+            void load(const std::string & fileName);
+
+            /** Adds a rule, an output is opened when it is first named. */
+            void addRule(const std::string & output, const std::string_view & pattern);
+
+            /** Sets the queue of the standard output, null to discard the "-" lines. */
+            void setOutput(LineSink *out);
+
+            /** Compiles the rules added. */
+            void compile();
+
+            /** Routes a message to the outputs of the patterns it contains
+              @return
+                false if it contains none and was dropped.
+            */
+            bool route(const std::string_view & message);
+
+            /** Writes the queued lines of the outputs without blocking, except the standard output. */
+            void flush();
+
+            /** Writes the queued lines of the file outputs, blocking, and starts the last posts. */
+            void drain();
+
+            /** Returns true while a webhook post is in flight */
+            bool isPosting() const;
+
+            /** Prints the filter statistics to the stream. */
+            void printStats(std::ostream & out) const;
+
+        protected:
+            /** An output and the messages routed to it */
+            struct Route {
+                std::string name;
+                LineSink *sink;
+                std::unique_ptr<LineSink> owned;
+                OutputQueue *queue;
+                /** The descriptor of a file output, closed after the sink is gone */
+                int fd;
+                WebhookSink *webhook;
+                size_t nofMatched;
+            };
+
+            /** Opens an output of a route. */
+            void open(Route & route);
+
+            Reactor & mReactor;
+            LineSink *mOut;
+            size_t mLimit;
+            PatternMatcher mMatcher;
+            std::vector<Route> mRoutes;
+            size_t mNofRouted;
+            size_t mNofDropped;
+    };
+}
+
+#endif // __RCONFILTER_HH__
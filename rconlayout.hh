@@ -0,0 +1,187 @@
+#ifndef __RCONLAYOUT_HH__
+#define __RCONLAYOUT_HH__
+
+#include "rconmsg.hh"
+#include "rconexception.hh"
+#include <sys/types.h>
+#include <cstddef>
+#include <string>
+#include <utility>
+
+namespace Rcon {
+
+    namespace Protocol {
+
+        /** Packet layout description
+          @remarks
+            Describes the bytes a BattlEye packet has after the common
+            'B','E', crc32, 0xff prefix: the packet type byte at offset 7,
+            followed, in this order, by the optional sequence number, the
+            optional multipart marker, part count and part index, the optional
+            result byte and the optional payload. The header length and all
+            field offsets follow from the flags at compile time.
+        */
+        struct PacketLayout {
+            /** The message type the layout encodes and decodes */
+            Message::MsgType type;
+            /** The packet type byte at offset 7 */
+            uint8_t packetType;
+            /** True for packets sent by the server, which the client decodes */
+            bool inbound;
+            bool hasSeqNum;
+            bool hasParts;
+            bool hasResult;
+            bool hasPayload;
+            /** The name used in error messages */
+            const char *name;
+
+            constexpr size_t seqNumOffset() const {
+                return Message::INITIAL_PACKET_LENGTH;
+            }
+
+            constexpr size_t partsOffset() const {
+                return seqNumOffset() + (hasSeqNum ? 1 : 0);
+            }
+
+            constexpr size_t resultOffset() const {
+                return partsOffset() + (hasParts ? 3 : 0);
+            }
+
+            constexpr size_t headerLength() const {
+                return resultOffset() + (hasResult ? 1 : 0);
+            }
+        };
+
+
+        /** The layouts of all BattlEye RCon packets
+          @remarks
+            Inbound layouts sharing a packet type byte are tried in table
+            order, so the more specific layout comes first. A new packet
+            type needs a MsgType and an entry here.
+        */
+        constexpr PacketLayout PACKET_LAYOUTS[] = {
+            /* type                           packet type          inbound seqNum parts  result payload name */
+            { Message::MSG_LOGIN,             Message::PKT_LOGIN,  false,  false, false, false, true,  "login" },
+            { Message::MSG_LOGIN_RESP,        Message::PKT_LOGIN,  true,   false, false, true,  false, "login response" },
+            { Message::MSG_CMD,               Message::PKT_CMD,    false,  true,  false, false, true,  "command" },
+            { Message::MSG_CMD_PART_RESP,     Message::PKT_CMD,    true,   true,  true,  false, true,  "multipart command response" },
+            { Message::MSG_CMD_RESP,          Message::PKT_CMD,    true,   true,  false, false, true,  "command response" },
+            { Message::MSG_SRV_MSG,           Message::PKT_SERVER, true,   true,  false, false, true,  "server message" },
+            { Message::MSG_SRV_ACK,           Message::PKT_SERVER, false,  true,  false, false, false, "server ACK" }
+        };
+
+        constexpr size_t NOF_PACKET_LAYOUTS = sizeof(PACKET_LAYOUTS) / sizeof(PACKET_LAYOUTS[0]);
+
+        /** Returns the layout of a message type at compile time */
+        constexpr const PacketLayout & layoutOf(Message::MsgType type, size_t i = 0) {
+            return (i == NOF_PACKET_LAYOUTS) ? throw "no layout for message type"
+                 : (PACKET_LAYOUTS[i].type == type) ? PACKET_LAYOUTS[i] : layoutOf(type, i + 1);
+        }
+
+        static_assert(layoutOf(Message::MSG_CMD_PART_RESP).headerLength() <= Message::MAX_HEADER_LENGTH,
+                      "MAX_HEADER_LENGTH is too small for the longest packet layout");
+
+
+        /** Packet codec
+          @remarks
+            The encoder, decoder and length validation of every packet
+            layout, generated from PACKET_LAYOUTS at compile time. Decoding
+            compares the packet against the inbound layouts without any
+            virtual dispatch and fills a MessageView.
+        */
+        struct PacketCodec {
+
+            /** Encodes the header of a packet of message type T
+              @return
+                The header length, the CRC32 is left to the caller.
+            */
+            template <Message::MsgType T>
+            static size_t encodeHeader(uint8_t *header, uint8_t seqNum = 0, uint8_t nofParts = 0,
+                                       uint8_t partIdx = 0, uint8_t result = 0) {
+                constexpr const PacketLayout & layout = layoutOf(T);
+
+                header[0] = 0x42;
+                header[1] = 0x45;
+                header[6] = 0xff;
+                header[7] = layout.packetType;
+                if constexpr (layout.hasSeqNum) {
+                    header[layout.seqNumOffset()] = seqNum;
+                }
+                if constexpr (layout.hasParts) {
+                    header[layout.partsOffset()] = Message::PKT_MULTI;
+                    header[layout.partsOffset() + 1] = nofParts;
+                    header[layout.partsOffset() + 2] = partIdx;
+                }
+                if constexpr (layout.hasResult) {
+                    header[layout.resultOffset()] = result;
+                }
+                return layout.headerLength();
+            }
+
+            /** Decodes the packet into view if it has the layout at index I
+              @remarks
+                The prefix and the CRC32 must have been checked already.
+                Throws a ProtocolException if the packet type matches but
+                its length or fields do not.
+              @return
+                false if the packet does not have the layout.
+            */
+            template <size_t I>
+            static bool decodeAs(const uint8_t *buffer, size_t length, MessageView & view) {
+                constexpr const PacketLayout & layout = PACKET_LAYOUTS[I];
+
+                if constexpr (!layout.inbound) {
+                    return false;
+                } else {
+                    if (buffer[7] != layout.packetType) {
+                        return false;
+                    }
+                    if constexpr (layout.hasParts) {
+                        /* Without the marker the packet is the plain layout after this one */
+                        if (length < layout.headerLength() || buffer[layout.partsOffset()] != Message::PKT_MULTI) {
+                            return false;
+                        }
+                    }
+                    if (layout.hasPayload ? (length < layout.headerLength()) : (length != layout.headerLength())) {
+                        throw ProtocolException(std::string("Malformed ") + layout.name + " received!");
+                    }
+
+                    view.type = layout.type;
+                    if constexpr (layout.hasSeqNum) {
+                        view.seqNum = buffer[layout.seqNumOffset()];
+                    }
+                    if constexpr (layout.hasParts) {
+                        view.nofParts = buffer[layout.partsOffset() + 1];
+                        view.partIdx = buffer[layout.partsOffset() + 2];
+                        if (view.nofParts == 0 || view.partIdx >= view.nofParts) {
+                            throw ProtocolException(std::string("Malformed ") + layout.name + " received!");
+                        }
+                    }
+                    if constexpr (layout.hasResult) {
+                        view.result = buffer[layout.resultOffset()];
+                    }
+                    if constexpr (layout.hasPayload) {
+                        view.payload = Message::extractView(buffer + layout.headerLength(), length - layout.headerLength());
+                    }
+                    return true;
+                }
+            }
+
+            /** Decodes the packet with the first matching inbound layout
+              @return
+                false if no inbound layout matches the packet type.
+            */
+            static bool decode(const uint8_t *buffer, size_t length, MessageView & view) {
+                return decodeAny(buffer, length, view, std::make_index_sequence<NOF_PACKET_LAYOUTS>());
+            }
+
+        private:
+            template <size_t... Is>
+            static bool decodeAny(const uint8_t *buffer, size_t length, MessageView & view, std::index_sequence<Is...>) {
+                return (decodeAs<Is>(buffer, length, view) || ...);
+            }
+        };
+    }
+}
+
+#endif // __RCONLAYOUT_HH__
@@ -0,0 +1,278 @@
+#include "rconlisten.hh"
+#include "rconmsg.hh"
+#include "rconexception.hh"
+#include "rconmetrics.hh"
+#include "rconfilter.hh"
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <climits>
+#include <cerrno>
+#include <cstring>
+
+
+namespace Rcon {
+
+    using namespace Protocol;
+
+
+    /* OutputQueue class */
+
+    OutputQueue::OutputQueue(Reactor & reactor, int fd, size_t limit, const std::string & spillFile) :
+        mReactor(reactor),
+        mFd(fd),
+        mSavedFlags(-1),
+        mPollable(false),
+        mWatching(false),
+        mClosed(false),
+        mLimit(limit),
+        mOffset(0),
+        mQueued(0),
+        mHighWater(0),
+        mNofDropped(0),
+        mNofSpilled(0),
+        mSpillFile(spillFile)
+    {
+        /* Pipes, sockets and terminals can be polled, regular files can not */
+        try {
+            mReactor.addSocket(mFd, this);
+            mReactor.watchReadable(mFd, false);
+            mPollable = true;
+        } catch (SocketException &) {
+            mPollable = false;
+        }
+
+        if (mPollable) {
+            mSavedFlags = fcntl(mFd, F_GETFL);
+            if (mSavedFlags != -1) {
+                fcntl(mFd, F_SETFL, mSavedFlags | O_NONBLOCK);
+            }
+        }
+    }
+
+    OutputQueue::~OutputQueue() {
+        if (mPollable) {
+            mReactor.removeSocket(mFd);
+            if (mSavedFlags != -1) {
+                fcntl(mFd, F_SETFL, mSavedFlags);
+            }
+        }
+    }
+
+    void OutputQueue::append(const std::string_view & line) {
+        if (mClosed) {
+            return;
+        }
+
+        if (mQueued + line.size() + 1 > mLimit) {
+            if (mSpillFile.empty()) {
+                ++mNofDropped;
+                return;
+            }
+            if (!mSpill.is_open()) {
+                mSpill.open(mSpillFile, std::ios::out | std::ios::app | std::ios::binary);
+                if (!mSpill) {
+                    throw AppException("could not open spill file " + mSpillFile);
+                }
+            }
+            mSpill.write(line.data(), line.size());
+            mSpill.put('\n');
+            ++mNofSpilled;
+            return;
+        }
+
+        if (mChunks.empty() || mChunks.back().size() + line.size() + 1 > OUTPUT_CHUNK_SIZE) {
+            mChunks.push_back(std::string());
+            mChunks.back().reserve(OUTPUT_CHUNK_SIZE);
+        }
+        mChunks.back().append(line.data(), line.size());
+        mChunks.back().push_back('\n');
+
+        mQueued += line.size() + 1;
+        if (mQueued > mHighWater) {
+            mHighWater = mQueued;
+        }
+    }
+
+    void OutputQueue::flush() {
+        const size_t MAX_IOVECS = (IOV_MAX < 64) ? IOV_MAX : 64;
+        struct iovec iov[MAX_IOVECS];
+
+        while (mQueued > 0 && !mClosed) {
+            size_t n = 0;
+            for (std::deque<std::string>::iterator it = mChunks.begin(); it != mChunks.end() && n < MAX_IOVECS; ++it, ++n) {
+                size_t skip = (n == 0) ? mOffset : 0;
+                iov[n].iov_base = &(*it)[skip];
+                iov[n].iov_len = it->size() - skip;
+            }
+
+            ssize_t nwritten = writev(mFd, iov, n);
+            if (nwritten == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                closed();
+                return;
+            }
+
+            mQueued -= nwritten;
+            size_t left = nwritten;
+            while (left > 0 && left >= mChunks.front().size() - mOffset) {
+                left -= mChunks.front().size() - mOffset;
+                mChunks.pop_front();
+                mOffset = 0;
+            }
+            mOffset += left;
+        }
+
+        bool watch = mPollable && mQueued > 0 && !mClosed;
+        if (watch != mWatching) {
+            mReactor.watchWritable(mFd, watch);
+            mWatching = watch;
+        }
+    }
+
+    void OutputQueue::drain() {
+        if (mPollable && mSavedFlags != -1) {
+            fcntl(mFd, F_SETFL, mSavedFlags);
+        }
+        flush();
+        if (mPollable && mSavedFlags != -1) {
+            fcntl(mFd, F_SETFL, mSavedFlags | O_NONBLOCK);
+        }
+        if (mSpill.is_open()) {
+            mSpill.flush();
+        }
+    }
+
+    bool OutputQueue::isClosed() const {
+        return mClosed;
+    }
+
+    size_t OutputQueue::getQueued() const {
+        return mQueued;
+    }
+
+    size_t OutputQueue::getHighWater() const {
+        return mHighWater;
+    }
+
+    size_t OutputQueue::getNofDropped() const {
+        return mNofDropped;
+    }
+
+    size_t OutputQueue::getNofSpilled() const {
+        return mNofSpilled;
+    }
+
+    void OutputQueue::onReadable() {
+        closed();
+    }
+
+    void OutputQueue::onWritable() {
+        flush();
+    }
+
+    void OutputQueue::closed() {
+        mClosed = true;
+        mChunks.clear();
+        mOffset = 0;
+        mQueued = 0;
+        if (mWatching) {
+            mReactor.watchWritable(mFd, false);
+            mWatching = false;
+        }
+    }
+
+
+    /* StreamListener class */
+
+    StreamListener::StreamListener(Reactor & reactor, Channel & channel, OutputWriter *output,
+                                   SequenceWindow & window) :
+        mReactor(reactor),
+        mChannel(channel),
+        mOutput(output),
+        mFilter(nullptr),
+        mServerWindow(window),
+        mKeepaliveTimer(0),
+        mNofMessages(0),
+        mNofBatches(0)
+    {
+        mKeepaliveTimer = mReactor.addTimer(KEEPALIVE_INTERVAL_MS, [this]() { keepalive(); });
+    }
+
+    StreamListener::~StreamListener() {
+        mReactor.cancelTimer(mKeepaliveTimer);
+    }
+
+    void StreamListener::handleView(Channel & channel, const MessageView & view) {
+        if (view.type != Message::MSG_SRV_MSG) {
+            /* Keepalive responses */
+            return;
+        }
+
+        ServerAck ack(view.seqNum);
+        channel.queue(ack);
+        ++mNofMessages;
+
+        SequenceWindow::Verdict verdict = mServerWindow.check(view.seqNum);
+        Metrics *metrics = channel.getMetrics();
+        if (metrics != nullptr) {
+            ++metrics->serverMessages;
+            metrics->duplicates += (verdict == SequenceWindow::SEQ_DUPLICATE) ? 1 : 0;
+        }
+        if (verdict == SequenceWindow::SEQ_DUPLICATE) {
+            return;
+        }
+        if (mFilter != nullptr) {
+            mFilter->route(view.payload);
+        } else if (mOutput != nullptr) {
+            mOutput->append(view.payload);
+        }
+    }
+
+    void StreamListener::handleError(Channel & channel, const Exception & e) {
+        mError = e.what();
+    }
+
+    void StreamListener::handleBatchEnd(Channel & channel) {
+        ++mNofBatches;
+        if (mOutput != nullptr) {
+            mOutput->flush();
+        }
+        if (mFilter != nullptr) {
+            mFilter->flush();
+        }
+    }
+
+    void StreamListener::setFilter(MessageFilter *filter) {
+        mFilter = filter;
+    }
+
+    std::string StreamListener::takeError() {
+        std::string error;
+        error.swap(mError);
+        return error;
+    }
+
+    void StreamListener::printStats(std::ostream & out) const {
+        out << "Stream: " << mNofMessages << " messages acknowledged in " << mNofBatches << " batches" << std::endl;
+        if (mOutput != nullptr) {
+            mOutput->printStats(out);
+        }
+        if (mFilter != nullptr) {
+            mFilter->printStats(out);
+        }
+        mServerWindow.printStats(out);
+    }
+
+    void StreamListener::keepalive() {
+        Command cmd("", mChannel.getCommandSequence().next());
+        mChannel.send(cmd);
+        mKeepaliveTimer = mReactor.addTimer(KEEPALIVE_INTERVAL_MS, [this]() { keepalive(); });
+    }
+}
@@ -0,0 +1,157 @@
+#ifndef __RCONLISTEN_HH__
+#define __RCONLISTEN_HH__
+
+#include "rcon.hh"
+#include "rconreactor.hh"
+#include "rconseq.hh"
+#include "rconwriter.hh"
+#include <sys/types.h>
+#include <string>
+#include <string_view>
+#include <deque>
+#include <fstream>
+#include <ostream>
+
+#define LISTEN_BATCH_SIZE 64
+#define LISTEN_QUEUE_LIMIT (1024 * 1024)
+#define OUTPUT_CHUNK_SIZE (64 * 1024)
+
+namespace Rcon {
+
+    class MessageFilter;
+
+
+    /** OutputQueue class
+      @remarks
+        A bounded output buffer in front of a possibly slow file descriptor.
+        Lines are appended to chunks which are written with writev() as far as
+        the descriptor takes them without blocking; the rest is written once the
+        reactor reports the descriptor writable again. Lines which do not fit
+        into the limit are appended to the spill file if one is given, and are
+        dropped otherwise, so the producer never waits for the consumer.
+        Descriptors which cannot be polled, like regular files, are written
+        blocking.
+      @param
+        reactor The reactor to watch writability on.
+      @param
+        fd The descriptor to write to, it is put into non-blocking mode until destruction.
+      @param
+        limit The maximum number of bytes kept in the queue.
+      @param
+        spillFile The file to append overflowing lines to, empty to drop them.
+    */
+    class OutputQueue : public SocketHandler, public LineSink {
+        public:
+            explicit OutputQueue(Reactor & reactor, int fd, size_t limit, const std::string & spillFile);
+
+            virtual ~OutputQueue();
+
+            /** Queues a line, which is terminated with a newline. */
+            virtual void append(const std::string_view & line);
+
+            /** Writes as much of the queue as possible without blocking. */
+            virtual void flush();
+
+            /** Writes the whole queue, blocking. */
+            virtual void drain();
+
+            /** Returns true once the reader of the descriptor has gone away */
+            bool isClosed() const;
+
+            /** Returns the number of bytes queued */
+            size_t getQueued() const;
+
+            /** Returns the highest number of bytes ever queued */
+            size_t getHighWater() const;
+
+            /** Returns the number of lines dropped because the queue was full */
+            size_t getNofDropped() const;
+
+            /** Returns the number of lines written to the spill file because the queue was full */
+            size_t getNofSpilled() const;
+
+            /** Called on errors and hangups only, readability is never watched. */
+            virtual void onReadable();
+
+            virtual void onWritable();
+
+        protected:
+            /** Gives up on the descriptor and discards the queue. */
+            void closed();
+
+            Reactor & mReactor;
+            int mFd;
+            int mSavedFlags;
+            bool mPollable;
+            bool mWatching;
+            bool mClosed;
+            size_t mLimit;
+            std::deque<std::string> mChunks;
+            size_t mOffset;
+            size_t mQueued;
+            size_t mHighWater;
+            size_t mNofDropped;
+            size_t mNofSpilled;
+            std::string mSpillFile;
+            std::ofstream mSpill;
+    };
+
+
+    /** StreamListener class
+      @remarks
+        Follows the server message stream of a logged in channel. Every
+        server message is acknowledged through the send batch of the channel
+        and its text is appended to the output queue, except for copies resent
+        by the server, which are acknowledged only; the acknowledgements of
+        a batch go out before the output is queued to the writer thread, so a
+        slow consumer never delays them. An empty command is sent every KEEPALIVE_INTERVAL_MS to
+        keep the session alive. With a filter, only the messages which
+        match its patterns are passed on, to the outputs of the filter.
+      @param
+        reactor The reactor which serves the channel.
+      @param
+        channel The logged in channel, preferably batching.
+      @param
+        output The queue for the message lines, may be null to only acknowledge.
+      @param
+        window The sequence window of the session, which may have seen messages already.
+    */
+    class StreamListener : public MessageHandler {
+        public:
+            explicit StreamListener(Reactor & reactor, Channel & channel, OutputWriter *output,
+                                    Protocol::SequenceWindow & window);
+
+            virtual ~StreamListener();
+
+            virtual void handleView(Channel & channel, const Protocol::MessageView & view);
+
+            virtual void handleError(Channel & channel, const Exception & e);
+
+            /** Writes the output of the batch once its acknowledgements have been sent. */
+            virtual void handleBatchEnd(Channel & channel);
+
+            /** Routes the messages through the filter instead of the output queue, null to stop. */
+            void setFilter(MessageFilter *filter);
+
+            /** Takes and clears the last channel error, empty if none */
+            std::string takeError();
+
+            /** Prints the stream statistics to the stream. */
+            void printStats(std::ostream & out) const;
+
+        protected:
+            void keepalive();
+
+            Reactor & mReactor;
+            Channel & mChannel;
+            OutputWriter *mOutput;
+            MessageFilter *mFilter;
+            Protocol::SequenceWindow & mServerWindow;
+            Reactor::TimerId mKeepaliveTimer;
+            std::string mError;
+            size_t mNofMessages;
+            size_t mNofBatches;
+    };
+}
+
+#endif // __RCONLISTEN_HH__
@@ -0,0 +1,443 @@
+#include "rconmetrics.hh"
+#include "rconexception.hh"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <sstream>
+#include <iomanip>
+
+
+namespace Rcon {
+
+    /* Bucket layout: the exact buckets below HISTOGRAM_SUB_BUCKETS, then half
+       as many linear buckets per power of two up to HISTOGRAM_MAX_EXPONENT */
+    static const int SUB_BUCKET_BITS = __builtin_ctz(HISTOGRAM_SUB_BUCKETS);
+    static const size_t HALF_BUCKETS = HISTOGRAM_SUB_BUCKETS / 2;
+    static const size_t NOF_BUCKETS = HISTOGRAM_SUB_BUCKETS + (HISTOGRAM_MAX_EXPONENT - SUB_BUCKET_BITS) * HALF_BUCKETS;
+
+    static_assert((HISTOGRAM_SUB_BUCKETS & (HISTOGRAM_SUB_BUCKETS - 1)) == 0, "HISTOGRAM_SUB_BUCKETS must be a power of two");
+    static_assert(HISTOGRAM_MAX_EXPONENT > SUB_BUCKET_BITS && HISTOGRAM_MAX_EXPONENT < 64, "HISTOGRAM_MAX_EXPONENT out of range");
+
+    /** The Prometheus bucket bounds in microseconds, from LAN to badly degraded servers */
+    static const uint64_t PROMETHEUS_BOUNDS_US[] = {
+        250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+    };
+
+
+    /** Writes microseconds as exact decimal seconds */
+    static void writeSeconds(std::ostream & out, uint64_t us) {
+        char text[32];
+        snprintf(text, sizeof(text), "%llu.%06llu", (unsigned long long)(us / 1000000), (unsigned long long)(us % 1000000));
+        out << text;
+    }
+
+
+    /* LatencyHistogram class */
+
+    LatencyHistogram::LatencyHistogram() :
+        mCounts(NOF_BUCKETS, 0),
+        mCount(0),
+        mSum(0),
+        mMin(0),
+        mMax(0)
+    {
+    }
+
+    size_t LatencyHistogram::bucketOf(uint64_t us) {
+        if (us < HISTOGRAM_SUB_BUCKETS) {
+            return us;
+        }
+        int shift = (63 - __builtin_clzll(us)) - (SUB_BUCKET_BITS - 1);
+        return HISTOGRAM_SUB_BUCKETS + (shift - 1) * HALF_BUCKETS + ((us >> shift) - HALF_BUCKETS);
+    }
+
+    uint64_t LatencyHistogram::lowestOf(size_t bucket) {
+        if (bucket < HISTOGRAM_SUB_BUCKETS) {
+            return bucket;
+        }
+        int shift = (bucket - HISTOGRAM_SUB_BUCKETS) / HALF_BUCKETS + 1;
+        uint64_t top = (bucket - HISTOGRAM_SUB_BUCKETS) % HALF_BUCKETS + HALF_BUCKETS;
+        return top << shift;
+    }
+
+    uint64_t LatencyHistogram::highestOf(size_t bucket) {
+        return (bucket + 1 < NOF_BUCKETS) ? lowestOf(bucket + 1) - 1 : ~(uint64_t)0;
+    }
+
+    void LatencyHistogram::record(uint64_t us) {
+        const uint64_t limit = ((uint64_t)1 << HISTOGRAM_MAX_EXPONENT) - 1;
+        if (us > limit) {
+            us = limit;
+        }
+        ++mCounts[bucketOf(us)];
+        if (mCount == 0 || us < mMin) {
+            mMin = us;
+        }
+        if (us > mMax) {
+            mMax = us;
+        }
+        ++mCount;
+        mSum += us;
+    }
+
+    void LatencyHistogram::recordSince(Reactor::Clock::time_point start) {
+        Reactor::Clock::duration elapsed = Reactor::Clock::now() - start;
+        int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+        record(us > 0 ? us : 0);
+    }
+
+    uint64_t LatencyHistogram::getCount() const {
+        return mCount;
+    }
+
+    uint64_t LatencyHistogram::getSum() const {
+        return mSum;
+    }
+
+    uint64_t LatencyHistogram::getMin() const {
+        return mMin;
+    }
+
+    uint64_t LatencyHistogram::getMax() const {
+        return mMax;
+    }
+
+    uint64_t LatencyHistogram::getPercentile(double q) const {
+        if (mCount == 0) {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)(q * mCount + 0.5);
+        rank = (rank < 1) ? 1 : (rank > mCount ? mCount : rank);
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < mCounts.size(); ++i) {
+            seen += mCounts[i];
+            if (seen >= rank) {
+                /* Report the bucket's upper end, but never more than was recorded */
+                uint64_t value = highestOf(i);
+                return (value > mMax) ? mMax : (value < mMin ? mMin : value);
+            }
+        }
+        return mMax;
+    }
+
+    uint64_t LatencyHistogram::getCountBelow(uint64_t us) const {
+        if (us >= mMax) {
+            return mCount;
+        }
+        uint64_t count = 0;
+        size_t last = bucketOf(us);
+        for (size_t i = 0; i <= last; ++i) {
+            count += mCounts[i];
+        }
+        return count;
+    }
+
+    void LatencyHistogram::printSummary(std::ostream & out, const std::string & name) const {
+        std::ios_base::fmtflags flags = out.flags();
+        std::streamsize precision = out.precision();
+
+        out << name << ": " << mCount << " samples";
+        if (mCount > 0) {
+            out << std::fixed << std::setprecision(2)
+                << ", min " << mMin / 1000.0
+                << ", p50 " << getPercentile(0.50) / 1000.0
+                << ", p90 " << getPercentile(0.90) / 1000.0
+                << ", p99 " << getPercentile(0.99) / 1000.0
+                << ", max " << mMax / 1000.0
+                << ", mean " << (double)mSum / mCount / 1000.0 << " ms";
+        }
+        out << std::endl;
+
+        out.flags(flags);
+        out.precision(precision);
+    }
+
+
+    /* Metrics class */
+
+    void Metrics::printSummary(std::ostream & out) const {
+        out << "packets: " << packetsSent << " sent (" << bytesSent << " bytes), "
+            << packetsReceived << " received (" << bytesReceived << " bytes), "
+            << crcFailures << " CRC failures, " << decodeErrors << " decode errors, "
+            << kernelDrops << " kernel drops, "
+            << timeouts << " timeouts, " << duplicates << " duplicate server messages, "
+            << staleParts << " stale parts" << std::endl;
+        loginRtt.printSummary(out, "login rtt");
+        commandRtt.printSummary(out, "command rtt");
+        multipartCompletion.printSummary(out, "multipart completion");
+    }
+
+    std::string Metrics::label(const std::string & name, const std::string & value) {
+        std::string text(name + "=\"");
+        for (size_t i = 0; i < value.size(); ++i) {
+            if (value[i] == '\\' || value[i] == '"') {
+                text += '\\';
+                text += value[i];
+            } else if (value[i] == '\n') {
+                text += "\\n";
+            } else {
+                text += value[i];
+            }
+        }
+        return text + "\"";
+    }
+
+    static void writeCounter(std::ostream & out, const std::vector<Metrics::Series> & series,
+                             const char *name, const char *help, uint64_t Metrics:: *field) {
+        out << "# HELP " << name << " " << help << "\n";
+        out << "# TYPE " << name << " counter\n";
+        for (size_t i = 0; i < series.size(); ++i) {
+            out << name << "{" << series[i].labels << "} " << series[i].metrics->*field << "\n";
+        }
+    }
+
+    static void writeHistogram(std::ostream & out, const std::vector<Metrics::Series> & series,
+                               const char *name, const char *help, LatencyHistogram Metrics:: *field) {
+        out << "# HELP " << name << " " << help << "\n";
+        out << "# TYPE " << name << " histogram\n";
+        for (size_t i = 0; i < series.size(); ++i) {
+            const LatencyHistogram & histogram = series[i].metrics->*field;
+            const std::string & labels = series[i].labels;
+            const char *sep = labels.empty() ? "" : ",";
+
+            for (size_t b = 0; b < sizeof(PROMETHEUS_BOUNDS_US) / sizeof(PROMETHEUS_BOUNDS_US[0]); ++b) {
+                out << name << "_bucket{" << labels << sep << "le=\"";
+                writeSeconds(out, PROMETHEUS_BOUNDS_US[b]);
+                out << "\"} " << histogram.getCountBelow(PROMETHEUS_BOUNDS_US[b]) << "\n";
+            }
+            out << name << "_bucket{" << labels << sep << "le=\"+Inf\"} " << histogram.getCount() << "\n";
+            out << name << "_sum{" << labels << "} ";
+            writeSeconds(out, histogram.getSum());
+            out << "\n";
+            out << name << "_count{" << labels << "} " << histogram.getCount() << "\n";
+        }
+    }
+
+    void Metrics::writePrometheus(std::ostream & out, const std::vector<Series> & series) {
+        out << "# HELP rcon_session_up Whether the session to the server is logged in.\n";
+        out << "# TYPE rcon_session_up gauge\n";
+        for (size_t i = 0; i < series.size(); ++i) {
+            out << "rcon_session_up{" << series[i].labels << "} " << (series[i].up ? 1 : 0) << "\n";
+        }
+
+        writeCounter(out, series, "rcon_packets_sent_total", "Packets sent to the server.", &Metrics::packetsSent);
+        writeCounter(out, series, "rcon_packets_received_total", "Packets received from the server.", &Metrics::packetsReceived);
+        writeCounter(out, series, "rcon_bytes_sent_total", "Bytes sent to the server.", &Metrics::bytesSent);
+        writeCounter(out, series, "rcon_bytes_received_total", "Bytes received from the server.", &Metrics::bytesReceived);
+        writeCounter(out, series, "rcon_crc_failures_total", "Packets dropped for a CRC32 mismatch.", &Metrics::crcFailures);
+        writeCounter(out, series, "rcon_decode_errors_total", "Packets dropped for other decoding errors.", &Metrics::decodeErrors);
+        writeCounter(out, series, "rcon_kernel_drops_total", "Datagrams dropped by the kernel for a full receive buffer.", &Metrics::kernelDrops);
+        writeCounter(out, series, "rcon_timeouts_total", "Expired login and command timeouts.", &Metrics::timeouts);
+        writeCounter(out, series, "rcon_server_messages_total", "Server messages received, including duplicates.", &Metrics::serverMessages);
+        writeCounter(out, series, "rcon_duplicate_server_messages_total", "Server messages resent although already seen.", &Metrics::duplicates);
+        writeCounter(out, series, "rcon_stale_parts_total", "Multipart response parts dropped for not fitting the response collected.", &Metrics::staleParts);
+        writeCounter(out, series, "rcon_reconnects_total", "Logins which brought a lost session up again.", &Metrics::reconnects);
+        writeCounter(out, series, "rcon_replayed_commands_total", "Commands queued while the session was down and sent once up again.", &Metrics::replayed);
+        writeCounter(out, series, "rcon_cache_hits_total", "Commands answered from the daemon cache without a round trip.", &Metrics::cacheHits);
+
+        writeHistogram(out, series, "rcon_login_rtt_seconds", "Time from sending the login to its response.", &Metrics::loginRtt);
+        writeHistogram(out, series, "rcon_command_rtt_seconds", "Time from sending a command to the first packet of its response.", &Metrics::commandRtt);
+        writeHistogram(out, series, "rcon_multipart_completion_seconds", "Time from sending a command to the last part of its multipart response.", &Metrics::multipartCompletion);
+    }
+
+
+    /* MetricsEndpoint class */
+
+    MetricsEndpoint::MetricsEndpoint(Reactor & reactor, const RenderCallback & render) :
+        mReactor(reactor),
+        mRender(render),
+        mListenFd(-1),
+        mSweepTimer(0)
+    {
+    }
+
+    MetricsEndpoint::~MetricsEndpoint() {
+        mReactor.cancelTimer(mSweepTimer);
+        mConnections.clear();
+        if (mListenFd != -1) {
+            mReactor.removeSocket(mListenFd);
+            close(mListenFd);
+        }
+    }
+
+    void MetricsEndpoint::open(const std::string & address) {
+        std::string host("127.0.0.1");
+        std::string port(address);
+        size_t sep = address.rfind(':');
+        if (sep != std::string::npos) {
+            host = address.substr(0, sep);
+            port = address.substr(sep + 1);
+            /* [::1]:9100 */
+            if (host.size() >= 2 && host[0] == '[' && host[host.size()-1] == ']') {
+                host = host.substr(1, host.size() - 2);
+            }
+        }
+
+        struct addrinfo hints;
+        struct addrinfo *result, *rp;
+        memset(&hints, 0, sizeof(struct addrinfo));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+
+        int s = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result);
+        if (s != 0) {
+            throw SocketException("metrics address " + address + ": " + gai_strerror(s));
+        }
+
+        std::string error("could not listen on " + address);
+        for (rp = result; rp != nullptr; rp = rp->ai_next) {
+            mListenFd = socket(rp->ai_family, rp->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, rp->ai_protocol);
+            if (mListenFd == -1)
+                continue;
+
+            int on = 1;
+            setsockopt(mListenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            if (bind(mListenFd, rp->ai_addr, rp->ai_addrlen) != -1 && listen(mListenFd, 16) != -1)
+                break;
+
+            error = "bind/listen " + address + ": " + strerror(errno);
+            close(mListenFd);
+            mListenFd = -1;
+        }
+        freeaddrinfo(result);
+
+        if (mListenFd == -1) {
+            throw SocketException(error);
+        }
+        mReactor.addSocket(mListenFd, this);
+    }
+
+    void MetricsEndpoint::onReadable() {
+        for (;;) {
+            int fd = accept4(mListenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            mConnections[fd] = std::unique_ptr<Connection>(new Connection(*this, fd));
+        }
+    }
+
+    void MetricsEndpoint::closeConnection(int fd) {
+        mClosed.push_back(fd);
+        if (mSweepTimer != 0) {
+            return;
+        }
+        /* Never delete a connection from within its own callback */
+        mSweepTimer = mReactor.addTimer(0, [this]() {
+            mSweepTimer = 0;
+            for (size_t i = 0; i < mClosed.size(); ++i) {
+                mConnections.erase(mClosed[i]);
+            }
+            mClosed.clear();
+        });
+    }
+
+
+    /* MetricsEndpoint::Connection class */
+
+    MetricsEndpoint::Connection::Connection(MetricsEndpoint & endpoint, int fd) :
+        mEndpoint(endpoint),
+        mFd(fd),
+        mResponding(false)
+    {
+        mEndpoint.mReactor.addSocket(mFd, this);
+    }
+
+    MetricsEndpoint::Connection::~Connection() {
+        mEndpoint.mReactor.removeSocket(mFd);
+        close(mFd);
+    }
+
+    void MetricsEndpoint::Connection::onReadable() {
+        char buf[METRICS_REQUEST_LIMIT];
+
+        while (!mResponding) {
+            ssize_t nread = recv(mFd, buf, sizeof(buf), 0);
+            if (nread == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    mEndpoint.closeConnection(mFd);
+                }
+                return;
+            }
+            if (nread == 0) {
+                mEndpoint.closeConnection(mFd);
+                return;
+            }
+            mIn.append(buf, nread);
+
+            if (mIn.find("\r\n\r\n") != std::string::npos || mIn.find("\n\n") != std::string::npos) {
+                respond();
+            } else if (mIn.size() > METRICS_REQUEST_LIMIT) {
+                mEndpoint.closeConnection(mFd);
+                return;
+            }
+        }
+    }
+
+    void MetricsEndpoint::Connection::onWritable() {
+        flush();
+    }
+
+    void MetricsEndpoint::Connection::respond() {
+        mResponding = true;
+        mEndpoint.mReactor.watchReadable(mFd, false);
+
+        std::string requestLine = mIn.substr(0, mIn.find_first_of("\r\n"));
+        std::string method = requestLine.substr(0, requestLine.find(' '));
+        std::string path = requestLine.substr(method.size() + (method.size() < requestLine.size() ? 1 : 0));
+        path = path.substr(0, path.find(' '));
+
+        std::stringstream body;
+        std::string status;
+        if (method != "GET") {
+            status = "405 Method Not Allowed";
+            body << "only GET is supported\n";
+        } else if (path != "/metrics" && path != "/") {
+            status = "404 Not Found";
+            body << "metrics are served on /metrics\n";
+        } else {
+            status = "200 OK";
+            mEndpoint.mRender(body);
+        }
+
+        std::string text = body.str();
+        std::stringstream response;
+        response << "HTTP/1.0 " << status << "\r\n"
+                 << "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                 << "Content-Length: " << text.size() << "\r\n"
+                 << "Connection: close\r\n\r\n"
+                 << text;
+        mOut = response.str();
+        flush();
+    }
+
+    void MetricsEndpoint::Connection::flush() {
+        while (!mOut.empty()) {
+            ssize_t nwritten = send(mFd, mOut.data(), mOut.size(), MSG_NOSIGNAL);
+            if (nwritten == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    mEndpoint.mReactor.watchWritable(mFd, true);
+                    return;
+                }
+                break;
+            }
+            mOut.erase(0, nwritten);
+        }
+        mEndpoint.closeConnection(mFd);
+    }
+}
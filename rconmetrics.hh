@@ -0,0 +1,215 @@
+#ifndef __RCONMETRICS_HH__
+#define __RCONMETRICS_HH__
+
+#include "rconreactor.hh"
+#include <sys/types.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include <ostream>
+
+#define HISTOGRAM_SUB_BUCKETS 32
+#define HISTOGRAM_MAX_EXPONENT 36
+#define METRICS_REQUEST_LIMIT 4096
+
+namespace Rcon {
+
+    /** LatencyHistogram class
+      @remarks
+        A fixed size, HDR-style log-linear histogram of latencies in
+        microseconds. Latencies below HISTOGRAM_SUB_BUCKETS are counted
+        exactly; every power of two above gets HISTOGRAM_SUB_BUCKETS / 2
+        linear buckets, so every recorded value is known to within about
+        6% over the whole range up to 2^HISTOGRAM_MAX_EXPONENT us. Recording
+        is a few shifts and an increment, without any allocation.
+    */
+    class LatencyHistogram {
+        public:
+            LatencyHistogram();
+
+            /** Records a latency in microseconds, larger values than the range are clamped. */
+            void record(uint64_t us);
+
+            /** Records the time passed since start */
+            void recordSince(Reactor::Clock::time_point start);
+
+            /** Returns the number of recorded latencies */
+            uint64_t getCount() const;
+
+            /** Returns the sum of all recorded latencies in microseconds */
+            uint64_t getSum() const;
+
+            /** Returns the lowest recorded latency, 0 if empty */
+            uint64_t getMin() const;
+
+            /** Returns the highest recorded latency, 0 if empty */
+            uint64_t getMax() const;
+
+            /** Returns the latency at or below which a fraction q of all latencies fall, 0 if empty */
+            uint64_t getPercentile(double q) const;
+
+            /** Returns the number of latencies recorded at or below us, to the histogram precision */
+            uint64_t getCountBelow(uint64_t us) const;
+
+            /** Prints count, percentiles and maximum in milliseconds in a single line */
+            void printSummary(std::ostream & out, const std::string & name) const;
+
+        protected:
+            /** Returns the bucket of a latency */
+            static size_t bucketOf(uint64_t us);
+
+            /** Returns the lowest latency counted in a bucket */
+            static uint64_t lowestOf(size_t bucket);
+
+            /** Returns the highest latency counted in a bucket */
+            static uint64_t highestOf(size_t bucket);
+
+            std::vector<uint64_t> mCounts;
+            uint64_t mCount;
+            uint64_t mSum;
+            uint64_t mMin;
+            uint64_t mMax;
+    };
+
+
+    /** Session metrics
+      @remarks
+        The protocol counters and latency histograms of a single server
+        session. The channel counts packets, bytes and decode failures,
+        while the session owner records timeouts, duplicates and
+        latencies. Counters only ever grow, also across reconnects.
+    */
+    struct Metrics {
+        Metrics() :
+            packetsSent(0),
+            packetsReceived(0),
+            bytesSent(0),
+            bytesReceived(0),
+            crcFailures(0),
+            decodeErrors(0),
+            kernelDrops(0),
+            timeouts(0),
+            serverMessages(0),
+            duplicates(0),
+            staleParts(0),
+            reconnects(0),
+            replayed(0),
+            cacheHits(0)
+        {}
+
+        uint64_t packetsSent;
+        uint64_t packetsReceived;
+        uint64_t bytesSent;
+        uint64_t bytesReceived;
+        /** Packets dropped for a CRC32 mismatch */
+        uint64_t crcFailures;
+        /** Packets dropped for any other decoding error */
+        uint64_t decodeErrors;
+        /** Datagrams dropped by the kernel because the socket receive buffer was full */
+        uint64_t kernelDrops;
+        /** Expired login and command timeouts, including the ones followed by a resend */
+        uint64_t timeouts;
+        uint64_t serverMessages;
+        /** Server messages resent by the server although already seen */
+        uint64_t duplicates;
+        /** Multipart response parts dropped because they do not fit the response collected */
+        uint64_t staleParts;
+        /** Logins which brought a lost session up again */
+        uint64_t reconnects;
+        /** Commands queued while the session was down and sent once it was up again */
+        uint64_t replayed;
+        /** Commands answered from the cache of the daemon without a round trip */
+        uint64_t cacheHits;
+
+        /** From sending the login to its response */
+        LatencyHistogram loginRtt;
+        /** From first sending a command to the first packet of its response */
+        LatencyHistogram commandRtt;
+        /** From first sending a command to the last part of its multipart response */
+        LatencyHistogram multipartCompletion;
+
+        /** Prints the counters and the histogram summaries */
+        void printSummary(std::ostream & out) const;
+
+        /** A labelled set of metrics of one session for writePrometheus() */
+        struct Series {
+            /** The label pairs without braces, e.g. server="1.2.3.4:2302" */
+            std::string labels;
+            const Metrics *metrics;
+            bool up;
+        };
+
+        /** Returns name="value" with the value escaped for the Prometheus text format */
+        static std::string label(const std::string & name, const std::string & value);
+
+        /** Writes the metrics of all sessions in the Prometheus text exposition format */
+        static void writePrometheus(std::ostream & out, const std::vector<Series> & series);
+    };
+
+
+    /** MetricsEndpoint class
+      @remarks
+        A minimal HTTP/1.0 server on the reactor which answers every
+        GET /metrics request with the text rendered by the callback and
+        closes the connection, as expected by a Prometheus scraper.
+      @param
+        reactor The reactor to serve the connections on.
+      @param
+        render The function which renders the current metrics.
+    */
+    class MetricsEndpoint : public SocketHandler {
+        public:
+            typedef std::function<void(std::ostream &)> RenderCallback;
+
+            explicit MetricsEndpoint(Reactor & reactor, const RenderCallback & render);
+
+            virtual ~MetricsEndpoint();
+
+            /** Listens on [host:]port, host defaults to the loopback address. */
+            void open(const std::string & address);
+
+            /** Accepts pending scraper connections. */
+            virtual void onReadable();
+
+        protected:
+            /** A scraper connection, reading the request and writing the response */
+            class Connection : public SocketHandler {
+                public:
+                    explicit Connection(MetricsEndpoint & endpoint, int fd);
+
+                    virtual ~Connection();
+
+                    virtual void onReadable();
+
+                    virtual void onWritable();
+
+                protected:
+                    /** Builds the response to the complete request in mIn. */
+                    void respond();
+
+                    /** Writes the response, watching writability if the socket is full */
+                    void flush();
+
+                    MetricsEndpoint & mEndpoint;
+                    int mFd;
+                    std::string mIn;
+                    std::string mOut;
+                    bool mResponding;
+            };
+
+            /** Closes a connection after the current reactor iteration. */
+            void closeConnection(int fd);
+
+            Reactor & mReactor;
+            RenderCallback mRender;
+            int mListenFd;
+            std::map<int, std::unique_ptr<Connection> > mConnections;
+            std::vector<int> mClosed;
+            Reactor::TimerId mSweepTimer;
+    };
+}
+
+#endif // __RCONMETRICS_HH__
@@ -1,25 +1,9 @@
 #include "rconmsg.hh"
 #include "rconexception.hh"
+#include "rconcrc.hh"
+#include "rconlayout.hh"
 #include <sstream>
-#include <iostream>
 #include <cstring>
-#include <zlib.h>
-
-void debug(const uint8_t *buffer, size_t len) {
-    size_t chunk = 32;
-    size_t pos = 0;
-    char logbuf[DEBUG_BUFFER_SIZE];
-    do {
-        chunk = (len < chunk) ? len : 32;
-        len = len - chunk;
-        for (int i=0; i<chunk; ++i) {
-            snprintf(logbuf, DEBUG_BUFFER_SIZE, "%02x ", buffer[pos++]);
-            std::cerr << logbuf;
-        }
-        std::cerr << std::endl;
-    } while (chunk != len);
-}
-
 
 namespace Rcon {
 
@@ -28,11 +12,11 @@ namespace Rcon {
 
         /* Message base class */
 
-        uint8_t Message::mNextSeqNum = 0;
-
         Message *Message::decode(const uint8_t *buffer, size_t length) {
-            log_debug(buffer, length);
+            return create(decodeView(buffer, length));
+        }
 
+        MessageView Message::decodeView(const uint8_t *buffer, size_t length) {
             if (length < 8) {
                 throw ProtocolException("Empty packet received!");
             }
@@ -41,13 +25,13 @@ namespace Rcon {
                 throw ProtocolException("Key bytes 'B','E' were not matched in packet header!");
             }
 
-            uint32_t test_crc32 = crc32(0L, buffer + 6, length - 6);
+            uint32_t test_crc32 = Crc32::calculate(buffer + 6, length - 6);
             uint32_t *actual_crc32 = (uint32_t*)(buffer + 2);
 
             if (test_crc32 != *actual_crc32) {
                 std::stringstream error;
                 error << "CRC32 check failed against " << std::hex << test_crc32 << ", packet is corrupted!" << std::endl;
-                throw ProtocolException(error.str());
+                throw ChecksumException(error.str());
             }
 
             if (buffer[6] != 0xff) {
@@ -56,75 +40,106 @@ namespace Rcon {
                 throw ProtocolException(error.str());
             }
 
-            std::string msg;
+            MessageView view;
+            if (!PacketCodec::decode(buffer, length, view)) {
+                std::stringstream error;
+                error << "Unknown message type " << std::hex << (int)buffer[7] << " received!";
+                throw ProtocolException(error.str());
+            }
+            return view;
+        }
+
+        Message *Message::create(const MessageView & view) {
+
+            switch(view.type) {
 
-            switch(buffer[7]) {
+                case MSG_LOGIN_RESP:
+                    return new LoginResponse(view.result);
 
-                case PKT_LOGIN:
-                    if (length == 9) {
-                        return new LoginResponse(buffer[8]);
-                    } else { // PKT_MULTI
-                        msg = extractStr(buffer + 10, length - 10);
-                        return new CommandPartialResponse(buffer[8], buffer[9], msg);
-                    }
+                case MSG_CMD_PART_RESP:
+                    return new CommandPartialResponse(view.seqNum, view.nofParts, view.partIdx, std::string(view.payload));
 
-                case PKT_CMD:
-                    msg = extractStr(buffer + 9, length - 9);
-                    return new CommandResponse(buffer[8], msg);
+                case MSG_CMD_RESP:
+                    return new CommandResponse(view.seqNum, std::string(view.payload));
 
-                case PKT_SERVER:
-                    msg = extractStr(buffer + 9, length - 9);
-                    return new ServerMessage(buffer[8], msg);
+                case MSG_SRV_MSG:
+                    return new ServerMessage(view.seqNum, std::string(view.payload));
 
                 default:
-                    std::stringstream error;
-                    error << "Unknown message type " << std::hex << buffer[7] << " received!";
-                    throw ProtocolException(error.str());
-            };
-            return new LoginResponse(0xff);
+                    throw ProtocolException("No message to create from an empty view!");
+            }
         }
 
         Message::MsgType Message::getType() const {
             return mType;
         }
 
-        void Message::encodeHeader(uint8_t *buffer) const {
-            buffer[0] = 0x42;
-            buffer[1] = 0x45;
-            std::fill(buffer+2, buffer+5, 0x00);
-            buffer[6] = 0xff;
+        void Message::calculateCrc(uint8_t *header, size_t headerLength, const std::string_view & payload) const {
+            uint32_t crc = Crc32::update(0, header + 6, headerLength - 6);
+            crc = Crc32::update(crc, reinterpret_cast<const uint8_t*>(payload.data()), payload.size());
+            uint32_t *crcPtr = (uint32_t*)(header + 2);
+            *crcPtr = crc;
         }
 
-        void Message::calculateCrc(uint8_t *buffer, size_t length) const{
-            uint32_t *crcPtr = (uint32_t*)(buffer + 2);
-            *crcPtr = crc32(0L, buffer + 6, length - 6);
+        std::string_view Message::getPayload() const {
+            return std::string_view();
         }
 
-        uint8_t Message::getNextSeqNum() {
-            return mNextSeqNum++;
+        size_t Message::getEncodedSize() const {
+            uint8_t header[MAX_HEADER_LENGTH];
+            return encodeFields(header) + getPayload().size();
+        }
+
+        size_t Message::encode(uint8_t *buffer, size_t capacity) const {
+            size_t headerLength;
+            std::string_view payload;
+            uint8_t header[MAX_HEADER_LENGTH];
+            size_t length = encode(header, headerLength, payload);
+
+            if (length > capacity) {
+                std::stringstream error;
+                error << "Packet of " << length << " bytes does not fit into a " << capacity << " byte buffer!";
+                throw ProtocolException(error.str());
+            }
+            memcpy(buffer, header, headerLength);
+            memcpy(buffer + headerLength, payload.data(), payload.size());
+            return length;
+        }
+
+        size_t Message::encode(uint8_t *header, size_t & headerLength, std::string_view & payload) const {
+            headerLength = encodeFields(header);
+            payload = getPayload();
+
+            size_t length = headerLength + payload.size();
+            if (length > MAX_PACKET_LENGTH) {
+                std::stringstream error;
+                error << "Packet of " << length << " bytes exceeds the maximum of " << MAX_PACKET_LENGTH << " bytes!";
+                throw ProtocolException(error.str());
+            }
+            calculateCrc(header, headerLength, payload);
+            return length;
         }
 
         std::string Message::extractStr(const uint8_t *buffer, size_t length) {
-            char *tmp = new char[length+1];
-            std::copy(buffer, buffer + length, tmp);
-            tmp[length] = '\0';
-            const std::string & str = std::string(tmp);
-            delete tmp;
-            return str;
+            return std::string(extractView(buffer, length));
+        }
+
+        std::string_view Message::extractView(const uint8_t *buffer, size_t length) {
+            /* The printable string ends at the first NUL byte, if any */
+            const char *str = reinterpret_cast<const char*>(buffer);
+            const void *nul = memchr(str, '\0', length);
+            return std::string_view(str, nul ? static_cast<const char*>(nul) - str : length);
         }
 
 
         /* Login class */
 
-        size_t Login::encode(uint8_t *buffer) const {
-            size_t length = 8;
-            encodeHeader(buffer);
-            buffer[7] = PKT_LOGIN;
-            std::copy(mPassword.begin(), mPassword.end(), buffer + length);
-            length += mPassword.size();
-            calculateCrc(buffer, length);
-            log_debug(buffer, length);
-            return length;
+        size_t Login::encodeFields(uint8_t *header) const {
+            return PacketCodec::encodeHeader<MSG_LOGIN>(header);
+        }
+
+        std::string_view Login::getPayload() const {
+            return std::string_view(mPassword);
         }
 
         const std::string & Login::getPassword() const {
@@ -132,13 +147,8 @@ namespace Rcon {
         }
 
 
-        size_t LoginResponse::encode(uint8_t *buffer) const {
-            size_t length = 9;
-            encodeHeader(buffer);
-            buffer[7] = PKT_LOGIN;
-            buffer[8] = mResult;
-            calculateCrc(buffer, length);
-            return length;
+        size_t LoginResponse::encodeFields(uint8_t *header) const {
+            return PacketCodec::encodeHeader<MSG_LOGIN_RESP>(header, 0, 0, 0, mResult);
         }
 
         uint8_t LoginResponse::getResult() const {
@@ -152,15 +162,12 @@ namespace Rcon {
 
         /* ServerMessage class */
 
-        size_t ServerMessage::encode(uint8_t *buffer) const {
-            size_t length = 9;
-            encodeHeader(buffer);
-            buffer[7] = PKT_SERVER;
-            buffer[8] = mSeqNum;
-            std::copy(mMsg.begin(), mMsg.end(), buffer + length);
-            length += mMsg.size();
-            calculateCrc(buffer, length);
-            return length;
+        size_t ServerMessage::encodeFields(uint8_t *header) const {
+            return PacketCodec::encodeHeader<MSG_SRV_MSG>(header, mSeqNum);
+        }
+
+        std::string_view ServerMessage::getPayload() const {
+            return std::string_view(mMsg);
         }
 
         uint8_t ServerMessage::getSeqNum() const {
@@ -175,20 +182,19 @@ namespace Rcon {
             return mMsg;
         }
 
-        void ServerMessage::setMessage(const std::string & msg) {
-            mMsg = msg;
+        void ServerMessage::setMessage(std::string_view msg) {
+            mMsg.assign(msg.data(), msg.size());
+        }
+
+        void ServerMessage::reserveMessage(size_t capacity) {
+            mMsg.reserve(capacity);
         }
 
 
         /* ServerAck class */
 
-        size_t ServerAck::encode(uint8_t *buffer) const {
-            size_t length = 9;
-            encodeHeader(buffer);
-            buffer[7] = PKT_SERVER;
-            buffer[8] = mSeqNum;
-            calculateCrc(buffer, length);
-            return length;
+        size_t ServerAck::encodeFields(uint8_t *header) const {
+            return PacketCodec::encodeHeader<MSG_SRV_ACK>(header, mSeqNum);
         }
 
         uint8_t ServerAck::getSeqNum() const {
@@ -202,15 +208,12 @@ namespace Rcon {
 
         /* Command class */
 
-        size_t Command::encode(uint8_t *buffer) const {
-            size_t length = 9;
-            encodeHeader(buffer);
-            buffer[7] = PKT_CMD;
-            buffer[8] = mSeqNum;
-            std::copy(mCmdStr.begin(), mCmdStr.end(), buffer + length);
-            length += mCmdStr.size();
-            calculateCrc(buffer, length);
-            return length;
+        size_t Command::encodeFields(uint8_t *header) const {
+            return PacketCodec::encodeHeader<MSG_CMD>(header, mSeqNum);
+        }
+
+        std::string_view Command::getPayload() const {
+            return std::string_view(mCmdStr);
         }
 
         const std::string & Command::getCommand() const {
@@ -224,30 +227,27 @@ namespace Rcon {
 
         /* CommandResponse class */
 
-        size_t CommandResponse::encode(uint8_t *buffer) const {
-            size_t length = 9;
-            encodeHeader(buffer);
-            buffer[7] = PKT_CMD;
-            buffer[8] = mSeqNum;
-            std::copy(mMsg.begin(), mMsg.end(), buffer + length);
-            length += mMsg.size();
-            calculateCrc(buffer, length);
-            return length;
+        size_t CommandResponse::encodeFields(uint8_t *header) const {
+            return PacketCodec::encodeHeader<MSG_CMD_RESP>(header, mSeqNum);
         }
 
 
         /* CommandPartialResponse class */
 
-        size_t CommandPartialResponse::encode(uint8_t *buffer) const {
-            size_t length = 10;
-            encodeHeader(buffer);
-            buffer[7] = PKT_MULTI;
-            buffer[8] = mNofParts;
-            buffer[9] = mPartIdx;
-            std::copy(mMsg.begin(), mMsg.end(), buffer + length);
-            length += mMsg.size();
-            calculateCrc(buffer, length);
-            return length;
+        size_t CommandPartialResponse::encodeFields(uint8_t *header) const {
+            return PacketCodec::encodeHeader<MSG_CMD_PART_RESP>(header, mSeqNum, mNofParts, mPartIdx);
+        }
+
+        std::string_view CommandPartialResponse::getPayload() const {
+            return std::string_view(mMsg);
+        }
+
+        uint8_t CommandPartialResponse::getSeqNum() const {
+            return mSeqNum;
+        }
+
+        void CommandPartialResponse::setSeqNum(uint8_t seqnum) {
+            mSeqNum = seqnum;
         }
 
         uint8_t CommandPartialResponse::getNofParts() const {
@@ -270,8 +270,12 @@ namespace Rcon {
             return mMsg;
         }
 
-        void CommandPartialResponse::setMessage(const std::string & msg) {
-            mMsg = msg;
+        void CommandPartialResponse::setMessage(std::string_view msg) {
+            mMsg.assign(msg.data(), msg.size());
+        }
+
+        void CommandPartialResponse::reserveMessage(size_t capacity) {
+            mMsg.reserve(capacity);
         }
     }
 }
@@ -2,22 +2,16 @@
 #define __RCONMSG_HH__
 
 #include <sys/types.h>
+#include <cstddef>
 #include <vector>
 #include <string>
-
-#define DEBUG_BUFFER_SIZE   1536
-#ifdef DEBUG
-#define log_debug(buf, len) debug(buf, len)
-#else
-#define log_debug(buf, len)
-#endif
-
-void debug(const uint8_t *buffer, size_t len);
+#include <string_view>
 
 namespace Rcon {
 
     namespace Protocol {
 
+        struct MessageView;
 
         /** The abstract message class
           @remarks
@@ -42,9 +36,14 @@ namespace Rcon {
 
                 /** All packets are at least 8 bytes long */
                 static const int INITIAL_PACKET_LENGTH = 8;
+                /** The longest packet header, of a multipart command response */
+                static const size_t MAX_HEADER_LENGTH = 12;
+                /** The largest packet fitting into a single UDP datagram */
+                static const size_t MAX_PACKET_LENGTH = 65507;
 
                 /** The message type identifiers found inside the packets */
                 static const uint8_t PKT_LOGIN = 0;
+                /** The marker byte after the seqnum of a multipart command response */
                 static const uint8_t PKT_MULTI = 0;
                 static const uint8_t PKT_CMD = 1;
                 static const uint8_t PKT_SERVER = 2;
@@ -67,40 +66,127 @@ namespace Rcon {
                 static Message *decode(const uint8_t *buffer, size_t length);
 
 
-                /** Abstract encode method
+                /** A static non-owning decoder method
+                  @remarks
+                    Validates the packet like decode() does, but does not allocate.
+                    The payload of the returned view points into buffer, so the view
+                    is only valid as long as the buffer is.
+                  @param
+                    buffer The byte buffer holding the binary packet data
+                  @param
+                    length The length of the byte buffer.
+                  @return
+                    The view of the decoded packet.
+                */
+                static MessageView decodeView(const uint8_t *buffer, size_t length);
+
+
+                /** Creates the owning message subclass instance for a decoded view
+                  @param
+                    view The view returned by decodeView().
+                  @return
+                    The corresponding message subclass instance, owned by the caller.
+                */
+                static Message *create(const MessageView & view);
+
+
+                /** Returns the exact size of the encoded packet in bytes */
+                size_t getEncodedSize() const;
+
+                /** Bounds checked encode method
+                  @remarks
+                    Throws a ProtocolException if the packet does not fit into
+                    capacity bytes or into a single datagram.
                   @param
                     buffer The packet byte buffer which to encode the message
                     subclass instance to.
+                  @param
+                    capacity The size of the buffer in bytes.
                   @return
                     The size of the message encoded in the packet buffer
                     in bytes.
                 */
-                virtual size_t encode(uint8_t *buffer) const = 0;
+                size_t encode(uint8_t *buffer, size_t capacity) const;
+
+                /** Scatter-gather encode method
+                  @remarks
+                    Encodes the packet header, including the CRC32 over header and
+                    payload, without copying the payload. The packet is the header
+                    followed by the payload, e.g. as two iovecs for sendmsg(). The
+                    payload view is only valid as long as the message is unchanged.
+                    Throws a ProtocolException if the packet does not fit into a
+                    single datagram.
+                  @param
+                    header The buffer to encode the header to, MAX_HEADER_LENGTH bytes.
+                  @param
+                    headerLength Returns the length of the encoded header in bytes.
+                  @param
+                    payload Returns the payload following the header.
+                  @return
+                    The size of the whole packet in bytes.
+                */
+                size_t encode(uint8_t *header, size_t & headerLength, std::string_view & payload) const;
+
+                /** Abstract header encode method
+                  @param
+                    header The buffer to encode the packet header up to the payload
+                    to, MAX_HEADER_LENGTH bytes. The CRC32 is left to the caller.
+                  @return
+                    The length of the header in bytes.
+                */
+                virtual size_t encodeFields(uint8_t *header) const = 0;
+
+                /** Returns the payload following the packet header, empty by default */
+                virtual std::string_view getPayload() const;
 
                 /** Returns the type of the message */
                 MsgType getType() const;
 
+                /** Helper method to extract a printable string from packet data. */
+                static std::string extractStr(const uint8_t *buffer, size_t length);
+
+                /** Helper method to view the printable string in packet data. */
+                static std::string_view extractView(const uint8_t *buffer, size_t length);
+
             protected:
                 /** Called by subclasses only so the correct message type may be set. */
                 explicit Message(MsgType type) :
                     mType(type)
                 {}
 
-                /** Encodes the RCon packet header for the packet */
-                void encodeHeader(uint8_t *buffer) const;
+                /** Calculates the CRC32 sum over the header and payload pieces
+                    of the packet into the header, see Crc32. */
+                void calculateCrc(uint8_t *header, size_t headerLength, const std::string_view & payload) const;
 
-                /** Calculates the zlib crc32 sum for the encoded packet in the buffer. */
-                void calculateCrc(uint8_t *buffer, size_t length) const;
+                MsgType mType;
 
-                /** Get next command packet sequence number, unique at least 256 times. */
-                static uint8_t getNextSeqNum();
+        };
 
-                MsgType mType;
-                static uint8_t mNextSeqNum;
 
-            private:
-                /** Helper method to extract a printable string from packet data. */
-                static std::string extractStr(const uint8_t *buffer, size_t length);
+        /** Decoded message view
+          @remarks
+            A tagged, non-owning view of a received packet. Only the fields
+            of the packet type given by type are meaningful:
+             - MSG_LOGIN_RESP: result.
+             - MSG_CMD_RESP, MSG_SRV_MSG: seqNum and payload.
+             - MSG_CMD_PART_RESP: seqNum, nofParts, partIdx and payload.
+            The payload points into the buffer passed to Message::decodeView().
+        */
+        struct MessageView {
+            MessageView() :
+                type(Message::MSG_NONE),
+                seqNum(0),
+                nofParts(0),
+                partIdx(0),
+                result(0)
+            {}
+
+            Message::MsgType type;
+            uint8_t seqNum;
+            uint8_t nofParts;
+            uint8_t partIdx;
+            uint8_t result;
+            std::string_view payload;
         };
 
 
@@ -128,13 +214,16 @@ namespace Rcon {
 
                 virtual ~Login() {}
 
-                /** encode method to serialize the login packet data
+                /** Encodes the login packet header
                   @param
-                    buffer The byte buffer in which to encode the packet.
+                    header The buffer in which to encode the header.
                   @return
-                    The size in bytes of the encoded packet in buffer.
+                    The length in bytes of the header.
                 */
-                virtual size_t encode(uint8_t *buffer) const;
+                virtual size_t encodeFields(uint8_t *header) const;
+
+                /** Returns the password following the header */
+                virtual std::string_view getPayload() const;
 
                 /** Fetches the password from the login message */
                 const std::string & getPassword() const;
@@ -168,13 +257,13 @@ namespace Rcon {
 
                 virtual ~LoginResponse() {}
 
-                /** encode method to serialize the login response packet data
+                /** Encodes the login response packet header
                   @param
-                    buffer The byte buffer in which to encode the packet.
+                    header The buffer in which to encode the header.
                   @return
-                    The size in bytes of the encoded packet in buffer.
+                    The length in bytes of the header.
                 */
-                virtual size_t encode(uint8_t *buffer) const;
+                virtual size_t encodeFields(uint8_t *header) const;
 
                 /** Fetches the result from the login response message */
                 uint8_t getResult() const;
@@ -215,13 +304,16 @@ namespace Rcon {
 
                 virtual ~ServerMessage() {}
 
-                /** encode method to serialize the server message packet data
+                /** Encodes the server message packet header
                   @param
-                    buffer The byte buffer in which to encode the packet.
+                    header The buffer in which to encode the header.
                   @return
-                    The size in bytes of the encoded packet in buffer.
+                    The length in bytes of the header.
                 */
-                virtual size_t encode(uint8_t *buffer) const;
+                virtual size_t encodeFields(uint8_t *header) const;
+
+                /** Returns the message text following the header */
+                virtual std::string_view getPayload() const;
 
                 /** Fetches the sequence number from the server message */
                 uint8_t getSeqNum() const;
@@ -232,8 +324,11 @@ namespace Rcon {
                 /** Fetches the text message from the server message */
                 const std::string & getMessage() const;
 
-                /** Sets the text message in the server message */
-                void setMessage(const std::string & msg);
+                /** Sets the text message in the server message, reusing its storage */
+                void setMessage(std::string_view msg);
+
+                /** Reserves storage for text messages of up to capacity bytes */
+                void reserveMessage(size_t capacity);
 
             protected:
                 /** Called by subclass only so the correct message type may be set. */
@@ -277,13 +372,13 @@ namespace Rcon {
 
                 virtual ~ServerAck() {}
 
-                /** encode method to serialize the server ACK packet data
+                /** Encodes the server ACK packet header
                   @param
-                    buffer The byte buffer in which to encode the packet.
+                    header The buffer in which to encode the header.
                   @return
-                    The size in bytes of the encoded packet in buffer.
+                    The length in bytes of the header.
                 */
-                virtual size_t encode(uint8_t *buffer) const;
+                virtual size_t encodeFields(uint8_t *header) const;
 
                 /** Fetches the text message from the server ACK message */
                 uint8_t getSeqNum() const;
@@ -318,12 +413,7 @@ namespace Rcon {
         class Command : public ServerAck {
             public:
                 Command() :
-                    ServerAck(MSG_CMD, getNextSeqNum())
-                {}
-
-                explicit Command(const std::string & cmd) :
-                    ServerAck(MSG_CMD, getNextSeqNum()),
-                    mCmdStr(cmd)
+                    ServerAck(MSG_CMD, 0)
                 {}
 
                 explicit Command(const std::string & cmd, uint8_t seqnum) :
@@ -332,19 +422,22 @@ namespace Rcon {
                 {}
 
                 Command(const Command & command) :
-                    ServerAck(MSG_CMD, getNextSeqNum()),
+                    ServerAck(MSG_CMD, command.getSeqNum()),
                     mCmdStr(command.mCmdStr)
                 {}
 
                 virtual ~Command() {}
 
-                /** encode method to serialize the RCon command packet data
+                /** Encodes the RCon command packet header
                   @param
-                    buffer The byte buffer in which to encode the packet.
+                    header The buffer in which to encode the header.
                   @return
-                    The size in bytes of the encoded packet in buffer.
+                    The length in bytes of the header.
                 */
-                virtual size_t encode(uint8_t *buffer) const;
+                virtual size_t encodeFields(uint8_t *header) const;
+
+                /** Returns the command following the header */
+                virtual std::string_view getPayload() const;
 
                 /** Fetches the command from the command message */
                 const std::string & getCommand() const;
@@ -383,19 +476,24 @@ namespace Rcon {
 
                 virtual ~CommandResponse() {}
 
-                /** encode method to serialize the RCon command response packet data
+                /** Encodes the RCon command response packet header
                   @param
-                    buffer The byte buffer in which to encode the packet.
+                    header The buffer in which to encode the header.
                   @return
-                    The size in bytes of the encoded packet in buffer.
+                    The length in bytes of the header.
                 */
-                virtual size_t encode(uint8_t *buffer) const;
+                virtual size_t encodeFields(uint8_t *header) const;
         };
 
 
         /** Command partial response message class
           @remarks
             This class represents the BattlEye RCon command partial response message packet.
+            Command responses too large for a single packet are split into nofParts
+            packets, which share the sequence number of the command and may arrive
+            in any order.
+          @param
+            seqnum The sequence number of the command this is a response to.
           @param
             nofParts The number of expected parts of all command partial response messages
             to receive.
@@ -412,6 +510,15 @@ namespace Rcon {
 
                 explicit CommandPartialResponse(uint8_t nofParts, uint8_t partIdx, const std::string & msg) :
                     Message(MSG_CMD_PART_RESP),
+                    mSeqNum(0),
+                    mNofParts(nofParts),
+                    mPartIdx(partIdx),
+                    mMsg(msg)
+                {}
+
+                explicit CommandPartialResponse(uint8_t seqnum, uint8_t nofParts, uint8_t partIdx, const std::string & msg) :
+                    Message(MSG_CMD_PART_RESP),
+                    mSeqNum(seqnum),
                     mNofParts(nofParts),
                     mPartIdx(partIdx),
                     mMsg(msg)
@@ -419,6 +526,7 @@ namespace Rcon {
 
                 CommandPartialResponse(const CommandPartialResponse & partResp) :
                     Message(MSG_CMD_PART_RESP),
+                    mSeqNum(partResp.mSeqNum),
                     mNofParts(partResp.mNofParts),
                     mPartIdx(partResp.mPartIdx),
                     mMsg(partResp.mMsg)
@@ -426,13 +534,22 @@ namespace Rcon {
 
                 virtual ~CommandPartialResponse() {}
 
-                /** encode method to serialize the RCon command partial response packet data
+                /** Encodes the RCon command partial response packet header
                   @param
-                    buffer The byte buffer in which to encode the packet.
+                    header The buffer in which to encode the header.
                   @return
-                    The size in bytes of the encoded packet in buffer.
+                    The length in bytes of the header.
                 */
-                virtual size_t encode(uint8_t *buffer) const;
+                virtual size_t encodeFields(uint8_t *header) const;
+
+                /** Returns the part text following the header */
+                virtual std::string_view getPayload() const;
+
+                /** Fetches the command sequence number from the command partial response message */
+                uint8_t getSeqNum() const;
+
+                /** Sets the command sequence number in the command partial response message */
+                void setSeqNum(uint8_t seqnum);
 
                 /** Fetches the number of parts from the command partial response message */
                 uint8_t getNofParts() const;
@@ -449,10 +566,14 @@ namespace Rcon {
                 /** Fetches the command result text from the command message */
                 const std::string & getMessage() const;
 
-                /** Sets the number of parts in the command partial response message */
-                void setMessage(const std::string & msg);
+                /** Sets the command result text in the command partial response message, reusing its storage */
+                void setMessage(std::string_view msg);
+
+                /** Reserves storage for command result texts of up to capacity bytes */
+                void reserveMessage(size_t capacity);
 
             protected:
+                uint8_t mSeqNum;
                 uint8_t mNofParts;
                 uint8_t mPartIdx;
                 std::string mMsg;
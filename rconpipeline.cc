@@ -0,0 +1,371 @@
+#include "rconpipeline.hh"
+#include "rconmsg.hh"
+#include "rconexception.hh"
+#include "rconmetrics.hh"
+#include <algorithm>
+#include <cctype>
+
+
+namespace Rcon {
+
+    using namespace Protocol;
+
+    Pipeline::Pipeline(Reactor & reactor, Channel & channel, size_t window, const ResultCallback & callback) :
+        mReactor(reactor),
+        mChannel(channel),
+        mWindow(window),
+        mCallback(callback),
+        mDeadlineMs(DEFAULT_TIMEOUT_MS),
+        mNofQueued(0),
+        mFirstIndex(0),
+        mNextIndex(0),
+        mInFlight(256),
+        mNofInFlight(0),
+        mNofFailed(0),
+        mMaxRate(0),
+        mRate(0),
+        mTokens(0),
+        mBurst(0),
+        mPaceTimer(0),
+        mCoalescing(false)
+    {
+        if (mWindow < 1 || mWindow > MAX_PIPELINE_WINDOW) {
+            throw AppException("pipeline window out of range");
+        }
+    }
+
+
+    Pipeline::~Pipeline() {
+        mReactor.cancelTimer(mPaceTimer);
+        for (size_t i = 0; i < mInFlight.size(); ++i) {
+            if (mInFlight[i].busy) {
+                mReactor.cancelTimer(mInFlight[i].timer);
+            }
+        }
+    }
+
+
+    void Pipeline::submit(const std::string & cmd, uint64_t tag, Priority priority) {
+        if (mCoalescing) {
+            if (!isReadOnly(cmd)) {
+                /* What is read after a command which may change it is never shared with what was read before */
+                mLeaders.clear();
+            } else {
+                std::unordered_map<std::string, uint64_t>::iterator it = mLeaders.find(cmd);
+                if (it != mLeaders.end()) {
+                    mFollowers[it->second].push_back(tag);
+                    return;
+                }
+                mLeaders[cmd] = tag;
+            }
+        }
+
+        Submission submission;
+        submission.command = cmd;
+        submission.tag = tag;
+        submission.priority = priority;
+        mQueues[priority].push_back(submission);
+        ++mNofQueued;
+        pump();
+    }
+
+
+    void Pipeline::pump() {
+
+        /* The window bounds the results not yet passed to the callback,
+           so a stalled command also stalls the reordering buffer. */
+        while (mNofQueued > 0 && mNextIndex - mFirstIndex < mWindow && mPaceTimer == 0) {
+
+            /* Never reuse a sequence number which is still in flight */
+            if (mInFlight[mChannel.getCommandSequence().peek()].busy) {
+                break;
+            }
+
+            if (mMaxRate > 0) {
+                refill();
+                if (mTokens < 1.0) {
+                    int delayMs = (int)((1.0 - mTokens) * 1000.0 / mRate) + 1;
+                    mPaceTimer = mReactor.addTimer(delayMs, [this]() {
+                        mPaceTimer = 0;
+                        pump();
+                    });
+                    break;
+                }
+                mTokens -= 1.0;
+            }
+
+            std::deque<Submission> *queue = mQueues;
+            while (queue->empty()) {
+                ++queue;
+            }
+
+            uint8_t seqNum = mChannel.getCommandSequence().next();
+            InFlight & slot = mInFlight[seqNum];
+            slot.busy = true;
+            slot.index = mNextIndex++;
+            slot.attempt = 0;
+            slot.sentAt = Reactor::Clock::now();
+            slot.deadline = slot.sentAt + std::chrono::milliseconds(mDeadlineMs);
+            slot.answered = false;
+            slot.reassembler.start(seqNum);
+
+            Result result;
+            result.command = queue->front().command;
+            result.tag = queue->front().tag;
+            queue->pop_front();
+            --mNofQueued;
+            mResults.push_back(result);
+            ++mNofInFlight;
+
+            send(seqNum);
+        }
+        /* With batching all commands sent at once go out with a single sendmmsg() */
+        mChannel.flush();
+    }
+
+
+    void Pipeline::send(uint8_t seqNum) {
+        InFlight & slot = mInFlight[seqNum];
+        Command cmd(mResults[slot.index - mFirstIndex].command, seqNum);
+        mChannel.queue(cmd);
+        arm(seqNum);
+    }
+
+
+    void Pipeline::arm(uint8_t seqNum) {
+        InFlight & slot = mInFlight[seqNum];
+        int timeoutMs = mChannel.getRtt().getTimeout(slot.attempt, slot.deadline);
+        slot.timer = mReactor.addTimer(timeoutMs, [this, seqNum]() { timeout(seqNum); });
+    }
+
+
+    void Pipeline::timeout(uint8_t seqNum) {
+        InFlight & slot = mInFlight[seqNum];
+        Metrics *metrics = mChannel.getMetrics();
+        if (metrics != nullptr) {
+            ++metrics->timeouts;
+        }
+        if (RCON_TRACING(timeout)) {
+            Trace::timeout(mChannel.getTraceId(), seqNum, slot.attempt);
+        }
+
+        /* Only commands sent after the rate was last halved tell whether the new rate is too high */
+        Reactor::Clock::time_point now = Reactor::Clock::now();
+        if (mMaxRate > 0 && slot.sentAt >= mDecreased) {
+            refill();
+            mRate = std::max(mRate / 2, std::min(mMaxRate, PIPELINE_MIN_RATE));
+            mDecreased = now;
+        }
+
+        if (now >= slot.deadline) {
+            std::string error = slot.reassembler.isStarted() ?
+                "Protocol Error: incomplete response, " + slot.reassembler.describeMissing() :
+                "Protocol Error: timeout";
+            complete(seqNum, false, std::string(), error);
+            return;
+        }
+        /* Same seqnum, so a late response to an earlier attempt still matches */
+        ++slot.attempt;
+        send(seqNum);
+        mChannel.flush();
+    }
+
+
+    bool Pipeline::handleView(const MessageView & view) {
+
+        if (view.type != Message::MSG_CMD_RESP && view.type != Message::MSG_CMD_PART_RESP) {
+            return false;
+        }
+
+        InFlight & slot = mInFlight[view.seqNum];
+        if (!slot.busy) {
+            return false;
+        }
+
+        Metrics *metrics = mChannel.getMetrics();
+        Reassembler::PartStatus status = Reassembler::PART_ADDED;
+        if (view.type == Message::MSG_CMD_PART_RESP) {
+            status = slot.reassembler.addPart(view);
+            if (status == Reassembler::PART_MISMATCHED) {
+                /* A late part of an earlier command with the same seqnum */
+                if (metrics != nullptr) {
+                    ++metrics->staleParts;
+                }
+                return true;
+            }
+        }
+        if (!slot.answered) {
+            if (metrics != nullptr) {
+                metrics->commandRtt.recordSince(slot.sentAt);
+            }
+            /* After a resend the round trip is ambiguous */
+            if (slot.attempt == 0) {
+                mChannel.getRtt().sampleSince(slot.sentAt);
+            }
+            slot.answered = true;
+        }
+
+        if (view.type == Message::MSG_CMD_RESP) {
+            complete(view.seqNum, true, std::string(view.payload), std::string());
+            return true;
+        }
+
+        mReactor.cancelTimer(slot.timer);
+        if (status == Reassembler::PART_COMPLETE) {
+            if (metrics != nullptr) {
+                metrics->multipartCompletion.recordSince(slot.sentAt);
+            }
+            complete(view.seqNum, true, slot.reassembler.str(), std::string());
+        } else {
+            arm(view.seqNum);
+        }
+        return true;
+    }
+
+
+    void Pipeline::complete(uint8_t seqNum, bool ok, const std::string & output, const std::string & error) {
+        InFlight & slot = mInFlight[seqNum];
+        mReactor.cancelTimer(slot.timer);
+
+        Result & result = mResults[slot.index - mFirstIndex];
+        result.done = true;
+        result.ok = ok;
+        result.output = output;
+        result.error = error;
+        if (!ok) {
+            ++mNofFailed;
+        } else if (mMaxRate > 0) {
+            refill();
+            mRate = std::min(mMaxRate, mRate + 1.0);
+        }
+
+        slot.busy = false;
+        --mNofInFlight;
+
+        emit();
+        pump();
+    }
+
+
+    void Pipeline::emit() {
+        while (!mResults.empty() && mResults.front().done) {
+            const Result & result = mResults.front();
+
+            /* Taken out first, so the callback may submit the same command again */
+            std::vector<uint64_t> followers;
+            if (mCoalescing) {
+                takeFollowers(result.command, result.tag, followers);
+            }
+
+            mCallback(result);
+            for (size_t i = 0; i < followers.size(); ++i) {
+                Result follower(result);
+                follower.tag = followers[i];
+                if (!follower.ok) {
+                    ++mNofFailed;
+                }
+                mCallback(follower);
+            }
+            mResults.pop_front();
+            ++mFirstIndex;
+        }
+    }
+
+
+    bool Pipeline::isIdle() const {
+        return mNofQueued == 0 && mResults.empty();
+    }
+
+
+    size_t Pipeline::getNofQueued() const {
+        return mNofQueued;
+    }
+
+
+    std::deque<Pipeline::Submission> Pipeline::takeQueued() {
+        std::deque<Submission> queued;
+        for (size_t i = 0; i < NOF_PRIORITIES; ++i) {
+            while (!mQueues[i].empty()) {
+                Submission & submission = mQueues[i].front();
+                queued.push_back(submission);
+
+                std::vector<uint64_t> followers;
+                takeFollowers(submission.command, submission.tag, followers);
+                for (size_t j = 0; j < followers.size(); ++j) {
+                    queued.push_back(submission);
+                    queued.back().tag = followers[j];
+                }
+                mQueues[i].pop_front();
+            }
+        }
+        mNofQueued = 0;
+        return queued;
+    }
+
+
+    void Pipeline::setRate(double rate, size_t burst) {
+        mMaxRate = mRate = (rate > 0) ? rate : 0;
+        mBurst = std::max(burst, (size_t)1);
+        mTokens = (double)mBurst;
+        mRefilled = Reactor::Clock::now();
+    }
+
+
+    double Pipeline::getRate() const {
+        return mRate;
+    }
+
+
+    void Pipeline::refill() {
+        Reactor::Clock::time_point now = Reactor::Clock::now();
+        std::chrono::duration<double> elapsed = now - mRefilled;
+        mTokens = std::min((double)mBurst, mTokens + elapsed.count() * mRate);
+        mRefilled = now;
+    }
+
+
+    void Pipeline::takeFollowers(const std::string & cmd, uint64_t tag, std::vector<uint64_t> & followers) {
+        std::unordered_map<uint64_t, std::vector<uint64_t> >::iterator it = mFollowers.find(tag);
+        if (it != mFollowers.end()) {
+            followers.swap(it->second);
+            mFollowers.erase(it);
+        }
+        std::unordered_map<std::string, uint64_t>::iterator leader = mLeaders.find(cmd);
+        if (leader != mLeaders.end() && leader->second == tag) {
+            mLeaders.erase(leader);
+        }
+    }
+
+
+    void Pipeline::setCoalescing(bool enable) {
+        mCoalescing = enable;
+    }
+
+
+    Pipeline::Priority Pipeline::priorityOf(const std::string & cmd) {
+        std::string name = cmd.substr(0, cmd.find(' '));
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+
+        /* The keepalive, so a busy session is not dropped, and the commands of an admin acting now */
+        if (name.empty() || name[0] == '#' || name == "kick" || name == "ban" || name == "addban" ||
+            name == "removeban" || name == "say") {
+            return PRIORITY_ADMIN;
+        }
+        return isReadOnly(cmd) ? PRIORITY_POLL : PRIORITY_NORMAL;
+    }
+
+
+    bool Pipeline::isReadOnly(const std::string & cmd) {
+        return cmd == "players" || cmd == "bans" || cmd == "admins" || cmd == "missions";
+    }
+
+
+    size_t Pipeline::getNofFailed() const {
+        return mNofFailed;
+    }
+
+
+    void Pipeline::setDeadline(int deadlineMs) {
+        mDeadlineMs = deadlineMs;
+    }
+}
@@ -0,0 +1,229 @@
+#ifndef __RCONPIPELINE_HH__
+#define __RCONPIPELINE_HH__
+
+#include "rcon.hh"
+#include "rconreactor.hh"
+#include "rconreasm.hh"
+#include <sys/types.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+
+#define MAX_PIPELINE_WINDOW 128
+/** The rate in commands per second a rate limited pipeline slows down to at most after timeouts */
+#define PIPELINE_MIN_RATE 1.0
+
+namespace Rcon {
+
+    /** Pipeline class
+      @remarks
+        Executes commands over a single logged in channel while keeping up
+        to window commands outstanding at the same time. Every command gets
+        its own sequence number from the channel's command sequence, which
+        is never reused while the command is
+        still in flight, so responses are matched back to their command even
+        after the 8 bit sequence number wraps around. Results are passed to
+        the result callback in submission order. A command which is not
+        answered within the retransmit timeout of the channel's round trip
+        estimate is sent again with the same sequence number, with the
+        timeout doubled on every attempt, until its deadline has passed.
+        Parts received by earlier attempts are kept. If the channel has metrics, the pipeline records the command round
+        trip and multipart completion times from the first send, so resends
+        show up as latency, and counts every timeout.
+        Commands waiting for the window are sent by priority class, admin
+        commands such as kick and ban before the others and read-only polls
+        such as players last, in submission order within a class. With a
+        rate set, the commands are paced by a token bucket: a timeout
+        halves the rate, down to PIPELINE_MIN_RATE, and every answer adds
+        one command per second back up to the rate set, so a server under
+        load is driven near what it sustains without drops. With coalescing
+        a read-only command submitted while the same command is waiting or
+        outstanding is not sent, it gets the result of the one pending,
+        unless a command which may change what it reads was submitted in
+        between.
+      @param
+        reactor The reactor which serves the channel.
+      @param
+        channel The logged in channel to execute the commands on.
+      @param
+        window The maximum number of outstanding commands, 1 to MAX_PIPELINE_WINDOW.
+      @param
+        callback The function which receives the results in the order the
+        commands are sent, which is submission order unless priorities or
+        coalescing reorder them; the tag of the submission tells them apart.
+    */
+    class Pipeline
+    {
+        public:
+            /** The priority classes of the commands, lower ones are sent first */
+            enum Priority {
+                PRIORITY_ADMIN,
+                PRIORITY_NORMAL,
+                PRIORITY_POLL,
+                NOF_PRIORITIES
+            };
+
+            /** The result of a single command */
+            struct Result {
+                Result() :
+                    tag(0),
+                    done(false),
+                    ok(false)
+                {}
+
+                std::string command;
+                std::string output;
+                std::string error;
+                /** The tag of the submission */
+                uint64_t tag;
+                bool done;
+                bool ok;
+            };
+
+            /** A command submitted and not sent yet */
+            struct Submission {
+                std::string command;
+                uint64_t tag;
+                Priority priority;
+            };
+
+            typedef std::function<void(const Result &)> ResultCallback;
+
+            explicit Pipeline(Reactor & reactor, Channel & channel, size_t window, const ResultCallback & callback);
+
+            virtual ~Pipeline();
+
+            /** Queues a command, which is sent as soon as the window, its priority and the rate allow it
+              @param
+                cmd The command.
+              @param
+                tag Passed back with the result.
+              @param
+                priority The priority class of the command.
+            */
+            void submit(const std::string & cmd, uint64_t tag = 0, Priority priority = PRIORITY_NORMAL);
+
+            /** Consumes the command responses of outstanding commands
+              @return
+                true if the view belonged to an outstanding command.
+            */
+            bool handleView(const Protocol::MessageView & view);
+
+            /** Returns true if every submitted command has been passed to the callback */
+            bool isIdle() const;
+
+            /** Returns the number of submitted commands not sent yet */
+            size_t getNofQueued() const;
+
+            /** Removes the submitted commands not sent yet, including the ones coalesced
+                into them, and returns them in the order they would have been sent,
+                e.g. to replay them once a lost session is up again. */
+            std::deque<Submission> takeQueued();
+
+            /** Limits the commands sent to rate per second with bursts of up to burst commands, a rate of 0 (the default) sends without limit. */
+            void setRate(double rate, size_t burst);
+
+            /** Returns the current rate in commands per second, 0 without limit */
+            double getRate() const;
+
+            /** Enables coalescing of identical read-only commands, off by default; the tags must then be unique */
+            void setCoalescing(bool enable);
+
+            /** Returns the priority class of a command, by its name */
+            static Priority priorityOf(const std::string & cmd);
+
+            /** Returns true if the command only reads, so identical ones may share a result */
+            static bool isReadOnly(const std::string & cmd);
+
+            /** Returns the number of commands which failed */
+            size_t getNofFailed() const;
+
+            /** Sets the total time from first sending a command until it fails, DEFAULT_TIMEOUT_MS by default */
+            void setDeadline(int deadlineMs);
+
+        protected:
+            /** An outstanding command, indexed by its sequence number */
+            struct InFlight {
+                InFlight() :
+                    busy(false),
+                    index(0),
+                    attempt(0),
+                    timer(0),
+                    answered(false),
+                    reassembler(BUF_SIZE)
+                {}
+
+                bool busy;
+                size_t index;
+                /** The number of times the command was resent */
+                int attempt;
+                Reactor::TimerId timer;
+                /** When the command was first sent */
+                Reactor::Clock::time_point sentAt;
+                /** When the command fails unless answered */
+                Reactor::Clock::time_point deadline;
+                /** True once the first packet of the response has arrived */
+                bool answered;
+                Protocol::Reassembler reassembler;
+            };
+
+            /** Sends queued commands while the window and the rate allow it. */
+            void pump();
+
+            /** Adds the tokens earned since the last refill, up to the burst. */
+            void refill();
+
+            /** Moves out the tags coalesced into a pending command, which identical ones no longer join. */
+            void takeFollowers(const std::string & cmd, uint64_t tag, std::vector<uint64_t> & followers);
+
+            /** Sends the command of an outstanding slot and arms its timer. */
+            void send(uint8_t seqNum);
+
+            /** Arms the retransmit timer of an outstanding slot. */
+            void arm(uint8_t seqNum);
+
+            /** Called when an outstanding command has not been answered in time. */
+            void timeout(uint8_t seqNum);
+
+            /** Stores the result of an outstanding command and frees its slot. */
+            void complete(uint8_t seqNum, bool ok, const std::string & output, const std::string & error);
+
+            /** Passes all leading completed results to the callback. */
+            void emit();
+
+            Reactor & mReactor;
+            Channel & mChannel;
+            size_t mWindow;
+            ResultCallback mCallback;
+            int mDeadlineMs;
+
+            std::deque<Submission> mQueues[NOF_PRIORITIES];
+            size_t mNofQueued;
+            std::deque<Result> mResults;
+            size_t mFirstIndex;
+            size_t mNextIndex;
+            std::vector<InFlight> mInFlight;
+            size_t mNofInFlight;
+            size_t mNofFailed;
+
+            /** The rate set, the current one and the tokens, 0 without limit */
+            double mMaxRate;
+            double mRate;
+            double mTokens;
+            size_t mBurst;
+            Reactor::Clock::time_point mRefilled;
+            /** When the rate was last halved */
+            Reactor::Clock::time_point mDecreased;
+            Reactor::TimerId mPaceTimer;
+
+            bool mCoalescing;
+            /** The tag of the pending read-only command which identical ones join, by command */
+            std::unordered_map<std::string, uint64_t> mLeaders;
+            /** The tags coalesced into each pending read-only command, by its tag */
+            std::unordered_map<uint64_t, std::vector<uint64_t> > mFollowers;
+    };
+}
+
+#endif // __RCONPIPELINE_HH__
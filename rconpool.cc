@@ -0,0 +1,117 @@
+#include "rconpool.hh"
+#include "rconexception.hh"
+
+
+namespace Rcon {
+
+    namespace Protocol {
+
+
+        /* MessagePool class */
+
+        MessagePool::MessagePool(size_t slotSize) :
+            mSlotSize(slotSize)
+        {
+        }
+
+        MessagePool::~MessagePool() {
+            for (size_t type = 0; type < NOF_TYPES; ++type) {
+                for (size_t i = 0; i < mFree[type].size(); ++i) {
+                    delete mFree[type][i];
+                }
+            }
+        }
+
+        Message *MessagePool::allocate(Message::MsgType type) const {
+
+            ServerMessage *srvMsg = nullptr;
+            CommandPartialResponse *partResp = nullptr;
+
+            switch (type) {
+
+                case Message::MSG_LOGIN_RESP:
+                    return new LoginResponse();
+
+                case Message::MSG_CMD_RESP:
+                    srvMsg = new CommandResponse();
+                    srvMsg->reserveMessage(mSlotSize);
+                    return srvMsg;
+
+                case Message::MSG_SRV_MSG:
+                    srvMsg = new ServerMessage();
+                    srvMsg->reserveMessage(mSlotSize);
+                    return srvMsg;
+
+                case Message::MSG_CMD_PART_RESP:
+                    partResp = new CommandPartialResponse();
+                    partResp->reserveMessage(mSlotSize);
+                    return partResp;
+
+                default:
+                    throw ProtocolException("No pool slot for this message type!");
+            }
+        }
+
+        Message *MessagePool::create(const MessageView & view) {
+
+            std::vector<Message*> & freeList = mFree[view.type];
+            Message *msg = nullptr;
+
+            if (freeList.empty()) {
+                msg = allocate(view.type);
+                ++mStats.allocated;
+            } else {
+                msg = freeList.back();
+                freeList.pop_back();
+                ++mStats.reused;
+            }
+
+            ++mStats.acquired;
+            if (++mStats.inUse > mStats.highWater) {
+                mStats.highWater = mStats.inUse;
+            }
+
+            switch (view.type) {
+
+                case Message::MSG_LOGIN_RESP:
+                    static_cast<LoginResponse*>(msg)->setResult(view.result);
+                    break;
+
+                case Message::MSG_CMD_RESP:
+                case Message::MSG_SRV_MSG:
+                    static_cast<ServerMessage*>(msg)->setSeqNum(view.seqNum);
+                    static_cast<ServerMessage*>(msg)->setMessage(view.payload);
+                    break;
+
+                case Message::MSG_CMD_PART_RESP:
+                    static_cast<CommandPartialResponse*>(msg)->setSeqNum(view.seqNum);
+                    static_cast<CommandPartialResponse*>(msg)->setNofParts(view.nofParts);
+                    static_cast<CommandPartialResponse*>(msg)->setPartIdx(view.partIdx);
+                    static_cast<CommandPartialResponse*>(msg)->setMessage(view.payload);
+                    break;
+
+                default:
+                    break;
+            }
+            return msg;
+        }
+
+        void MessagePool::release(Message *msg) {
+            if (msg == nullptr) {
+                return;
+            }
+            mFree[msg->getType()].push_back(msg);
+            --mStats.inUse;
+        }
+
+        const MessagePool::Stats & MessagePool::getStats() const {
+            return mStats;
+        }
+
+        void MessagePool::printStats(std::ostream & out) const {
+            out << "message pool: " << mStats.allocated << " slots allocated, "
+                << mStats.inUse << " in use, high-water mark " << mStats.highWater << ", "
+                << mStats.reused << "/" << mStats.acquired << " messages from reused slots" << std::endl;
+        }
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef __RCONPOOL_HH__
+#define __RCONPOOL_HH__
+
+#include "rconmsg.hh"
+#include <sys/types.h>
+#include <vector>
+#include <ostream>
+
+namespace Rcon {
+
+    namespace Protocol {
+
+        /** Message pool class
+          @remarks
+            A per-session pool of received protocol messages. Released
+            messages are kept on a free list per message type and reused
+            by the next create() of the same type, so a long running session
+            stops calling new/delete once it has reached its steady state.
+            The text storage of every slot is reserved to slotSize bytes up
+            front, so assigning a payload to a reused slot never reallocates.
+          @param
+            slotSize The text capacity reserved for every message slot.
+        */
+        class MessagePool {
+            public:
+                /** Pool statistics */
+                struct Stats {
+                    Stats() :
+                        allocated(0),
+                        inUse(0),
+                        highWater(0),
+                        acquired(0),
+                        reused(0)
+                    {}
+
+                    /** The number of slots allocated from the heap */
+                    size_t allocated;
+                    /** The number of slots currently handed out */
+                    size_t inUse;
+                    /** The maximum number of slots handed out at the same time */
+                    size_t highWater;
+                    /** The total number of create() calls */
+                    uint64_t acquired;
+                    /** The number of create() calls served from a free list */
+                    uint64_t reused;
+                };
+
+                explicit MessagePool(size_t slotSize);
+
+                virtual ~MessagePool();
+
+                /** Creates the owning message for a decoded view from a pool slot
+                  @param
+                    view The view returned by Message::decodeView().
+                  @return
+                    The message, which must be given back with release().
+                */
+                Message *create(const MessageView & view);
+
+                /** Gives a message created by create() back to the pool. */
+                void release(Message *msg);
+
+                /** Returns the pool statistics */
+                const Stats & getStats() const;
+
+                /** Prints the pool statistics in a single line */
+                void printStats(std::ostream & out) const;
+
+            protected:
+                /** Allocates a new slot for the message type */
+                Message *allocate(Message::MsgType type) const;
+
+                static const size_t NOF_TYPES = Message::MSG_SRV_ACK + 1;
+
+                size_t mSlotSize;
+                std::vector<Message*> mFree[NOF_TYPES];
+                Stats mStats;
+
+            private:
+                MessagePool(const MessagePool &);
+                MessagePool & operator=(const MessagePool &);
+        };
+    }
+}
+
+#endif // __RCONPOOL_HH__
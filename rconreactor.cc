@@ -0,0 +1,802 @@
+#include "rconreactor.hh"
+#include "rcon.hh"
+#include "rconmsg.hh"
+#include "rconexception.hh"
+#include "rconmetrics.hh"
+#include "rconuring.hh"
+#include "rconresolve.hh"
+#include "rconcapture.hh"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <signal.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+
+
+namespace Rcon {
+
+    using namespace Protocol;
+
+    /* MessageHandler interface */
+
+    void MessageHandler::handleView(Channel & channel, const MessageView & view) {
+        handleMessage(channel, Message::create(view));
+    }
+
+    void MessageHandler::handleMessage(Channel & channel, Message *msg) {
+        delete msg;
+    }
+
+    void MessageHandler::handleBatchEnd(Channel & channel) {
+    }
+
+
+    /* Reactor base class */
+
+    Reactor *Reactor::create() {
+#ifdef RCON_WITH_IO_URING
+        const char *backend = getenv("RCON_REACTOR");
+        if (backend == nullptr || strcmp(backend, "epoll") != 0) {
+            try {
+                return new IoUringReactor();
+            } catch (SocketException &) {
+                /* Disabled or too old a kernel */
+            }
+        }
+#endif
+        return new EpollReactor();
+    }
+
+    void Reactor::addDatagramSocket(int fd, DatagramHandler *handler) {
+        addSocket(fd, handler);
+    }
+
+    Reactor::TimerId Reactor::addTimer(int delayMs, const TimerCallback & callback) {
+        TimerId id = mNextTimerId++;
+        Clock::time_point when = Clock::now() + std::chrono::milliseconds(delayMs);
+        mTimers[TimerKey(when, id)] = callback;
+        mTimerIndex[id] = when;
+        return id;
+    }
+
+    void Reactor::cancelTimer(TimerId id) {
+        std::map<TimerId, Clock::time_point>::iterator it = mTimerIndex.find(id);
+        if (it == mTimerIndex.end()) {
+            return;
+        }
+        mTimers.erase(TimerKey(it->second, id));
+        mTimerIndex.erase(it);
+    }
+
+    int Reactor::nextTimeout() const {
+        if (mTimers.empty()) {
+            return -1;
+        }
+        Clock::time_point now = Clock::now();
+        Clock::time_point next = mTimers.begin()->first.first;
+        if (next <= now) {
+            return 0;
+        }
+        /* Round up, so the timer has expired when waitEvents() returns */
+        return (int)std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count() + 1;
+    }
+
+    void Reactor::fireTimers() {
+        Clock::time_point now = Clock::now();
+        while (!mTimers.empty() && mTimers.begin()->first.first <= now) {
+            TimerCallback callback = mTimers.begin()->second;
+            mTimerIndex.erase(mTimers.begin()->first.second);
+            mTimers.erase(mTimers.begin());
+            callback();
+        }
+    }
+
+    void Reactor::runOnce(int maxWaitMs) {
+        int timeout = nextTimeout();
+        if (maxWaitMs >= 0 && (timeout < 0 || maxWaitMs < timeout)) {
+            timeout = maxWaitMs;
+        }
+        waitEvents(timeout);
+        fireTimers();
+        if (Trace::isEnabled()) {
+            Trace::flush();
+        }
+    }
+
+    void Reactor::run() {
+        mStopped = false;
+        while (!mStopped) {
+            runOnce();
+        }
+    }
+
+    void Reactor::stop() {
+        mStopped = true;
+    }
+
+    static volatile sig_atomic_t gStopSignalled = 0;
+
+    static void stopSignalled(int) {
+        gStopSignalled = 1;
+    }
+
+    void Reactor::catchStopSignals() {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = stopSignalled;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+    }
+
+    bool Reactor::isStopSignalled() {
+        return gStopSignalled != 0;
+    }
+
+    std::thread Reactor::startThreadBlockingStopSignals(const std::function<void()> & function) {
+        sigset_t blocked, saved;
+        sigemptyset(&blocked);
+        sigaddset(&blocked, SIGINT);
+        sigaddset(&blocked, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &blocked, &saved);
+        std::thread thread;
+        try {
+            thread = std::thread(function);
+        } catch (...) {
+            pthread_sigmask(SIG_SETMASK, &saved, nullptr);
+            throw;
+        }
+        pthread_sigmask(SIG_SETMASK, &saved, nullptr);
+        return thread;
+    }
+
+
+    /* EpollReactor class */
+
+    EpollReactor::EpollReactor() :
+        mEpollFd(epoll_create1(EPOLL_CLOEXEC)),
+        mNofWaits(0),
+        mNofEvents(0)
+    {
+        if (mEpollFd == -1) {
+            throw SocketException(std::string("epoll_create1: ") + strerror(errno));
+        }
+    }
+
+    EpollReactor::~EpollReactor() {
+        ::close(mEpollFd);
+    }
+
+    void EpollReactor::addSocket(int fd, SocketHandler *handler) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            throw SocketException(std::string("epoll_ctl: ") + strerror(errno));
+        }
+        Registration registration;
+        registration.handler = handler;
+        registration.events = EPOLLIN;
+        mHandlers[fd] = registration;
+    }
+
+    void EpollReactor::removeSocket(int fd) {
+        epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, nullptr);
+        mHandlers.erase(fd);
+    }
+
+    void EpollReactor::modify(int fd, uint32_t events) {
+        std::map<int, Registration>::iterator it = mHandlers.find(fd);
+        if (it == mHandlers.end() || it->second.events == events) {
+            return;
+        }
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.fd = fd;
+        if (epoll_ctl(mEpollFd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+            throw SocketException(std::string("epoll_ctl: ") + strerror(errno));
+        }
+        it->second.events = events;
+    }
+
+    void EpollReactor::watchReadable(int fd, bool enable) {
+        std::map<int, Registration>::iterator it = mHandlers.find(fd);
+        if (it != mHandlers.end()) {
+            modify(fd, enable ? (it->second.events | EPOLLIN) : (it->second.events & ~EPOLLIN));
+        }
+    }
+
+    void EpollReactor::watchWritable(int fd, bool enable) {
+        std::map<int, Registration>::iterator it = mHandlers.find(fd);
+        if (it != mHandlers.end()) {
+            modify(fd, enable ? (it->second.events | EPOLLOUT) : (it->second.events & ~EPOLLOUT));
+        }
+    }
+
+    void EpollReactor::printStats(std::ostream & out) const {
+        out << "reactor: epoll, " << mNofWaits << " waits, " << mNofEvents << " events" << std::endl;
+    }
+
+    void EpollReactor::waitEvents(int timeoutMs) {
+        const int MAX_EVENTS = 64;
+        struct epoll_event events[MAX_EVENTS];
+
+        ++mNofWaits;
+        int n = epoll_wait(mEpollFd, events, MAX_EVENTS, timeoutMs);
+        if (n == -1) {
+            if (errno == EINTR) {
+                return;
+            }
+            throw SocketException(std::string("epoll_wait: ") + strerror(errno));
+        }
+        mNofEvents += n;
+
+        for (int i = 0; i < n; ++i) {
+            /* A handler may have removed another socket of this batch */
+            std::map<int, Registration>::iterator it = mHandlers.find(events[i].data.fd);
+            if (it != mHandlers.end() && (events[i].events & EPOLLOUT)) {
+                it->second.handler->onWritable();
+                it = mHandlers.find(events[i].data.fd);
+            }
+            if (it != mHandlers.end() && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                it->second.handler->onReadable();
+            }
+        }
+    }
+
+
+    /* Channel class */
+
+    Channel::~Channel() {
+        close();
+    }
+
+    void Channel::open(const std::string & host, const std::string & port) {
+        open(Resolver::resolveNow(host, port));
+    }
+
+    void Channel::open(const std::vector<Address> & addresses) {
+
+        close();
+
+        /* The first address of each family, in the order of getaddrinfo() which prefers IPv6 */
+        size_t nofCandidates = 0;
+        for (size_t i = 0; i < addresses.size() && nofCandidates < CHANNEL_MAX_CANDIDATES; ++i) {
+            bool taken = false;
+            for (size_t j = 0; j < nofCandidates; ++j) {
+                taken = taken || addresses[i].family() == mCandidates[j].family;
+            }
+            if (taken) {
+                continue;
+            }
+            int fd = connectSocket(addresses[i]);
+            if (fd != -1) {
+                if (RCON_TRACING(open)) {
+                    Trace::open(mTraceId, (const struct sockaddr *)&addresses[i].storage, addresses[i].length);
+                }
+                mCandidates[nofCandidates].fd = fd;
+                mCandidates[nofCandidates].family = addresses[i].family();
+                ++nofCandidates;
+            }
+        }
+
+        if (nofCandidates == 0) {
+            throw SocketException("Could not connect");
+        }
+
+        mKernelDrops = 0;
+        mCommandSequence.reset();
+
+        if (nofCandidates == 1) {
+            mFd = mCandidates[0].fd;
+            mCandidates[0].fd = -1;
+            mReactor.addDatagramSocket(mFd, this);
+            return;
+        }
+        for (size_t i = 0; i < nofCandidates; ++i) {
+            mReactor.addDatagramSocket(mCandidates[i].fd, &mCandidates[i]);
+        }
+    }
+
+    int Channel::connectSocket(const Address & address) {
+        int fd = socket(address.family(), SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1) {
+            return -1;
+        }
+
+        if (mRecvBufferSize > 0) {
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &mRecvBufferSize, sizeof(mRecvBufferSize));
+        }
+        if (mSendBufferSize > 0) {
+            setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &mSendBufferSize, sizeof(mSendBufferSize));
+        }
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+
+        if (connect(fd, (const struct sockaddr *)&address.storage, address.length) == -1) {
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    void Channel::close() {
+        for (size_t i = 0; i < CHANNEL_MAX_CANDIDATES; ++i) {
+            if (mCandidates[i].fd != mFd) {
+                dropCandidate(mCandidates[i]);
+            }
+            mCandidates[i].fd = -1;
+        }
+        if (mFd != -1) {
+            mReactor.removeSocket(mFd);
+            ::close(mFd);
+            mFd = -1;
+        }
+    }
+
+    bool Channel::isRacing() const {
+        if (mFd != -1) {
+            return false;
+        }
+        for (size_t i = 0; i < CHANNEL_MAX_CANDIDATES; ++i) {
+            if (mCandidates[i].fd != -1) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Channel::dropCandidate(Candidate & candidate) {
+        if (candidate.fd != -1) {
+            mReactor.removeSocket(candidate.fd);
+            ::close(candidate.fd);
+            candidate.fd = -1;
+        }
+    }
+
+    void Channel::raceReceive(Candidate & candidate) {
+        uint8_t buf[BUF_SIZE];
+        uint8_t control[CMSG_SPACE(sizeof(uint32_t))];
+        struct iovec iov;
+        iov.iov_base = buf;
+        iov.iov_len = BUF_SIZE;
+
+        while (candidate.fd != -1) {
+            struct msghdr hdr;
+            memset(&hdr, 0, sizeof(hdr));
+            hdr.msg_iov = &iov;
+            hdr.msg_iovlen = 1;
+            hdr.msg_control = control;
+            hdr.msg_controllen = sizeof(control);
+
+            ssize_t nread = recvmsg(candidate.fd, &hdr, 0);
+            if (nread == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    raceFailed(candidate, errno);
+                }
+                return;
+            }
+            if (raceAnswered(candidate, buf, nread, hdr)) {
+                /* Anything else pending is read through the channel on the next wakeup */
+                onDatagramsEnd();
+                return;
+            }
+        }
+    }
+
+    bool Channel::raceAnswered(Candidate & candidate, const uint8_t *buffer, size_t length, const struct msghdr & hdr) {
+        /* Anything but a login response, even a corrupt one, does not end the race */
+        try {
+            if (Message::decodeView(buffer, length).type != Message::MSG_LOGIN_RESP) {
+                return false;
+            }
+        } catch (Exception &) {
+            return false;
+        }
+
+        mFd = candidate.fd;
+        for (size_t i = 0; i < CHANNEL_MAX_CANDIDATES; ++i) {
+            if (&mCandidates[i] != &candidate) {
+                dropCandidate(mCandidates[i]);
+            }
+        }
+
+        checkDrops(hdr);
+        dispatch(buffer, length);
+        return true;
+    }
+
+    void Channel::raceFailed(Candidate & candidate, int error) {
+        dropCandidate(candidate);
+        if (!isRacing()) {
+            mHandler.handleError(*this, SocketException(std::string("socket read error: ") + strerror(error)));
+        }
+    }
+
+    void Channel::send(const Message & msg) {
+        uint8_t header[Message::MAX_HEADER_LENGTH];
+        size_t headerLength;
+        std::string_view payload;
+        size_t len = msg.encode(header, headerLength, payload);
+
+        /* The payload is sent straight from the message */
+        struct iovec iov[2];
+        iov[0].iov_base = header;
+        iov[0].iov_len = headerLength;
+        iov[1].iov_base = const_cast<char*>(payload.data());
+        iov[1].iov_len = payload.size();
+
+        struct msghdr hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_iov = iov;
+        hdr.msg_iovlen = payload.empty() ? 1 : 2;
+
+        if (mFd != -1) {
+            if (sendmsg(mFd, &hdr, 0) != (ssize_t)len) {
+                throw ProtocolException("partial/failed write");
+            }
+            countSent(1, len);
+            if (RCON_TRACING(send)) {
+                Trace::send(mTraceId, header, headerLength, payload);
+            }
+            return;
+        }
+
+        /* Racing, every candidate gets a copy and those which cannot send drop out */
+        for (size_t i = 0; i < CHANNEL_MAX_CANDIDATES; ++i) {
+            if (mCandidates[i].fd == -1) {
+                continue;
+            }
+            if (sendmsg(mCandidates[i].fd, &hdr, 0) != (ssize_t)len) {
+                dropCandidate(mCandidates[i]);
+                continue;
+            }
+            countSent(1, len);
+            if (RCON_TRACING(send)) {
+                Trace::send(mTraceId, header, headerLength, payload);
+            }
+        }
+        if (!isRacing()) {
+            throw ProtocolException("partial/failed write");
+        }
+    }
+
+    void Channel::queue(const Message & msg) {
+        if (mBatchSize <= 1 || mFd == -1) {
+            send(msg);
+            return;
+        }
+        size_t len = msg.getEncodedSize();
+        if (len > BUF_SIZE) {
+            /* Too large for a batch slot, keep the order and send it on its own */
+            flush();
+            send(msg);
+            return;
+        }
+        if (mNofQueued == mBatchSize) {
+            flush();
+        }
+        msg.encode(&mSendBuffer[mNofQueued * BUF_SIZE], BUF_SIZE);
+        mSendIovecs[mNofQueued].iov_len = len;
+        ++mNofQueued;
+    }
+
+    void Channel::flush() {
+        size_t sent = 0;
+        while (sent < mNofQueued) {
+            int n = sendmmsg(mFd, &mSendHeaders[sent], mNofQueued - sent, 0);
+            if (n == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                mNofQueued = 0;
+                throw ProtocolException(std::string("partial/failed write: ") + strerror(errno));
+            }
+            if (mMetrics != nullptr) {
+                size_t bytes = 0;
+                for (int i = 0; i < n; ++i) {
+                    bytes += mSendIovecs[sent + i].iov_len;
+                }
+                countSent(n, bytes);
+            }
+            if (RCON_TRACING(send)) {
+                for (int i = 0; i < n; ++i) {
+                    Trace::send(mTraceId, (const uint8_t *)mSendIovecs[sent + i].iov_base, mSendIovecs[sent + i].iov_len);
+                }
+            }
+            sent += n;
+        }
+        mNofQueued = 0;
+    }
+
+    void Channel::countSent(size_t packets, size_t bytes) {
+        if (mMetrics != nullptr) {
+            mMetrics->packetsSent += packets;
+            mMetrics->bytesSent += bytes;
+        }
+    }
+
+    void Channel::setBatchSize(size_t batchSize) {
+        if (mNofQueued > 0) {
+            flush();
+        }
+        mBatchSize = (batchSize > 1) ? batchSize : 1;
+        if (mBatchSize == 1) {
+            mRecvBuffer.clear();
+            mRecvControl.clear();
+            mSendBuffer.clear();
+            return;
+        }
+
+        /* Every datagram gets a fixed BUF_SIZE slot, the headers point into them for good */
+        mRecvBuffer.resize(mBatchSize * BUF_SIZE);
+        mRecvIovecs.resize(mBatchSize);
+        mRecvHeaders.resize(mBatchSize);
+        mRecvControl.resize(mBatchSize * CMSG_SPACE(sizeof(uint32_t)));
+        mSendBuffer.resize(mBatchSize * BUF_SIZE);
+        mSendIovecs.resize(mBatchSize);
+        mSendHeaders.resize(mBatchSize);
+
+        for (size_t i = 0; i < mBatchSize; ++i) {
+            mRecvIovecs[i].iov_base = &mRecvBuffer[i * BUF_SIZE];
+            mRecvIovecs[i].iov_len = BUF_SIZE;
+            memset(&mRecvHeaders[i], 0, sizeof(struct mmsghdr));
+            mRecvHeaders[i].msg_hdr.msg_iov = &mRecvIovecs[i];
+            mRecvHeaders[i].msg_hdr.msg_iovlen = 1;
+            mRecvHeaders[i].msg_hdr.msg_control = &mRecvControl[i * CMSG_SPACE(sizeof(uint32_t))];
+            mRecvHeaders[i].msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint32_t));
+
+            mSendIovecs[i].iov_base = &mSendBuffer[i * BUF_SIZE];
+            mSendIovecs[i].iov_len = 0;
+            memset(&mSendHeaders[i], 0, sizeof(struct mmsghdr));
+            mSendHeaders[i].msg_hdr.msg_iov = &mSendIovecs[i];
+            mSendHeaders[i].msg_hdr.msg_iovlen = 1;
+        }
+    }
+
+    void Channel::setMetrics(Metrics *metrics) {
+        mMetrics = metrics;
+    }
+
+    Metrics *Channel::getMetrics() const {
+        return mMetrics;
+    }
+
+    void Channel::setCapture(CaptureLog *capture, uint32_t server) {
+        mCapture = capture;
+        mCaptureServer = server;
+    }
+
+    void Channel::setSocketBuffers(int recvBytes, int sendBytes) {
+        mRecvBufferSize = recvBytes;
+        mSendBufferSize = sendBytes;
+    }
+
+    uint64_t Channel::getNofKernelDrops() const {
+        return mNofKernelDrops;
+    }
+
+    void Channel::printStats(std::ostream & out) const {
+        int recvBytes = 0;
+        int sendBytes = 0;
+        socklen_t length = sizeof(int);
+        if (mFd != -1) {
+            getsockopt(mFd, SOL_SOCKET, SO_RCVBUF, &recvBytes, &length);
+            length = sizeof(int);
+            getsockopt(mFd, SOL_SOCKET, SO_SNDBUF, &sendBytes, &length);
+        }
+        out << "socket: " << recvBytes << " bytes receive buffer, " << sendBytes << " bytes send buffer, batches of "
+            << mBatchSize << ", " << mNofKernelDrops << " datagrams dropped by the kernel" << std::endl;
+    }
+
+    void Channel::checkDrops(const struct msghdr & hdr) {
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr;
+             cmsg = CMSG_NXTHDR(const_cast<struct msghdr *>(&hdr), cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SO_RXQ_OVFL) {
+                continue;
+            }
+            uint32_t drops;
+            memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+            /* The counter only grows and may wrap around */
+            uint32_t delta = drops - mKernelDrops;
+            mKernelDrops = drops;
+            mNofKernelDrops += delta;
+            if (mMetrics != nullptr) {
+                mMetrics->kernelDrops += delta;
+            }
+        }
+    }
+
+    RttEstimator & Channel::getRtt() {
+        return mRtt;
+    }
+
+    CommandSequence & Channel::getCommandSequence() {
+        return mCommandSequence;
+    }
+
+    bool Channel::isOpen() const {
+        return mFd != -1 || isRacing();
+    }
+
+    int Channel::getFd() const {
+        return mFd;
+    }
+
+    uint32_t Channel::getTraceId() const {
+        return mTraceId;
+    }
+
+    void Channel::onReadable() {
+        if (mBatchSize > 1) {
+            receiveBatch();
+            return;
+        }
+
+        uint8_t buf[BUF_SIZE];
+        uint8_t control[CMSG_SPACE(sizeof(uint32_t))];
+        struct iovec iov;
+        iov.iov_base = buf;
+        iov.iov_len = BUF_SIZE;
+
+        /* Drain the socket, the handler may close the channel in between */
+        while (mFd != -1) {
+            struct msghdr hdr;
+            memset(&hdr, 0, sizeof(hdr));
+            hdr.msg_iov = &iov;
+            hdr.msg_iovlen = 1;
+            hdr.msg_control = control;
+            hdr.msg_controllen = sizeof(control);
+
+            ssize_t nread = recvmsg(mFd, &hdr, 0);
+            if (nread == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    mHandler.handleBatchEnd(*this);
+                    return;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                mHandler.handleError(*this, SocketException(std::string("socket read error: ") + strerror(errno)));
+                return;
+            }
+            checkDrops(hdr);
+            dispatch(buf, nread);
+        }
+    }
+
+    void Channel::onDatagram(const uint8_t *buffer, size_t length, const struct msghdr & hdr) {
+        /* The handler may have closed the channel on an earlier datagram of the iteration */
+        if (mFd == -1) {
+            return;
+        }
+        checkDrops(hdr);
+        dispatch(buffer, length);
+    }
+
+    void Channel::onDatagramError(int error) {
+        mHandler.handleError(*this, SocketException(std::string("socket read error: ") + strerror(error)));
+    }
+
+    void Channel::onDatagramsEnd() {
+        if (mFd == -1) {
+            return;
+        }
+        flush();
+        mHandler.handleBatchEnd(*this);
+    }
+
+    void Channel::Candidate::onReadable() {
+        if (fd == channel->mFd) {
+            channel->onReadable();
+        } else {
+            channel->raceReceive(*this);
+        }
+    }
+
+    void Channel::Candidate::onDatagram(const uint8_t *buffer, size_t length, const struct msghdr & hdr) {
+        if (fd == channel->mFd) {
+            channel->onDatagram(buffer, length, hdr);
+        } else if (fd != -1) {
+            channel->raceAnswered(*this, buffer, length, hdr);
+        }
+    }
+
+    void Channel::Candidate::onDatagramError(int error) {
+        if (fd == channel->mFd) {
+            channel->onDatagramError(error);
+        } else if (fd != -1) {
+            channel->raceFailed(*this, error);
+        }
+    }
+
+    void Channel::Candidate::onDatagramsEnd() {
+        if (fd == channel->mFd) {
+            channel->onDatagramsEnd();
+        }
+    }
+
+    void Channel::receiveBatch() {
+
+        const size_t controlSize = CMSG_SPACE(sizeof(uint32_t));
+
+        /* Drain the socket, the handler may close the channel in between */
+        while (mFd != -1) {
+            /* The kernel shrinks the control lengths to what it filled in */
+            for (size_t i = 0; i < mBatchSize; ++i) {
+                mRecvHeaders[i].msg_hdr.msg_controllen = controlSize;
+            }
+
+            int n = recvmmsg(mFd, &mRecvHeaders[0], mBatchSize, MSG_DONTWAIT, nullptr);
+            if (n == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                mHandler.handleError(*this, SocketException(std::string("socket read error: ") + strerror(errno)));
+                return;
+            }
+
+            for (int i = 0; i < n && mFd != -1; ++i) {
+                checkDrops(mRecvHeaders[i].msg_hdr);
+                dispatch(&mRecvBuffer[i * BUF_SIZE], mRecvHeaders[i].msg_len);
+            }
+
+            if (mFd == -1) {
+                return;
+            }
+            flush();
+            mHandler.handleBatchEnd(*this);
+
+            if ((size_t)n < mBatchSize) {
+                return;
+            }
+        }
+    }
+
+    void Channel::dispatch(const uint8_t *buffer, size_t length) {
+        /* A corrupt datagram is as good as lost, the retransmit timers recover from it */
+        if (mMetrics != nullptr) {
+            ++mMetrics->packetsReceived;
+            mMetrics->bytesReceived += length;
+        }
+        if (RCON_TRACING(receive)) {
+            Trace::receive(mTraceId, buffer, length);
+        }
+
+        MessageView view;
+        try {
+            view = Message::decodeView(buffer, length);
+        } catch (ChecksumException & e) {
+            if (mMetrics != nullptr) {
+                ++mMetrics->crcFailures;
+            }
+            if (RCON_TRACING(crc_failure)) {
+                Trace::crcFailure(mTraceId, buffer, length);
+            }
+            return;
+        } catch (Exception & e) {
+            if (mMetrics != nullptr) {
+                ++mMetrics->decodeErrors;
+            }
+            return;
+        }
+        if (RCON_TRACING(decode)) {
+            Trace::decode(mTraceId, view);
+        }
+        if (mCapture != nullptr && view.type == Message::MSG_SRV_MSG) {
+            mCapture->append(mCaptureServer, buffer, length);
+        }
+        mHandler.handleView(*this, view);
+    }
+}
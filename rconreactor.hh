@@ -0,0 +1,456 @@
+#ifndef __RCONREACTOR_HH__
+#define __RCONREACTOR_HH__
+
+#include "rconrtt.hh"
+#include "rconseq.hh"
+#include "rcontrace.hh"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+#include <thread>
+#include <chrono>
+#include <ostream>
+
+/** The datagrams read and queued per batch by a channel with batching enabled */
+#define CHANNEL_BATCH_SIZE 16
+/** The socket buffer sizes requested for every channel, capped by net.core.rmem_max/wmem_max */
+#define CHANNEL_RECV_BUFFER (1024 * 1024)
+#define CHANNEL_SEND_BUFFER (256 * 1024)
+/** The addresses a channel races the login over, the first of every address family */
+#define CHANNEL_MAX_CANDIDATES 2
+
+namespace Rcon {
+
+    class Exception;
+    class Channel;
+    class CaptureLog;
+    struct Metrics;
+    struct Address;
+
+    namespace Protocol {
+        class Message;
+        struct MessageView;
+    }
+
+    /** Socket event handler interface
+      @remarks
+        Implemented by everything that registers a file descriptor
+        to a reactor. onReadable() is called whenever the descriptor
+        has data to read, onWritable() whenever it can be written to
+        while writability is watched.
+    */
+    class SocketHandler {
+        public:
+            virtual ~SocketHandler() {}
+
+            /** Called by the reactor when the registered fd is readable. */
+            virtual void onReadable() = 0;
+
+            /** Called by the reactor when the registered fd is writable. */
+            virtual void onWritable() {}
+    };
+
+
+    /** Datagram handler interface
+      @remarks
+        Implemented by the handlers of datagram sockets which can take the
+        datagrams received by the reactor itself. Reactors on a completion
+        based API receive into their own buffers and pass every datagram
+        to onDatagram(), the others call onReadable() as usual.
+    */
+    class DatagramHandler : public SocketHandler {
+        public:
+            /** Called for every datagram received on the registered fd. The
+                buffer and the control messages are only valid during the call. */
+            virtual void onDatagram(const uint8_t *buffer, size_t length, const struct msghdr & hdr) = 0;
+
+            /** Called when receiving on the registered fd fails with the errno error. */
+            virtual void onDatagramError(int error) = 0;
+
+            /** Called once the datagrams received during a reactor iteration were passed. */
+            virtual void onDatagramsEnd() {}
+    };
+
+
+    /** Message handler interface
+      @remarks
+        Receives the messages decoded by a Channel. Every packet is first
+        passed to handleView() as a non-owning view into the receive buffer.
+        By default handleView() creates the owning message and passes it
+        to handleMessage(), which takes ownership of it; handlers on the hot
+        path override handleView() to avoid the allocation.
+    */
+    class MessageHandler {
+        public:
+            virtual ~MessageHandler() {}
+
+            /** Called for every packet decoded from the channel. The view is only valid during the call. */
+            virtual void handleView(Channel & channel, const Protocol::MessageView & view);
+
+            /** Called with the owning message created by the default handleView(). */
+            virtual void handleMessage(Channel & channel, Protocol::Message *msg);
+
+            /** Called when reading from the channel socket fails. Datagrams which
+                fail the CRC32 or decoding are only counted and dropped. */
+            virtual void handleError(Channel & channel, const Exception & e) = 0;
+
+            /** Called after every batch of packets read from the channel, once the
+                messages queued during the batch have been sent. Without batching
+                a batch is everything read until the socket was drained. */
+            virtual void handleBatchEnd(Channel & channel);
+    };
+
+
+    /** The abstract reactor class
+      @remarks
+        A reactor waits for readable sockets and expiring timers and
+        dispatches them to their handlers. The timer queue is kept in
+        this base class; subclasses implement waitEvents() on top of
+        an OS specific readiness API. Use create() to get the default
+        reactor of the platform.
+    */
+    class Reactor {
+        public:
+            typedef uint64_t TimerId;
+            typedef std::function<void()> TimerCallback;
+            typedef std::chrono::steady_clock Clock;
+
+            Reactor() :
+                mNextTimerId(1),
+                mStopped(false)
+            {}
+
+            virtual ~Reactor() {}
+
+            /** Creates the default reactor for this platform, the io_uring reactor
+                if built with it and supported by the kernel, else the epoll reactor.
+                RCON_REACTOR=epoll in the environment forces the epoll reactor. */
+            static Reactor *create();
+
+            /** Registers a socket to the reactor
+              @param
+                fd The file descriptor to watch for readability.
+              @param
+                handler The handler to call when fd is readable.
+            */
+            virtual void addSocket(int fd, SocketHandler *handler) = 0;
+
+            /** Registers a datagram socket, whose datagrams the reactor may receive
+                itself and pass to onDatagram(). By default this is addSocket(). */
+            virtual void addDatagramSocket(int fd, DatagramHandler *handler);
+
+            /** Unregisters a socket from the reactor. The fd is not closed. */
+            virtual void removeSocket(int fd) = 0;
+
+            /** Enables or disables onReadable() calls for a registered socket, enabled by addSocket(). */
+            virtual void watchReadable(int fd, bool enable) = 0;
+
+            /** Enables or disables onWritable() calls for a registered socket, disabled by addSocket(). */
+            virtual void watchWritable(int fd, bool enable) = 0;
+
+            /** Registers a single shot timer
+              @param
+                delayMs The delay in milliseconds after which the timer fires.
+              @param
+                callback The function to call when the timer fires.
+              @return
+                The timer id, which may be used to cancel the timer.
+            */
+            TimerId addTimer(int delayMs, const TimerCallback & callback);
+
+            /** Cancels a pending timer. Cancelling an expired timer is a no-op. */
+            void cancelTimer(TimerId id);
+
+            /** Waits at most maxWaitMs milliseconds (-1 for no limit) for events
+                and dispatches all ready sockets and expired timers. */
+            void runOnce(int maxWaitMs = -1);
+
+            /** Runs the event loop until stop() is called. */
+            void run();
+
+            /** Makes run() return after the current iteration. */
+            void stop();
+
+            /** Prints the backend and its system call counters in a single line */
+            virtual void printStats(std::ostream & out) const = 0;
+
+            /** Installs SIGINT and SIGTERM handlers which set the stop flag. */
+            static void catchStopSignals();
+
+            /** Returns true once SIGINT or SIGTERM was caught after catchStopSignals(). */
+            static bool isStopSignalled();
+
+            /** Starts a thread with SIGINT and SIGTERM blocked, so only the creator
+                sees the stop signals; the thread inherits the signal mask. */
+            static std::thread startThreadBlockingStopSignals(const std::function<void()> & function);
+
+        protected:
+            /** Waits at most timeoutMs milliseconds for socket events and
+                dispatches them to their handlers. */
+            virtual void waitEvents(int timeoutMs) = 0;
+
+            /** Returns the milliseconds until the next timer expires, or -1. */
+            int nextTimeout() const;
+
+            /** Fires all expired timers. */
+            void fireTimers();
+
+            typedef std::pair<Clock::time_point, TimerId> TimerKey;
+
+            std::map<TimerKey, TimerCallback> mTimers;
+            std::map<TimerId, Clock::time_point> mTimerIndex;
+            TimerId mNextTimerId;
+            bool mStopped;
+    };
+
+
+    /** Epoll based reactor for Linux */
+    class EpollReactor : public Reactor {
+        public:
+            EpollReactor();
+
+            virtual ~EpollReactor();
+
+            virtual void addSocket(int fd, SocketHandler *handler);
+
+            virtual void removeSocket(int fd);
+
+            virtual void watchReadable(int fd, bool enable);
+
+            virtual void watchWritable(int fd, bool enable);
+
+            virtual void printStats(std::ostream & out) const;
+
+        protected:
+            virtual void waitEvents(int timeoutMs);
+
+            /** Sets the epoll event mask of a registered socket. */
+            void modify(int fd, uint32_t events);
+
+            struct Registration {
+                SocketHandler *handler;
+                uint32_t events;
+            };
+
+            int mEpollFd;
+            std::map<int, Registration> mHandlers;
+            uint64_t mNofWaits;
+            uint64_t mNofEvents;
+    };
+
+
+    /** Channel class
+      @remarks
+        A connected, non-blocking UDP socket to a single BattlEye RCon
+        server registered to a reactor. The channel owns the socket fd,
+        drains all pending datagrams whenever the socket becomes readable
+        and dispatches the decoded messages to its message handler.
+        A datagram which fails the CRC32 or decoding is counted in the
+        metrics and dropped like a lost one, so only socket errors reach
+        the handler.
+        With a batch size above one the channel reads up to that many
+        datagrams per recvmmsg() call into preallocated slots and sends
+        the messages queued during a batch with a single sendmmsg().
+        The channel keeps the round trip time estimate of its server, which
+        drives the retransmit timeouts of everything sent over it, and the
+        sequence numbers of the commands of the session, which restart on
+        every open().
+        The socket gets CHANNEL_RECV_BUFFER and CHANNEL_SEND_BUFFER sized
+        buffers, so bursts of server messages are queued by the kernel
+        instead of dropped, and reports the datagrams the kernel dropped
+        anyway through SO_RXQ_OVFL. On a reactor which receives datagrams
+        itself, like the io_uring reactor, the channel is passed the
+        datagrams instead of reading them and only sends by itself.
+        A server with both IPv6 and IPv4 addresses is raced happy eyeballs
+        style: open() connects a socket to the first address of each
+        family, everything sent until the first valid login response goes
+        out over all of them and the socket which got that response is
+        kept, the others are closed.
+      @param
+        reactor The reactor which serves the channel.
+      @param
+        handler The handler which receives the decoded messages.
+    */
+    class Channel : public DatagramHandler {
+        public:
+            explicit Channel(Reactor & reactor, MessageHandler & handler) :
+                mReactor(reactor),
+                mHandler(handler),
+                mFd(-1),
+                mMetrics(nullptr),
+                mCapture(nullptr),
+                mCaptureServer(0),
+                mRecvBufferSize(CHANNEL_RECV_BUFFER),
+                mSendBufferSize(CHANNEL_SEND_BUFFER),
+                mKernelDrops(0),
+                mNofKernelDrops(0),
+                mBatchSize(1),
+                mNofQueued(0),
+                mTraceId(Trace::nextId())
+            {
+                for (size_t i = 0; i < CHANNEL_MAX_CANDIDATES; ++i) {
+                    mCandidates[i].channel = this;
+                }
+            }
+
+            virtual ~Channel();
+
+            /** Resolves host and port, blocking but through the resolver cache, and opens the channel. */
+            void open(const std::string & host, const std::string & port);
+
+            /** Connects the channel socket, racing the first address of every
+                family until the first login response if there are several. */
+            void open(const std::vector<Address> & addresses);
+
+            /** Unregisters and closes the channel socket. */
+            void close();
+
+            /** Encodes and sends a message to the server. */
+            void send(const Protocol::Message & msg);
+
+            /** Encodes a message into the send batch, which is sent by flush().
+                Without batching the message is sent right away. */
+            void queue(const Protocol::Message & msg);
+
+            /** Sends all queued messages with as few sendmmsg() calls as possible. */
+            void flush();
+
+            /** Sets the number of datagrams read and queued per batch, 1 disables batching. */
+            void setBatchSize(size_t batchSize);
+
+            /** Sets the socket buffer sizes requested by open(), 0 keeps the system default. */
+            void setSocketBuffers(int recvBytes, int sendBytes);
+
+            /** Returns the number of datagrams the kernel dropped because the receive buffer was full */
+            uint64_t getNofKernelDrops() const;
+
+            /** Prints the effective socket buffer sizes and the kernel drops in a single line */
+            void printStats(std::ostream & out) const;
+
+            /** Sets the metrics which count the packets, bytes and decoding
+                failures of the channel, null (the default) to count nothing. */
+            void setMetrics(Metrics *metrics);
+
+            /** Returns the metrics of the channel, may be null */
+            Metrics *getMetrics() const;
+
+            /** Sets the capture which the server message datagrams received
+                are appended to with the server id, null (the default) to capture nothing. */
+            void setCapture(CaptureLog *capture, uint32_t server);
+
+            /** Returns the round trip time estimate of the server */
+            Protocol::RttEstimator & getRtt();
+
+            /** Returns the command sequence numbers of the session */
+            Protocol::CommandSequence & getCommandSequence();
+
+            /** Returns true if the channel socket is open, or its candidate sockets are racing. */
+            bool isOpen() const;
+
+            /** Returns the channel socket fd, -1 if closed. */
+            int getFd() const;
+
+            /** Returns the id which tags the tracepoints of the channel, kept across open() */
+            uint32_t getTraceId() const;
+
+            virtual void onReadable();
+
+            virtual void onDatagram(const uint8_t *buffer, size_t length, const struct msghdr & hdr);
+
+            virtual void onDatagramError(int error);
+
+            /** Sends the messages queued during the iteration and ends the batch. */
+            virtual void onDatagramsEnd();
+
+        protected:
+            /** A socket racing for the login, which serves the channel once it won */
+            struct Candidate : public DatagramHandler {
+                Candidate() :
+                    channel(nullptr),
+                    fd(-1),
+                    family(AF_UNSPEC)
+                {}
+
+                virtual void onReadable();
+
+                virtual void onDatagram(const uint8_t *buffer, size_t length, const struct msghdr & hdr);
+
+                virtual void onDatagramError(int error);
+
+                virtual void onDatagramsEnd();
+
+                Channel *channel;
+                int fd;
+                int family;
+            };
+
+            /** Creates a socket with the channel options connected to the address, -1 on failure. */
+            int connectSocket(const Address & address);
+
+            /** Returns true while the candidate sockets race for the login response */
+            bool isRacing() const;
+
+            /** Reads the datagrams of a racing candidate socket. */
+            void raceReceive(Candidate & candidate);
+
+            /** Keeps the candidate and closes the others if the datagram is a login response
+              @return
+                true if the candidate won the race.
+            */
+            bool raceAnswered(Candidate & candidate, const uint8_t *buffer, size_t length, const struct msghdr & hdr);
+
+            /** Drops a candidate which failed, the error goes to the handler once all failed. */
+            void raceFailed(Candidate & candidate, int error);
+
+            /** Unregisters and closes the socket of a candidate. */
+            void dropCandidate(Candidate & candidate);
+
+            /** Drains the socket with recvmmsg() in batches of mBatchSize datagrams. */
+            void receiveBatch();
+
+            /** Decodes a received datagram and passes it to the handler, corrupt ones are dropped. */
+            void dispatch(const uint8_t *buffer, size_t length);
+
+            /** Reads the kernel drop counter from the control messages of a received datagram. */
+            void checkDrops(const struct msghdr & hdr);
+
+            /** Counts sent datagrams if metrics are set. */
+            void countSent(size_t packets, size_t bytes);
+
+            Reactor & mReactor;
+            MessageHandler & mHandler;
+            int mFd;
+            Metrics *mMetrics;
+            CaptureLog *mCapture;
+            uint32_t mCaptureServer;
+            Protocol::RttEstimator mRtt;
+            Protocol::CommandSequence mCommandSequence;
+            /** The racing sockets, then the winner with the fd of mFd, unused with a single address */
+            Candidate mCandidates[CHANNEL_MAX_CANDIDATES];
+
+            int mRecvBufferSize;
+            int mSendBufferSize;
+            /** The last SO_RXQ_OVFL counter of the socket, which counts since the socket was created */
+            uint32_t mKernelDrops;
+            uint64_t mNofKernelDrops;
+
+            size_t mBatchSize;
+            std::vector<uint8_t> mRecvBuffer;
+            std::vector<struct iovec> mRecvIovecs;
+            std::vector<struct mmsghdr> mRecvHeaders;
+            std::vector<uint8_t> mRecvControl;
+
+            size_t mNofQueued;
+            std::vector<uint8_t> mSendBuffer;
+            std::vector<struct iovec> mSendIovecs;
+            std::vector<struct mmsghdr> mSendHeaders;
+
+            uint32_t mTraceId;
+    };
+}
+
+#endif // __RCONREACTOR_HH__
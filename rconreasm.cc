@@ -0,0 +1,119 @@
+#include "rconreasm.hh"
+#include "rconmsg.hh"
+#include <sstream>
+#include <cstring>
+
+
+namespace Rcon {
+
+    namespace Protocol {
+
+
+        /* Reassembler class */
+
+        Reassembler::Reassembler(size_t partSize) :
+            mPartSize(partSize),
+            mSeqNum(0),
+            mNofParts(0),
+            mNofReceived(0)
+        {
+        }
+
+        void Reassembler::start(uint8_t seqNum) {
+            mSeqNum = seqNum;
+            mNofParts = 0;
+            mNofReceived = 0;
+        }
+
+        Reassembler::PartStatus Reassembler::addPart(const MessageView & view) {
+
+            if (view.nofParts == 0) {
+                return PART_MISMATCHED;
+            }
+            if (mNofParts == 0) {
+                /* First part of the response, preallocate all slots */
+                mNofParts = view.nofParts;
+                mBuffer.resize(mNofParts * mPartSize);
+                mLengths.assign(mNofParts, 0);
+                mReceived.assign(mNofParts, false);
+            }
+
+            if (view.nofParts != mNofParts || view.partIdx >= mNofParts) {
+                return PART_MISMATCHED;
+            }
+
+            if (mReceived[view.partIdx]) {
+                return PART_DUPLICATE;
+            }
+            size_t length = (view.payload.size() < mPartSize) ? view.payload.size() : mPartSize;
+            memcpy(&mBuffer[view.partIdx * mPartSize], view.payload.data(), length);
+            mLengths[view.partIdx] = length;
+            mReceived[view.partIdx] = true;
+            ++mNofReceived;
+            return isComplete() ? PART_COMPLETE : PART_ADDED;
+        }
+
+        uint8_t Reassembler::getSeqNum() const {
+            return mSeqNum;
+        }
+
+        bool Reassembler::isStarted() const {
+            return mNofParts > 0;
+        }
+
+        bool Reassembler::isComplete() const {
+            return mNofParts > 0 && mNofReceived == mNofParts;
+        }
+
+        std::vector<uint8_t> Reassembler::getMissingParts() const {
+            std::vector<uint8_t> missing;
+            for (size_t i = 0; i < mNofParts; ++i) {
+                if (!mReceived[i]) {
+                    missing.push_back(i);
+                }
+            }
+            return missing;
+        }
+
+        std::string Reassembler::describeMissing() const {
+            std::vector<uint8_t> missing = getMissingParts();
+            std::stringstream text;
+            text << missing.size() << " of " << mNofParts << " parts missing (";
+            for (size_t i = 0; i < missing.size(); ++i) {
+                text << (i ? ", " : "") << (int)missing[i];
+            }
+            text << ")";
+            return text.str();
+        }
+
+        void Reassembler::write(std::ostream & out) const {
+            for (size_t i = 0; i < mNofParts; ++i) {
+                out.write(&mBuffer[i * mPartSize], mLengths[i]);
+            }
+        }
+
+        std::string Reassembler::str() const {
+            size_t total = 0;
+            for (size_t i = 0; i < mNofParts; ++i) {
+                total += mLengths[i];
+            }
+            std::string text;
+            text.reserve(total);
+            for (size_t i = 0; i < mNofParts; ++i) {
+                text.append(&mBuffer[i * mPartSize], mLengths[i]);
+            }
+            return text;
+        }
+
+        std::string_view Reassembler::getPart(size_t partIdx) const {
+            if (partIdx >= mNofParts) {
+                return std::string_view();
+            }
+            return std::string_view(&mBuffer[partIdx * mPartSize], mLengths[partIdx]);
+        }
+
+        size_t Reassembler::getNofParts() const {
+            return mNofParts;
+        }
+    }
+}
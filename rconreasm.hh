@@ -0,0 +1,96 @@
+#ifndef __RCONREASM_HH__
+#define __RCONREASM_HH__
+
+#include <sys/types.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <ostream>
+
+namespace Rcon {
+
+    namespace Protocol {
+
+        struct MessageView;
+
+        /** Multipart response reassembler
+          @remarks
+            Collects the CommandPartialResponse packets of a single command.
+            On the first part the output buffer is preallocated for all
+            nofParts parts as one contiguous block with a fixed size slot per
+            part, and every part is copied straight from the receive buffer
+            into the slot of its part index, so parts may arrive in any order.
+            Duplicate parts are ignored, and so are parts which do not match
+            the number of parts of the response, like a late part of an
+            earlier command which had the same seqnum. The buffer is kept
+            between commands.
+          @param
+            partSize The maximum payload size of a single part.
+        */
+        class Reassembler {
+            public:
+                /** What addPart() did with a part */
+                enum PartStatus {
+                    PART_ADDED,
+                    PART_COMPLETE,
+                    PART_DUPLICATE,
+                    PART_MISMATCHED
+                };
+
+                explicit Reassembler(size_t partSize);
+
+                virtual ~Reassembler() {}
+
+                /** Starts collecting the response parts of the command with seqNum. */
+                void start(uint8_t seqNum);
+
+                /** Adds a part to the response
+                  @param
+                    view A MSG_CMD_PART_RESP view with the seqnum passed to start().
+                  @return
+                    PART_COMPLETE once the part completed the response,
+                    PART_MISMATCHED if the part was dropped because its
+                    number of parts or part index does not fit the response.
+                */
+                PartStatus addPart(const MessageView & view);
+
+                /** Returns the sequence number of the command being collected */
+                uint8_t getSeqNum() const;
+
+                /** Returns true if at least one part has been received */
+                bool isStarted() const;
+
+                /** Returns true if all parts have been received */
+                bool isComplete() const;
+
+                /** Returns the part indexes which have not been received yet */
+                std::vector<uint8_t> getMissingParts() const;
+
+                /** Returns a text describing the missing parts, e.g. "2 of 5 parts missing (1, 3)" */
+                std::string describeMissing() const;
+
+                /** Writes the payload of all received parts in part index order */
+                void write(std::ostream & out) const;
+
+                /** Returns the payload of all received parts in part index order */
+                std::string str() const;
+
+                /** Returns the payload of a single part */
+                std::string_view getPart(size_t partIdx) const;
+
+                /** Returns the number of parts of the response, 0 if not started */
+                size_t getNofParts() const;
+
+            protected:
+                size_t mPartSize;
+                uint8_t mSeqNum;
+                size_t mNofParts;
+                size_t mNofReceived;
+                std::vector<char> mBuffer;
+                std::vector<size_t> mLengths;
+                std::vector<bool> mReceived;
+        };
+    }
+}
+
+#endif // __RCONREASM_HH__
@@ -0,0 +1,210 @@
+#include "rconresolve.hh"
+#include "rconexception.hh"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <cstring>
+#include <thread>
+
+
+namespace Rcon {
+
+    /* Address struct */
+
+    int Address::family() const {
+        return storage.ss_family;
+    }
+
+
+    /* Resolver class */
+
+    std::mutex Resolver::sCacheMutex;
+    std::map<Resolver::CacheKey, Resolver::CacheEntry> Resolver::sCache;
+
+    Resolver::Resolver(Reactor & reactor) :
+        mReplies(reactor),
+        mShared(new Shared()),
+        mNextId(1),
+        mNofThreads(0)
+    {
+        mShared->owner = this;
+    }
+
+    Resolver::~Resolver() {
+        /* Threads still in getaddrinfo() drop their result and exit */
+        std::lock_guard<std::mutex> lock(mShared->mutex);
+        mShared->owner = nullptr;
+        mShared->jobs.clear();
+        mShared->wakeup.notify_all();
+    }
+
+    Resolver::RequestId Resolver::resolve(const std::string & host, const std::string & port, const Callback & callback) {
+        RequestId id = mNextId++;
+        mPending[id] = callback;
+
+        std::vector<Address> addresses;
+        int error;
+        if (lookupCache(CacheKey(host, port), addresses, error)) {
+            post(id, addresses, error);
+            return id;
+        }
+
+        /* Numeric addresses never block, they need no thread */
+        error = lookup(host, port, AI_NUMERICHOST | AI_NUMERICSERV, addresses);
+        if (error == 0) {
+            post(id, addresses, 0);
+            return id;
+        }
+
+        Job job;
+        job.id = id;
+        job.host = host;
+        job.port = port;
+
+        std::lock_guard<std::mutex> lock(mShared->mutex);
+        mShared->jobs.push_back(job);
+        if (mShared->nofIdle < mShared->jobs.size() && mNofThreads < RESOLVER_THREADS) {
+            std::shared_ptr<Shared> shared = mShared;
+            Reactor::startThreadBlockingStopSignals([shared]() { serve(shared); }).detach();
+            ++mNofThreads;
+        } else {
+            mShared->wakeup.notify_one();
+        }
+        return id;
+    }
+
+    void Resolver::cancel(RequestId id) {
+        mPending.erase(id);
+    }
+
+    std::vector<Address> Resolver::resolveNow(const std::string & host, const std::string & port) {
+        CacheKey key(host, port);
+        std::vector<Address> addresses;
+        int error;
+        if (!lookupCache(key, addresses, error)) {
+            error = lookup(host, port, 0, addresses);
+            storeCache(key, addresses, error);
+        }
+        if (error != 0) {
+            throw SocketException(describe(error));
+        }
+        return addresses;
+    }
+
+    int Resolver::lookup(const std::string & host, const std::string & port, int flags, std::vector<Address> & addresses) {
+
+        struct addrinfo hints;
+        struct addrinfo *result;
+
+        memset(&hints, 0, sizeof(struct addrinfo));
+        hints.ai_family = AF_UNSPEC;    /* Allow IPv4 or IPv6 */
+        hints.ai_socktype = SOCK_DGRAM;
+        hints.ai_flags = flags;
+
+        addresses.clear();
+        int s = getaddrinfo(host.c_str(), port.c_str(), &hints, &result);
+        if (s != 0) {
+            return s;
+        }
+        for (struct addrinfo *rp = result; rp != nullptr; rp = rp->ai_next) {
+            if (rp->ai_addrlen > sizeof(struct sockaddr_storage)) {
+                continue;
+            }
+            Address address;
+            memset(&address.storage, 0, sizeof(address.storage));
+            memcpy(&address.storage, rp->ai_addr, rp->ai_addrlen);
+            address.length = rp->ai_addrlen;
+            addresses.push_back(address);
+        }
+        freeaddrinfo(result);
+        return addresses.empty() ? EAI_NONAME : 0;
+    }
+
+    bool Resolver::lookupCache(const CacheKey & key, std::vector<Address> & addresses, int & error) {
+        std::lock_guard<std::mutex> lock(sCacheMutex);
+        std::map<CacheKey, CacheEntry>::iterator it = sCache.find(key);
+        if (it == sCache.end()) {
+            return false;
+        }
+        if (it->second.expires <= std::chrono::steady_clock::now()) {
+            sCache.erase(it);
+            return false;
+        }
+        addresses = it->second.addresses;
+        error = it->second.error;
+        return true;
+    }
+
+    void Resolver::storeCache(const CacheKey & key, const std::vector<Address> & addresses, int error) {
+        /* Temporary failures are retried on the next lookup */
+        if (error != 0 && error != EAI_NONAME) {
+            return;
+        }
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(sCacheMutex);
+        if (sCache.size() >= RESOLVER_CACHE_SIZE) {
+            for (std::map<CacheKey, CacheEntry>::iterator it = sCache.begin(); it != sCache.end();) {
+                if (it->second.expires <= now) {
+                    it = sCache.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            if (sCache.size() >= RESOLVER_CACHE_SIZE) {
+                sCache.erase(sCache.begin());
+            }
+        }
+
+        CacheEntry & entry = sCache[key];
+        entry.expires = now + std::chrono::milliseconds(error == 0 ? RESOLVER_CACHE_TTL_MS : RESOLVER_NEGATIVE_TTL_MS);
+        entry.addresses = addresses;
+        entry.error = error;
+    }
+
+    std::string Resolver::describe(int error) {
+        return std::string("getaddrinfo: ") + gai_strerror(error);
+    }
+
+    void Resolver::serve(std::shared_ptr<Shared> shared) {
+        std::unique_lock<std::mutex> lock(shared->mutex);
+        while (shared->owner != nullptr) {
+            if (shared->jobs.empty()) {
+                ++shared->nofIdle;
+                shared->wakeup.wait(lock);
+                --shared->nofIdle;
+                continue;
+            }
+            Job job = shared->jobs.front();
+            shared->jobs.pop_front();
+
+            lock.unlock();
+            std::vector<Address> addresses;
+            int error = lookup(job.host, job.port, 0, addresses);
+            lock.lock();
+
+            Resolver *owner = shared->owner;
+            if (owner != nullptr) {
+                owner->mReplies.post([owner, job, addresses, error]() {
+                    storeCache(CacheKey(job.host, job.port), addresses, error);
+                    owner->finish(job.id, addresses, error);
+                });
+            }
+        }
+    }
+
+    void Resolver::finish(RequestId id, const std::vector<Address> & addresses, int error) {
+        std::map<RequestId, Callback>::iterator it = mPending.find(id);
+        if (it == mPending.end()) {
+            return;
+        }
+        /* The callback may resolve again */
+        Callback callback = it->second;
+        mPending.erase(it);
+        callback(addresses, error == 0 ? std::string() : describe(error));
+    }
+
+    void Resolver::post(RequestId id, const std::vector<Address> & addresses, int error) {
+        mReplies.post([this, id, addresses, error]() { finish(id, addresses, error); });
+    }
+}
@@ -0,0 +1,152 @@
+#ifndef __RCONRESOLVE_HH__
+#define __RCONRESOLVE_HH__
+
+#include "rconreactor.hh"
+#include "rconshard.hh"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <cstdint>
+#include <string>
+#include <chrono>
+#include <vector>
+#include <map>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+/** The resolver threads started at most per resolver, on demand */
+#define RESOLVER_THREADS 4
+/** How long resolved addresses are cached, getaddrinfo() does not report the record TTLs */
+#define RESOLVER_CACHE_TTL_MS 60000
+/** How long a name which does not exist is cached */
+#define RESOLVER_NEGATIVE_TTL_MS 5000
+/** The most host names kept in the cache */
+#define RESOLVER_CACHE_SIZE 4096
+
+namespace Rcon {
+
+    /** A resolved UDP endpoint */
+    struct Address {
+        struct sockaddr_storage storage;
+        socklen_t length;
+
+        /** Returns the address family, AF_INET or AF_INET6 */
+        int family() const;
+    };
+
+
+    /** Resolver class
+      @remarks
+        Resolves host names off the reactor thread. Lookups which are not
+        numeric or cached are queued to a pool of up to RESOLVER_THREADS
+        threads running getaddrinfo(), which are started on demand, so a
+        fan-out to hundreds of host names resolves them in parallel instead
+        of one after the other. The results are posted back and the
+        callbacks run on the reactor thread, never from within resolve().
+        All resolvers of the process share a cache of the results, kept for
+        RESOLVER_CACHE_TTL_MS, and of names which do not exist, kept for
+        RESOLVER_NEGATIVE_TTL_MS. The resolver threads have SIGINT and
+        SIGTERM blocked and are not joined, a lookup hanging on an
+        unreachable DNS server does not hold up the destruction.
+      @param
+        reactor The reactor to run the callbacks on.
+    */
+    class Resolver {
+        public:
+            typedef uint64_t RequestId;
+            /** Called with the addresses in the order of getaddrinfo(), or an error message if there are none */
+            typedef std::function<void(const std::vector<Address> & addresses, const std::string & error)> Callback;
+
+            explicit Resolver(Reactor & reactor);
+
+            virtual ~Resolver();
+
+            Resolver(const Resolver &) = delete;
+            Resolver & operator=(const Resolver &) = delete;
+
+            /** Resolves host and port in the background
+              @param
+                host The host name or numeric address.
+              @param
+                port The port number or service name.
+              @param
+                callback The function to call with the result on the reactor thread.
+              @return
+                The request id, which may be used to cancel the request.
+            */
+            RequestId resolve(const std::string & host, const std::string & port, const Callback & callback);
+
+            /** Drops the callback of a pending request. Cancelling a finished request is a no-op. */
+            void cancel(RequestId id);
+
+            /** Resolves host and port on the calling thread, through the cache.
+                Throws SocketException if there is no address. */
+            static std::vector<Address> resolveNow(const std::string & host, const std::string & port);
+
+        protected:
+            /** A lookup queued to the resolver threads */
+            struct Job {
+                RequestId id;
+                std::string host;
+                std::string port;
+            };
+
+            /** The state shared with the resolver threads, which may outlive the resolver */
+            struct Shared {
+                Shared() :
+                    owner(nullptr),
+                    nofIdle(0)
+                {}
+
+                std::mutex mutex;
+                std::condition_variable wakeup;
+                std::deque<Job> jobs;
+                /** Cleared by the destructor, the threads then exit */
+                Resolver *owner;
+                size_t nofIdle;
+            };
+
+            /** A cached result */
+            struct CacheEntry {
+                std::chrono::steady_clock::time_point expires;
+                std::vector<Address> addresses;
+                int error;
+            };
+
+            typedef std::pair<std::string, std::string> CacheKey;
+
+            /** Runs getaddrinfo(), returns 0 or its error code */
+            static int lookup(const std::string & host, const std::string & port, int flags, std::vector<Address> & addresses);
+
+            /** Looks up a result of the cache, false if missing or expired */
+            static bool lookupCache(const CacheKey & key, std::vector<Address> & addresses, int & error);
+
+            /** Caches a result, errors only if the name does not exist */
+            static void storeCache(const CacheKey & key, const std::vector<Address> & addresses, int error);
+
+            /** Returns the message of a getaddrinfo() error */
+            static std::string describe(int error);
+
+            /** The loop of a resolver thread */
+            static void serve(std::shared_ptr<Shared> shared);
+
+            /** Runs the callback of a request, on the reactor thread. */
+            void finish(RequestId id, const std::vector<Address> & addresses, int error);
+
+            /** Posts the result of a request to the reactor thread. */
+            void post(RequestId id, const std::vector<Address> & addresses, int error);
+
+            WorkQueue mReplies;
+            std::shared_ptr<Shared> mShared;
+            std::map<RequestId, Callback> mPending;
+            RequestId mNextId;
+            size_t mNofThreads;
+
+            static std::mutex sCacheMutex;
+            static std::map<CacheKey, CacheEntry> sCache;
+    };
+}
+
+#endif // __RCONRESOLVE_HH__
@@ -0,0 +1,75 @@
+#include "rconrtt.hh"
+
+
+namespace Rcon {
+
+    namespace Protocol {
+
+        /** The timer granularity of the reactor in microseconds */
+        static const int64_t CLOCK_GRANULARITY_US = 1000;
+
+
+        /* RttEstimator class */
+
+        RttEstimator::RttEstimator() {
+            reset();
+        }
+
+        void RttEstimator::reset() {
+            mSrtt = 0;
+            mRttVar = 0;
+            mTimeout = RTT_INITIAL_TIMEOUT_MS * 1000;
+            mNofSamples = 0;
+        }
+
+        void RttEstimator::sample(Clock::duration rtt) {
+            int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(rtt).count();
+            us = (us > 0) ? us : 0;
+
+            if (mNofSamples == 0) {
+                mSrtt = us;
+                mRttVar = us / 2;
+            } else {
+                int64_t delta = (mSrtt > us) ? mSrtt - us : us - mSrtt;
+                mRttVar = (3 * mRttVar + delta) / 4;
+                mSrtt = (7 * mSrtt + us) / 8;
+            }
+            ++mNofSamples;
+
+            int64_t variation = 4 * mRttVar;
+            mTimeout = mSrtt + (variation > CLOCK_GRANULARITY_US ? variation : CLOCK_GRANULARITY_US);
+            if (mTimeout < RTT_MIN_TIMEOUT_MS * 1000) {
+                mTimeout = RTT_MIN_TIMEOUT_MS * 1000;
+            } else if (mTimeout > RTT_MAX_TIMEOUT_MS * 1000) {
+                mTimeout = RTT_MAX_TIMEOUT_MS * 1000;
+            }
+        }
+
+        void RttEstimator::sampleSince(Clock::time_point sentAt) {
+            sample(Clock::now() - sentAt);
+        }
+
+        int RttEstimator::getTimeout(int attempt) const {
+            int64_t timeout = (mTimeout + 999) / 1000;
+            for (int i = 0; i < attempt && timeout < RTT_MAX_TIMEOUT_MS; ++i) {
+                timeout *= 2;
+            }
+            return (timeout < RTT_MAX_TIMEOUT_MS) ? (int)timeout : RTT_MAX_TIMEOUT_MS;
+        }
+
+        int RttEstimator::getTimeout(int attempt, Clock::time_point deadline) const {
+            int64_t left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+            int timeout = getTimeout(attempt);
+            return (left < timeout) ? (left > 0 ? (int)left : 0) : timeout;
+        }
+
+        bool RttEstimator::hasSamples() const {
+            return mNofSamples > 0;
+        }
+
+        void RttEstimator::printStats(std::ostream & out) const {
+            out << "rtt: " << mNofSamples << " samples, srtt " << mSrtt / 1000.0 << " ms, rttvar "
+                << mRttVar / 1000.0 << " ms, retransmit timeout " << getTimeout() << " ms" << std::endl;
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef __RCONRTT_HH__
+#define __RCONRTT_HH__
+
+#include <sys/types.h>
+#include <cstdint>
+#include <chrono>
+#include <ostream>
+
+/** The retransmit timeout before the first round trip was measured */
+#define RTT_INITIAL_TIMEOUT_MS 500
+#define RTT_MIN_TIMEOUT_MS 20
+#define RTT_MAX_TIMEOUT_MS 8000
+
+namespace Rcon {
+
+    namespace Protocol {
+
+        /** Round trip time estimator class
+          @remarks
+            Keeps the smoothed round trip time and its variation of a single
+            session like TCP does (RFC 6298) and derives the retransmit
+            timeout from them: SRTT + 4 * RTTVAR, bounded to
+            RTT_MIN_TIMEOUT_MS .. RTT_MAX_TIMEOUT_MS. Only round trips of
+            packets which were sent once may be sampled, as the response to
+            a resent packet cannot be told apart from the response to the
+            first attempt. Every further attempt doubles the timeout.
+        */
+        class RttEstimator {
+            public:
+                typedef std::chrono::steady_clock Clock;
+
+                RttEstimator();
+
+                /** Forgets all samples. */
+                void reset();
+
+                /** Adds the round trip time of a packet which was sent once */
+                void sample(Clock::duration rtt);
+
+                /** Adds the round trip time from sentAt until now */
+                void sampleSince(Clock::time_point sentAt);
+
+                /** Returns the retransmit timeout in milliseconds
+                  @param
+                    attempt The number of times the packet was resent already.
+                */
+                int getTimeout(int attempt = 0) const;
+
+                /** Returns the milliseconds to wait for attempt, but no longer than until deadline */
+                int getTimeout(int attempt, Clock::time_point deadline) const;
+
+                /** Returns true once a round trip time was sampled */
+                bool hasSamples() const;
+
+                /** Prints the estimate in a single line */
+                void printStats(std::ostream & out) const;
+
+            protected:
+                /** All in microseconds */
+                int64_t mSrtt;
+                int64_t mRttVar;
+                int64_t mTimeout;
+                uint64_t mNofSamples;
+        };
+    }
+}
+
+#endif // __RCONRTT_HH__
@@ -0,0 +1,84 @@
+#include "rconseq.hh"
+
+
+namespace Rcon {
+
+    namespace Protocol {
+
+
+        /* SequenceWindow class */
+
+        SequenceWindow::SequenceWindow() :
+            mLast(0),
+            mStarted(false)
+        {
+        }
+
+        void SequenceWindow::reset() {
+            mSeen.reset();
+            mLast = 0;
+            mStarted = false;
+        }
+
+        SequenceWindow::Verdict SequenceWindow::check(uint8_t seqNum) {
+            ++mStats.received;
+
+            if (!mStarted) {
+                /* Nothing before the first message can be told apart from a copy */
+                mSeen.set();
+                mLast = seqNum;
+                mStarted = true;
+                return SEQ_NEW;
+            }
+
+            uint8_t ahead = seqNum - mLast;
+            if (ahead > 0 && ahead < 128) {
+                /* The skipped and the new entries were last used a full wrap ago */
+                for (uint8_t i = 1; i < ahead; ++i) {
+                    mSeen.reset((uint8_t)(mLast + i));
+                }
+                mStats.gaps += ahead - 1;
+                mSeen.set(seqNum);
+                mLast = seqNum;
+                return SEQ_NEW;
+            }
+
+            if (mSeen.test(seqNum)) {
+                ++mStats.duplicates;
+                return SEQ_DUPLICATE;
+            }
+            mSeen.set(seqNum);
+            ++mStats.resends;
+            return SEQ_LATE;
+        }
+
+        const SequenceWindow::Stats & SequenceWindow::getStats() const {
+            return mStats;
+        }
+
+        void SequenceWindow::printStats(std::ostream & out) const {
+            out << "server messages: " << mStats.received << " received, " << mStats.duplicates << " duplicates, "
+                << mStats.gaps << " gaps, " << mStats.resends << " resends" << std::endl;
+        }
+
+
+        /* CommandSequence class */
+
+        CommandSequence::CommandSequence() :
+            mNext(0)
+        {
+        }
+
+        void CommandSequence::reset() {
+            mNext = 0;
+        }
+
+        uint8_t CommandSequence::next() {
+            return mNext++;
+        }
+
+        uint8_t CommandSequence::peek() const {
+            return mNext;
+        }
+    }
+}
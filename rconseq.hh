@@ -0,0 +1,107 @@
+#ifndef __RCONSEQ_HH__
+#define __RCONSEQ_HH__
+
+#include <sys/types.h>
+#include <cstdint>
+#include <bitset>
+#include <ostream>
+
+namespace Rcon {
+
+    namespace Protocol {
+
+        /** Server message sequence window class
+          @remarks
+            Tells new server messages apart from the copies BattlEye resends
+            when it has not seen our acknowledgement in time. A 256 entry
+            bitmap over the 8 bit sequence number records the messages seen,
+            relative to the newest sequence number: a message up to 127
+            ahead of it is new and moves the window, skipping its predecessors
+            counts them as gaps; a message behind it is a duplicate unless it
+            fills one of those gaps. Duplicates still have to be acknowledged
+            but must not be emitted again.
+        */
+        class SequenceWindow {
+            public:
+                enum Verdict {
+                    /** The next message or one ahead of it */
+                    SEQ_NEW,
+                    /** A message which fills a gap, resent by the server or reordered */
+                    SEQ_LATE,
+                    /** A copy of a message already seen */
+                    SEQ_DUPLICATE
+                };
+
+                /** Window statistics */
+                struct Stats {
+                    Stats() :
+                        received(0),
+                        duplicates(0),
+                        gaps(0),
+                        resends(0)
+                    {}
+
+                    /** The number of messages passed to check() */
+                    uint64_t received;
+                    /** The number of copies of messages already seen */
+                    uint64_t duplicates;
+                    /** The number of sequence numbers skipped by a newer message */
+                    uint64_t gaps;
+                    /** The number of skipped sequence numbers which arrived later */
+                    uint64_t resends;
+                };
+
+                SequenceWindow();
+
+                /** Forgets the window, as BattlEye restarts the sequence on every login. */
+                void reset();
+
+                /** Records a received server message
+                  @param
+                    seqNum The sequence number of the message.
+                  @return
+                    Whether the message is new, late or a duplicate.
+                */
+                Verdict check(uint8_t seqNum);
+
+                /** Returns the window statistics */
+                const Stats & getStats() const;
+
+                /** Prints the window statistics in a single line */
+                void printStats(std::ostream & out) const;
+
+            protected:
+                std::bitset<256> mSeen;
+                uint8_t mLast;
+                bool mStarted;
+                Stats mStats;
+        };
+
+
+        /** Command sequence class
+          @remarks
+            Hands out the sequence numbers of the commands sent over one
+            session. Every session keeps its own, so sessions on different
+            threads never share state, and BattlEye only requires the numbers
+            to be unique among the commands in flight on a session.
+        */
+        class CommandSequence {
+            public:
+                CommandSequence();
+
+                /** Starts again at 0, for a new session */
+                void reset();
+
+                /** Returns the next sequence number and advances */
+                uint8_t next();
+
+                /** Returns the next sequence number without advancing */
+                uint8_t peek() const;
+
+            protected:
+                uint8_t mNext;
+        };
+    }
+}
+
+#endif // __RCONSEQ_HH__
@@ -0,0 +1,359 @@
+#include "rconsession.hh"
+#include "rconmsg.hh"
+#include "rconexception.hh"
+#include <sys/types.h>
+#include <chrono>
+
+
+namespace Rcon {
+
+    /* Session class */
+
+    Session::Session(Reactor & reactor, Resolver & resolver, const Target & target, size_t window) :
+        mReactor(reactor),
+        mResolver(resolver),
+        mTarget(target),
+        mChannel(reactor, *this),
+        mWindow(window),
+        mState(SESSION_DOWN),
+        mNextTag(1),
+        mNofDropped(0),
+        mLoginAnswered(false),
+        mLoginResult(0),
+        mResolveRequest(0),
+        mLoginTimer(0),
+        mKeepaliveTimer(0),
+        mWakeTimer(0),
+        mShutdownTimer(0)
+    {
+        mChannel.setMetrics(&mMetrics);
+        mChannel.setBatchSize(CHANNEL_BATCH_SIZE);
+    }
+
+    Session::~Session() {
+        mReactor.cancelTimer(mWakeTimer);
+        mReactor.cancelTimer(mShutdownTimer);
+        shutdown();
+    }
+
+    Task<void> Session::login() {
+        if (mState != SESSION_DOWN) {
+            throw ProtocolException("already logged in");
+        }
+        if (mShutdownTimer != 0) {
+            mReactor.cancelTimer(mShutdownTimer);
+            mShutdownTimer = 0;
+            shutdown();
+        }
+        mState = SESSION_LOGIN;
+        mError.clear();
+        mServerWindow.reset();
+        mLoginAnswered = false;
+
+        try {
+            std::vector<Address> addresses;
+            std::string error;
+            co_await suspendWith([this, &addresses, &error](std::coroutine_handle<> handle) {
+                mLoginWaiter = handle;
+                mResolveRequest = mResolver.resolve(mTarget.host, mTarget.port,
+                                                    [this, &addresses, &error](const std::vector<Address> & result,
+                                                                               const std::string & resolveError) {
+                    mResolveRequest = 0;
+                    addresses = result;
+                    error = resolveError;
+                    wake(mLoginWaiter);
+                });
+            });
+            if (mState != SESSION_LOGIN) {
+                throw Exception(mError);
+            }
+            if (!error.empty()) {
+                throw SocketException(error);
+            }
+            mChannel.open(addresses);
+
+            /**** Login, resent with backoff until the login deadline ****/
+            int timeoutMs = (mTarget.timeoutMs > 0) ? mTarget.timeoutMs : DEFAULT_TIMEOUT_MS;
+            Reactor::Clock::time_point sent = Reactor::Clock::now();
+            Reactor::Clock::time_point deadline = sent + std::chrono::milliseconds(timeoutMs);
+            int attempt = 0;
+            for (;;) {
+                Protocol::Login login(mTarget.password);
+                mChannel.send(login);
+                int waitMs = mChannel.getRtt().getTimeout(attempt, deadline);
+                co_await suspendWith([this, waitMs](std::coroutine_handle<> handle) {
+                    mLoginWaiter = handle;
+                    mLoginTimer = mReactor.addTimer(waitMs, [this]() {
+                        mLoginTimer = 0;
+                        wake(mLoginWaiter);
+                    });
+                });
+                if (mState != SESSION_LOGIN) {
+                    throw Exception(mError);
+                }
+                if (mLoginAnswered) {
+                    break;
+                }
+                ++mMetrics.timeouts;
+                if (RCON_TRACING(timeout)) {
+                    Trace::timeout(mChannel.getTraceId(), -1, attempt);
+                }
+                if (Reactor::Clock::now() >= deadline) {
+                    throw ProtocolException("timeout");
+                }
+                ++attempt;
+            }
+            mMetrics.loginRtt.recordSince(sent);
+            if (attempt == 0) {
+                mChannel.getRtt().sampleSince(sent);
+            }
+            if (mLoginResult == 0) {
+                throw ProtocolException("Wrong RCON password!");
+            }
+
+            mPipeline.reset(new Pipeline(mReactor, mChannel, mWindow,
+                [this](const Pipeline::Result & result) { onResult(result); }));
+            mPipeline->setDeadline(timeoutMs);
+            mPipeline->setRate(mTarget.rate, mTarget.burst);
+            mPipeline->setCoalescing(true);
+            mState = SESSION_READY;
+            mLastSend = Reactor::Clock::now();
+            armKeepalive();
+
+        } catch (Exception & e) {
+            fail(e.what());
+            throw;
+        }
+    }
+
+    Task<std::string> Session::command(std::string cmd) {
+        if (mState != SESSION_READY) {
+            throw ProtocolException("not logged in");
+        }
+
+        Pending pending;
+        uint64_t tag = mNextTag++;
+        mPending[tag] = &pending;
+        mLastSend = Reactor::Clock::now();
+        try {
+            mPipeline->submit(cmd, tag, Pipeline::priorityOf(cmd));
+        } catch (Exception & e) {
+            fail(e.what());
+        }
+
+        /* The frame of the coroutine keeps the result until it is resumed */
+        if (!pending.done) {
+            co_await suspendWith([&pending](std::coroutine_handle<> handle) { pending.handle = handle; });
+        }
+        if (!pending.result.ok) {
+            throw CommandException(pending.result.error);
+        }
+        co_return std::move(pending.result.output);
+    }
+
+    AsyncGenerator<ServerMessage> Session::messages() {
+        for (;;) {
+            if (mMessages.empty()) {
+                if (mState == SESSION_DOWN) {
+                    co_return;
+                }
+                co_await suspendWith([this](std::coroutine_handle<> handle) { mMessageWaiter = handle; });
+                continue;
+            }
+            ServerMessage message = std::move(mMessages.front());
+            mMessages.pop_front();
+            co_yield message;
+        }
+    }
+
+    void Session::close() {
+        fail("session closed");
+        mReactor.cancelTimer(mShutdownTimer);
+        mShutdownTimer = 0;
+        shutdown();
+    }
+
+    bool Session::isReady() const {
+        return mState == SESSION_READY;
+    }
+
+    const Target & Session::getTarget() const {
+        return mTarget;
+    }
+
+    const Metrics & Session::getMetrics() const {
+        return mMetrics;
+    }
+
+    size_t Session::getNofDropped() const {
+        return mNofDropped;
+    }
+
+    void Session::wake(std::coroutine_handle<> & handle) {
+        if (!handle) {
+            return;
+        }
+        mWoken.push_back(handle);
+        handle = nullptr;
+        if (mWakeTimer == 0) {
+            mWakeTimer = mReactor.addTimer(0, [this]() {
+                mWakeTimer = 0;
+                resumeWoken();
+            });
+        }
+    }
+
+    void Session::resumeWoken() {
+        /* A coroutine may destroy the session, so only the local copy is used */
+        std::vector<std::coroutine_handle<> > woken;
+        woken.swap(mWoken);
+        for (size_t i = 0; i < woken.size(); ++i) {
+            woken[i].resume();
+        }
+    }
+
+    void Session::fail(const std::string & reason) {
+        mState = SESSION_DOWN;
+        mError = reason;
+        mReactor.cancelTimer(mLoginTimer);
+        mReactor.cancelTimer(mKeepaliveTimer);
+        mLoginTimer = mKeepaliveTimer = 0;
+        mResolver.cancel(mResolveRequest);
+        mResolveRequest = 0;
+
+        for (std::unordered_map<uint64_t, Pending*>::iterator it = mPending.begin(); it != mPending.end(); ++it) {
+            Pending *pending = it->second;
+            if (pending != nullptr) {
+                pending->result.ok = false;
+                pending->result.error = "session lost: " + reason;
+                pending->done = true;
+                wake(pending->handle);
+            }
+        }
+        mPending.clear();
+        wake(mLoginWaiter);
+        wake(mMessageWaiter);
+
+        /* Never tear down the pipeline or the channel from within one of their own callbacks */
+        if (mShutdownTimer == 0) {
+            mShutdownTimer = mReactor.addTimer(0, [this]() {
+                mShutdownTimer = 0;
+                shutdown();
+            });
+        }
+    }
+
+    void Session::shutdown() {
+        mReactor.cancelTimer(mLoginTimer);
+        mReactor.cancelTimer(mKeepaliveTimer);
+        mLoginTimer = mKeepaliveTimer = 0;
+        mResolver.cancel(mResolveRequest);
+        mResolveRequest = 0;
+        mChannel.close();
+        mPipeline.reset();
+    }
+
+    void Session::onResult(const Pipeline::Result & result) {
+        std::unordered_map<uint64_t, Pending*>::iterator it = mPending.find(result.tag);
+        if (it == mPending.end()) {
+            /* Failed already */
+            return;
+        }
+        Pending *pending = it->second;
+        mPending.erase(it);
+
+        if (pending == nullptr) {
+            if (!result.ok) {
+                fail("keepalive not answered");
+            }
+            return;
+        }
+        pending->result = result;
+        pending->done = true;
+        wake(pending->handle);
+    }
+
+    void Session::armKeepalive() {
+        Reactor::Clock::duration idle = Reactor::Clock::now() - mLastSend;
+        int delay = KEEPALIVE_INTERVAL_MS - (int)std::chrono::duration_cast<std::chrono::milliseconds>(idle).count();
+        mKeepaliveTimer = mReactor.addTimer(delay > 0 ? delay : 0, [this]() {
+            mKeepaliveTimer = 0;
+            keepalive();
+        });
+    }
+
+    void Session::keepalive() {
+        if (mState != SESSION_READY) {
+            return;
+        }
+        Reactor::Clock::duration idle = Reactor::Clock::now() - mLastSend;
+        if (idle >= std::chrono::milliseconds(KEEPALIVE_INTERVAL_MS)) {
+            /* BattlEye answers the empty command with an empty response */
+            uint64_t tag = mNextTag++;
+            mPending[tag] = nullptr;
+            mLastSend = Reactor::Clock::now();
+            try {
+                mPipeline->submit(std::string(), tag, Pipeline::PRIORITY_ADMIN);
+            } catch (Exception & e) {
+                fail(e.what());
+                return;
+            }
+        }
+        armKeepalive();
+    }
+
+    void Session::handleView(Channel & channel, const Protocol::MessageView & view) {
+        if (mState == SESSION_DOWN) {
+            return;
+        }
+
+        try {
+            switch (view.type) {
+
+                case Protocol::Message::MSG_SRV_MSG:
+                    {
+                        Protocol::ServerAck ack(view.seqNum);
+                        channel.queue(ack);
+                    }
+                    ++mMetrics.serverMessages;
+                    if (mServerWindow.check(view.seqNum) == Protocol::SequenceWindow::SEQ_DUPLICATE) {
+                        ++mMetrics.duplicates;
+                        break;
+                    }
+                    if (mMessages.size() >= SESSION_MESSAGE_LIMIT) {
+                        mMessages.pop_front();
+                        ++mNofDropped;
+                    }
+                    mMessages.push_back(ServerMessage());
+                    mMessages.back().seqNum = view.seqNum;
+                    mMessages.back().text.assign(view.payload.data(), view.payload.size());
+                    mMessages.back().received = Reactor::Clock::now();
+                    wake(mMessageWaiter);
+                    break;
+
+                case Protocol::Message::MSG_LOGIN_RESP:
+                    if (mState != SESSION_LOGIN || mLoginAnswered) {
+                        break;
+                    }
+                    mReactor.cancelTimer(mLoginTimer);
+                    mLoginTimer = 0;
+                    mLoginAnswered = true;
+                    mLoginResult = view.result;
+                    wake(mLoginWaiter);
+                    break;
+
+                default:
+                    if (mPipeline) {
+                        mPipeline->handleView(view);
+                    }
+                    break;
+            }
+        } catch (Exception & e) {
+            fail(e.what());
+        }
+    }
+
+    void Session::handleError(Channel &, const Exception & e) {
+        fail(e.what());
+    }
+}
@@ -0,0 +1,179 @@
+#ifndef __RCONSESSION_HH__
+#define __RCONSESSION_HH__
+
+#include "rcontask.hh"
+#include "rconreactor.hh"
+#include "rconpipeline.hh"
+#include "rconresolve.hh"
+#include "rconseq.hh"
+#include "rconmetrics.hh"
+#include "rconconfig.hh"
+#include <sys/types.h>
+#include <cstdint>
+#include <string>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <coroutine>
+
+/** The commands a session keeps outstanding at the same time by default */
+#define SESSION_WINDOW 16
+/** The server messages a session keeps until they are taken, the oldest are dropped beyond */
+#define SESSION_MESSAGE_LIMIT 4096
+
+namespace Rcon {
+
+    /** A message the server sent on its own, e.g. a chat line */
+    struct ServerMessage {
+        uint8_t seqNum;
+        std::string text;
+        /** When the message was received */
+        Reactor::Clock::time_point received;
+    };
+
+
+    /** Session class
+      @remarks
+        A session to a single BattlEye RCon server for embedding the client
+        as a library, with a coroutine API:
+            Session session(reactor, resolver, target);
+            co_await session.login();
+            std::string players = co_await session.command("players");
+            AsyncGenerator<ServerMessage> messages = session.messages();
+            while (ServerMessage *msg = co_await messages.next()) { ... }
+        The session runs on the thread of its reactor, like the channels of
+        the daemon: nothing blocks, so any number of sessions and of their
+        operations share the reactor, and sessions may be sharded across
+        the reactors of Worker threads. Every coroutine is resumed from a
+        zero delay timer of the reactor, never from within a channel or
+        pipeline callback, so it may close the session. The login is resent
+        with backoff until the deadline, commands are pipelined within the
+        window by priority class, paced at the rate of the server, with
+        identical read-only commands sharing a result, and resent like the
+        ones of the command line client, server
+        messages are acknowledged, resent copies dropped, and an empty
+        keepalive command is sent when nothing was sent for
+        KEEPALIVE_INTERVAL_MS. Errors are thrown as the exceptions of the
+        command line client. Once the channel fails or the session is
+        closed, the commands waiting fail, messages() ends and the session
+        may log in again. A session must only be destroyed once nothing
+        awaits it.
+      @param
+        reactor The reactor serving the session.
+      @param
+        resolver The resolver of that reactor.
+      @param
+        target The server, with its password and deadline.
+      @param
+        window The commands kept outstanding at the same time, 1 to MAX_PIPELINE_WINDOW.
+    */
+    class Session : public MessageHandler {
+        public:
+            explicit Session(Reactor & reactor, Resolver & resolver, const Target & target, size_t window = SESSION_WINDOW);
+
+            virtual ~Session();
+
+            Session(const Session &) = delete;
+            Session & operator=(const Session &) = delete;
+
+            /** Resolves the server and logs in, throws ProtocolException if the
+                password is wrong or the deadline passed. */
+            Task<void> login();
+
+            /** Executes a command, returns its output or throws CommandException. */
+            Task<std::string> command(std::string cmd);
+
+            /** Returns the server messages as they arrive, until the session is down.
+                Messages received before are returned first. */
+            AsyncGenerator<ServerMessage> messages();
+
+            /** Closes the channel, the commands waiting fail. */
+            void close();
+
+            /** Returns true if the session is logged in */
+            bool isReady() const;
+
+            /** Returns the server of the session */
+            const Target & getTarget() const;
+
+            /** Returns the metrics of the session */
+            const Metrics & getMetrics() const;
+
+            /** Returns the number of server messages dropped because nobody took them */
+            size_t getNofDropped() const;
+
+            virtual void handleView(Channel & channel, const Protocol::MessageView & view);
+
+            virtual void handleError(Channel & channel, const Exception & e);
+
+        protected:
+            enum State {
+                SESSION_DOWN,
+                SESSION_LOGIN,
+                SESSION_READY
+            };
+
+            /** A command awaiting its result, on the frame of its coroutine */
+            struct Pending {
+                Pending() :
+                    done(false)
+                {}
+
+                std::coroutine_handle<> handle;
+                Pipeline::Result result;
+                bool done;
+            };
+
+            /** Resumes a suspended coroutine from the reactor and clears the handle. */
+            void wake(std::coroutine_handle<> & handle);
+
+            /** Resumes the coroutines woken since the last call. */
+            void resumeWoken();
+
+            /** Fails the commands waiting and ends the messages, the channel is closed outside of the current callback. */
+            void fail(const std::string & reason);
+
+            /** Cancels the timers and the resolution and closes the channel. */
+            void shutdown();
+
+            void onResult(const Pipeline::Result & result);
+
+            /** Arms the keepalive timer relative to the last command sent. */
+            void armKeepalive();
+
+            void keepalive();
+
+            Reactor & mReactor;
+            Resolver & mResolver;
+            Target mTarget;
+            Channel mChannel;
+            size_t mWindow;
+            State mState;
+            std::string mError;
+            std::unique_ptr<Pipeline> mPipeline;
+            /** The commands submitted by their tag, null for a keepalive */
+            std::unordered_map<uint64_t, Pending*> mPending;
+            uint64_t mNextTag;
+            Protocol::SequenceWindow mServerWindow;
+            std::deque<ServerMessage> mMessages;
+            size_t mNofDropped;
+            Metrics mMetrics;
+
+            std::coroutine_handle<> mLoginWaiter;
+            bool mLoginAnswered;
+            uint8_t mLoginResult;
+            std::coroutine_handle<> mMessageWaiter;
+            /** The coroutines to resume from mWakeTimer */
+            std::vector<std::coroutine_handle<> > mWoken;
+
+            Resolver::RequestId mResolveRequest;
+            Reactor::TimerId mLoginTimer;
+            Reactor::TimerId mKeepaliveTimer;
+            Reactor::TimerId mWakeTimer;
+            Reactor::TimerId mShutdownTimer;
+            Reactor::Clock::time_point mLastSend;
+    };
+}
+
+#endif // __RCONSESSION_HH__
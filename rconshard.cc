@@ -0,0 +1,86 @@
+#include "rconshard.hh"
+#include "rconexception.hh"
+#include <sys/types.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+
+
+namespace Rcon {
+
+    /* WorkQueue class */
+
+    WorkQueue::WorkQueue(Reactor & reactor) :
+        mReactor(reactor),
+        mEventFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+        mSignalled(false)
+    {
+        if (mEventFd == -1) {
+            throw SocketException(std::string("eventfd: ") + strerror(errno));
+        }
+        mReactor.addSocket(mEventFd, this);
+    }
+
+    WorkQueue::~WorkQueue() {
+        mReactor.removeSocket(mEventFd);
+        close(mEventFd);
+    }
+
+    void WorkQueue::post(Task task) {
+        mTasks.push(std::move(task));
+        if (!mSignalled.exchange(true, std::memory_order_acq_rel)) {
+            uint64_t one = 1;
+            while (write(mEventFd, &one, sizeof(one)) == -1 && errno == EINTR) {
+            }
+        }
+    }
+
+    void WorkQueue::onReadable() {
+        uint64_t count;
+        while (read(mEventFd, &count, sizeof(count)) == -1 && errno == EINTR) {
+        }
+
+        /* Cleared before draining, so a post racing with the drain signals again */
+        mSignalled.store(false, std::memory_order_release);
+
+        Task task;
+        while (mTasks.pop(task)) {
+            task();
+        }
+    }
+
+
+    /* Worker class */
+
+    Worker::Worker() :
+        mReactor(Reactor::create())
+    {
+        mInbox.reset(new WorkQueue(*mReactor));
+    }
+
+    Worker::~Worker() {
+        stop();
+        mInbox.reset();
+    }
+
+    void Worker::start() {
+        mThread = Reactor::startThreadBlockingStopSignals([this]() { mReactor->run(); });
+    }
+
+    void Worker::stop() {
+        if (mThread.joinable()) {
+            post([this]() { mReactor->stop(); });
+            mThread.join();
+        }
+    }
+
+    void Worker::post(WorkQueue::Task task) {
+        mInbox->post(std::move(task));
+    }
+
+    Reactor & Worker::getReactor() {
+        return *mReactor;
+    }
+}
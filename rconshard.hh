@@ -0,0 +1,145 @@
+#ifndef __RCONSHARD_HH__
+#define __RCONSHARD_HH__
+
+#include "rconreactor.hh"
+#include <sys/types.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <utility>
+
+namespace Rcon {
+
+    /** MpscQueue class
+      @remarks
+        An unbounded, lock-free queue with any number of producer threads
+        and a single consumer thread, after Dmitry Vyukov's intrusive MPSC
+        node queue. push() is a single atomic exchange; pop() never blocks
+        and may briefly see the queue as empty while a push is half done,
+        which the consumer notices on its next wakeup. The queue always
+        holds a stub node, the node of the last popped element.
+    */
+    template <typename T>
+    class MpscQueue {
+        public:
+            MpscQueue() :
+                mHead(new Node()),
+                mTail(mHead.load(std::memory_order_relaxed))
+            {}
+
+            virtual ~MpscQueue() {
+                T value;
+                while (pop(value)) {
+                }
+                delete mTail;
+            }
+
+            MpscQueue(const MpscQueue &) = delete;
+            MpscQueue & operator=(const MpscQueue &) = delete;
+
+            /** Appends a value, from any thread. */
+            void push(T value) {
+                Node *node = new Node();
+                node->value = std::move(value);
+                Node *prev = mHead.exchange(node, std::memory_order_acq_rel);
+                prev->next.store(node, std::memory_order_release);
+            }
+
+            /** Takes the oldest value, from the consumer thread only
+              @return
+                false if the queue is empty.
+            */
+            bool pop(T & value) {
+                Node *tail = mTail;
+                Node *next = tail->next.load(std::memory_order_acquire);
+                if (next == nullptr) {
+                    return false;
+                }
+                value = std::move(next->value);
+                mTail = next;
+                delete tail;
+                return true;
+            }
+
+        protected:
+            struct Node {
+                Node() :
+                    next(nullptr)
+                {}
+
+                std::atomic<Node*> next;
+                T value;
+            };
+
+            /* Producers and the consumer never share a cache line */
+            alignas(64) std::atomic<Node*> mHead;
+            alignas(64) Node *mTail;
+    };
+
+
+    /** WorkQueue class
+      @remarks
+        Runs functions posted from any thread on the thread of a reactor.
+        The functions are queued on an MpscQueue and an eventfd registered
+        to the reactor wakes it up, once per burst of posts rather than once
+        per function.
+      @param
+        reactor The reactor to run the posted functions on.
+    */
+    class WorkQueue : public SocketHandler {
+        public:
+            typedef std::function<void()> Task;
+
+            explicit WorkQueue(Reactor & reactor);
+
+            virtual ~WorkQueue();
+
+            /** Queues a function to run on the reactor thread, from any thread. */
+            void post(Task task);
+
+            /** Runs the queued functions. */
+            virtual void onReadable();
+
+        protected:
+            Reactor & mReactor;
+            int mEventFd;
+            MpscQueue<Task> mTasks;
+            /** Set while a wakeup is pending, so a burst of posts writes the eventfd once */
+            std::atomic<bool> mSignalled;
+    };
+
+
+    /** Worker class
+      @remarks
+        A thread running its own reactor, so the sessions it serves share
+        no state and no locks with the other workers. Other threads hand
+        work to it with post(). SIGINT and SIGTERM are blocked on the worker
+        thread, they are left to the thread which created it.
+    */
+    class Worker {
+        public:
+            Worker();
+
+            virtual ~Worker();
+
+            /** Starts the worker thread. */
+            void start();
+
+            /** Stops the reactor after the functions posted so far and joins the thread. */
+            void stop();
+
+            /** Queues a function to run on the worker thread, from any thread. */
+            void post(WorkQueue::Task task);
+
+            /** Returns the reactor of the worker, only to be used on the worker thread once started */
+            Reactor & getReactor();
+
+        protected:
+            std::unique_ptr<Reactor> mReactor;
+            std::unique_ptr<WorkQueue> mInbox;
+            std::thread mThread;
+    };
+}
+
+#endif // __RCONSHARD_HH__
@@ -0,0 +1,506 @@
+#include "rcontable.hh"
+#include <algorithm>
+
+
+namespace Rcon {
+
+    namespace Protocol {
+
+        static const Table::Column sPlayerColumns[] = {
+            { "id",       Table::COLUMN_NUMBER, true },
+            { "ip",       Table::COLUMN_STRING, true },
+            { "port",     Table::COLUMN_NUMBER, true },
+            { "ping",     Table::COLUMN_NUMBER, false },
+            { "guid",     Table::COLUMN_STRING, false },
+            { "verified", Table::COLUMN_BOOL,   false },
+            { "name",     Table::COLUMN_STRING, false },
+            { "lobby",    Table::COLUMN_BOOL,   false }
+        };
+
+        static const Table::Column sBanColumns[] = {
+            { "type",     Table::COLUMN_STRING, true },
+            { "id",       Table::COLUMN_NUMBER, false },
+            { "ban",      Table::COLUMN_STRING, true },
+            { "minutes",  Table::COLUMN_NUMBER, false },
+            { "reason",   Table::COLUMN_STRING, false }
+        };
+
+        static const Table::Column sAdminColumns[] = {
+            { "id",       Table::COLUMN_NUMBER, true },
+            { "ip",       Table::COLUMN_STRING, true },
+            { "port",     Table::COLUMN_NUMBER, true }
+        };
+
+        static const Table::Column sMissionColumns[] = {
+            { "name",     Table::COLUMN_STRING, true }
+        };
+
+        static const std::string_view sTrue("true");
+        static const std::string_view sFalse("false");
+        static const std::string_view sLobbySuffix(" (Lobby)");
+
+        static std::string_view trim(std::string_view text) {
+            size_t first = text.find_first_not_of(" \t\r");
+            if (first == std::string_view::npos) {
+                return std::string_view();
+            }
+            size_t last = text.find_last_not_of(" \t\r");
+            return text.substr(first, last - first + 1);
+        }
+
+        /** Takes the next blank separated token off the front of the line */
+        static std::string_view nextToken(std::string_view & line) {
+            size_t first = line.find_first_not_of(" \t");
+            if (first == std::string_view::npos) {
+                line = std::string_view();
+                return line;
+            }
+            size_t end = line.find_first_of(" \t", first);
+            if (end == std::string_view::npos) {
+                end = line.size();
+            }
+            std::string_view token = line.substr(first, end - first);
+            line.remove_prefix(end);
+            return token;
+        }
+
+        static bool isInteger(const std::string_view & value) {
+            size_t start = (!value.empty() && value[0] == '-') ? 1 : 0;
+            return value.size() > start && value.find_first_not_of("0123456789", start) == std::string_view::npos;
+        }
+
+        static bool endsWith(const std::string_view & text, const std::string_view & suffix) {
+            return text.size() >= suffix.size() && text.substr(text.size() - suffix.size()) == suffix;
+        }
+
+        /** Splits ip:port at the last colon, the port stays empty without one */
+        static void splitAddress(const std::string_view & address, std::string_view & ip, std::string_view & port) {
+            size_t colon = address.rfind(':');
+            if (colon == std::string_view::npos) {
+                ip = address;
+                port = std::string_view();
+                return;
+            }
+            ip = address.substr(0, colon);
+            port = address.substr(colon + 1);
+        }
+
+
+        /* Table class */
+
+        Table::Table(Kind kind) :
+            mKind(kind)
+        {
+        }
+
+        Table::Kind Table::kindOf(const std::string_view & command) {
+            std::string_view name = trim(command);
+            if (name == "players") {
+                return TABLE_PLAYERS;
+            }
+            if (name == "bans") {
+                return TABLE_BANS;
+            }
+            if (name == "admins") {
+                return TABLE_ADMINS;
+            }
+            if (name == "missions") {
+                return TABLE_MISSIONS;
+            }
+            return TABLE_NONE;
+        }
+
+        bool Table::parse(const std::string_view & text) {
+            mRows.clear();
+
+            bool header = false;
+            bool inRows = false;
+            std::string_view section;
+            size_t start = 0;
+            while (start < text.size()) {
+                size_t end = text.find('\n', start);
+                if (end == std::string_view::npos) {
+                    end = text.size();
+                }
+                std::string_view line = trim(text.substr(start, end - start));
+                start = end + 1;
+
+                if (mKind == TABLE_MISSIONS) {
+                    /* A plain list of names below its heading */
+                    if (!header) {
+                        header = (line == "Missions on server:");
+                    } else if (!line.empty()) {
+                        parseRow(line, section);
+                    }
+                    continue;
+                }
+
+                if (mKind == TABLE_BANS && endsWith(line, "Bans:")) {
+                    section = (line.compare(0, 4, "GUID") == 0) ? std::string_view("guid") : std::string_view("ip");
+                    inRows = false;
+                    continue;
+                }
+                if (!inRows) {
+                    /* The rows start below the dashed line under the column names */
+                    if (line.size() >= 3 && line.find_first_not_of('-') == std::string_view::npos) {
+                        header = inRows = true;
+                    }
+                    continue;
+                }
+                if (line.empty() || line[0] == '(') {
+                    inRows = false;
+                    continue;
+                }
+                parseRow(line, section);
+            }
+            return header;
+        }
+
+        void Table::parseRow(std::string_view line, const std::string_view & section) {
+            Row row;
+
+            switch (mKind) {
+                case TABLE_PLAYERS:
+                    {
+                        row.fields[0] = nextToken(line);
+                        splitAddress(nextToken(line), row.fields[1], row.fields[2]);
+                        row.fields[3] = nextToken(line);
+
+                        /* The GUID is followed by its verification state, (OK) or (?) */
+                        std::string_view guid = nextToken(line);
+                        size_t paren = guid.find('(');
+                        row.fields[5] = sFalse;
+                        if (paren != std::string_view::npos && endsWith(guid, ")")) {
+                            if (guid.substr(paren) == "(OK)") {
+                                row.fields[5] = sTrue;
+                            }
+                            guid = guid.substr(0, paren);
+                        }
+                        row.fields[4] = guid;
+
+                        std::string_view name = trim(line);
+                        row.fields[7] = sFalse;
+                        if (endsWith(name, sLobbySuffix)) {
+                            name.remove_suffix(sLobbySuffix.size());
+                            row.fields[7] = sTrue;
+                        }
+                        row.fields[6] = name;
+                    }
+                    break;
+
+                case TABLE_BANS:
+                    row.fields[0] = section;
+                    row.fields[1] = nextToken(line);
+                    row.fields[2] = nextToken(line);
+                    row.fields[3] = nextToken(line);
+                    row.fields[4] = trim(line);
+                    break;
+
+                case TABLE_ADMINS:
+                    row.fields[0] = nextToken(line);
+                    splitAddress(nextToken(line), row.fields[1], row.fields[2]);
+                    break;
+
+                case TABLE_MISSIONS:
+                    row.fields[0] = line;
+                    break;
+
+                default:
+                    return;
+            }
+
+            /* Numbered tables skip anything which is not a numbered row */
+            if (mKind != TABLE_MISSIONS && !isInteger(row.fields[mKind == TABLE_BANS ? 1 : 0])) {
+                return;
+            }
+            mRows.push_back(row);
+        }
+
+        void Table::sort() {
+            std::sort(mRows.begin(), mRows.end(), [this](const Row & a, const Row & b) {
+                return compareKeys(a, b) < 0;
+            });
+        }
+
+        Table::Kind Table::getKind() const {
+            return mKind;
+        }
+
+        const char *Table::getName() const {
+            switch (mKind) {
+                case TABLE_PLAYERS:  return "players";
+                case TABLE_BANS:     return "bans";
+                case TABLE_ADMINS:   return "admins";
+                case TABLE_MISSIONS: return "missions";
+                default:             return "none";
+            }
+        }
+
+        const char *Table::getAddedName() const {
+            return (mKind == TABLE_PLAYERS) ? "join" : "add";
+        }
+
+        const char *Table::getRemovedName() const {
+            return (mKind == TABLE_PLAYERS) ? "leave" : "remove";
+        }
+
+        size_t Table::getNofColumns() const {
+            switch (mKind) {
+                case TABLE_PLAYERS:  return sizeof(sPlayerColumns) / sizeof(Column);
+                case TABLE_BANS:     return sizeof(sBanColumns) / sizeof(Column);
+                case TABLE_ADMINS:   return sizeof(sAdminColumns) / sizeof(Column);
+                case TABLE_MISSIONS: return sizeof(sMissionColumns) / sizeof(Column);
+                default:             return 0;
+            }
+        }
+
+        const Table::Column & Table::getColumn(size_t columnIdx) const {
+            switch (mKind) {
+                case TABLE_PLAYERS:  return sPlayerColumns[columnIdx];
+                case TABLE_BANS:     return sBanColumns[columnIdx];
+                case TABLE_ADMINS:   return sAdminColumns[columnIdx];
+                default:             return sMissionColumns[columnIdx];
+            }
+        }
+
+        const std::vector<Table::Row> & Table::getRows() const {
+            return mRows;
+        }
+
+        int Table::compareKeys(const Row & a, const Row & b) const {
+            for (size_t i = 0; i < getNofColumns(); ++i) {
+                if (!getColumn(i).key) {
+                    continue;
+                }
+                int c = a.fields[i].compare(b.fields[i]);
+                if (c != 0) {
+                    return c;
+                }
+            }
+            return 0;
+        }
+
+        bool Table::differs(const Row & a, const Row & b) const {
+            for (size_t i = 0; i < getNofColumns(); ++i) {
+                if (!getColumn(i).key && a.fields[i] != b.fields[i]) {
+                    return true;
+                }
+            }
+            return false;
+        }
+    }
+
+
+    using namespace Protocol;
+
+    /* TableWriter class */
+
+    TableWriter::TableWriter(Format format, std::ostream & out) :
+        mFormat(format),
+        mOut(out)
+    {
+    }
+
+    bool TableWriter::parseFormat(const std::string & name, Format & format) {
+        if (name == "text") {
+            format = FORMAT_TEXT;
+        } else if (name == "json") {
+            format = FORMAT_JSON;
+        } else if (name == "csv") {
+            format = FORMAT_CSV;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    TableWriter::Format TableWriter::getFormat() const {
+        return mFormat;
+    }
+
+    void TableWriter::write(const Table & table, const std::string_view & server) {
+        const std::vector<Table::Row> & rows = table.getRows();
+        for (size_t i = 0; i < rows.size(); ++i) {
+            writeRecord(table, rows[i], server, nullptr, nullptr);
+        }
+    }
+
+    size_t TableWriter::writeDiff(const Table & before, const Table & after, const std::string_view & server) {
+        const std::vector<Table::Row> & old = before.getRows();
+        const std::vector<Table::Row> & now = after.getRows();
+        size_t nofRecords = 0;
+        size_t i = 0;
+        size_t j = 0;
+
+        /* Both are sorted by key, so a single merge pass pairs the rows up */
+        while (i < old.size() || j < now.size()) {
+            int c = (i == old.size()) ? 1 : (j == now.size()) ? -1 : after.compareKeys(old[i], now[j]);
+            if (c < 0) {
+                writeRecord(before, old[i++], server, before.getRemovedName(), nullptr);
+                ++nofRecords;
+            } else if (c > 0) {
+                writeRecord(after, now[j++], server, after.getAddedName(), nullptr);
+                ++nofRecords;
+            } else {
+                if (after.differs(old[i], now[j])) {
+                    writeRecord(after, now[j], server, "change", &old[i]);
+                    ++nofRecords;
+                }
+                ++i;
+                ++j;
+            }
+        }
+        return nofRecords;
+    }
+
+    void TableWriter::writeMessage(const std::string_view & time, const std::string_view & server, uint8_t seqNum,
+                                   const std::string_view & message) {
+
+        switch (mFormat) {
+            case FORMAT_TEXT:
+                mOut << time << ' ' << server << ' ' << message << '\n';
+                return;
+
+            case FORMAT_CSV:
+                if (std::find(mHeaders.begin(), mHeaders.end(), -1) == mHeaders.end()) {
+                    mHeaders.push_back(-1);
+                    mOut << "time,server,seq,message\n";
+                }
+                mOut << time << ',';
+                writeCsvField(server);
+                mOut << ',' << static_cast<unsigned>(seqNum) << ',';
+                writeCsvField(message);
+                mOut.put('\n');
+                return;
+
+            case FORMAT_JSON:
+                mOut << "{\"time\":\"" << time << "\",\"server\":";
+                writeJsonString(server);
+                mOut << ",\"seq\":" << static_cast<unsigned>(seqNum) << ",\"message\":";
+                writeJsonString(message);
+                mOut << "}\n";
+                return;
+        }
+    }
+
+    void TableWriter::writeRecord(const Table & table, const Table::Row & row,
+                                  const std::string_view & server, const char *op, const Table::Row *before) {
+
+        if (mFormat == FORMAT_CSV) {
+            writeHeader(table, !server.empty(), op != nullptr);
+            if (!server.empty()) {
+                writeCsvField(server);
+                mOut.put(',');
+            }
+            if (op != nullptr) {
+                mOut << op << ',';
+            }
+            for (size_t i = 0; i < table.getNofColumns(); ++i) {
+                if (i > 0) {
+                    mOut.put(',');
+                }
+                writeCsvField(row.fields[i]);
+            }
+            mOut.put('\n');
+            return;
+        }
+
+        mOut.put('{');
+        if (!server.empty()) {
+            mOut << "\"server\":";
+            writeJsonString(server);
+            mOut.put(',');
+        }
+        mOut << "\"table\":\"" << table.getName() << '"';
+        if (op != nullptr) {
+            mOut << ",\"op\":\"" << op << '"';
+        }
+        for (size_t i = 0; i < table.getNofColumns(); ++i) {
+            const Table::Column & column = table.getColumn(i);
+            const std::string_view & value = row.fields[i];
+            mOut << ",\"" << column.name << "\":";
+            if ((column.type == Table::COLUMN_NUMBER && isInteger(value)) || column.type == Table::COLUMN_BOOL) {
+                mOut.write(value.data(), value.size());
+            } else {
+                writeJsonString(value);
+            }
+        }
+        if (before != nullptr) {
+            /* The columns a change is about, so consumers need not compare themselves */
+            mOut << ",\"changed\":[";
+            bool first = true;
+            for (size_t i = 0; i < table.getNofColumns(); ++i) {
+                if (!table.getColumn(i).key && row.fields[i] != before->fields[i]) {
+                    mOut << (first ? "\"" : ",\"") << table.getColumn(i).name << '"';
+                    first = false;
+                }
+            }
+            mOut.put(']');
+        }
+        mOut << "}\n";
+    }
+
+    void TableWriter::writeHeader(const Table & table, bool withServer, bool withOp) {
+        int header = table.getKind() * 4 + (withServer ? 2 : 0) + (withOp ? 1 : 0);
+        if (std::find(mHeaders.begin(), mHeaders.end(), header) != mHeaders.end()) {
+            return;
+        }
+        mHeaders.push_back(header);
+
+        if (withServer) {
+            mOut << "server,";
+        }
+        if (withOp) {
+            mOut << "op,";
+        }
+        for (size_t i = 0; i < table.getNofColumns(); ++i) {
+            mOut << (i > 0 ? "," : "") << table.getColumn(i).name;
+        }
+        mOut.put('\n');
+    }
+
+    void TableWriter::writeJsonString(const std::string_view & value) {
+        static const char hex[] = "0123456789abcdef";
+
+        mOut.put('"');
+        size_t plain = 0;
+        for (size_t i = 0; i < value.size(); ++i) {
+            unsigned char c = value[i];
+            if (c >= 0x20 && c != '"' && c != '\\') {
+                continue;
+            }
+            /* Runs of plain characters are written in one go */
+            mOut.write(value.data() + plain, i - plain);
+            plain = i + 1;
+            if (c == '"' || c == '\\') {
+                mOut.put('\\').put(c);
+            } else if (c == '\n') {
+                mOut << "\\n";
+            } else if (c == '\t') {
+                mOut << "\\t";
+            } else {
+                mOut << "\\u00" << hex[c >> 4] << hex[c & 0xf];
+            }
+        }
+        mOut.write(value.data() + plain, value.size() - plain);
+        mOut.put('"');
+    }
+
+    void TableWriter::writeCsvField(const std::string_view & value) {
+        if (value.find_first_of(",\"\r\n") == std::string_view::npos) {
+            mOut.write(value.data(), value.size());
+            return;
+        }
+        mOut.put('"');
+        size_t plain = 0;
+        for (size_t i = 0; i < value.size(); ++i) {
+            if (value[i] == '"') {
+                mOut.write(value.data() + plain, i + 1 - plain);
+                mOut.put('"');
+                plain = i + 1;
+            }
+        }
+        mOut.write(value.data() + plain, value.size() - plain);
+        mOut.put('"');
+    }
+}
@@ -0,0 +1,191 @@
+#ifndef __RCONTABLE_HH__
+#define __RCONTABLE_HH__
+
+#include <sys/types.h>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <ostream>
+
+/** The most columns of any BattlEye table */
+#define TABLE_MAX_COLUMNS 8
+
+namespace Rcon {
+
+    namespace Protocol {
+
+        /** BattlEye table class
+          @remarks
+            The rows of the table output of the players, bans, admins and
+            missions commands, e.g.
+                Players on server:
+                [#] [IP Address]:[Port] [Ping] [GUID] [Name]
+                --------------------------------------------------
+                0   1.2.3.4:2304     47   0123456789abcdef0123456789abcdef(OK) Name (Lobby)
+                (1 players in total)
+            Every field is a view into the response text, which is not
+            copied, so the text must outlive the table until the next
+            parse(). Rows are identified by their key columns; a row
+            whose key is unchanged but any other column differs has
+            changed, which is what diffs between two snapshots are made of.
+        */
+        class Table {
+            public:
+                enum Kind {
+                    TABLE_NONE,
+                    TABLE_PLAYERS,
+                    TABLE_BANS,
+                    TABLE_ADMINS,
+                    TABLE_MISSIONS
+                };
+
+                enum ColumnType {
+                    COLUMN_STRING,
+                    /** Written bare in JSON if the field is an integer, e.g. not "perm" */
+                    COLUMN_NUMBER,
+                    COLUMN_BOOL
+                };
+
+                struct Column {
+                    const char *name;
+                    ColumnType type;
+                    bool key;
+                };
+
+                /** A row, with one field per column of the table */
+                struct Row {
+                    std::string_view fields[TABLE_MAX_COLUMNS];
+                };
+
+                explicit Table(Kind kind);
+
+                virtual ~Table() {}
+
+                /** Returns the table kind of the output of a command, TABLE_NONE if it has none */
+                static Kind kindOf(const std::string_view & command);
+
+                /** Parses a response, the rows are views into text
+                  @return
+                    false if the text is not a table of this kind, e.g. an error message.
+                */
+                bool parse(const std::string_view & text);
+
+                /** Sorts the rows by their key columns, as diffs expect. */
+                void sort();
+
+                /** Returns the kind of the table */
+                Kind getKind() const;
+
+                /** Returns the name of the table, e.g. "players" */
+                const char *getName() const;
+
+                /** Returns the operations a diff writes for a new, a removed and a changed row */
+                const char *getAddedName() const;
+                const char *getRemovedName() const;
+
+                size_t getNofColumns() const;
+
+                const Column & getColumn(size_t columnIdx) const;
+
+                const std::vector<Row> & getRows() const;
+
+                /** Compares the key columns of two rows, like std::string_view::compare() */
+                int compareKeys(const Row & a, const Row & b) const;
+
+                /** Returns true if the rows differ in a column which is not a key */
+                bool differs(const Row & a, const Row & b) const;
+
+            protected:
+                /** Parses the row lines after the dashed header line of a section
+                  @param
+                    section The value of the leading type column, if the table has one.
+                */
+                void parseRow(std::string_view line, const std::string_view & section);
+
+                Kind mKind;
+                std::vector<Row> mRows;
+        };
+    }
+
+
+    /** TableWriter class
+      @remarks
+        Writes parsed tables as records, one JSON object per line or CSV
+        with a header line before the first record of each table kind.
+        Diffs are written as the rows which were added, removed or changed
+        between two sorted snapshots of a table, with the operation in an
+        "op" field, e.g. {"table":"players","op":"join",...}.
+      @param
+        format The record format.
+      @param
+        out The stream to write the records to.
+    */
+    class TableWriter {
+        public:
+            enum Format {
+                FORMAT_TEXT,
+                FORMAT_JSON,
+                FORMAT_CSV
+            };
+
+            explicit TableWriter(Format format, std::ostream & out);
+
+            virtual ~TableWriter() {}
+
+            /** Returns the format of a -o argument, "text", "json" or "csv"
+              @return
+                false if the name is unknown.
+            */
+            static bool parseFormat(const std::string & name, Format & format);
+
+            /** Returns the record format */
+            Format getFormat() const;
+
+            /** Writes all rows of a table
+              @param
+                table The table to write.
+              @param
+                server The server to tag the records with, none if empty.
+            */
+            void write(const Protocol::Table & table, const std::string_view & server);
+
+            /** Writes the rows added, removed or changed from before to after, both sorted
+              @return
+                The number of records written.
+            */
+            size_t writeDiff(const Protocol::Table & before, const Protocol::Table & after, const std::string_view & server);
+
+            /** Writes a captured server message, as "<time> <server> <message>" lines in the text format
+              @param
+                time The receive time of the message.
+              @param
+                server The server the message came from.
+              @param
+                seqNum The sequence number of the message.
+              @param
+                message The message.
+            */
+            void writeMessage(const std::string_view & time, const std::string_view & server, uint8_t seqNum,
+                              const std::string_view & message);
+
+        protected:
+            /** Writes a single record, the op is omitted if null */
+            void writeRecord(const Protocol::Table & table, const Protocol::Table::Row & row,
+                             const std::string_view & server, const char *op, const Protocol::Table::Row *before);
+
+            /** Writes the CSV header line of the table kind unless already written. */
+            void writeHeader(const Protocol::Table & table, bool withServer, bool withOp);
+
+            void writeJsonString(const std::string_view & value);
+
+            void writeCsvField(const std::string_view & value);
+
+            Format mFormat;
+            std::ostream & mOut;
+            /** The CSV header lines written, by table kind and the optional columns, -1 for messages */
+            std::vector<int> mHeaders;
+    };
+}
+
+#endif // __RCONTABLE_HH__
@@ -0,0 +1,395 @@
+#ifndef __RCONTASK_HH__
+#define __RCONTASK_HH__
+
+#include "rconreactor.hh"
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <memory>
+
+namespace Rcon {
+
+    template<typename T> class Task;
+
+    /** The parts shared by the promises of all tasks */
+    struct TaskPromiseBase {
+        /** Resumes the awaiting coroutine, if any, once the task is done */
+        struct FinalAwaiter {
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            template<typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+                std::coroutine_handle<> continuation = handle.promise().continuation;
+                return continuation ? continuation : std::noop_coroutine();
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        std::suspend_always initial_suspend() const noexcept {
+            return std::suspend_always();
+        }
+
+        FinalAwaiter final_suspend() const noexcept {
+            return FinalAwaiter();
+        }
+
+        void unhandled_exception() {
+            error = std::current_exception();
+        }
+
+        std::coroutine_handle<> continuation;
+        std::exception_ptr error;
+    };
+
+
+    /** Task class
+      @remarks
+        The result of a coroutine of the client library. A task is lazy,
+        it starts once awaited, runs on the thread which resumes it and
+        passes its result or exception to the awaiting coroutine, which is
+        resumed without growing the stack. Tasks are only moved, the
+        coroutine frame belongs to the task.
+    */
+    template<typename T>
+    class Task {
+        public:
+            struct promise_type : public TaskPromiseBase {
+                Task get_return_object() {
+                    return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+                }
+
+                template<typename U>
+                void return_value(U && result) {
+                    value.emplace(std::forward<U>(result));
+                }
+
+                std::optional<T> value;
+            };
+
+            Task(Task && other) noexcept :
+                mHandle(std::exchange(other.mHandle, nullptr))
+            {}
+
+            Task & operator=(Task && other) noexcept {
+                if (this != &other) {
+                    if (mHandle) {
+                        mHandle.destroy();
+                    }
+                    mHandle = std::exchange(other.mHandle, nullptr);
+                }
+                return *this;
+            }
+
+            Task(const Task &) = delete;
+            Task & operator=(const Task &) = delete;
+
+            virtual ~Task() {
+                if (mHandle) {
+                    mHandle.destroy();
+                }
+            }
+
+            /** Returns true once the coroutine has returned or thrown */
+            bool isDone() const {
+                return !mHandle || mHandle.done();
+            }
+
+            /** Starts the task without awaiting it, e.g. under runTask(). */
+            void start() {
+                mHandle.resume();
+            }
+
+            /** Returns the result of a task which is done, or throws its exception */
+            T getResult() {
+                if (mHandle.promise().error) {
+                    std::rethrow_exception(mHandle.promise().error);
+                }
+                return std::move(*mHandle.promise().value);
+            }
+
+            bool await_ready() const noexcept {
+                return isDone();
+            }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                mHandle.promise().continuation = awaiting;
+                return mHandle;
+            }
+
+            T await_resume() {
+                return getResult();
+            }
+
+        protected:
+            explicit Task(std::coroutine_handle<promise_type> handle) :
+                mHandle(handle)
+            {}
+
+            std::coroutine_handle<promise_type> mHandle;
+    };
+
+
+    /** The task of a coroutine without a result */
+    template<>
+    class Task<void> {
+        public:
+            struct promise_type : public TaskPromiseBase {
+                Task get_return_object() {
+                    return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+                }
+
+                void return_void() {}
+            };
+
+            Task(Task && other) noexcept :
+                mHandle(std::exchange(other.mHandle, nullptr))
+            {}
+
+            Task & operator=(Task && other) noexcept {
+                if (this != &other) {
+                    if (mHandle) {
+                        mHandle.destroy();
+                    }
+                    mHandle = std::exchange(other.mHandle, nullptr);
+                }
+                return *this;
+            }
+
+            Task(const Task &) = delete;
+            Task & operator=(const Task &) = delete;
+
+            virtual ~Task() {
+                if (mHandle) {
+                    mHandle.destroy();
+                }
+            }
+
+            bool isDone() const {
+                return !mHandle || mHandle.done();
+            }
+
+            void start() {
+                mHandle.resume();
+            }
+
+            void getResult() {
+                if (mHandle.promise().error) {
+                    std::rethrow_exception(mHandle.promise().error);
+                }
+            }
+
+            bool await_ready() const noexcept {
+                return isDone();
+            }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                mHandle.promise().continuation = awaiting;
+                return mHandle;
+            }
+
+            void await_resume() {
+                getResult();
+            }
+
+        protected:
+            explicit Task(std::coroutine_handle<promise_type> handle) :
+                mHandle(handle)
+            {}
+
+            std::coroutine_handle<promise_type> mHandle;
+    };
+
+
+    /** AsyncGenerator class
+      @remarks
+        A coroutine which may await and yields a sequence of values, each
+        taken by the consumer with
+            while (T *value = co_await generator.next()) { ... }
+        The value is only valid until the next call of next(); next()
+        returns null once the generator has returned and rethrows what it
+        threw. There is a single consumer at a time.
+    */
+    template<typename T>
+    class AsyncGenerator {
+        public:
+            struct promise_type;
+
+            /** Passes control back to the consumer after a value was yielded or the generator returned */
+            struct YieldAwaiter {
+                bool await_ready() const noexcept {
+                    return false;
+                }
+
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                    return handle.promise().consumer;
+                }
+
+                void await_resume() const noexcept {}
+            };
+
+            struct promise_type {
+                AsyncGenerator get_return_object() {
+                    return AsyncGenerator(std::coroutine_handle<promise_type>::from_promise(*this));
+                }
+
+                std::suspend_always initial_suspend() const noexcept {
+                    return std::suspend_always();
+                }
+
+                YieldAwaiter final_suspend() noexcept {
+                    current = nullptr;
+                    return YieldAwaiter();
+                }
+
+                /* Yielded temporaries live until the generator is resumed */
+                YieldAwaiter yield_value(T & value) noexcept {
+                    current = std::addressof(value);
+                    return YieldAwaiter();
+                }
+
+                YieldAwaiter yield_value(T && value) noexcept {
+                    current = std::addressof(value);
+                    return YieldAwaiter();
+                }
+
+                void return_void() {}
+
+                void unhandled_exception() {
+                    error = std::current_exception();
+                }
+
+                T *current = nullptr;
+                std::coroutine_handle<> consumer;
+                std::exception_ptr error;
+            };
+
+            /** Resumes the generator until it yields the next value */
+            struct NextAwaiter {
+                bool await_ready() const noexcept {
+                    return !handle || handle.done();
+                }
+
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                    handle.promise().consumer = awaiting;
+                    return handle;
+                }
+
+                T *await_resume() {
+                    if (!handle) {
+                        return nullptr;
+                    }
+                    if (handle.done()) {
+                        if (handle.promise().error) {
+                            std::rethrow_exception(std::exchange(handle.promise().error, nullptr));
+                        }
+                        return nullptr;
+                    }
+                    return handle.promise().current;
+                }
+
+                std::coroutine_handle<promise_type> handle;
+            };
+
+            AsyncGenerator(AsyncGenerator && other) noexcept :
+                mHandle(std::exchange(other.mHandle, nullptr))
+            {}
+
+            AsyncGenerator(const AsyncGenerator &) = delete;
+            AsyncGenerator & operator=(const AsyncGenerator &) = delete;
+
+            virtual ~AsyncGenerator() {
+                if (mHandle) {
+                    mHandle.destroy();
+                }
+            }
+
+            /** Returns the awaitable of the next value */
+            NextAwaiter next() {
+                NextAwaiter awaiter;
+                awaiter.handle = mHandle;
+                return awaiter;
+            }
+
+        protected:
+            explicit AsyncGenerator(std::coroutine_handle<promise_type> handle) :
+                mHandle(handle)
+            {}
+
+            std::coroutine_handle<promise_type> mHandle;
+    };
+
+
+    /** The coroutine of spawn(), which destroys itself once done */
+    struct DetachedTask {
+        struct promise_type {
+            DetachedTask get_return_object() const noexcept {
+                return DetachedTask();
+            }
+
+            std::suspend_never initial_suspend() const noexcept {
+                return std::suspend_never();
+            }
+
+            std::suspend_never final_suspend() const noexcept {
+                return std::suspend_never();
+            }
+
+            void return_void() const noexcept {}
+
+            /** Like an exception escaping a thread */
+            void unhandled_exception() const noexcept {
+                std::terminate();
+            }
+        };
+    };
+
+    inline DetachedTask detach(Task<void> task) {
+        co_await task;
+    }
+
+    /** Starts a task which runs on without being awaited; it must catch what it throws. */
+    inline void spawn(Task<void> && task) {
+        detach(std::move(task));
+    }
+
+    /** Starts a task and runs the reactor until it is done
+      @return
+        The result of the task, or throws its exception.
+    */
+    template<typename T>
+    T runTask(Reactor & reactor, Task<T> task) {
+        task.start();
+        while (!task.isDone()) {
+            reactor.runOnce();
+        }
+        return task.getResult();
+    }
+
+
+    /** Suspends a coroutine, passing its handle to the function, which arranges for it to be resumed */
+    template<typename Function>
+    struct Suspension {
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) {
+            function(handle);
+        }
+
+        void await_resume() const noexcept {}
+
+        Function function;
+    };
+
+    template<typename Function>
+    Suspension<Function> suspendWith(Function function) {
+        return Suspension<Function> { function };
+    }
+}
+
+#endif // __RCONTASK_HH__
@@ -0,0 +1,254 @@
+#include "rcontrace.hh"
+#include "rconmsg.hh"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <time.h>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+#ifdef RCON_WITH_USDT
+/* Referenced by the probe notes, the tracer increments them while attached */
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define RCON_SEMAPHORE(name) \
+    __extension__ volatile unsigned short name __attribute__((unused)) __attribute__((section(".probes"))) = 0
+
+extern "C" {
+    RCON_SEMAPHORE(rcon_send_semaphore);
+    RCON_SEMAPHORE(rcon_receive_semaphore);
+    RCON_SEMAPHORE(rcon_decode_semaphore);
+    RCON_SEMAPHORE(rcon_crc_failure_semaphore);
+    RCON_SEMAPHORE(rcon_timeout_semaphore);
+    RCON_SEMAPHORE(rcon_open_semaphore);
+}
+#else
+#define DTRACE_PROBE3(provider, probe, a1, a2, a3)
+#define DTRACE_PROBE4(provider, probe, a1, a2, a3, a4)
+#define DTRACE_PROBE2(provider, probe, a1, a2)
+#endif
+
+
+namespace Rcon {
+
+    namespace {
+
+        const char HEX_DIGITS[] = "0123456789abcdef";
+
+        const char *const TYPE_NAMES[] = {
+            "none", "login", "login_resp", "cmd", "cmd_resp", "cmd_part", "srv_msg", "srv_ack"
+        };
+
+        /** The records of a thread, written out when full, at flush() and when the thread ends */
+        struct TraceBuffer {
+            TraceBuffer() :
+                used(0)
+            {}
+
+            ~TraceBuffer() {
+                write();
+            }
+
+            /** Makes room for a record of at most length bytes */
+            char *reserve(size_t length) {
+                if (data.empty()) {
+                    /* Only threads which trace pay for the buffer */
+                    data.resize(TRACE_BATCH_SIZE);
+                }
+                if (used + length > data.size()) {
+                    write();
+                }
+                return data.data() + used;
+            }
+
+            void write() {
+                size_t written = 0;
+                while (written < used) {
+                    ssize_t n = ::write(STDERR_FILENO, data.data() + written, used - written);
+                    if (n == -1) {
+                        if (errno == EINTR) {
+                            continue;
+                        }
+                        /* Tracing never fails the session */
+                        break;
+                    }
+                    written += n;
+                }
+                used = 0;
+            }
+
+            std::vector<char> data;
+            size_t used;
+        };
+
+        thread_local TraceBuffer tBuffer;
+
+        /** Starts a record with the time and the channel, snprintf() formats the whole line */
+        void record(uint32_t channel, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+        void record(uint32_t channel, const char *format, ...) {
+            static const size_t LINE_LENGTH = 256;
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+
+            char *line = tBuffer.reserve(LINE_LENGTH);
+            int n = snprintf(line, LINE_LENGTH, "trace %lld.%06ld #%u ",
+                             (long long)now.tv_sec, now.tv_nsec / 1000, channel);
+            va_list args;
+            va_start(args, format);
+            n += vsnprintf(line + n, LINE_LENGTH - n, format, args);
+            va_end(args);
+            if ((size_t)n >= LINE_LENGTH - 1) {
+                n = LINE_LENGTH - 2;
+            }
+            line[n++] = '\n';
+            tBuffer.used += n;
+        }
+
+        /** Appends the bytes as hex dump lines of TRACE_HEXDUMP_WIDTH bytes, formatted in place */
+        void hexdump(const uint8_t *data, size_t length) {
+            /* "    0000  " + 3 per byte + an extra space + the characters */
+            static const size_t LINE_LENGTH = 11 + 4 * TRACE_HEXDUMP_WIDTH + 2;
+            for (size_t pos = 0; pos < length; pos += TRACE_HEXDUMP_WIDTH) {
+                size_t chunk = std::min<size_t>(length - pos, TRACE_HEXDUMP_WIDTH);
+                char *line = tBuffer.reserve(LINE_LENGTH);
+                char *out = line;
+                size_t addr = pos;
+                memcpy(out, "    ", 4);
+                out += 4;
+                for (int shift = 12; shift >= 0; shift -= 4) {
+                    *out++ = HEX_DIGITS[(addr >> shift) & 0xf];
+                }
+                *out++ = ' ';
+                *out++ = ' ';
+                for (size_t i = 0; i < TRACE_HEXDUMP_WIDTH; ++i) {
+                    if (i < chunk) {
+                        *out++ = HEX_DIGITS[data[pos + i] >> 4];
+                        *out++ = HEX_DIGITS[data[pos + i] & 0xf];
+                    } else {
+                        *out++ = ' ';
+                        *out++ = ' ';
+                    }
+                    *out++ = ' ';
+                }
+                *out++ = ' ';
+                for (size_t i = 0; i < chunk; ++i) {
+                    uint8_t c = data[pos + i];
+                    *out++ = (c >= 0x20 && c < 0x7f) ? (char)c : '.';
+                }
+                *out++ = '\n';
+                tBuffer.used += out - line;
+            }
+        }
+
+        /** Appends the record of a datagram, with its hex dump in that mode */
+        void dumpPacket(uint32_t channel, const char *event, const uint8_t *packet, size_t length) {
+            record(channel, "%s %zu bytes", event, length);
+            if (Trace::getMode() == Trace::TRACE_HEXDUMP) {
+                hexdump(packet, length);
+            }
+        }
+
+        /** Where a datagram sent in two pieces is put together for the probe and the hex dump */
+        thread_local std::vector<uint8_t> tPacket;
+    }
+
+
+    /* Trace class */
+
+    std::atomic<Trace::Mode> Trace::sMode(Trace::TRACE_OFF);
+    std::atomic<uint32_t> Trace::sNextId(1);
+
+    void Trace::setMode(Mode mode) {
+        sMode.store(mode, std::memory_order_relaxed);
+    }
+
+    Trace::Mode Trace::getMode() {
+        return sMode.load(std::memory_order_relaxed);
+    }
+
+    uint32_t Trace::nextId() {
+        return sNextId.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Trace::send(uint32_t channel, const uint8_t *header, size_t headerLength, std::string_view payload) {
+        size_t length = headerLength + payload.size();
+        if (!RCON_PROBE_ATTACHED(send) && getMode() != TRACE_HEXDUMP) {
+            if (isEnabled()) {
+                record(channel, "send %zu bytes", length);
+            }
+            return;
+        }
+        tPacket.resize(length);
+        memcpy(tPacket.data(), header, headerLength);
+        memcpy(tPacket.data() + headerLength, payload.data(), payload.size());
+        send(channel, tPacket.data(), length);
+    }
+
+    void Trace::send(uint32_t channel, const uint8_t *packet, size_t length) {
+        DTRACE_PROBE3(rcon, send, channel, length, packet);
+        if (isEnabled()) {
+            dumpPacket(channel, "send", packet, length);
+        }
+    }
+
+    void Trace::receive(uint32_t channel, const uint8_t *packet, size_t length) {
+        DTRACE_PROBE3(rcon, receive, channel, length, packet);
+        if (isEnabled()) {
+            dumpPacket(channel, "receive", packet, length);
+        }
+    }
+
+    void Trace::decode(uint32_t channel, const Protocol::MessageView & view) {
+        DTRACE_PROBE4(rcon, decode, channel, (int)view.type, (int)view.seqNum, view.payload.size());
+        if (isEnabled()) {
+            record(channel, "decode %s seq %u, %zu bytes payload",
+                   TYPE_NAMES[view.type], (unsigned)view.seqNum, view.payload.size());
+        }
+    }
+
+    void Trace::crcFailure(uint32_t channel, const uint8_t *packet, size_t length) {
+        DTRACE_PROBE3(rcon, crc_failure, channel, length, packet);
+        if (isEnabled()) {
+            dumpPacket(channel, "crc_failure", packet, length);
+        }
+    }
+
+    void Trace::timeout(uint32_t channel, int seqNum, int attempt) {
+        DTRACE_PROBE3(rcon, timeout, channel, seqNum, attempt);
+        if (isEnabled()) {
+            if (seqNum < 0) {
+                record(channel, "timeout login, attempt %d", attempt);
+            } else {
+                record(channel, "timeout seq %d, attempt %d", seqNum, attempt);
+            }
+        }
+    }
+
+    void Trace::open(uint32_t channel, const struct sockaddr *address, socklen_t length) {
+        char host[NI_MAXHOST];
+        char port[NI_MAXSERV];
+        if (getnameinfo(address, length, host, sizeof(host), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+            strcpy(host, "?");
+            strcpy(port, "?");
+        }
+        char name[NI_MAXHOST + NI_MAXSERV + 3];
+        snprintf(name, sizeof(name), (address->sa_family == AF_INET6) ? "[%s]:%s" : "%s:%s", host, port);
+        DTRACE_PROBE2(rcon, open, channel, name);
+        if (isEnabled()) {
+            record(channel, "open %s", name);
+        }
+    }
+
+    void Trace::flush() {
+        if (tBuffer.used > 0) {
+            tBuffer.write();
+        }
+    }
+}
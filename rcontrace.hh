@@ -0,0 +1,116 @@
+#ifndef __RCONTRACE_HH__
+#define __RCONTRACE_HH__
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+#include <atomic>
+
+/** The bytes of trace records a thread collects before writing them out at once */
+#define TRACE_BATCH_SIZE 65536
+/** The bytes per line of a hex dump */
+#define TRACE_HEXDUMP_WIDTH 16
+
+#ifdef RCON_WITH_USDT
+/* Set by the tracer while it is attached to a probe, see rcontrace.cc */
+extern "C" {
+    extern volatile unsigned short rcon_send_semaphore;
+    extern volatile unsigned short rcon_receive_semaphore;
+    extern volatile unsigned short rcon_decode_semaphore;
+    extern volatile unsigned short rcon_crc_failure_semaphore;
+    extern volatile unsigned short rcon_timeout_semaphore;
+    extern volatile unsigned short rcon_open_semaphore;
+}
+#define RCON_PROBE_ATTACHED(probe) (rcon_##probe##_semaphore != 0)
+#else
+#define RCON_PROBE_ATTACHED(probe) false
+#endif
+
+/** True if anything consumes the tracepoint, the arguments of the Trace call are only computed then */
+#define RCON_TRACING(probe) __builtin_expect(RCON_PROBE_ATTACHED(probe) || Rcon::Trace::isEnabled(), 0)
+
+namespace Rcon {
+
+    namespace Protocol {
+        struct MessageView;
+    }
+
+    /** Trace class
+      @remarks
+        Tracepoints on the hot path of the channels and pipelines: every
+        datagram sent and received, every decoded message, CRC failures
+        and timeouts, each tagged with the id of its channel, which stays
+        the same across the reconnects of a session, plus an open
+        tracepoint mapping that id to the address of the server.
+        Call sites test RCON_TRACING(probe) first, so a tracepoint nobody
+        consumes is a load and a branch predicted not taken.
+        Built with RCON_WITH_USDT the tracepoints are USDT probes of the
+        provider "rcon", e.g.
+            bpftrace -e 'usdt:./rcon:rcon:timeout { @[arg0] = count(); }'
+        with the arguments
+            send, receive, crc_failure (channel, length, packet)
+            decode (channel, type, seqNum, payload length)
+            timeout (channel, seqNum or -1 for the login, attempt)
+            open (channel, address)
+        Their semaphores tell whether a tracer is attached. Without a
+        tracer the built-in one writes a line per event, and in hex dump
+        mode the packets, to stderr. The records of a thread are collected
+        and written at once at the end of every reactor iteration or
+        every TRACE_BATCH_SIZE bytes. The mode is set before any reactor
+        runs.
+    */
+    class Trace {
+        public:
+            enum Mode {
+                TRACE_OFF,
+                TRACE_EVENTS,
+                TRACE_HEXDUMP
+            };
+
+            /** Sets the mode of the built-in tracer */
+            static void setMode(Mode mode);
+
+            /** Returns the mode of the built-in tracer */
+            static Mode getMode();
+
+            /** Returns true if the built-in tracer is on */
+            static bool isEnabled() {
+                return sMode.load(std::memory_order_relaxed) != TRACE_OFF;
+            }
+
+            /** Returns a new channel id */
+            static uint32_t nextId();
+
+            /** A datagram was sent, in two pieces as the channel sends it */
+            static void send(uint32_t channel, const uint8_t *header, size_t headerLength, std::string_view payload);
+
+            /** A datagram was sent */
+            static void send(uint32_t channel, const uint8_t *packet, size_t length);
+
+            /** A datagram was received, before it is decoded */
+            static void receive(uint32_t channel, const uint8_t *packet, size_t length);
+
+            /** A received datagram was decoded */
+            static void decode(uint32_t channel, const Protocol::MessageView & view);
+
+            /** The checksum of a received datagram did not match */
+            static void crcFailure(uint32_t channel, const uint8_t *packet, size_t length);
+
+            /** A command, or the login for seqNum -1, was not answered in time */
+            static void timeout(uint32_t channel, int seqNum, int attempt);
+
+            /** The channel was opened to the address */
+            static void open(uint32_t channel, const struct sockaddr *address, socklen_t length);
+
+            /** Writes the records the thread collected */
+            static void flush();
+
+        protected:
+            static std::atomic<Mode> sMode;
+            static std::atomic<uint32_t> sNextId;
+    };
+}
+
+#endif // __RCONTRACE_HH__
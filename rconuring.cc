@@ -0,0 +1,499 @@
+#ifdef RCON_WITH_IO_URING
+
+#include "rconuring.hh"
+#include "rcon.hh"
+#include "rconexception.hh"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <poll.h>
+#include <cerrno>
+#include <cstring>
+
+
+namespace Rcon {
+
+    /* The user data of a request: kind in bits 62-63, generation in bits 32-61, fd in bits 0-31 */
+    enum RequestKind {
+        REQUEST_INTERNAL = 0,
+        REQUEST_POLL = 1,
+        REQUEST_RECV = 2
+    };
+
+    static const uint32_t GENERATION_MASK = 0x3fffffff;
+
+    static uint64_t userData(RequestKind kind, int fd, uint32_t generation) {
+        return ((uint64_t)kind << 62) | ((uint64_t)(generation & GENERATION_MASK) << 32) | (uint32_t)fd;
+    }
+
+    static int ioUringSetup(unsigned entries, struct io_uring_params *params) {
+        return (int)syscall(__NR_io_uring_setup, entries, params);
+    }
+
+    static int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, void *arg, size_t argSize) {
+        return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize);
+    }
+
+    static int ioUringRegister(int fd, unsigned opcode, void *arg, unsigned nofArgs) {
+        return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nofArgs);
+    }
+
+
+    /* IoUringReactor class */
+
+    IoUringReactor::IoUringReactor() :
+        mRingFd(-1),
+        mSqRing(MAP_FAILED),
+        mSqRingSize(0),
+        mCqRing(MAP_FAILED),
+        mCqRingSize(0),
+        mSqes(static_cast<struct io_uring_sqe *>(MAP_FAILED)),
+        mSqHead(nullptr),
+        mSqTail(nullptr),
+        mSqMask(0),
+        mSqLocalTail(0),
+        mCqHead(nullptr),
+        mCqTail(nullptr),
+        mCqMask(0),
+        mCqes(nullptr),
+        mBufRing(static_cast<struct io_uring_buf_ring *>(MAP_FAILED)),
+        mBufRingSize(0),
+        mBufferSize(0),
+        mBufTail(0),
+        mNextGeneration(0),
+        mNofEnters(0),
+        mNofCompletions(0),
+        mNofDatagrams(0),
+        mNofShortages(0)
+    {
+        try {
+            setup();
+        } catch (...) {
+            teardown();
+            throw;
+        }
+    }
+
+    IoUringReactor::~IoUringReactor() {
+        teardown();
+    }
+
+    void IoUringReactor::setup() {
+
+        /* A flood of datagrams completes far more requests than are submitted */
+        memset(&mParams, 0, sizeof(mParams));
+        mParams.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+        mParams.cq_entries = URING_ENTRIES * 4;
+        mRingFd = ioUringSetup(URING_ENTRIES, &mParams);
+        if (mRingFd == -1 && errno == EINVAL) {
+            memset(&mParams, 0, sizeof(mParams));
+            mParams.flags = IORING_SETUP_CQSIZE;
+            mParams.cq_entries = URING_ENTRIES * 4;
+            mRingFd = ioUringSetup(URING_ENTRIES, &mParams);
+        }
+        if (mRingFd == -1) {
+            throw SocketException(std::string("io_uring_setup: ") + strerror(errno));
+        }
+        if (!(mParams.features & IORING_FEAT_EXT_ARG)) {
+            throw SocketException("io_uring: the kernel does not support waiting with a timeout");
+        }
+
+        mSqRingSize = mParams.sq_off.array + mParams.sq_entries * sizeof(unsigned);
+        mCqRingSize = mParams.cq_off.cqes + mParams.cq_entries * sizeof(struct io_uring_cqe);
+        if (mParams.features & IORING_FEAT_SINGLE_MMAP) {
+            mSqRingSize = mCqRingSize = (mSqRingSize > mCqRingSize) ? mSqRingSize : mCqRingSize;
+        }
+        mSqRing = mmap(nullptr, mSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_SQ_RING);
+        if (mSqRing == MAP_FAILED) {
+            throw SocketException(std::string("io_uring mmap: ") + strerror(errno));
+        }
+        if (mParams.features & IORING_FEAT_SINGLE_MMAP) {
+            mCqRing = mSqRing;
+        } else {
+            mCqRing = mmap(nullptr, mCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_CQ_RING);
+            if (mCqRing == MAP_FAILED) {
+                throw SocketException(std::string("io_uring mmap: ") + strerror(errno));
+            }
+        }
+        mSqes = static_cast<struct io_uring_sqe *>(mmap(nullptr, mParams.sq_entries * sizeof(struct io_uring_sqe),
+                                                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                                        mRingFd, IORING_OFF_SQES));
+        if (mSqes == MAP_FAILED) {
+            throw SocketException(std::string("io_uring mmap: ") + strerror(errno));
+        }
+
+        uint8_t *sq = static_cast<uint8_t *>(mSqRing);
+        mSqHead = reinterpret_cast<unsigned *>(sq + mParams.sq_off.head);
+        mSqTail = reinterpret_cast<unsigned *>(sq + mParams.sq_off.tail);
+        mSqMask = *reinterpret_cast<unsigned *>(sq + mParams.sq_off.ring_mask);
+        mSqLocalTail = *mSqTail;
+        /* Entry i of the submission queue is always sqe i */
+        unsigned *array = reinterpret_cast<unsigned *>(sq + mParams.sq_off.array);
+        for (unsigned i = 0; i < mParams.sq_entries; ++i) {
+            array[i] = i;
+        }
+
+        uint8_t *cq = static_cast<uint8_t *>(mCqRing);
+        mCqHead = reinterpret_cast<unsigned *>(cq + mParams.cq_off.head);
+        mCqTail = reinterpret_cast<unsigned *>(cq + mParams.cq_off.tail);
+        mCqMask = *reinterpret_cast<unsigned *>(cq + mParams.cq_off.ring_mask);
+        mCqes = reinterpret_cast<struct io_uring_cqe *>(cq + mParams.cq_off.cqes);
+
+        /* Every buffer holds the recvmsg header, the drop counter and a whole datagram */
+        memset(&mRecvTemplate, 0, sizeof(mRecvTemplate));
+        mRecvTemplate.msg_namelen = 0;
+        mRecvTemplate.msg_controllen = CMSG_SPACE(sizeof(uint32_t));
+        mBufferSize = sizeof(struct io_uring_recvmsg_out) + mRecvTemplate.msg_controllen + BUF_SIZE;
+        mBuffers.resize(URING_BUFFERS * mBufferSize);
+
+        mBufRingSize = URING_BUFFERS * sizeof(struct io_uring_buf);
+        mBufRing = static_cast<struct io_uring_buf_ring *>(mmap(nullptr, mBufRingSize, PROT_READ | PROT_WRITE,
+                                                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (mBufRing == MAP_FAILED) {
+            throw SocketException(std::string("io_uring mmap: ") + strerror(errno));
+        }
+
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<uintptr_t>(mBufRing);
+        reg.ring_entries = URING_BUFFERS;
+        reg.bgid = 0;
+        if (ioUringRegister(mRingFd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+            throw SocketException(std::string("io_uring provided buffers: ") + strerror(errno));
+        }
+        for (uint32_t i = 0; i < URING_BUFFERS; ++i) {
+            recycle(i);
+        }
+    }
+
+    void IoUringReactor::teardown() {
+        /* Closing the ring cancels all requests */
+        if (mRingFd != -1) {
+            ::close(mRingFd);
+            mRingFd = -1;
+        }
+        if (mBufRing != MAP_FAILED) {
+            munmap(mBufRing, mBufRingSize);
+            mBufRing = static_cast<struct io_uring_buf_ring *>(MAP_FAILED);
+        }
+        if (mSqes != MAP_FAILED) {
+            munmap(mSqes, mParams.sq_entries * sizeof(struct io_uring_sqe));
+            mSqes = static_cast<struct io_uring_sqe *>(MAP_FAILED);
+        }
+        if (mCqRing != MAP_FAILED && mCqRing != mSqRing) {
+            munmap(mCqRing, mCqRingSize);
+        }
+        mCqRing = MAP_FAILED;
+        if (mSqRing != MAP_FAILED) {
+            munmap(mSqRing, mSqRingSize);
+            mSqRing = MAP_FAILED;
+        }
+    }
+
+    void IoUringReactor::addSocket(int fd, SocketHandler *handler) {
+        /* Regular files are always ready, epoll refuses them and so does this reactor */
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            throw SocketException(std::string("fstat: ") + strerror(errno));
+        }
+        if (S_ISREG(st.st_mode) || S_ISDIR(st.st_mode)) {
+            throw SocketException("io_uring: fd can not be polled");
+        }
+        if (mHandlers.find(fd) != mHandlers.end()) {
+            throw SocketException("io_uring: fd already registered");
+        }
+
+        Registration registration;
+        registration.handler = handler;
+        registration.datagrams = nullptr;
+        registration.receiving = false;
+        registration.events = POLLIN;
+        registration.armed = 0;
+        registration.batchEnd = false;
+        arm(fd, mHandlers[fd] = registration);
+    }
+
+    void IoUringReactor::addDatagramSocket(int fd, DatagramHandler *handler) {
+        addSocket(fd, handler);
+        Registration & registration = mHandlers[fd];
+        registration.datagrams = handler;
+        registration.receiving = true;
+        arm(fd, registration);
+    }
+
+    void IoUringReactor::removeSocket(int fd) {
+        std::map<int, Registration>::iterator it = mHandlers.find(fd);
+        if (it == mHandlers.end()) {
+            return;
+        }
+        if (it->second.armed != 0) {
+            cancel(it->second.armed);
+        }
+        mHandlers.erase(it);
+
+        /* Submit right away, before the caller closes the fd and its number is reused */
+        enter(0, 0);
+    }
+
+    void IoUringReactor::watchReadable(int fd, bool enable) {
+        std::map<int, Registration>::iterator it = mHandlers.find(fd);
+        if (it == mHandlers.end()) {
+            return;
+        }
+        uint32_t events = enable ? (it->second.events | POLLIN) : (it->second.events & ~POLLIN);
+        if (events != it->second.events) {
+            it->second.events = events;
+            arm(fd, it->second);
+        }
+    }
+
+    void IoUringReactor::watchWritable(int fd, bool enable) {
+        std::map<int, Registration>::iterator it = mHandlers.find(fd);
+        if (it == mHandlers.end()) {
+            return;
+        }
+        uint32_t events = enable ? (it->second.events | POLLOUT) : (it->second.events & ~POLLOUT);
+        if (events != it->second.events) {
+            /* Writability needs a poll, the handler reads on readiness from then on */
+            it->second.receiving = false;
+            it->second.events = events;
+            arm(fd, it->second);
+        }
+    }
+
+    void IoUringReactor::printStats(std::ostream & out) const {
+        out << "reactor: io_uring, " << mNofEnters << " enters, " << mNofCompletions << " completions, "
+            << mNofDatagrams << " datagrams received into provided buffers, " << mNofShortages
+            << " buffer shortages" << std::endl;
+    }
+
+    void IoUringReactor::arm(int fd, Registration & registration) {
+        if (registration.armed != 0) {
+            cancel(registration.armed);
+            registration.armed = 0;
+        }
+        if (registration.events == 0) {
+            return;
+        }
+
+        mNextGeneration = (mNextGeneration + 1) & GENERATION_MASK;
+        if (mNextGeneration == 0) {
+            mNextGeneration = 1;
+        }
+
+        struct io_uring_sqe *sqe = nextSqe();
+        sqe->fd = fd;
+        if (registration.receiving) {
+            /* Keeps receiving into the provided buffers until cancelled or out of buffers */
+            sqe->opcode = IORING_OP_RECVMSG;
+            sqe->addr = reinterpret_cast<uintptr_t>(&mRecvTemplate);
+            sqe->len = 1;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = 0;
+            sqe->user_data = userData(REQUEST_RECV, fd, mNextGeneration);
+        } else {
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->len = IORING_POLL_ADD_MULTI;
+            sqe->poll32_events = registration.events;
+            sqe->user_data = userData(REQUEST_POLL, fd, mNextGeneration);
+        }
+        registration.armed = sqe->user_data;
+    }
+
+    void IoUringReactor::cancel(uint64_t armed) {
+        struct io_uring_sqe *sqe = nextSqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = armed;
+        sqe->user_data = userData(REQUEST_INTERNAL, 0, 0);
+    }
+
+    struct io_uring_sqe *IoUringReactor::nextSqe() {
+        if (mSqLocalTail - __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE) >= mParams.sq_entries) {
+            enter(0, 0);
+            if (mSqLocalTail - __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE) >= mParams.sq_entries) {
+                throw SocketException("io_uring: submission queue full");
+            }
+        }
+        struct io_uring_sqe *sqe = &mSqes[mSqLocalTail & mSqMask];
+        memset(sqe, 0, sizeof(*sqe));
+        ++mSqLocalTail;
+        return sqe;
+    }
+
+    void IoUringReactor::enter(unsigned minComplete, int timeoutMs) {
+        unsigned toSubmit = mSqLocalTail - __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE);
+        if (toSubmit == 0 && minComplete == 0) {
+            return;
+        }
+        __atomic_store_n(mSqTail, mSqLocalTail, __ATOMIC_RELEASE);
+
+        unsigned flags = 0;
+        struct io_uring_getevents_arg arg;
+        struct __kernel_timespec ts;
+        void *argp = nullptr;
+        size_t argSize = 0;
+        if (minComplete > 0) {
+            flags |= IORING_ENTER_GETEVENTS;
+            if (timeoutMs >= 0) {
+                ts.tv_sec = timeoutMs / 1000;
+                ts.tv_nsec = (long long)(timeoutMs % 1000) * 1000000;
+                memset(&arg, 0, sizeof(arg));
+                arg.ts = reinterpret_cast<uintptr_t>(&ts);
+                flags |= IORING_ENTER_EXT_ARG;
+                argp = &arg;
+                argSize = sizeof(arg);
+            }
+        }
+
+        ++mNofEnters;
+        if (ioUringEnter(mRingFd, toSubmit, minComplete, flags, argp, argSize) == -1) {
+            /* Timeouts, signals and a full completion queue are handled by reaping */
+            if (errno == ETIME || errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                return;
+            }
+            throw SocketException(std::string("io_uring_enter: ") + strerror(errno));
+        }
+    }
+
+    void IoUringReactor::waitEvents(int timeoutMs) {
+        if (*mCqHead == __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE) && timeoutMs != 0) {
+            enter(1, timeoutMs);
+        } else {
+            enter(0, 0);
+        }
+
+        /* Reap at most one queue worth, so timers are not starved by a flood */
+        for (unsigned i = 0; i < mParams.cq_entries; ++i) {
+            unsigned head = *mCqHead;
+            if (head == __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            struct io_uring_cqe cqe = mCqes[head & mCqMask];
+            __atomic_store_n(mCqHead, head + 1, __ATOMIC_RELEASE);
+            ++mNofCompletions;
+            complete(cqe);
+        }
+
+        std::vector<int> batchEnds;
+        batchEnds.swap(mBatchEnds);
+        for (size_t i = 0; i < batchEnds.size(); ++i) {
+            /* A handler may have removed another socket of this batch */
+            std::map<int, Registration>::iterator it = mHandlers.find(batchEnds[i]);
+            if (it != mHandlers.end() && it->second.batchEnd) {
+                it->second.batchEnd = false;
+                it->second.datagrams->onDatagramsEnd();
+            }
+        }
+    }
+
+    void IoUringReactor::complete(const struct io_uring_cqe & cqe) {
+        RequestKind kind = (RequestKind)(cqe.user_data >> 62);
+        bool hasBuffer = (cqe.flags & IORING_CQE_F_BUFFER) != 0;
+        uint32_t bufferId = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        if (kind == REQUEST_INTERNAL) {
+            return;
+        }
+
+        /* Completions of cancelled requests may still arrive, with or without a buffer */
+        int fd = (int)(uint32_t)cqe.user_data;
+        std::map<int, Registration>::iterator it = mHandlers.find(fd);
+        if (it == mHandlers.end() || it->second.armed != cqe.user_data) {
+            if (hasBuffer) {
+                recycle(bufferId);
+            }
+            return;
+        }
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+            it->second.armed = 0;
+        }
+
+        if (kind == REQUEST_RECV) {
+            if (cqe.res >= 0 && hasBuffer) {
+                receive(fd, it->second, cqe.res, bufferId);
+            } else if (cqe.res == -ENOBUFS) {
+                ++mNofShortages;
+            } else if (cqe.res == -EINVAL) {
+                /* No multishot recvmsg before Linux 6.0, read on readiness instead */
+                it->second.receiving = false;
+            } else if (cqe.res < 0) {
+                if (hasBuffer) {
+                    recycle(bufferId);
+                }
+                it->second.datagrams->onDatagramError(-cqe.res);
+            }
+        } else if (cqe.res > 0) {
+            SocketHandler *handler = it->second.handler;
+            uint32_t revents = (uint32_t)cqe.res;
+            if (revents & POLLOUT) {
+                handler->onWritable();
+                it = mHandlers.find(fd);
+            }
+            if (it != mHandlers.end() && it->second.handler == handler && (revents & (POLLIN | POLLHUP | POLLERR))) {
+                handler->onReadable();
+            }
+        }
+
+        /* Arm again once a multishot request ended, unless the handler already did */
+        it = mHandlers.find(fd);
+        if (it != mHandlers.end() && it->second.armed == 0 && cqe.res != -EBADF) {
+            arm(fd, it->second);
+        }
+    }
+
+    void IoUringReactor::receive(int fd, Registration & registration, int result, uint32_t bufferId) {
+        uint8_t *buffer = &mBuffers[bufferId * mBufferSize];
+        struct io_uring_recvmsg_out out;
+        if ((size_t)result < sizeof(out)) {
+            recycle(bufferId);
+            return;
+        }
+        memcpy(&out, buffer, sizeof(out));
+
+        /* The layout is fixed by the template: header, name, control messages, payload */
+        size_t controlOffset = sizeof(out) + mRecvTemplate.msg_namelen;
+        size_t payloadOffset = controlOffset + mRecvTemplate.msg_controllen;
+        size_t length = out.payloadlen;
+        if (payloadOffset + length > (size_t)result) {
+            length = ((size_t)result > payloadOffset) ? (size_t)result - payloadOffset : 0;
+        }
+
+        struct msghdr hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_control = buffer + controlOffset;
+        hdr.msg_controllen = (out.controllen < mRecvTemplate.msg_controllen) ? out.controllen : mRecvTemplate.msg_controllen;
+        hdr.msg_flags = out.flags;
+
+        if (!registration.batchEnd) {
+            registration.batchEnd = true;
+            mBatchEnds.push_back(fd);
+        }
+        ++mNofDatagrams;
+
+        /* The registration may be gone once the handler returns */
+        try {
+            registration.datagrams->onDatagram(buffer + payloadOffset, length, hdr);
+        } catch (...) {
+            recycle(bufferId);
+            throw;
+        }
+        recycle(bufferId);
+    }
+
+    void IoUringReactor::recycle(uint32_t bufferId) {
+        /* Not bufs[], which the empty struct of __DECLARE_FLEX_ARRAY moves in C++. Only
+           the fields of the entry are set, the ring tail shares the memory of the first one */
+        struct io_uring_buf *buf = reinterpret_cast<struct io_uring_buf *>(mBufRing) + (mBufTail & (URING_BUFFERS - 1));
+        buf->addr = reinterpret_cast<uintptr_t>(&mBuffers[bufferId * mBufferSize]);
+        buf->len = mBufferSize;
+        buf->bid = bufferId;
+        ++mBufTail;
+        __atomic_store_n(&mBufRing->tail, mBufTail, __ATOMIC_RELEASE);
+    }
+}
+
+#endif // RCON_WITH_IO_URING
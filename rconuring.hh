@@ -0,0 +1,141 @@
+#ifndef __RCONURING_HH__
+#define __RCONURING_HH__
+
+#ifdef RCON_WITH_IO_URING
+
+#include "rconreactor.hh"
+#include <sys/types.h>
+#include <linux/io_uring.h>
+#include <cstdint>
+#include <vector>
+#include <map>
+#include <ostream>
+
+/** The submission queue entries of the ring, the completion queue gets four times as many */
+#define URING_ENTRIES 256
+/** The receive buffers provided to the kernel, a power of two */
+#define URING_BUFFERS 1024
+
+namespace Rcon {
+
+    /** io_uring based reactor for Linux
+      @remarks
+        Built with RCON_WITH_IO_URING (make WITH_IO_URING=1) and used by
+        Reactor::create() whenever the kernel supports it, otherwise the
+        EpollReactor is used. The rings are set up with the raw system
+        calls, liburing is not needed.
+        Datagram sockets get a multishot recvmsg which receives into a ring
+        of URING_BUFFERS buffers provided to the kernel once, so all
+        datagrams which arrived in the meantime are reaped by a single
+        io_uring_enter() and passed to DatagramHandler::onDatagram() without
+        any further system call. Every other socket is watched by a
+        multishot poll and dispatched to onReadable() and onWritable() like
+        by the epoll reactor. Sending is left to the handlers, which batch
+        with sendmmsg().
+    */
+    class IoUringReactor : public Reactor {
+        public:
+            /** Sets up the rings, throws a SocketException if the kernel lacks a required feature. */
+            IoUringReactor();
+
+            virtual ~IoUringReactor();
+
+            /** Registers a socket, throws a SocketException for fds which can not be polled. */
+            virtual void addSocket(int fd, SocketHandler *handler);
+
+            virtual void addDatagramSocket(int fd, DatagramHandler *handler);
+
+            virtual void removeSocket(int fd);
+
+            virtual void watchReadable(int fd, bool enable);
+
+            virtual void watchWritable(int fd, bool enable);
+
+            virtual void printStats(std::ostream & out) const;
+
+        protected:
+            virtual void waitEvents(int timeoutMs);
+
+            /** Sets up and maps the rings and provides the receive buffers. */
+            void setup();
+
+            /** Unmaps and closes whatever setup() got to. */
+            void teardown();
+
+            struct Registration {
+                SocketHandler *handler;
+                /** Set for the sockets registered by addDatagramSocket() */
+                DatagramHandler *datagrams;
+                /** Set while the reactor receives the datagrams of the socket rather than polling it */
+                bool receiving;
+                /** The poll mask, POLLIN means receiving while receiving is set */
+                uint32_t events;
+                /** The user data of the armed multishot request, 0 if none is armed */
+                uint64_t armed;
+                /** Set when datagrams were passed during the current iteration */
+                bool batchEnd;
+            };
+
+            /** Cancels the armed request of a socket and arms a new one for its events. */
+            void arm(int fd, Registration & registration);
+
+            /** Queues the cancellation of the request with the given user data. */
+            void cancel(uint64_t userData);
+
+            /** Reserves the next submission queue entry, submitting the queue if it is full */
+            struct io_uring_sqe *nextSqe();
+
+            /** Submits the queued entries and waits at most timeoutMs for a completion. */
+            void enter(unsigned minComplete, int timeoutMs);
+
+            /** Dispatches a completion of an armed request. */
+            void complete(const struct io_uring_cqe & cqe);
+
+            /** Passes a received datagram to the handler of a socket. */
+            void receive(int fd, Registration & registration, int result, uint32_t bufferId);
+
+            /** Gives a receive buffer back to the kernel. */
+            void recycle(uint32_t bufferId);
+
+            int mRingFd;
+
+            struct io_uring_params mParams;
+            void *mSqRing;
+            size_t mSqRingSize;
+            void *mCqRing;
+            size_t mCqRingSize;
+            struct io_uring_sqe *mSqes;
+
+            unsigned *mSqHead;
+            unsigned *mSqTail;
+            unsigned mSqMask;
+            unsigned mSqLocalTail;
+
+            unsigned *mCqHead;
+            unsigned *mCqTail;
+            unsigned mCqMask;
+            struct io_uring_cqe *mCqes;
+
+            struct io_uring_buf_ring *mBufRing;
+            size_t mBufRingSize;
+            std::vector<uint8_t> mBuffers;
+            size_t mBufferSize;
+            unsigned short mBufTail;
+            /** The recvmsg template of every datagram socket, giving the sizes of the buffer layout */
+            struct msghdr mRecvTemplate;
+
+            std::map<int, Registration> mHandlers;
+            uint32_t mNextGeneration;
+            /** The sockets which were passed datagrams during the current iteration */
+            std::vector<int> mBatchEnds;
+
+            uint64_t mNofEnters;
+            uint64_t mNofCompletions;
+            uint64_t mNofDatagrams;
+            uint64_t mNofShortages;
+    };
+}
+
+#endif // RCON_WITH_IO_URING
+
+#endif // __RCONURING_HH__
@@ -0,0 +1,245 @@
+#include "rconwebhook.hh"
+#include "rconexception.hh"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+
+namespace Rcon {
+
+    /* WebhookSink class */
+
+    WebhookSink::WebhookSink(Reactor & reactor, const std::string & url, size_t limit) :
+        mReactor(reactor),
+        mAddressIdx(0),
+        mLimit(limit),
+        mFd(-1),
+        mConnected(false),
+        mNofPosting(0),
+        mSent(0),
+        mTimer(0),
+        mNofPosted(0),
+        mNofFailed(0),
+        mNofDropped(0)
+    {
+        const std::string scheme("http://");
+        if (url.compare(0, scheme.size(), scheme) != 0) {
+            throw AppException("unsupported webhook " + url + ", only http:// is spoken");
+        }
+
+        size_t pathStart = url.find('/', scheme.size());
+        std::string authority = url.substr(scheme.size(), pathStart - scheme.size());
+        mPath = (pathStart == std::string::npos) ? "/" : url.substr(pathStart);
+        mHost = authority;
+
+        /* host, host:port, [v6] or [v6]:port */
+        std::string host = authority;
+        std::string port("80");
+        size_t colon = authority.rfind(':');
+        if (!authority.empty() && authority[0] == '[') {
+            size_t close = authority.find(']');
+            if (close == std::string::npos) {
+                throw AppException("invalid webhook " + url);
+            }
+            host = authority.substr(1, close - 1);
+            if (close + 1 < authority.size()) {
+                if (authority[close + 1] != ':') {
+                    throw AppException("invalid webhook " + url);
+                }
+                port = authority.substr(close + 2);
+            }
+        } else if (colon != std::string::npos) {
+            host = authority.substr(0, colon);
+            port = authority.substr(colon + 1);
+        }
+        if (host.empty() || port.empty()) {
+            throw AppException("invalid webhook " + url);
+        }
+
+        /* Once at startup, the stream does not wait for lookups */
+        mAddresses = Resolver::resolveNow(host, port);
+    }
+
+    WebhookSink::~WebhookSink() {
+        if (mFd != -1) {
+            mReactor.removeSocket(mFd);
+            close(mFd);
+        }
+        if (mTimer != 0) {
+            mReactor.cancelTimer(mTimer);
+        }
+    }
+
+    void WebhookSink::append(const std::string_view & line) {
+        if (mPending.size() + line.size() + 1 > mLimit) {
+            ++mNofDropped;
+            return;
+        }
+        mPending.append(line.data(), line.size());
+        mPending.push_back('\n');
+    }
+
+    void WebhookSink::flush() {
+        if (mFd == -1 && !mPending.empty()) {
+            post();
+        }
+    }
+
+    void WebhookSink::drain() {
+        flush();
+    }
+
+    bool WebhookSink::isPosting() const {
+        return mFd != -1;
+    }
+
+    size_t WebhookSink::getNofPosted() const {
+        return mNofPosted;
+    }
+
+    size_t WebhookSink::getNofFailed() const {
+        return mNofFailed;
+    }
+
+    size_t WebhookSink::getNofDropped() const {
+        return mNofDropped;
+    }
+
+    void WebhookSink::post() {
+        for (size_t tried = 0; tried < mAddresses.size() && mFd == -1; ++tried) {
+            mFd = connectAddress();
+            if (mFd == -1) {
+                mAddressIdx = (mAddressIdx + 1) % mAddresses.size();
+            }
+        }
+        if (mFd == -1) {
+            /* The lines stay collected for the next flush */
+            ++mNofFailed;
+            return;
+        }
+
+        mNofPosting = mPending.size();
+        mRequest = "POST " + mPath + " HTTP/1.1\r\n"
+                   "Host: " + mHost + "\r\n"
+                   "Content-Type: text/plain; charset=utf-8\r\n"
+                   "Content-Length: " + std::to_string(mNofPosting) + "\r\n"
+                   "Connection: close\r\n\r\n";
+        mRequest += mPending;
+        mSent = 0;
+        mResponse.clear();
+        mConnected = false;
+
+        /* Hangups while connecting show up as readable */
+        mReactor.addSocket(mFd, this);
+        mReactor.watchWritable(mFd, true);
+        mTimer = mReactor.addTimer(WEBHOOK_TIMEOUT_MS, [this]() {
+            mTimer = 0;
+            finish(false);
+        });
+    }
+
+    int WebhookSink::connectAddress() {
+        const Address & address = mAddresses[mAddressIdx];
+        int fd = socket(address.family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1) {
+            return -1;
+        }
+        if (connect(fd, reinterpret_cast<const struct sockaddr *>(&address.storage), address.length) == -1 &&
+            errno != EINPROGRESS) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    void WebhookSink::finish(bool ok) {
+        if (mTimer != 0) {
+            mReactor.cancelTimer(mTimer);
+            mTimer = 0;
+        }
+        mReactor.removeSocket(mFd);
+        close(mFd);
+        mFd = -1;
+        mRequest.clear();
+
+        if (!ok) {
+            /* Retried with the lines collected meanwhile on the next flush, at the next address */
+            ++mNofFailed;
+            mNofPosting = 0;
+            mAddressIdx = (mAddressIdx + 1) % mAddresses.size();
+            return;
+        }
+        ++mNofPosted;
+        mPending.erase(0, mNofPosting);
+        mNofPosting = 0;
+        /* The lines collected meanwhile */
+        flush();
+    }
+
+    void WebhookSink::onWritable() {
+        if (!mConnected) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            if (getsockopt(mFd, SOL_SOCKET, SO_ERROR, &error, &length) == -1 || error != 0) {
+                finish(false);
+                return;
+            }
+            mConnected = true;
+        }
+
+        while (mSent < mRequest.size()) {
+            ssize_t nsent = send(mFd, mRequest.data() + mSent, mRequest.size() - mSent, MSG_NOSIGNAL);
+            if (nsent == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    finish(false);
+                }
+                return;
+            }
+            mSent += nsent;
+        }
+        mReactor.watchWritable(mFd, false);
+    }
+
+    void WebhookSink::onReadable() {
+        if (!mConnected) {
+            /* A hangup while connecting, or a new post on the descriptor of the last one */
+            int error = 0;
+            socklen_t length = sizeof(error);
+            if (getsockopt(mFd, SOL_SOCKET, SO_ERROR, &error, &length) == -1 || error != 0) {
+                finish(false);
+            }
+            return;
+        }
+
+        char buf[4096];
+        for (;;) {
+            ssize_t nread = recv(mFd, buf, sizeof(buf), 0);
+            if (nread == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    finish(false);
+                }
+                return;
+            }
+            if (nread == 0) {
+                break;
+            }
+            if (mResponse.size() < WEBHOOK_RESPONSE_LIMIT) {
+                mResponse.append(buf, std::min<size_t>(nread, WEBHOOK_RESPONSE_LIMIT - mResponse.size()));
+            }
+        }
+
+        /* "HTTP/1.1 204 No Content", the server closes after the response */
+        bool ok = mResponse.size() >= 12 && mResponse.compare(0, 5, "HTTP/") == 0;
+        size_t space = ok ? mResponse.find(' ') : std::string::npos;
+        finish(space != std::string::npos && space + 1 < mResponse.size() && mResponse[space + 1] == '2');
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef __RCONWEBHOOK_HH__
+#define __RCONWEBHOOK_HH__
+
+#include "rconreactor.hh"
+#include "rconresolve.hh"
+#include "rconlisten.hh"
+#include <sys/types.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/** How long a webhook post may take until it is given up */
+#define WEBHOOK_TIMEOUT_MS 5000
+/** The most bytes of a webhook response kept to read the status from */
+#define WEBHOOK_RESPONSE_LIMIT 1024
+
+namespace Rcon {
+
+    /** WebhookSink class
+      @remarks
+        Posts the lines routed to it to an HTTP endpoint, one per line as
+        text/plain. One post is in flight at a time; the lines appended
+        meanwhile are collected and posted together once it is answered,
+        so a slow endpoint gets fewer, larger posts instead of holding up
+        the stream. The lines of a post are only let go of once it is
+        answered with a 2xx status; a post which fails or times out is
+        retried with the lines collected since on the next flush, against
+        the next of the resolved addresses. Lines which do not fit into the
+        limit are dropped. Only plain HTTP is spoken, a TLS endpoint needs
+        a local proxy in front.
+      @param
+        reactor The reactor to run the connections on.
+      @param
+        url The endpoint, http://host[:port][/path].
+      @param
+        limit The maximum number of bytes collected for the next post.
+    */
+    class WebhookSink : public SocketHandler, public LineSink {
+        public:
+            explicit WebhookSink(Reactor & reactor, const std::string & url, size_t limit);
+
+            virtual ~WebhookSink();
+
+            /** Collects a line for the next post. */
+            virtual void append(const std::string_view & line);
+
+            /** Posts the collected lines unless a post is in flight. */
+            virtual void flush();
+
+            /** Posts the collected lines, the post is finished by the reactor. */
+            virtual void drain();
+
+            /** Returns true while a post is in flight */
+            bool isPosting() const;
+
+            /** Returns the number of posts answered with a 2xx status */
+            size_t getNofPosted() const;
+
+            /** Returns the number of posts which failed or timed out */
+            size_t getNofFailed() const;
+
+            /** Returns the number of lines dropped because the limit was reached */
+            size_t getNofDropped() const;
+
+            virtual void onReadable();
+
+            virtual void onWritable();
+
+        protected:
+            /** Connects to the current address and sends the collected lines,
+                moving on to the next address if connecting fails right away. */
+            void post();
+
+            /** Connects a socket to the current address, -1 if that fails right away. */
+            int connectAddress();
+
+            /** Closes the connection of the post in flight. */
+            void finish(bool ok);
+
+            Reactor & mReactor;
+            std::string mHost;
+            std::string mPath;
+            std::vector<Address> mAddresses;
+            /** The address posted to, the next one is tried after a failure */
+            size_t mAddressIdx;
+            size_t mLimit;
+            int mFd;
+            bool mConnected;
+            /** The lines collected, starting with the ones of the post in flight */
+            std::string mPending;
+            /** The bytes of mPending in the post in flight */
+            size_t mNofPosting;
+            std::string mRequest;
+            size_t mSent;
+            std::string mResponse;
+            Reactor::TimerId mTimer;
+            size_t mNofPosted;
+            size_t mNofFailed;
+            size_t mNofDropped;
+    };
+}
+
+#endif // __RCONWEBHOOK_HH__
@@ -0,0 +1,388 @@
+#include "rconwriter.hh"
+#include "rconexception.hh"
+#include "rconreactor.hh"
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+
+namespace Rcon {
+
+    /** Raises an index shared by both threads to at least value */
+    static void advance(std::atomic<uint64_t> & index, uint64_t value) {
+        uint64_t current = index.load();
+        while (current < value && !index.compare_exchange_weak(current, value)) {
+        }
+    }
+
+
+    /* OutputWriter class */
+
+    OutputWriter::OutputWriter(int fd, size_t limit, Policy policy, const std::string & spillFile) :
+        mFd(fd),
+        mPolicy(policy),
+        mSlices(WRITER_SLOTS),
+        mHead(0),
+        mClaim(0),
+        mRelease(0),
+        mWritten(0),
+        mCopying(false),
+        mClosed(false),
+        mStopping(false),
+        mWriterSleeping(false),
+        mProducerWaiting(false),
+        mNofWrites(0),
+        mHeadBytes(0),
+        mDropped(0),
+        mHighWater(0),
+        mNofDropped(0),
+        mNofSpilled(0),
+        mNofBlocked(0),
+        mSpillFile(spillFile)
+    {
+        size_t capacity = WRITER_MIN_CAPACITY;
+        while (capacity < limit) {
+            capacity *= 2;
+        }
+        mRing.resize(capacity);
+        mMask = capacity - 1;
+        if (mPolicy == POLICY_DROP_OLDEST) {
+            mBatch.resize(WRITER_BATCH_SIZE);
+        }
+
+        mThread = Reactor::startThreadBlockingStopSignals([this]() { run(); });
+    }
+
+    OutputWriter::~OutputWriter() {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStopping = true;
+            mWriterWakeup.notify_one();
+        }
+        mThread.join();
+        if (mSpill.is_open()) {
+            mSpill.flush();
+        }
+    }
+
+    bool OutputWriter::parsePolicy(const std::string & name, Policy & policy) {
+        if (name == "block") {
+            policy = POLICY_BLOCK;
+        } else if (name == "drop") {
+            policy = POLICY_DROP_OLDEST;
+        } else if (name == "spill") {
+            policy = POLICY_SPILL;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    void OutputWriter::append(const std::string_view & line) {
+        push(&line, 1, true);
+    }
+
+    void OutputWriter::append(const std::string_view *parts, size_t nofParts) {
+        push(parts, nofParts, true);
+    }
+
+    void OutputWriter::write(const std::string_view & text) {
+        push(&text, 1, false);
+    }
+
+    void OutputWriter::flush() {
+    }
+
+    void OutputWriter::drain() {
+        uint64_t head = mHead.load(std::memory_order_relaxed);
+        waitProducer([this, head]() { return mWritten.load() >= head || mClosed.load(); });
+    }
+
+    bool OutputWriter::isClosed() const {
+        return mClosed.load();
+    }
+
+    size_t OutputWriter::getHighWater() const {
+        return mHighWater;
+    }
+
+    size_t OutputWriter::getNofDropped() const {
+        return mNofDropped;
+    }
+
+    size_t OutputWriter::getNofSpilled() const {
+        return mNofSpilled;
+    }
+
+    void OutputWriter::printStats(std::ostream & out) const {
+        static const char *policies[] = { "block", "drop", "spill" };
+        out << "output: " << mRing.size() << " bytes ring, " << policies[mPolicy] << " on overflow, high-water "
+            << mHighWater << " bytes, " << mNofWrites.load() << " writes, " << mNofDropped << " dropped, "
+            << mNofSpilled << " spilled, " << mNofBlocked << " blocked" << std::endl;
+    }
+
+    void OutputWriter::push(const std::string_view *parts, size_t nofParts, bool newline) {
+        size_t size = newline ? 1 : 0;
+        for (size_t i = 0; i < nofParts; ++i) {
+            size += parts[i].size();
+        }
+        if (size == 0) {
+            return;
+        }
+
+        if (!reserve(size)) {
+            if (mPolicy == POLICY_SPILL) {
+                spill(parts, nofParts, newline);
+            } else {
+                ++mNofDropped;
+            }
+            return;
+        }
+
+        uint64_t pos = mHeadBytes;
+        for (size_t i = 0; i <= nofParts; ++i) {
+            const char *data = (i < nofParts) ? parts[i].data() : "\n";
+            size_t length = (i < nofParts) ? parts[i].size() : (newline ? 1 : 0);
+            size_t offset = pos & mMask;
+            size_t first = std::min(length, mRing.size() - offset);
+            memcpy(&mRing[offset], data, first);
+            memcpy(&mRing[0], data + first, length - first);
+            pos += length;
+        }
+
+        uint64_t head = mHead.load(std::memory_order_relaxed);
+        Slice & slice = mSlices[head & (WRITER_SLOTS - 1)];
+        slice.begin = mHeadBytes;
+        slice.end = pos;
+        mHeadBytes = pos;
+        mHead.store(head + 1);
+
+        size_t used = getUsed();
+        if (used > mHighWater) {
+            mHighWater = used;
+        }
+
+        if (mWriterSleeping.load()) {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mWriterWakeup.notify_one();
+        }
+    }
+
+    size_t OutputWriter::getUsed() const {
+        uint64_t release = mRelease.load();
+        if (release == mHead.load(std::memory_order_relaxed)) {
+            return 0;
+        }
+        /* An unreleased slice, which only the producer writes */
+        return mHeadBytes - mSlices[release & (WRITER_SLOTS - 1)].begin;
+    }
+
+    bool OutputWriter::reserve(size_t size) {
+        if (size > mRing.size()) {
+            return false;
+        }
+
+        for (;;) {
+            uint64_t head = mHead.load(std::memory_order_relaxed);
+            uint64_t release = mRelease.load();
+            if (head - release < WRITER_SLOTS && mRing.size() - getUsed() >= size) {
+                return true;
+            }
+
+            switch (mPolicy) {
+                case POLICY_SPILL:
+                    return false;
+
+                case POLICY_BLOCK:
+                    ++mNofBlocked;
+                    waitProducer([this, release]() { return mRelease.load() != release; });
+                    continue;
+
+                case POLICY_DROP_OLDEST:
+                    break;
+            }
+
+            /* The writer claims with the same compare and swap, a slice is either written or dropped */
+            uint64_t claim = mClaim.load();
+            if (claim < head && mClaim.compare_exchange_strong(claim, claim + 1)) {
+                ++mNofDropped;
+                mDropped = claim + 1;
+            }
+            /* The slices before mDropped are dropped or copied out, unless the writer is still copying */
+            if (mDropped > release && !mCopying.load()) {
+                advance(mRelease, mDropped);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    void OutputWriter::spill(const std::string_view *parts, size_t nofParts, bool newline) {
+        if (!mSpill.is_open()) {
+            mSpill.open(mSpillFile, std::ios::out | std::ios::app | std::ios::binary);
+            if (!mSpill) {
+                throw AppException("could not open spill file " + mSpillFile);
+            }
+        }
+        for (size_t i = 0; i < nofParts; ++i) {
+            mSpill.write(parts[i].data(), parts[i].size());
+        }
+        if (newline) {
+            mSpill.put('\n');
+        }
+        ++mNofSpilled;
+    }
+
+    void OutputWriter::waitProducer(const std::function<bool()> & ready) {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mProducerWaiting = true;
+        while (!ready()) {
+            mProducerWakeup.wait(lock);
+        }
+        mProducerWaiting = false;
+    }
+
+    void OutputWriter::wakeProducer() {
+        if (mProducerWaiting.load()) {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mProducerWakeup.notify_all();
+        }
+    }
+
+    void OutputWriter::run() {
+        for (;;) {
+            if (writeBatch()) {
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mMutex);
+            mWriterSleeping = true;
+            while (mClaim.load() == mHead.load() && !mStopping.load()) {
+                mWriterWakeup.wait(lock);
+            }
+            mWriterSleeping = false;
+            if (mClaim.load() == mHead.load()) {
+                /* Stopping with everything written */
+                return;
+            }
+        }
+    }
+
+    uint64_t OutputWriter::endOfBatch(uint64_t first, uint64_t head) const {
+        uint64_t begin = mSlices[first & (WRITER_SLOTS - 1)].begin;
+        uint64_t last = first + 1;
+        while (last < head && mSlices[last & (WRITER_SLOTS - 1)].end - begin <= WRITER_BATCH_SIZE) {
+            ++last;
+        }
+        return last;
+    }
+
+    bool OutputWriter::writeBatch() {
+        uint64_t first;
+        uint64_t last;
+
+        if (mPolicy != POLICY_DROP_OLDEST) {
+            /* Nobody else takes slices, they are written straight from the ring */
+            first = mClaim.load(std::memory_order_relaxed);
+            uint64_t head = mHead.load();
+            if (first == head) {
+                return false;
+            }
+            last = endOfBatch(first, head);
+            writeRing(mSlices[first & (WRITER_SLOTS - 1)].begin, mSlices[(last - 1) & (WRITER_SLOTS - 1)].end);
+            mClaim.store(last);
+            mRelease.store(last);
+
+        } else {
+            /* The producer does not reuse the slices after mClaim while mCopying is set */
+            mCopying = true;
+            size_t length = 0;
+            for (;;) {
+                first = mClaim.load();
+                uint64_t head = mHead.load();
+                if (first == head) {
+                    mCopying = false;
+                    return false;
+                }
+                last = endOfBatch(first, head);
+                uint64_t begin = mSlices[first & (WRITER_SLOTS - 1)].begin;
+                length = mSlices[(last - 1) & (WRITER_SLOTS - 1)].end - begin;
+                if (length > mBatch.size()) {
+                    mBatch.resize(length);
+                }
+                size_t offset = begin & mMask;
+                size_t part = std::min(length, mRing.size() - offset);
+                memcpy(&mBatch[0], &mRing[offset], part);
+                memcpy(&mBatch[part], &mRing[0], length - part);
+                /* Fails if the producer dropped the first slice meanwhile */
+                if (mClaim.compare_exchange_strong(first, last)) {
+                    break;
+                }
+            }
+            advance(mRelease, last);
+            mCopying = false;
+            wakeProducer();
+            writeBuffer(&mBatch[0], length);
+        }
+
+        advance(mWritten, last);
+        wakeProducer();
+        return true;
+    }
+
+    void OutputWriter::writeRing(uint64_t begin, uint64_t end) {
+        size_t length = end - begin;
+        size_t offset = begin & mMask;
+        size_t part = std::min(length, mRing.size() - offset);
+
+        struct iovec iov[2];
+        iov[0].iov_base = &mRing[offset];
+        iov[0].iov_len = part;
+        iov[1].iov_base = &mRing[0];
+        iov[1].iov_len = length - part;
+        int n = (length > part) ? 2 : 1;
+
+        struct iovec *next = iov;
+        while (n > 0 && !mClosed.load(std::memory_order_relaxed)) {
+            ssize_t nwritten = writev(mFd, next, n);
+            ++mNofWrites;
+            if (nwritten == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                mClosed = true;
+                wakeProducer();
+                return;
+            }
+            while (n > 0 && static_cast<size_t>(nwritten) >= next->iov_len) {
+                nwritten -= next->iov_len;
+                ++next;
+                --n;
+            }
+            if (n > 0) {
+                next->iov_base = static_cast<char *>(next->iov_base) + nwritten;
+                next->iov_len -= nwritten;
+            }
+        }
+    }
+
+    void OutputWriter::writeBuffer(const char *data, size_t length) {
+        while (length > 0 && !mClosed.load(std::memory_order_relaxed)) {
+            ssize_t nwritten = ::write(mFd, data, length);
+            ++mNofWrites;
+            if (nwritten == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                mClosed = true;
+                wakeProducer();
+                return;
+            }
+            data += nwritten;
+            length -= nwritten;
+        }
+    }
+}
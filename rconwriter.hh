@@ -0,0 +1,211 @@
+#ifndef __RCONWRITER_HH__
+#define __RCONWRITER_HH__
+
+#include <sys/types.h>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <fstream>
+#include <ostream>
+
+/** The most slices queued at the same time, a power of two */
+#define WRITER_SLOTS 8192
+/** The smallest ring of bytes, the limit is rounded up to a power of two */
+#define WRITER_MIN_CAPACITY 4096
+/** The most bytes written by a single writev() */
+#define WRITER_BATCH_SIZE (64 * 1024)
+
+namespace Rcon {
+
+    /** Line sink interface
+      @remarks
+        Implemented by the outputs the server message lines are written to.
+    */
+    class LineSink {
+        public:
+            virtual ~LineSink() {}
+
+            /** Queues a line, which is terminated with a newline. */
+            virtual void append(const std::string_view & line) = 0;
+
+            /** Writes as much of the queue as possible without blocking. */
+            virtual void flush() = 0;
+
+            /** Writes the whole queue, blocking. */
+            virtual void drain() = 0;
+    };
+
+
+    /** OutputWriter class
+      @remarks
+        Writes the output on a thread of its own, so the thread which
+        acknowledges the server messages never waits for the reader of the
+        output. The output is queued as slices, each a line or a text,
+        copied into a ring of bytes with a ring of slice boundaries beside
+        it; the queue is single producer, single consumer and lock-free,
+        the mutex is only taken to sleep and to wake up a sleeper. The
+        writer thread takes the slices queued in batches of up to
+        WRITER_BATCH_SIZE bytes and writes each batch with one writev(),
+        straight from the ring. When the ring is full the overflow policy
+        applies:
+            POLICY_BLOCK        The producer waits for the writer.
+            POLICY_DROP_OLDEST  The oldest slices the writer has not taken
+                                yet are dropped to make room. The writer
+                                then copies each batch out of the ring
+                                before writing it, so a writer blocked on
+                                the descriptor never holds up the ring.
+            POLICY_SPILL        The slice is appended to the spill file.
+        Slices larger than the ring are dropped unless spilled. Once the
+        descriptor fails, e.g. the reader of a pipe went away with SIGPIPE
+        ignored, the rest of the output is discarded.
+      @param
+        fd The descriptor to write to, which is left blocking.
+      @param
+        limit The bytes kept queued at most.
+      @param
+        policy The overflow policy.
+      @param
+        spillFile The file to append overflowing slices to with POLICY_SPILL.
+    */
+    class OutputWriter : public LineSink {
+        public:
+            enum Policy {
+                POLICY_BLOCK,
+                POLICY_DROP_OLDEST,
+                POLICY_SPILL
+            };
+
+            explicit OutputWriter(int fd, size_t limit, Policy policy, const std::string & spillFile);
+
+            /** Writes the rest of the queue and stops the writer thread. */
+            virtual ~OutputWriter();
+
+            OutputWriter(const OutputWriter &) = delete;
+            OutputWriter & operator=(const OutputWriter &) = delete;
+
+            /** Returns the policy of a -P argument, "block", "drop" or "spill"
+              @return
+                false if the name is unknown.
+            */
+            static bool parsePolicy(const std::string & name, Policy & policy);
+
+            /** Queues a line, which is terminated with a newline. */
+            virtual void append(const std::string_view & line);
+
+            /** Queues the parts as one line, which is terminated with a newline. */
+            void append(const std::string_view *parts, size_t nofParts);
+
+            /** Queues a text as is. */
+            void write(const std::string_view & text);
+
+            /** The slices are taken by the writer as soon as they are queued, this is a no-op. */
+            virtual void flush();
+
+            /** Waits until everything queued has been written. */
+            virtual void drain();
+
+            /** Returns true once the descriptor failed */
+            bool isClosed() const;
+
+            /** Returns the highest number of bytes ever queued */
+            size_t getHighWater() const;
+
+            /** Returns the number of slices dropped because the queue was full */
+            size_t getNofDropped() const;
+
+            /** Returns the number of slices written to the spill file because the queue was full */
+            size_t getNofSpilled() const;
+
+            /** Prints the writer statistics to the stream. */
+            void printStats(std::ostream & out) const;
+
+        protected:
+            /** The bytes of a slice in the ring, as positions which only grow */
+            struct Slice {
+                uint64_t begin;
+                uint64_t end;
+            };
+
+            /** Queues the parts as one slice. */
+            void push(const std::string_view *parts, size_t nofParts, bool newline);
+
+            /** Makes room for a slice by the policy
+              @return
+                false if the slice does not fit.
+            */
+            bool reserve(size_t size);
+
+            /** Returns the bytes queued, on the producer thread */
+            size_t getUsed() const;
+
+            /** Appends a slice which does not fit to the spill file. */
+            void spill(const std::string_view *parts, size_t nofParts, bool newline);
+
+            /** Waits on the producer thread until the condition holds. */
+            void waitProducer(const std::function<bool()> & ready);
+
+            /** Wakes up the producer, on the writer thread. */
+            void wakeProducer();
+
+            /** The loop of the writer thread */
+            void run();
+
+            /** Takes and writes the next batch, false if the queue is empty. */
+            bool writeBatch();
+
+            /** Returns the slice after the batch starting with first, the producer must not reuse them */
+            uint64_t endOfBatch(uint64_t first, uint64_t head) const;
+
+            /** Writes the bytes of the ring from begin to end. */
+            void writeRing(uint64_t begin, uint64_t end);
+
+            /** Writes a buffer of the writer thread. */
+            void writeBuffer(const char *data, size_t length);
+
+            int mFd;
+            Policy mPolicy;
+            std::vector<char> mRing;
+            uint64_t mMask;
+            std::vector<Slice> mSlices;
+            std::vector<char> mBatch;
+
+            /** The slices published by the producer */
+            std::atomic<uint64_t> mHead;
+            /** The next slice not taken by the writer or dropped by the producer */
+            std::atomic<uint64_t> mClaim;
+            /** The slices before it are free for the producer to reuse */
+            std::atomic<uint64_t> mRelease;
+            /** The slices before it have been written or dropped */
+            std::atomic<uint64_t> mWritten;
+            /** Set by the writer while it reads the slices of a batch it has not claimed yet */
+            std::atomic<bool> mCopying;
+            std::atomic<bool> mClosed;
+            std::atomic<bool> mStopping;
+            std::atomic<bool> mWriterSleeping;
+            std::atomic<bool> mProducerWaiting;
+            std::atomic<size_t> mNofWrites;
+
+            /** Producer thread only */
+            uint64_t mHeadBytes;
+            uint64_t mDropped;
+            size_t mHighWater;
+            size_t mNofDropped;
+            size_t mNofSpilled;
+            size_t mNofBlocked;
+            std::string mSpillFile;
+            std::ofstream mSpill;
+
+            std::mutex mMutex;
+            std::condition_variable mWriterWakeup;
+            std::condition_variable mProducerWakeup;
+            std::thread mThread;
+    };
+}
+
+#endif // __RCONWRITER_HH__